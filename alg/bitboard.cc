@@ -0,0 +1,86 @@
+#include "alg/bitboard.h"
+
+namespace z2util {
+
+uint64_t Bitboard::Shifted(int y, int dx) const {
+    if (y < 0 || y >= height() || dx >= WIDTH || dx <= -WIDTH)
+        return ~0ULL;
+    uint64_t v = row_[y];
+    if (dx > 0) {
+        v = v >> dx | ~(~0ULL >> dx);
+    } else if (dx < 0) {
+        v = v << -dx | ((1ULL << -dx) - 1);
+    }
+    return v;
+}
+
+void Bitboard::Count(int y, int r, std::vector<uint64_t>* count) const {
+    count->assign(count->size(), 0);
+    for(int dy=-r; dy<r; dy++) {
+        for(int dx=-r; dx<r; dx++) {
+            // Ripple-carry add a one bit value into every column.
+            uint64_t carry = Shifted(y + dy, dx);
+            for(int b=0; b < int(count->size()) && carry; b++) {
+                uint64_t c = (*count)[b];
+                (*count)[b] = c ^ carry;
+                carry &= c;
+            }
+        }
+    }
+}
+
+Bitboard Bitboard::AtLeast(int r, int n) const {
+    Bitboard result(height());
+    if (n <= 0) {
+        for(auto& v : result.row_)
+            v = ~0ULL;
+        return result;
+    }
+    // Enough bit planes to hold a count of (2r)^2, and to hold n.
+    int bits = 1;
+    while((1 << bits) <= 4 * r * r || (1 << bits) <= n)
+        bits++;
+    std::vector<uint64_t> count(bits);
+    for(int y=0; y<height(); y++) {
+        Count(y, r, &count);
+        // Compare count >= n, from the most significant bit down.
+        uint64_t gt = 0, eq = ~0ULL;
+        for(int b=bits-1; b>=0; b--) {
+            if (n >> b & 1) {
+                eq &= count[b];
+            } else {
+                gt |= eq & count[b];
+                eq &= ~count[b];
+            }
+        }
+        result.row_[y] = gt | eq;
+    }
+    return result;
+}
+
+Bitboard Bitboard::AtMost(int r, int n) const {
+    return ~AtLeast(r, n + 1);
+}
+
+Bitboard Bitboard::operator|(const Bitboard& b) const {
+    Bitboard result(*this);
+    for(int y=0; y<height(); y++)
+        result.row_[y] |= b.row_[y];
+    return result;
+}
+
+Bitboard Bitboard::operator&(const Bitboard& b) const {
+    Bitboard result(*this);
+    for(int y=0; y<height(); y++)
+        result.row_[y] &= b.row_[y];
+    return result;
+}
+
+Bitboard Bitboard::operator~() const {
+    Bitboard result(*this);
+    for(auto& v : result.row_)
+        v = ~v;
+    return result;
+}
+
+}  // namespace z2util
@@ -0,0 +1,48 @@
+#ifndef Z2UTIL_ALG_BITBOARD_H
+#define Z2UTIL_ALG_BITBOARD_H
+#include <cstdint>
+#include <vector>
+
+namespace z2util {
+
+// A map of cells up to 64 wide, stored one row per uint64_t: bit x of
+// row y is the cell at (x, y).  Neighbour counts are computed for a
+// whole row at once with bit-sliced adders, so a rule costs a handful of
+// word operations per row instead of a loop over every cell.
+class Bitboard {
+  public:
+    static const int WIDTH = 64;
+
+    explicit Bitboard(int height) : row_(height) {}
+
+    int height() const { return int(row_.size()); }
+    uint64_t row(int y) const { return row_[y]; }
+    void set_row(int y, uint64_t v) { row_[y] = v; }
+    bool get(int x, int y) const { return row_[y] >> x & 1; }
+    void set(int x, int y, bool v) {
+        row_[y] = (row_[y] & ~(1ULL << x)) | uint64_t(v) << x;
+    }
+
+    // The cells where at least (at most) n of the cells in the window
+    // from (x-r, y-r) to (x+r-1, y+r-1) are set.  Cells outside the board
+    // count as set.
+    Bitboard AtLeast(int r, int n) const;
+    Bitboard AtMost(int r, int n) const;
+
+    Bitboard operator|(const Bitboard& b) const;
+    Bitboard operator&(const Bitboard& b) const;
+    Bitboard operator~() const;
+    bool operator==(const Bitboard& b) const { return row_ == b.row_; }
+
+  private:
+    // Adds the window counts for row y into count, one bit plane per
+    // element, least significant first.
+    void Count(int y, int r, std::vector<uint64_t>* count) const;
+    // Row y shifted so that bit x holds the cell at (x+dx, y).
+    uint64_t Shifted(int y, int dx) const;
+
+    std::vector<uint64_t> row_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_ALG_BITBOARD_H
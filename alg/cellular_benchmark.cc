@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <gflags/gflags.h>
+
+#include "alg/bitboard.h"
+
+DEFINE_int32(height, 100, "Map height");
+DEFINE_int32(iterations, 4, "Automaton iterations per run");
+DEFINE_int32(radius, 2, "Radius of the sparse-wall rule");
+DEFINE_int32(repeat, 100, "Number of runs to time");
+DEFINE_double(probability, 0.25, "Initial wall probability");
+
+const char kUsage[] =
+R"ZZZ(<flags>
+
+Description:
+  Times the cellular terrain automaton using the cell-by-cell loops the
+  terrain generator used to use against the bitboard implementation, and
+  checks that both produce the same map.
+)ZZZ";
+
+namespace {
+using z2util::Bitboard;
+const int W = Bitboard::WIDTH;
+
+// The original implementation: count the walls around every cell.
+// Cells outside the map count as walls, as in Bitboard.
+class Reference {
+  public:
+    Reference(int height) : height_(height), data_(height * W) {}
+    bool get(int x, int y) const {
+        return x < 0 || y < 0 || x >= W || y >= height_ || data_[y * W + x];
+    }
+    void set(int x, int y, bool v) { data_[y * W + x] = v; }
+
+    int WallsWithin(int x, int y, int r) const {
+        int count = 0;
+        for(int yy=y-r; yy<y+r; yy++) {
+            for(int xx=x-r; xx<x+r; xx++) {
+                if (get(xx, yy)) ++count;
+            }
+        }
+        return count;
+    }
+    void Iterate(int radius) {
+        std::vector<uint8_t> d(data_.size());
+        for(int y=0; y<height_; y++) {
+            for(int x=0; x<W; x++) {
+                d[y * W + x] = WallsWithin(x, y, 1) >= 5 ||
+                               WallsWithin(x, y, radius) <= 2;
+            }
+        }
+        data_.swap(d);
+    }
+  private:
+    int height_;
+    std::vector<uint8_t> data_;
+};
+
+template<typename F>
+double Time(F f) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i=0; i<FLAGS_repeat; i++)
+        f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count()
+        / FLAGS_repeat;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    gflags::SetUsageMessage(kUsage);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    std::default_random_engine rand(1);
+    std::uniform_real_distribution<float> u(0.0, 1.0f);
+    Reference ref(FLAGS_height);
+    Bitboard bb(FLAGS_height);
+    for(int y=0; y<FLAGS_height; y++) {
+        for(int x=0; x<W; x++) {
+            bool wall = u(rand) < FLAGS_probability;
+            ref.set(x, y, wall);
+            bb.set(x, y, wall);
+        }
+    }
+
+    Reference ref_result = ref;
+    Bitboard bb_result = bb;
+    double ref_us = Time([&]() {
+        ref_result = ref;
+        for(int i=0; i<FLAGS_iterations; i++)
+            ref_result.Iterate(FLAGS_radius);
+    });
+    double bb_us = Time([&]() {
+        bb_result = bb;
+        for(int i=0; i<FLAGS_iterations; i++) {
+            bb_result = bb_result.AtLeast(1, 5) |
+                        bb_result.AtMost(FLAGS_radius, 2);
+        }
+    });
+
+    int mismatch = 0;
+    for(int y=0; y<FLAGS_height; y++) {
+        for(int x=0; x<W; x++) {
+            mismatch += ref_result.get(x, y) != bb_result.get(x, y);
+        }
+    }
+    printf("64x%d map, %d iterations, radius %d\n",
+           FLAGS_height, FLAGS_iterations, FLAGS_radius);
+    printf("  cell loops: %10.1f us\n", ref_us);
+    printf("  bitboard:   %10.1f us (%.1fx)\n", bb_us, ref_us / bb_us);
+    printf("  mismatched cells: %d\n", mismatch);
+    return mismatch ? 1 : 0;
+}
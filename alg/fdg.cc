@@ -62,7 +62,7 @@ void Node::Print() {
     printf("}\n");
 }
 
-void Node::ApplyForces(double deltaT) {
+bool Node::ApplyForces(double deltaT) {
     // Newton's 2nd Law: F = ma
     acc_ = force_ / mass_;
     force_ = Vec2(0, 0);
@@ -71,9 +71,10 @@ void Node::ApplyForces(double deltaT) {
     vel_ = vel_ * (1.0 - friction_) + acc_ * deltaT;
     Vec2 delta = vel_ * deltaT;
     if (pause_ || delta.length() < 1e-6)
-        return;
+        return false;
 
     pos_ += delta;
+    return true;
 }
 
 void Graph::Print() {
@@ -81,11 +82,13 @@ void Graph::Print() {
         n.second->Print();
 }
 
-void Graph::Compute(double deltaT) {
+bool Graph::Compute(double deltaT) {
     for(const auto& n : nodes_)
         n.second->ComputeForces(nodes_);
+    bool moved = false;
     for(const auto& n : nodes_)
-        n.second->ApplyForces(deltaT);
+        moved |= n.second->ApplyForces(deltaT);
+    return moved;
 }
 
 }  // namepsace fdg
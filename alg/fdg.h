@@ -63,7 +63,8 @@ class Node {
     void Print();
     void ComputeForces(
             const std::map<int32_t, std::unique_ptr<Node>>& nodes);
-    void ApplyForces(double deltaT);
+    // Returns whether the node moved.
+    bool ApplyForces(double deltaT);
   private:
     int32_t id_;
     Vec2 start_pos_;
@@ -103,7 +104,8 @@ class Graph {
     }
 
     void Print();
-    void Compute(double deltaT);
+    // Returns whether any node moved, i.e. the graph hasn't settled yet.
+    bool Compute(double deltaT);
     void Clear() { nodes_.clear(); }
   private:
     std::map<int32_t, std::unique_ptr<Node>> nodes_;
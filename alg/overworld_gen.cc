@@ -0,0 +1,225 @@
+#include "alg/overworld_gen.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <queue>
+
+#include "alg/overworld_rle.h"
+#include "alg/terrain.h"
+
+namespace z2util {
+
+bool OverworldGenerator::Walkable(uint8_t tile) {
+    switch(tile) {
+        case Terrain::MOUNTAINS:
+        case Terrain::WATER:
+        case Terrain::BOULDER:
+        case Terrain::SPIDER:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool OverworldGenerator::Better(const Result& a, const Result& b) {
+    bool ga = a.placed && a.fits, gb = b.placed && b.fits;
+    if (ga != gb)
+        return ga;
+    if (a.placed != b.placed)
+        return a.placed;
+    if (a.carved != b.carved)
+        return a.carved < b.carved;
+    if (a.bytes != b.bytes)
+        return a.bytes < b.bytes;
+    return a.seed < b.seed;
+}
+
+OverworldGenerator::Result OverworldGenerator::Generate(int64_t seed) const {
+    Result r{seed, false, false, 0, 0, opt_.width(), opt_.height()};
+    r.tile.resize(r.width * r.height);
+    std::mt19937 rng(seed);
+
+    MakeTerrain(&r);
+    r.placed = Place(&rng, &r);
+    if (r.placed)
+        Carve(&r);
+    Verify(&r);
+    return r;
+}
+
+void OverworldGenerator::MakeTerrain(Result* r) const {
+    PerlinTerrain terrain;
+    terrain.SetSize(r->width, r->height);
+    terrain.set_noise_zoom(opt_.noise_zoom());
+    terrain.Generate(unsigned(r->seed));
+    terrain.GetTiles(-r->width / 2, -r->height / 2, r->width, r->height,
+                     r->tile.data());
+}
+
+bool OverworldGenerator::Place(std::mt19937* rng, Result* r) const {
+    const int w = r->width, h = r->height;
+    std::vector<bool> used(w * h);
+    std::vector<int> cand, cave;
+
+    for(const auto& site : opt_.site()) {
+        // If the map is too crowded, relax the spacing until the site fits.
+        for(int spacing = std::max(1, opt_.min_spacing()); ; spacing /= 2) {
+            cand.clear();
+            cave.clear();
+            for(int y=1; y<h-1; y++) {
+                for(int x=1; x<w-1; x++) {
+                    int i = y * w + x;
+                    if (used[i] || !Walkable(r->tile[i]))
+                        continue;
+                    bool near = false;
+                    for(const auto& p : r->site) {
+                        if (std::max(std::abs(p.first - x),
+                                     std::abs(p.second - y)) < spacing) {
+                            near = true;
+                            break;
+                        }
+                    }
+                    if (near)
+                        continue;
+                    cand.push_back(i);
+                    if (r->tile[i-1] == Terrain::MOUNTAINS ||
+                        r->tile[i+1] == Terrain::MOUNTAINS ||
+                        r->tile[i-w] == Terrain::MOUNTAINS ||
+                        r->tile[i+w] == Terrain::MOUNTAINS) {
+                        cave.push_back(i);
+                    }
+                }
+            }
+            if (site.tile() == Terrain::CAVE && !cave.empty())
+                cand.swap(cave);
+            if (!cand.empty() || spacing <= 1)
+                break;
+        }
+        if (cand.empty())
+            return false;
+
+        std::uniform_int_distribution<int> pick(0, int(cand.size()) - 1);
+        int i = cand[pick(*rng)];
+        used[i] = true;
+        r->tile[i] = site.tile();
+        r->site.emplace_back(i % w, i / w);
+    }
+    return true;
+}
+
+void OverworldGenerator::Reach(const Result& r,
+                               std::vector<bool>* reached) const {
+    const int w = r.width, h = r.height;
+    reached->assign(w * h, false);
+    if (r.site.empty())
+        return;
+    std::vector<int> stack = {r.site[0].second * w + r.site[0].first};
+    (*reached)[stack[0]] = true;
+    while(!stack.empty()) {
+        int i = stack.back();
+        stack.pop_back();
+        int x = i % w, y = i / w;
+        const int dx[] = {-1, 1, 0, 0};
+        const int dy[] = {0, 0, -1, 1};
+        for(int d=0; d<4; d++) {
+            int nx = x + dx[d], ny = y + dy[d];
+            if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+                continue;
+            int n = ny * w + nx;
+            if (!(*reached)[n] && Walkable(r.tile[n])) {
+                (*reached)[n] = true;
+                stack.push_back(n);
+            }
+        }
+    }
+}
+
+void OverworldGenerator::Carve(Result* r) const {
+    const int w = r->width, h = r->height;
+    const int carve = std::max(1, opt_.carve_cost());
+    std::vector<bool> reached;
+    std::vector<int> dist(w * h), from(w * h);
+    typedef std::pair<int, int> Entry;
+
+    for(size_t s=1; s<r->site.size(); s++) {
+        Reach(*r, &reached);
+        int target = r->site[s].second * w + r->site[s].first;
+        if (reached[target])
+            continue;
+
+        // Dijkstra from everything already reachable to the site.
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> q;
+        std::fill(dist.begin(), dist.end(), INT_MAX);
+        for(int i=0; i<w*h; i++) {
+            if (reached[i]) {
+                dist[i] = 0;
+                from[i] = -1;
+                q.emplace(0, i);
+            }
+        }
+        while(!q.empty()) {
+            Entry e = q.top();
+            q.pop();
+            int i = e.second;
+            if (e.first > dist[i])
+                continue;
+            if (i == target)
+                break;
+            int x = i % w, y = i / w;
+            const int dx[] = {-1, 1, 0, 0};
+            const int dy[] = {0, 0, -1, 1};
+            for(int d=0; d<4; d++) {
+                int nx = x + dx[d], ny = y + dy[d];
+                if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+                    continue;
+                int n = ny * w + nx;
+                int cost = e.first + (Walkable(r->tile[n]) ? 1 : carve);
+                if (cost < dist[n]) {
+                    dist[n] = cost;
+                    from[n] = i;
+                    q.emplace(cost, n);
+                }
+            }
+        }
+
+        for(int i=from[target]; i >= 0 && !reached[i]; i=from[i]) {
+            uint8_t& t = r->tile[i];
+            if (!Walkable(t)) {
+                t = t == Terrain::WATER ? Terrain::BRIDGE : Terrain::ROAD;
+                r->carved++;
+            }
+        }
+    }
+}
+
+void OverworldGenerator::Verify(Result* r) const {
+    OverworldRle rle(r->width, r->height);
+    rle.set_hackjam(opt_.hackjam());
+    rle.set_compress_boulders(opt_.compress_boulders());
+    for(int y=0; y<r->height; y++) {
+        for(int x=0; x<r->width; x++) {
+            rle.set_tile(x, y, r->tile[y * r->width + x]);
+        }
+    }
+    for(size_t s=0; s<r->site.size(); s++) {
+        if (opt_.site(s).fixed())
+            rle.set_fixed(r->site[s].first, r->site[s].second, true);
+    }
+    r->bytes = int(rle.Encode().size());
+    r->fits = opt_.max_length() <= 0 || r->bytes <= opt_.max_length();
+}
+
+void OverworldSearch::Start(const OverworldGeneratorOptions& opt) {
+    // Generate is const, so the workers share one generator.
+    OverworldGenerator gen(opt);
+    search_.Start("Overworld", opt.seed(), opt.seeds(), opt.threads(),
+                  opt.top_k(), OverworldGenerator::Better,
+                  [gen](int64_t seed, OverworldGenerator::Result* r) {
+                      *r = gen.Generate(seed);
+                      return true;
+                  });
+}
+
+}  // namespace z2util
@@ -0,0 +1,78 @@
+#ifndef Z2UTIL_ALG_OVERWORLD_GEN_H
+#define Z2UTIL_ALG_OVERWORLD_GEN_H
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "alg/seed_search.h"
+#include "proto/generator.pb.h"
+
+namespace z2util {
+
+// Generates a complete overworld in stages:
+//   1. Terrain: perlin noise elevation and moisture over the whole map.
+//   2. Placement: each site goes on a random land tile, away from the
+//      map edge and the other sites.  Caves prefer tiles next to
+//      mountains.
+//   3. Carving: each site is joined to the sites already reachable from
+//      the start by the cheapest path, cutting roads through mountains
+//      and bridges over water.
+//   4. Verification: the map is run length encoded to check that it fits.
+class OverworldGenerator {
+  public:
+    struct Result {
+        int64_t seed;
+        bool placed;
+        bool fits;
+        int bytes;
+        // Tiles turned into road or bridge to make every site reachable.
+        int carved;
+        int width, height;
+        std::vector<uint8_t> tile;
+        // Position of each site, in the order of the options.
+        std::vector<std::pair<int, int>> site;
+    };
+
+    explicit OverworldGenerator(const OverworldGeneratorOptions& opt)
+      : opt_(opt) {}
+
+    Result Generate(int64_t seed) const;
+
+    // Orders results best first: placed and fitting, then fewest carved
+    // tiles, then fewest bytes.
+    static bool Better(const Result& a, const Result& b);
+
+    static bool Walkable(uint8_t tile);
+
+  private:
+    void MakeTerrain(Result* r) const;
+    bool Place(std::mt19937* rng, Result* r) const;
+    void Carve(Result* r) const;
+    void Verify(Result* r) const;
+    // Marks the tiles reachable from the start.
+    void Reach(const Result& r, std::vector<bool>* reached) const;
+
+    OverworldGeneratorOptions opt_;
+};
+
+// Runs the generator over a range of seeds on a pool of worker threads
+// and keeps the best maps.
+class OverworldSearch {
+  public:
+    void Start(const OverworldGeneratorOptions& opt);
+    void Cancel() { search_.Cancel(); }
+    bool running() const { return search_.running(); }
+    int done() const { return search_.done(); }
+    int total() const { return search_.total(); }
+    // The best results so far, best first.
+    std::vector<OverworldGenerator::Result> Results() {
+        return search_.Results();
+    }
+
+  private:
+    SeedSearch<OverworldGenerator::Result> search_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_ALG_OVERWORLD_GEN_H
@@ -0,0 +1,210 @@
+#include "alg/overworld_rle.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace z2util {
+namespace {
+const int INF = INT_MAX / 2;
+const int MAX_RUN = 16;
+
+// Tiles which are never changed by (or painted in) a suggestion: towns,
+// caves, palaces, boulders and spiders.
+bool Special(uint8_t tile) {
+    return tile <= 0x02 || tile == 0x0E || tile == 0x0F;
+}
+}  // namespace
+
+OverworldRle::OverworldRle(int width, int height)
+  : width_(width),
+  height_(height),
+  compress_boulders_(false),
+  hackjam_(false),
+  tile_(width * height),
+  fixed_(width * height)
+{}
+
+int OverworldRle::TokenCost(uint8_t tile, int len) const {
+    int cost = INF;
+    // A plain byte: tile in the low nibble, length-1 in the high nibble.
+    // With hackjam, $xF with length > 1 is the escape, so a run of $0F
+    // can't be a plain byte.
+    if (tile < 16 && len <= 16 && !(hackjam_ && tile == 0x0F && len > 1))
+        cost = 1;
+    // The escape: $xF followed by the tile, for up to 15 tiles.
+    if (cost == INF && hackjam_ && len <= 15)
+        cost = 2;
+    return cost == INF ? -1 : cost;
+}
+
+bool OverworldRle::Single(int x, int y) const {
+    uint8_t t = tile(x, y);
+    return fixed_[y * width_ + x] ||
+        (!compress_boulders_ && (t == 0x0E || t == 0x0F));
+}
+
+bool OverworldRle::Locked(int x, int y) const {
+    return Single(x, y) || Special(tile(x, y));
+}
+
+void OverworldRle::Emit(uint8_t tile, int len, std::vector<uint8_t>* data) const {
+    if (TokenCost(tile, len) == 1) {
+        data->push_back(tile | (len - 1) << 4);
+    } else {
+        data->push_back(0xF | len << 4);
+        data->push_back(tile);
+    }
+}
+
+void OverworldRle::RowDp(int y, int k, std::vector<int>* cost,
+                         std::vector<Step>* step) const {
+    // dp[x * (k+1) + c]: the fewest bytes encoding the first x tiles of
+    // the row with exactly c changes.
+    const int K = k + 1;
+    std::vector<int> dp((width_ + 1) * K, INF);
+    step->assign((width_ + 1) * K, Step{0, 0});
+    dp[0] = 0;
+
+    for(int x=0; x<width_; x++) {
+        int count[256] = {0};
+        std::vector<uint8_t> present;
+        int locked = -1;
+        for(int len=1; len <= MAX_RUN && x + len <= width_; len++) {
+            int cx = x + len - 1;
+            uint8_t t = tile(cx, y);
+            // Single tiles can only be a run by themselves.
+            if (len > 1 && (Single(x, y) || Single(cx, y)))
+                break;
+            if (Locked(cx, y)) {
+                if (locked != -1 && locked != t)
+                    break;
+                locked = t;
+            }
+            if (count[t]++ == 0)
+                present.push_back(t);
+
+            for(uint8_t paint : present) {
+                // Locked tiles can't change, so the run must be painted
+                // with the locked tile.
+                if (locked != -1 && paint != locked)
+                    continue;
+                int changes = len - count[paint];
+                if (changes > k || (changes && Special(paint)))
+                    continue;
+                int bytes = TokenCost(paint, len);
+                if (bytes < 0)
+                    continue;
+                for(int c=0; c + changes < K; c++) {
+                    int from = dp[x * K + c];
+                    if (from == INF)
+                        continue;
+                    int to = (x + len) * K + c + changes;
+                    if (from + bytes < dp[to]) {
+                        dp[to] = from + bytes;
+                        (*step)[to] = Step{uint8_t(len), paint};
+                    }
+                }
+            }
+        }
+    }
+    cost->assign(dp.begin() + width_ * K, dp.end());
+}
+
+std::vector<uint8_t> OverworldRle::Encode(std::vector<int>* offset) const {
+    std::vector<uint8_t> data;
+    std::vector<int> cost;
+    std::vector<Step> step;
+    if (offset)
+        offset->assign(width_ * height_, -1);
+
+    for(int y=0; y<height_; y++) {
+        RowDp(y, 0, &cost, &step);
+        std::vector<Step> runs;
+        for(int x=width_; x>0; x-=step[x].len) {
+            runs.push_back(step[x]);
+        }
+        int x = 0;
+        for(auto r = runs.rbegin(); r != runs.rend(); ++r) {
+            if (offset)
+                (*offset)[y * width_ + x] = int(data.size());
+            Emit(r->tile, r->len, &data);
+            x += r->len;
+        }
+    }
+    return data;
+}
+
+int OverworldRle::RowLength(int y) const {
+    std::vector<int> cost;
+    std::vector<Step> step;
+    RowDp(y, 0, &cost, &step);
+    return cost[0];
+}
+
+bool OverworldRle::Suggest(int max_length, std::vector<Change>* changes,
+                           int max_changes) const {
+    changes->clear();
+    const int K = std::min(max_changes, width_);
+    // best[y][c]: the fewest bytes for row y with exactly c changes.
+    std::vector<std::vector<int>> best(height_);
+    std::vector<Step> step;
+    for(int y=0; y<height_; y++) {
+        RowDp(y, K, &best[y], &step);
+    }
+
+    // Knapsack across the rows: total[y][c] is the fewest bytes for the
+    // first y rows with c changes.
+    const int C = max_changes + 1;
+    std::vector<std::vector<int>> total(height_ + 1, std::vector<int>(C, INF));
+    std::vector<std::vector<int>> choice(height_ + 1, std::vector<int>(C, 0));
+    total[0][0] = 0;
+    for(int y=0; y<height_; y++) {
+        for(int c=0; c<C; c++) {
+            if (total[y][c] == INF)
+                continue;
+            for(int k=0; k<=K && c + k < C; k++) {
+                if (best[y][k] == INF)
+                    continue;
+                int bytes = total[y][c] + best[y][k];
+                if (bytes < total[y+1][c+k]) {
+                    total[y+1][c+k] = bytes;
+                    choice[y+1][c+k] = k;
+                }
+            }
+        }
+    }
+
+    int n = 0;
+    while(n < C && total[height_][n] > max_length)
+        n++;
+    if (n == C)
+        return false;
+
+    std::vector<int> cost;
+    for(int y=height_; y>0; y--) {
+        int k = choice[y][n];
+        n -= k;
+        if (k == 0)
+            continue;
+        RowDp(y-1, k, &cost, &step);
+        const int RK = k + 1;
+        for(int x=width_, c=k; x>0;) {
+            const Step& s = step[x * RK + c];
+            for(int i=x - s.len; i<x; i++) {
+                uint8_t t = tile(i, y-1);
+                if (t != s.tile) {
+                    changes->push_back(Change{i, y-1, t, s.tile});
+                    c--;
+                }
+            }
+            x -= s.len;
+        }
+    }
+    std::sort(changes->begin(), changes->end(),
+              [](const Change& a, const Change& b) {
+                  return a.y == b.y ? a.x < b.x : a.y < b.y;
+              });
+    return true;
+}
+
+}  // namespace z2util
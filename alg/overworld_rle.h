@@ -0,0 +1,71 @@
+#ifndef Z2UTIL_ALG_OVERWORLD_RLE_H
+#define Z2UTIL_ALG_OVERWORLD_RLE_H
+#include <cstdint>
+#include <vector>
+namespace z2util {
+
+// Run length encoder for overworld maps.
+//
+// Each byte holds a tile in the low nibble and the run length minus one in
+// the high nibble.  With the hackjam2020 expansion, a byte of $xF with a
+// run length greater than one is an escape: the following byte is the tile
+// and the run is one shorter.  Runs never cross rows.
+//
+// Encoding is done by dynamic programming over each row, so the result is
+// the smallest possible under those rules.
+class OverworldRle {
+  public:
+    OverworldRle(int width, int height);
+
+    struct Change {
+        int x, y;
+        uint8_t from, to;
+    };
+
+    inline void set_tile(int x, int y, uint8_t t) { tile_[y * width_ + x] = t; }
+    inline uint8_t tile(int x, int y) const { return tile_[y * width_ + x]; }
+    // Fixed tiles are always encoded by themselves (eg: connector spots).
+    inline void set_fixed(int x, int y, bool f) { fixed_[y * width_ + x] = f; }
+    inline void set_compress_boulders(bool c) { compress_boulders_ = c; }
+    inline void set_hackjam(bool h) { hackjam_ = h; }
+
+    // Encode the map.  If |offset| is not null, it receives, for each tile,
+    // the offset of the byte which starts its run, or -1 if the tile is in
+    // the middle of a run.
+    std::vector<uint8_t> Encode(std::vector<int>* offset=nullptr) const;
+    // The encoded length of one row.
+    int RowLength(int y) const;
+
+    // Find the fewest tile changes which make the encoded map fit in
+    // |max_length| bytes.  Fixed tiles, towns, caves, palaces, boulders and
+    // spiders are never changed or painted.  Returns false if more than
+    // |max_changes| would be needed.
+    bool Suggest(int max_length, std::vector<Change>* changes,
+                 int max_changes=256) const;
+
+  private:
+    struct Step {
+        uint8_t len;
+        uint8_t tile;
+    };
+    // Bytes needed for a run of |len| |tile|s as a single token, or -1 if
+    // the run can't be encoded as one token.
+    int TokenCost(uint8_t tile, int len) const;
+    bool Single(int x, int y) const;
+    bool Locked(int x, int y) const;
+    // Row DP allowing up to |k| changes.  |cost| receives, for each number
+    // of changes, the smallest encoding; |step| the choices which lead there.
+    void RowDp(int y, int k, std::vector<int>* cost,
+               std::vector<Step>* step) const;
+    void Emit(uint8_t tile, int len, std::vector<uint8_t>* data) const;
+
+    int width_;
+    int height_;
+    bool compress_boulders_;
+    bool hackjam_;
+    std::vector<uint8_t> tile_;
+    std::vector<bool> fixed_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_ALG_OVERWORLD_RLE_H
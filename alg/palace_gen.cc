@@ -2,6 +2,7 @@
 
 #include "imwidget/map_command.h"
 #include "util/config.h"
+#include "util/logging.h"
 #include "proto/rominfo.pb.h"
 
 namespace z2util {
@@ -11,16 +12,25 @@ const PalaceGenerator::FloorCeiling PalaceGenerator::fpos_[] = {
         {1, 11}, {2, 11}, {3, 11}, {4, 11}, {5, 11}, {6, 11}, {7, 11},
 };
 
-PalaceGenerator::PalaceGenerator(PalaceGeneratorOptions& opt)
+PalaceGenerator::PalaceGenerator(const PalaceGeneratorOptions& opt)
   : opt_(opt),
     real_(0.0, 1.0),
-    room_(0) {
+    room_(0),
+    dry_run_(false),
+    fitness_{0, } {
     rng_.seed(opt.seed());
     if (opt_.horizontal_bias() == 0.0)
         opt_.set_horizontal_bias(0.75);
     InitPalaceMaps();
 }
 
+void PalaceGenerator::set_mapper(Mapper* m) {
+    mapper_ = m;
+    decomp_.reset(new Z2Decompress);
+    decomp_->set_mapper(m);
+    decomp_->Init();
+}
+
 void PalaceGenerator::InitPalaceMaps() {
     const auto& ri = ConfigLoader<RomInfo>::GetConfig();
     int n = 0;
@@ -33,22 +43,94 @@ void PalaceGenerator::InitPalaceMaps() {
     }
 }
 
-void PalaceGenerator::Generate() {
+bool PalaceGenerator::Generate() {
+    const int kMaxAttempts = 1000;
+    const PalaceSolver::Items items = {
+        opt_.jump_required(), opt_.glove_required(), opt_.fairy_required()
+    };
+    bool dry_run = dry_run_;
+    std::mt19937 saved;
+    bool ok = false;
+
+    // Build palaces without writing them until one can be solved with the
+    // required items.
+    dry_run_ = true;
+    for(int attempt=0; attempt < kMaxAttempts && !ok; attempt++) {
+        saved = rng_;
+        Layout();
+        BuildRooms();
+        std::vector<bool> reached = solver_.Solve(0, items);
+        ok = true;
+        for(const auto& r : rooms_) {
+            if ((r.boss_room || r.item_room) && !reached[r.room])
+                ok = false;
+        }
+    }
+    dry_run_ = dry_run;
+    if (!ok) {
+        LOG(ERROR, "No solvable palace for seed ", opt_.seed(), " after ",
+                   kMaxAttempts, " attempts.");
+    }
+    fitness_.solvable = ok;
+    if (dry_run_ || !ok)
+        return ok;
+
+    // Rebuild the accepted palace from the same rng state, this time
+    // writing it to the ROM.
+    rng_ = saved;
+    Layout();
+    BuildRooms();
+    FixElevatorConnections();
+    fitness_.solvable = ok;
+    return ok;
+}
+
+void PalaceGenerator::Layout() {
     bool ok;
     do {
         GenerateMaze();
         MapToRooms();
         WalkMaze(0, 0, LEFT);
         ok = SelectSpecialRooms();
-        printf("special rooms = %d\n", ok);
+        if (!dry_run_)
+            printf("special rooms = %d\n", ok);
     } while(!ok);
-
     SimplePrint();
+}
+
+void PalaceGenerator::BuildRooms() {
+    fitness_ = Fitness{opt_.seed(), 0, };
+    solver_.Clear();
     holder_.reset(new MapHolder(mapper_));
     for(const auto& r : rooms_) {
         PrepareRoom(r.room);
     }
-    FixElevatorConnections();
+    for(const auto& r : rooms_) {
+        if (r.boss_room)
+            fitness_.path_length = r.distance;
+        if (r.dead_end)
+            fitness_.dead_ends++;
+        if (r.elevator)
+            fitness_.elevators++;
+    }
+}
+
+void PalaceGenerator::SaveRoom(int r, MapConnection* connection) {
+    std::vector<uint8_t> data = holder_->MapDataAbs();
+    fitness_.bytes += data.size();
+    if (dry_run_) {
+        // Give the solver the room as generated.  The decompressor needs
+        // the original room for its type and background map.
+        decomp_->Decompress(palace_maps_[opt_.start_room() + r]);
+        decomp_->Clear();
+        decomp_->DecompressSideView(data.data());
+        solver_.AddRoom(r, *decomp_,
+                        rooms_[r].elevator ? rooms_[r].elevator : -1,
+                        *connection);
+        return;
+    }
+    holder_->Save();
+    connection->Save();
 }
 
 void PalaceGenerator::GenerateMaze() {
@@ -87,10 +169,12 @@ void PalaceGenerator::GenerateMaze() {
             map_[y][x].room = room_++;
         }
     }
-    printf("Basic Layout\n");
+    if (!dry_run_)
+        printf("Basic Layout\n");
     SimplePrint();
     VisitRooms(x0, y0);
-    printf("With Connections\n");
+    if (!dry_run_)
+        printf("With Connections\n");
     SimplePrint();
 }
 
@@ -439,8 +523,7 @@ void PalaceGenerator::PrepareEntranceRoom(int r) {
     } else {
         connection.set_down(63, 0);
     }
-    holder_->Save();
-    connection.Save();
+    SaveRoom(r, &connection);
 }
 
 void PalaceGenerator::PrepareBossRoom(int r) {
@@ -496,8 +579,7 @@ void PalaceGenerator::PrepareBossRoom(int r) {
     connection.set_right(63, 0);
     connection.set_up(rooms_[r].up, 0);
     connection.set_down(rooms_[r].down, 0);
-    holder_->Save();
-    connection.Save();
+    SaveRoom(r, &connection);
 }
 
 void PalaceGenerator::PrepareItemRoom(int r) {
@@ -558,8 +640,7 @@ void PalaceGenerator::PrepareItemRoom(int r) {
     connection.set_right(rooms_[r].right, 0);
     connection.set_up(rooms_[r].up, 2);
     connection.set_down(rooms_[r].down, 2);
-    holder_->Save();
-    connection.Save();
+    SaveRoom(r, &connection);
 }
 
 void PalaceGenerator::PrepareRoom(int r) {
@@ -628,8 +709,7 @@ void PalaceGenerator::PrepareRoom(int r) {
     connection.set_right(rooms_[r].right, 0);
     connection.set_up(rooms_[r].up, 2);
     connection.set_down(rooms_[r].down, 2);
-    holder_->Save();
-    connection.Save();
+    SaveRoom(r, &connection);
 
 }
 
@@ -787,6 +867,8 @@ void PalaceGenerator::FixElevatorConnections() {
 }
 
 void PalaceGenerator::SimplePrint() {
+    if (dry_run_)
+        return;
     for(int y=0; y<opt_.grid_height(); y++) {
         for(int x=0; x<opt_.grid_width(); x++) {
             if (map_[y][x].room == -1) {
@@ -7,8 +7,10 @@
 #include <memory>
 #include <vector>
 
+#include "alg/palace_solver.h"
 #include "imwidget/map_command.h"
 #include "nes/mapper.h"
+#include "nes/z2decompress.h"
 #include "proto/generator.pb.h"
 #include "proto/rominfo.pb.h"
 
@@ -29,11 +31,28 @@ class PalaceGenerator {
         bool boss_room, item_room;
         int distance;
     };
-    PalaceGenerator(PalaceGeneratorOptions& opt);
+    // Measurements of a generated palace used to rank seeds.
+    struct Fitness {
+        int64_t seed;
+        int path_length;    // Rooms between the entrance and the boss.
+        int dead_ends;
+        int elevators;
+        int bytes;          // Size of the room data.
+        bool solvable;      // The boss and item can be reached.
+        double score;
+    };
+    PalaceGenerator(const PalaceGeneratorOptions& opt);
 
-    void Generate();
+    // Generates a palace the solver can finish and, unless this is a dry
+    // run, writes it to the ROM.  Returns false, writing nothing, if no
+    // solvable palace was found.
+    bool Generate();
     void SimplePrint();
-    inline void set_mapper(Mapper* m) { mapper_ = m; }
+    void set_mapper(Mapper* m);
+    // In a dry run, the palace is generated and measured but nothing is
+    // written to the ROM or printed.
+    inline void set_dry_run(bool d) { dry_run_ = d; }
+    inline const Fitness& fitness() const { return fitness_; }
   private:
     enum Direction { LEFT, RIGHT, UP, DOWN, };
     struct RoomGen {
@@ -45,6 +64,8 @@ class PalaceGenerator {
     };
 
     void InitPalaceMaps();
+    void Layout();
+    void BuildRooms();
     void GenerateMaze();
     void VisitRooms(int x, int y);
     void WalkMaze(int r, int distance, Direction from);
@@ -55,6 +76,7 @@ class PalaceGenerator {
     void PrepareBossRoom(int r);
     void PrepareItemRoom(int r);
     void FixElevatorConnections();
+    void SaveRoom(int r, MapConnection* connection);
 
     void CleanNearElevator(int r, int x);
     int MakeElevator(int r, int x, int floor_val);
@@ -78,6 +100,10 @@ class PalaceGenerator {
     Map palace_maps_[64];
     std::unique_ptr<MapHolder> holder_;
     RoomGen gen_;
+    bool dry_run_;
+    Fitness fitness_;
+    std::unique_ptr<Z2Decompress> decomp_;
+    PalaceSolver solver_;
 
     static const FloorCeiling fpos_[];
     static const int MAXX = 62;
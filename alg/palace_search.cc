@@ -0,0 +1,65 @@
+#include "alg/palace_search.h"
+
+#include "imwidget/map_command.h"
+
+namespace z2util {
+
+PalaceSearch::~PalaceSearch() {
+    Cancel();
+}
+
+void PalaceSearch::Start(const PalaceGeneratorOptions& opt,
+                         const PalaceSearchOptions& search) {
+    Cancel();
+    opt_ = opt;
+    weight_ = search.weight();
+    cartridge_.reset(new Cartridge(*mapper_->cartridge()));
+    snapshot_.reset(MapperRegistry::New(cartridge_.get(),
+                                        cartridge_->mapper()));
+
+    // The object name tables are built lazily; build them before any
+    // worker creates a map command.
+    MapCommand::Init();
+    auto better = [](const PalaceGenerator::Fitness& a,
+                     const PalaceGenerator::Fitness& b) {
+        return a.score > b.score || (a.score == b.score && a.seed < b.seed);
+    };
+    search_.Start("Palace", opt.seed(), search.seeds(), search.threads(),
+                  search.top_k(), better,
+                  [this](int64_t seed, PalaceGenerator::Fitness* f) {
+                      return Evaluate(seed, f);
+                  });
+}
+
+void PalaceSearch::Cancel() {
+    search_.Cancel();
+}
+
+double PalaceSearch::Score(const PalaceFitnessWeights& w,
+                           const PalaceGenerator::Fitness& f) {
+    return w.path_length() * f.path_length +
+           w.dead_ends() * f.dead_ends +
+           w.elevators() * f.elevators +
+           w.bytes() * f.bytes;
+}
+
+bool PalaceSearch::Evaluate(int64_t seed, PalaceGenerator::Fitness* f) {
+    PalaceGeneratorOptions opt = opt_;
+    opt.set_seed(seed);
+    // Each palace gets its own generator, and so its own rng and
+    // MapHolder.
+    PalaceGenerator pgen(opt);
+    pgen.set_mapper(snapshot_.get());
+    pgen.set_dry_run(true);
+    if (!pgen.Generate())
+        return false;
+    *f = pgen.fitness();
+    f->score = Score(weight_, *f);
+    return true;
+}
+
+std::vector<PalaceGenerator::Fitness> PalaceSearch::Results() {
+    return search_.Results();
+}
+
+}  // namespace z2util
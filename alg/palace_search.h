@@ -0,0 +1,50 @@
+#ifndef Z2UTIL_ALG_PALACE_SEARCH_H
+#define Z2UTIL_ALG_PALACE_SEARCH_H
+
+#include <memory>
+#include <vector>
+
+#include "alg/palace_gen.h"
+#include "alg/seed_search.h"
+#include "nes/mapper.h"
+#include "proto/generator.pb.h"
+
+namespace z2util {
+
+// Generates palaces for a range of seeds on a pool of worker threads and
+// keeps the best scoring seeds.  Each worker runs the generator as a dry
+// run against a copy of the cartridge taken when the search starts, so the
+// ROM may be edited while the search runs.
+class PalaceSearch {
+  public:
+    PalaceSearch(Mapper* m) : mapper_(m) {}
+    ~PalaceSearch();
+
+    void Start(const PalaceGeneratorOptions& opt,
+               const PalaceSearchOptions& search);
+    void Cancel();
+    // Returns true while any worker is still running.
+    bool running() const { return search_.running(); }
+    int done() const { return search_.done(); }
+    int total() const { return search_.total(); }
+    // The best results so far, best first.  Each worker's results are
+    // merged when it finishes.
+    std::vector<PalaceGenerator::Fitness> Results();
+
+    static double Score(const PalaceFitnessWeights& w,
+                        const PalaceGenerator::Fitness& f);
+  private:
+    bool Evaluate(int64_t seed, PalaceGenerator::Fitness* f);
+
+    Mapper* mapper_;
+    // The copy of the ROM the workers read.
+    std::unique_ptr<Cartridge> cartridge_;
+    std::unique_ptr<Mapper> snapshot_;
+    PalaceGeneratorOptions opt_;
+    PalaceFitnessWeights weight_;
+    // Declared last so the workers are joined before the snapshot goes.
+    SeedSearch<PalaceGenerator::Fitness> search_;
+};
+
+}  // namespace
+#endif // Z2UTIL_ALG_PALACE_SEARCH_H
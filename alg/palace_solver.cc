@@ -0,0 +1,285 @@
+#include "alg/palace_solver.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "util/config.h"
+
+namespace z2util {
+
+PalaceSolver::TileClass PalaceSolver::Classify(uint8_t tile) {
+    // As in the game, palace metatiles are solid from a threshold within
+    // each group of 64 tiles.
+    static const uint8_t solid[4] = {0x40, 0x4b, 0x85, 0xd1};
+    switch(tile) {
+        case 0x4c:              // Breakable block.
+            return BREAKABLE;
+        case 0x83: case 0x84:   // Lava.
+            return DEADLY;
+        case 0xd4:              // Locked door.
+            return OPEN;
+        default:
+            ;
+    }
+    return tile >= solid[tile >> 6] ? SOLID : OPEN;
+}
+
+void PalaceSolver::AddRoom(int room, const Z2Decompress& decomp, int elevator,
+                           const MapConnection& conn) {
+    if (room >= int(room_.size()))
+        room_.resize(room + 1, Room{0, -1, });
+    Room& r = room_[room];
+    r.width = decomp.mapwidth();
+    r.elevator = elevator;
+    MapConnection::Unpacked u[4] = {
+        conn.left(), conn.down(), conn.up(), conn.right()
+    };
+    for(int i=0; i<4; i++) {
+        r.dest[i] = u[i].destination;
+        r.start[i] = u[i].start;
+    }
+    r.tile.resize(r.width * HEIGHT);
+    for(int y=0; y<HEIGHT; y++) {
+        for(int x=0; x<r.width; x++) {
+            r.tile[y * r.width + x] = decomp.map(x, y);
+        }
+    }
+}
+
+int PalaceSolver::FindElevator(MapHolder* holder) {
+    for(const auto& cmd : *holder->mutable_command()) {
+        if (cmd.absy() == 15 && cmd.object() == 0x50)
+            return cmd.absx();
+    }
+    return -1;
+}
+
+void PalaceSolver::Load(Mapper* mapper, const Map& map) {
+    const auto& ri = ConfigLoader<RomInfo>::GetConfig();
+    std::unique_ptr<Z2Decompress> decomp(new Z2Decompress);
+    MapHolder holder(mapper);
+    MapConnection conn(mapper);
+    decomp->set_mapper(mapper);
+    decomp->Init();
+
+    Clear();
+    int n = 0;
+    for(const auto& m : ri.map()) {
+        if (m.type() == MapType::OVERWORLD
+            || m.world() != map.world()
+            || m.overworld() != map.overworld()
+            || (map.world() == 0 && m.subworld() != map.subworld())) {
+            continue;
+        }
+        decomp->Decompress(m);
+        holder.Parse(m);
+        conn.Parse(m);
+        AddRoom(n++, *decomp, FindElevator(&holder), conn);
+    }
+}
+
+// A search over the places Link can stand.  Each room has
+// width*HEIGHT standing positions plus one node for its elevator shaft.
+class PalaceSolver::Search {
+  public:
+    Search(const PalaceSolver& s, const Items& items)
+      : room_(s.room_),
+      items_(items),
+      stride_(64 * HEIGHT + 1),
+      seen_(room_.size() * stride_),
+      flown_(room_.size() * stride_) {}
+
+    std::vector<bool> Run(int room) {
+        std::vector<bool> reached(room_.size());
+        if (room < 0 || room >= int(room_.size()) || !room_[room].width)
+            return reached;
+        Arrive(room, 0, HEIGHT - 2);
+        while(!queue_.empty()) {
+            int state = queue_.back();
+            queue_.pop_back();
+            int r = state / stride_;
+            int i = state % stride_;
+            reached[r] = true;
+            if (i == SHAFT) {
+                Shaft(r);
+            } else {
+                Stand(r, i % room_[r].width, i / room_[r].width);
+            }
+        }
+        return reached;
+    }
+
+  private:
+    static const int SHAFT = 64 * HEIGHT;
+
+    TileClass Cell(const Room& r, int x, int y) const {
+        if (x < 0 || y < 0 || x >= r.width || y >= HEIGHT)
+            return OPEN;
+        return Classify(r.tile[y * r.width + x]);
+    }
+    bool Passable(const Room& r, int x, int y) const {
+        TileClass c = Cell(r, x, y);
+        return c == OPEN || (c == BREAKABLE && items_.glove);
+    }
+    // Link's body (two tiles tall, feet at y) fits at x, y.
+    bool Body(const Room& r, int x, int y) const {
+        return x >= 0 && x < r.width && y >= 0 && y < HEIGHT &&
+               Passable(r, x, y) && Passable(r, x, y-1);
+    }
+    bool Floor(const Room& r, int x, int y) const {
+        TileClass c = Cell(r, x, y+1);
+        return y + 1 < HEIGHT && (c == SOLID || c == BREAKABLE);
+    }
+
+    void Push(int room, int index) {
+        int state = room * stride_ + index;
+        if (!seen_[state]) {
+            seen_[state] = true;
+            queue_.push_back(state);
+        }
+    }
+
+    // Drop from x, y until landing, falling out of the room or dying.
+    void Fall(int room, int x, int y) {
+        const Room& r = room_[room];
+        while(!Floor(r, x, y)) {
+            if (++y >= HEIGHT) {
+                Exit(room, DOWN, x);
+                return;
+            }
+            if (!Body(r, x, y))
+                return;
+        }
+        Push(room, y * r.width + x);
+    }
+
+    // Enter a room at x, y: find the nearest place at or above y where
+    // Link fits, then fall.
+    void Arrive(int room, int x, int y) {
+        const Room& r = room_[room];
+        x = std::max(0, std::min(x, r.width - 1));
+        for(y = std::min(y, HEIGHT - 1); y >= 0; y--) {
+            if (Body(r, x, y)) {
+                Fall(room, x, y);
+                return;
+            }
+        }
+    }
+
+    void Exit(int room, int dir, int x, int y=0) {
+        const Room& r = room_[room];
+        int d = r.dest[dir];
+        if (d == NOWHERE || d >= int(room_.size()) || !room_[d].width)
+            return;
+        const Room& to = room_[d];
+        switch(dir) {
+            case LEFT:
+                Arrive(d, r.start[dir] * 16 + 15, y);
+                break;
+            case RIGHT:
+                Arrive(d, r.start[dir] * 16, y);
+                break;
+            case DOWN:
+                if (to.elevator >= 0) {
+                    Push(d, SHAFT);
+                } else {
+                    Arrive(d, x, 0);
+                }
+                break;
+            case UP:
+                if (to.elevator >= 0)
+                    Push(d, SHAFT);
+                break;
+        }
+    }
+
+    void Stand(int room, int x, int y) {
+        const Room& r = room_[room];
+        int height = items_.jump ? 4 : 3;
+        int reach = items_.jump ? 6 : 4;
+
+        // Walk one step, or jump up to |height| and across up to |reach|,
+        // falling wherever the jump ends.
+        for(int h=0; h<=height; h++) {
+            int ya = y - h;
+            if (h && !Body(r, x, ya))
+                break;
+            for(int dir=-1; dir<=1; dir+=2) {
+                for(int i=1; i <= (h ? reach : 1); i++) {
+                    int nx = x + dir * i;
+                    if (nx < 0) {
+                        Exit(room, LEFT, nx, ya);
+                        break;
+                    } else if (nx >= r.width) {
+                        Exit(room, RIGHT, nx, ya);
+                        break;
+                    }
+                    if (!Body(r, nx, ya))
+                        break;
+                    Fall(room, nx, ya);
+                }
+            }
+        }
+        if (r.elevator >= 0 && x >= r.elevator - 1 && x <= r.elevator + 2)
+            Push(room, SHAFT);
+        if (items_.fairy)
+            Fly(room, x, y);
+    }
+
+    // Ride the elevator to any floor next to the shaft, or to the rooms
+    // above and below.
+    void Shaft(int room) {
+        const Room& r = room_[room];
+        for(int y=0; y<HEIGHT; y++) {
+            for(int x=r.elevator-1; x<=r.elevator+2; x++) {
+                if (Body(r, x, y) && Floor(r, x, y))
+                    Push(room, y * r.width + x);
+            }
+        }
+        Exit(room, UP, r.elevator);
+        Exit(room, DOWN, r.elevator);
+    }
+
+    // The fairy is one tile tall and ignores gravity.
+    void Fly(int room, int x, int y) {
+        const Room& r = room_[room];
+        std::vector<int> stack = {y * r.width + x};
+        while(!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            if (flown_[room * stride_ + i])
+                continue;
+            flown_[room * stride_ + i] = true;
+            int fx = i % r.width, fy = i / r.width;
+            if (Body(r, fx, fy))
+                Fall(room, fx, fy);
+            if (fx == 0)
+                Exit(room, LEFT, fx, fy);
+            if (fx == r.width - 1)
+                Exit(room, RIGHT, fx, fy);
+            const int dx[] = {-1, 1, 0, 0};
+            const int dy[] = {0, 0, -1, 1};
+            for(int d=0; d<4; d++) {
+                int nx = fx + dx[d], ny = fy + dy[d];
+                if (nx >= 0 && nx < r.width && ny >= 0 && ny < HEIGHT &&
+                    Passable(r, nx, ny) && Cell(r, nx, ny) != DEADLY) {
+                    stack.push_back(ny * r.width + nx);
+                }
+            }
+        }
+    }
+
+    const std::vector<Room>& room_;
+    Items items_;
+    int stride_;
+    std::vector<bool> seen_;
+    std::vector<bool> flown_;
+    std::vector<int> queue_;
+};
+
+std::vector<bool> PalaceSolver::Solve(int room, const Items& items) const {
+    Search search(*this, items);
+    return search.Run(room);
+}
+
+}  // namespace z2util
@@ -0,0 +1,70 @@
+#ifndef Z2UTIL_ALG_PALACE_SOLVER_H
+#define Z2UTIL_ALG_PALACE_SOLVER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "imwidget/map_command.h"
+#include "nes/mapper.h"
+#include "nes/z2decompress.h"
+#include "proto/rominfo.pb.h"
+
+namespace z2util {
+
+// Checks whether the rooms of a palace can be reached with a given set of
+// items.  Each room is the decompressed tile grid and its connections.
+// The search is over the places Link can stand (a two tile tall body on
+// top of a solid tile), with moves for walking, jumping (a box shaped jump:
+// up, across, then fall), riding elevators, breaking blocks with the glove
+// and flying as a fairy.
+//
+// The jump limits are the ones the palace generator designs for: without
+// the jump spell Link can climb 3 tiles and clear a 3 tile gap; with it,
+// 4 tiles and a 5 tile gap.  Locked doors are assumed to be openable.
+class PalaceSolver {
+  public:
+    struct Items {
+        bool jump;
+        bool glove;
+        bool fairy;
+    };
+    PalaceSolver() {}
+
+    void Clear() { room_.clear(); }
+    // Add a room.  |elevator| is the x position of the elevator or -1.
+    void AddRoom(int room, const Z2Decompress& decomp, int elevator,
+                 const MapConnection& conn);
+    // Load the rooms of the palace containing |map| from the ROM.  Room
+    // numbers are indices into the maps of its world, as in the
+    // connection table.
+    void Load(Mapper* mapper, const Map& map);
+    // Explore the palace starting at the left edge of |room|.  Returns,
+    // for each room number, whether Link can get there.
+    std::vector<bool> Solve(int room, const Items& items) const;
+    inline bool has_room(int r) const {
+        return r >= 0 && r < int(room_.size()) && room_[r].width;
+    }
+
+    // The elevator position in a room's map commands, or -1.
+    static int FindElevator(MapHolder* holder);
+  private:
+    enum TileClass { OPEN, SOLID, BREAKABLE, DEADLY };
+    struct Room {
+        int width;
+        int elevator;
+        // Destination and start screen for left, down, up and right.
+        int dest[4];
+        int start[4];
+        std::vector<uint8_t> tile;
+    };
+    enum { LEFT, DOWN, UP, RIGHT };
+    static const int HEIGHT = 13;
+    static const int NOWHERE = 63;
+
+    static TileClass Classify(uint8_t tile);
+    class Search;
+    std::vector<Room> room_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_ALG_PALACE_SOLVER_H
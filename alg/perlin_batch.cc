@@ -0,0 +1,236 @@
+#include "alg/perlin_batch.h"
+
+#include <cmath>
+
+// The AVX2 kernel is compiled for AVX2 whatever the target, and only run
+// on cpus which have it.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    defined(__GNUC__)
+#define PERLIN_BATCH_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define STB_PERLIN_IMPLEMENTATION 1
+#include "util/stb_perlin.h"
+
+namespace z2util {
+namespace {
+// The y half of a lattice lookup, which is shared by the whole row.
+struct RowY {
+    int y0, y1;
+    float y, v;
+};
+
+inline float Ease(float a) {
+    return stb__perlin_ease(a);
+}
+
+inline float Lerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+RowY MakeRowY(float fy) {
+    int py = int(std::floor(fy));
+    float y = fy - py;
+    return RowY{py & 255, (py + 1) & 255, y, Ease(y)};
+}
+
+#if defined(PERLIN_BATCH_AVX2)
+// Returns how many of the n points were done, a multiple of 8.
+__attribute__((target("avx2")))
+int RowAvx2(const uint8_t* hash, const float* gx, const float* gy,
+            const RowY& r, float zoom, int scale, int x0, int n,
+            float* out) {
+    const float ym1 = r.y - 1;
+    int i = 0;
+    const __m256 vzoom = _mm256_set1_ps(zoom);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 vy = _mm256_set1_ps(r.y);
+    const __m256 vym1 = _mm256_set1_ps(ym1);
+    const __m256 vv = _mm256_set1_ps(r.v);
+    const __m256i y0 = _mm256_set1_epi32(r.y0);
+    const __m256i y1 = _mm256_set1_epi32(r.y1);
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i step = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const int* h32 = reinterpret_cast<const int*>(hash);
+    for(; i + 8 <= n; i += 8) {
+        __m256i xi = _mm256_mullo_epi32(
+            _mm256_add_epi32(_mm256_set1_epi32(x0 + i), step),
+            _mm256_set1_epi32(scale));
+        __m256 fx = _mm256_mul_ps(vzoom, _mm256_cvtepi32_ps(xi));
+        __m256 flx = _mm256_floor_ps(fx);
+        __m256i px = _mm256_cvtps_epi32(flx);
+        __m256 x = _mm256_sub_ps(fx, flx);
+        __m256 xm1 = _mm256_sub_ps(x, one);
+        __m256 u = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(x,
+            _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f)), x),
+            _mm256_set1_ps(10.0f)), x), x), x);
+
+        __m256i ix0 = _mm256_slli_epi32(_mm256_and_si256(px, mask), 8);
+        __m256i ix1 = _mm256_slli_epi32(_mm256_and_si256(
+            _mm256_add_epi32(px, _mm256_set1_epi32(1)), mask), 8);
+        __m256i h00 = _mm256_and_si256(_mm256_i32gather_epi32(
+            h32, _mm256_or_si256(ix0, y0), 1), mask);
+        __m256i h01 = _mm256_and_si256(_mm256_i32gather_epi32(
+            h32, _mm256_or_si256(ix0, y1), 1), mask);
+        __m256i h10 = _mm256_and_si256(_mm256_i32gather_epi32(
+            h32, _mm256_or_si256(ix1, y0), 1), mask);
+        __m256i h11 = _mm256_and_si256(_mm256_i32gather_epi32(
+            h32, _mm256_or_si256(ix1, y1), 1), mask);
+
+        __m256 n00 = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_i32gather_ps(gx, h00, 4), x),
+            _mm256_mul_ps(_mm256_i32gather_ps(gy, h00, 4), vy));
+        __m256 n01 = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_i32gather_ps(gx, h01, 4), x),
+            _mm256_mul_ps(_mm256_i32gather_ps(gy, h01, 4), vym1));
+        __m256 n10 = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_i32gather_ps(gx, h10, 4), xm1),
+            _mm256_mul_ps(_mm256_i32gather_ps(gy, h10, 4), vy));
+        __m256 n11 = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_i32gather_ps(gx, h11, 4), xm1),
+            _mm256_mul_ps(_mm256_i32gather_ps(gy, h11, 4), vym1));
+
+        __m256 n0 = _mm256_add_ps(n00,
+            _mm256_mul_ps(_mm256_sub_ps(n01, n00), vv));
+        __m256 n1 = _mm256_add_ps(n10,
+            _mm256_mul_ps(_mm256_sub_ps(n11, n10), vv));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(n0,
+            _mm256_mul_ps(_mm256_sub_ps(n1, n0), u)));
+    }
+    return i;
+}
+#endif
+
+#if defined(__SSE2__)
+// Returns how many of the n points were done, a multiple of 4.
+int RowSse2(const uint8_t* hash, const float* gx, const float* gy,
+            const RowY& r, float zoom, int scale, int x0, int n,
+            float* out) {
+    const float ym1 = r.y - 1;
+    int i = 0;
+    // SSE2 has no gather, so the table lookups are done per lane and the
+    // arithmetic four lanes at a time.
+    const __m128 vzoom = _mm_set1_ps(zoom);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 vy = _mm_set1_ps(r.y);
+    const __m128 vym1 = _mm_set1_ps(ym1);
+    const __m128 vv = _mm_set1_ps(r.v);
+    alignas(16) int pxs[4];
+    alignas(16) float g[8][4];
+    for(; i + 4 <= n; i += 4) {
+        __m128i xi = _mm_setr_epi32((x0 + i) * scale, (x0 + i + 1) * scale,
+                                    (x0 + i + 2) * scale, (x0 + i + 3) * scale);
+        __m128 fx = _mm_mul_ps(vzoom, _mm_cvtepi32_ps(xi));
+        // floor(): truncate, then step down where truncation rounded up.
+        __m128i px = _mm_cvttps_epi32(fx);
+        __m128 flx = _mm_cvtepi32_ps(px);
+        __m128 up = _mm_cmpgt_ps(flx, fx);
+        px = _mm_add_epi32(px, _mm_castps_si128(up));
+        flx = _mm_sub_ps(flx, _mm_and_ps(up, one));
+        __m128 x = _mm_sub_ps(fx, flx);
+        __m128 xm1 = _mm_sub_ps(x, one);
+        __m128 u = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(x, _mm_set1_ps(6.0f)),
+            _mm_set1_ps(15.0f)), x), _mm_set1_ps(10.0f)), x), x), x);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(pxs), px);
+        for(int lane=0; lane<4; lane++) {
+            int ix0 = (pxs[lane] & 255) << 8;
+            int ix1 = ((pxs[lane] + 1) & 255) << 8;
+            int h[4] = {
+                hash[ix0 | r.y0], hash[ix0 | r.y1],
+                hash[ix1 | r.y0], hash[ix1 | r.y1],
+            };
+            for(int c=0; c<4; c++) {
+                g[c * 2][lane] = gx[h[c]];
+                g[c * 2 + 1][lane] = gy[h[c]];
+            }
+        }
+        __m128 n00 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(g[0]), x),
+                                _mm_mul_ps(_mm_load_ps(g[1]), vy));
+        __m128 n01 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(g[2]), x),
+                                _mm_mul_ps(_mm_load_ps(g[3]), vym1));
+        __m128 n10 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(g[4]), xm1),
+                                _mm_mul_ps(_mm_load_ps(g[5]), vy));
+        __m128 n11 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(g[6]), xm1),
+                                _mm_mul_ps(_mm_load_ps(g[7]), vym1));
+
+        __m128 n0 = _mm_add_ps(n00, _mm_mul_ps(_mm_sub_ps(n01, n00), vv));
+        __m128 n1 = _mm_add_ps(n10, _mm_mul_ps(_mm_sub_ps(n11, n10), vv));
+        _mm_storeu_ps(out + i,
+                      _mm_add_ps(n0, _mm_mul_ps(_mm_sub_ps(n1, n0), u)));
+    }
+    return i;
+}
+#endif
+}  // namespace
+
+PerlinBatch::PerlinBatch(int z)
+  : hash_(256 * 256 + 3)
+{
+    int z0 = z & 255;
+    for(int x=0; x<256; x++) {
+        int r0 = stb__perlin_randtab[x];
+        for(int y=0; y<256; y++) {
+            int r00 = stb__perlin_randtab[r0 + y];
+            hash_[x << 8 | y] = stb__perlin_randtab[r00 + z0] & 63;
+        }
+    }
+    for(int h=0; h<64; h++) {
+        gx_[h] = stb__perlin_grad(h, 1, 0, 0);
+        gy_[h] = stb__perlin_grad(h, 0, 1, 0);
+    }
+}
+
+void PerlinBatch::Row(float zoom, int scale, int x0, int y, int n,
+                      float* out) const {
+    const RowY r = MakeRowY(zoom * (scale * y));
+    const uint8_t* hash = hash_.data();
+    const float ym1 = r.y - 1;
+    int i = 0;
+
+#if defined(PERLIN_BATCH_AVX2)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        i = RowAvx2(hash, gx_, gy_, r, zoom, scale, x0, n, out);
+    } else {
+        i = RowSse2(hash, gx_, gy_, r, zoom, scale, x0, n, out);
+    }
+#elif defined(__SSE2__)
+    i = RowSse2(hash, gx_, gy_, r, zoom, scale, x0, n, out);
+#endif
+
+    for(; i<n; i++) {
+        float fx = zoom * ((x0 + i) * scale);
+        int px = int(std::floor(fx));
+        float x = fx - px;
+        float u = Ease(x);
+        int ix0 = (px & 255) << 8;
+        int ix1 = ((px + 1) & 255) << 8;
+        int h00 = hash[ix0 | r.y0], h01 = hash[ix0 | r.y1];
+        int h10 = hash[ix1 | r.y0], h11 = hash[ix1 | r.y1];
+        float n00 = gx_[h00] * x + gy_[h00] * r.y;
+        float n01 = gx_[h01] * x + gy_[h01] * ym1;
+        float n10 = gx_[h10] * (x - 1) + gy_[h10] * r.y;
+        float n11 = gx_[h11] * (x - 1) + gy_[h11] * ym1;
+        float n0 = Lerp(n00, n01, r.v);
+        float n1 = Lerp(n10, n11, r.v);
+        out[i] = Lerp(n0, n1, u);
+    }
+}
+
+void PerlinBatch::Octaves(float zoom, int x0, int y, int n, float* out) const {
+    std::vector<float> o2(n), o4(n);
+    Row(zoom, 1, x0, y, n, out);
+    Row(zoom, 2, x0, y, n, o2.data());
+    Row(zoom, 4, x0, y, n, o4.data());
+    for(int i=0; i<n; i++) {
+        out[i] = out[i] / 2.0f + o2[i] / 4.0f + o4[i] / 8.0f;
+    }
+}
+
+}  // namespace z2util
@@ -0,0 +1,33 @@
+#ifndef Z2UTIL_ALG_PERLIN_BATCH_H
+#define Z2UTIL_ALG_PERLIN_BATCH_H
+#include <cstdint>
+#include <vector>
+
+namespace z2util {
+
+// Evaluates stb_perlin_noise3 for a row of points at once.  All of the
+// points lie on one integer z plane, so the z interpolation drops out and
+// the lattice hashes for the plane can be computed up front.  The results
+// are identical to calling stb_perlin_noise3(zoom*x, zoom*y, z).
+class PerlinBatch {
+  public:
+    explicit PerlinBatch(int z);
+
+    // out[i] = noise(zoom * (x0 + i) * scale, zoom * y * scale)
+    // for i in [0, n).
+    void Row(float zoom, int scale, int x0, int y, int n, float* out) const;
+
+    // The three octaves used by PerlinTerrain:
+    // out[i] = n(1)/2 + n(2)/4 + n(4)/8.
+    void Octaves(float zoom, int x0, int y, int n, float* out) const;
+
+  private:
+    // Gradient index for each (x, y) lattice point on the plane, plus
+    // padding so 32-bit gathers can read past the last entry.
+    std::vector<uint8_t> hash_;
+    float gx_[64];
+    float gy_[64];
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_ALG_PERLIN_BATCH_H
@@ -0,0 +1,123 @@
+#ifndef Z2UTIL_ALG_SEED_SEARCH_H
+#define Z2UTIL_ALG_SEED_SEARCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/logging.h"
+
+namespace z2util {
+
+// Evaluates a range of seeds on a pool of worker threads and keeps the
+// best results.  The generators own one of these and supply the
+// evaluation and the ordering.
+template<typename T>
+class SeedSearch {
+  public:
+    // Fills in the result for a seed.  Returns false if the seed should
+    // not be ranked at all.  Called on every worker thread at once.
+    typedef std::function<bool(int64_t seed, T* result)> Evaluate;
+    // True if a is better than b.
+    typedef std::function<bool(const T& a, const T& b)> Better;
+
+    SeedSearch() : next_(0), end_(0), total_(0), done_(0), workers_(0),
+                   top_k_(1) {}
+    ~SeedSearch() { Cancel(); }
+
+    // Searches seeds [first, first+count) on |threads| threads (or one per
+    // cpu if threads <= 0), keeping the top_k best.
+    void Start(const char* name, int64_t first, int count, int threads,
+               int top_k, Better better, Evaluate evaluate) {
+        Cancel();
+        better_ = better;
+        evaluate_ = evaluate;
+        top_k_ = std::max(1, top_k);
+        best_.clear();
+        done_ = 0;
+        total_ = count;
+        next_ = first;
+        end_ = first + count;
+
+        int n = threads;
+        if (n <= 0)
+            n = std::max(1u, std::thread::hardware_concurrency());
+        LOG(INFO, name, " search: ", count, " seeds on ", n, " threads.");
+        workers_ = n;
+        for(int i=0; i<n; i++) {
+            threads_.emplace_back(&SeedSearch::Worker, this);
+        }
+    }
+
+    void Cancel() {
+        // Claim every remaining seed so the workers stop after their
+        // current one.
+        int64_t left = end_ - next_.exchange(end_);
+        if (left > 0)
+            done_ += int(left);
+        for(auto& t : threads_) {
+            t.join();
+        }
+        threads_.clear();
+    }
+
+    // Returns true while any worker is still running.
+    bool running() const { return workers_ > 0; }
+    int done() const { return done_; }
+    int total() const { return total_; }
+    // The best results so far, best first.  Each worker's results are
+    // merged when it finishes.
+    std::vector<T> Results() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return best_;
+    }
+
+  private:
+    void Keep(std::vector<T>* list, const T& r) {
+        size_t k = top_k_;
+        if (list->size() == k && !better_(r, list->back()))
+            return;
+        list->insert(std::upper_bound(list->begin(), list->end(), r,
+                                      better_), r);
+        if (list->size() > k)
+            list->pop_back();
+    }
+
+    void Worker() {
+        std::vector<T> best;
+        for(;;) {
+            int64_t seed = next_++;
+            if (seed >= end_)
+                break;
+            T r;
+            if (evaluate_(seed, &r))
+                Keep(&best, r);
+            done_++;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(const auto& r : best) {
+            Keep(&best_, r);
+        }
+        workers_--;
+    }
+
+    Better better_;
+    Evaluate evaluate_;
+    std::atomic<int64_t> next_;
+    int64_t end_;
+    int total_;
+    std::atomic<int> done_;
+    std::atomic<int> workers_;
+    int top_k_;
+    std::mutex mutex_;
+    std::vector<T> best_;
+    std::vector<std::thread> threads_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_ALG_SEED_SEARCH_H
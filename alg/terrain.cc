@@ -1,6 +1,6 @@
 #include "alg/terrain.h"
 
-#define STB_PERLIN_IMPLEMENTATION 1
+#include "alg/bitboard.h"
 #include "util/stb_perlin.h"
 namespace z2util {
 
@@ -25,17 +25,43 @@ std::unique_ptr<Terrain> Terrain::New(Type type) {
     return std::move(ptr);
 }
 
+void Terrain::GetTiles(int x0, int y0, int w, int h, uint8_t* out) {
+    for(int y=0; y<h; y++) {
+        for(int x=0; x<w; x++) {
+            *out++ = GetTile(x0 + x, y0 + y);
+        }
+    }
+}
+
 void PerlinTerrain::Generate(unsigned int seed) {
     Terrain::Generate(seed);
     std::uniform_real_distribution<float> u(-100, 100);
     elevation_z_ = u(rand_);
     moisture_z_ = u(rand_);
+    // Noise() truncates z, so the batches use the same integer planes.
+    elevation_.reset(new PerlinBatch(int(elevation_z_)));
+    moisture_.reset(new PerlinBatch(int(moisture_z_)));
 }
 
 int PerlinTerrain::GetTile(int x, int y) {
-    const float e = Elevation(x, y);
-    const float m = Moisture(x, y);
+    return Classify(Elevation(x, y), Moisture(x, y));
+}
 
+void PerlinTerrain::GetTiles(int x0, int y0, int w, int h, uint8_t* out) {
+    std::vector<float> e(w), m(w);
+    for(int y=y0; y<y0+h; y++) {
+        elevation_->Octaves(noise_zoom_, x0, y, w, e.data());
+        moisture_->Octaves(noise_zoom_, x0, y, w, m.data());
+        for(int i=0; i<w; i++) {
+            const int x = x0 + i;
+            const float d = x * x + y * y;
+            e[i] = powf(e[i], 3.0f) + 0.03f - noise_zoom_ * 0.0001 * d;
+            *out++ = Classify(e[i], m[i]);
+        }
+    }
+}
+
+int PerlinTerrain::Classify(float e, float m) const {
     if (e > 0.030f) {
         if (m > 0.1) return TREES;
         return MOUNTAINS;
@@ -80,52 +106,25 @@ void CellularTerrain::Generate(unsigned int seed) {
     Terrain::Generate(seed);
     std::uniform_real_distribution<float> u(0.0, 1.0f);
 
+    static_assert(MAPWIDTH == Bitboard::WIDTH, "rows must fit a bitboard");
+    Bitboard walls(MAPHEIGHT);
     for(int y=0; y<MAPHEIGHT; y++) {
         for(int x=0; x<MAPWIDTH; x++) {
-            data_[y][x] = u(rand_) < probability_ ? bg_ : fg_;
+            walls.set(x, y, u(rand_) < probability_);
         }
     }
 
-    for (int i = 0; i < 4; ++i) {
-        Iterate([this](int x, int y){
-            return WallsWithin(x, y, 1) >= 5 || WallsWithin(x, y, 2) <= 2;
-        });
+    for (int i = 0; i < iterations_; ++i) {
+        walls = walls.AtLeast(1, 5) | walls.AtMost(2, 2);
     }
-    /*
-    for (int i = 0; i < 3; ++i) {
-        Iterate([this](int x, int y){
-            return WallsWithin(x, y, 1) >= 5;
-        });
-    }
-    */
-}
 
-int CellularTerrain::WallsWithin(int x, int y, int r) {
-    int count = 0;
-    for(int yy=y-r; yy<y+r; yy++) {
-        for(int xx=x-r; xx<x+r; xx++) {
-            if (data_[yy][xx] == bg_) ++count;
-        }
-    }
-    return count;
-}
-
-void CellularTerrain::Iterate(std::function<bool(int, int)> selector) {
-    uint8_t d[MAPHEIGHT][MAPWIDTH];
-    for (int y = 0; y < MAPHEIGHT; ++y) {
-        for (int x = 0; x < MAPWIDTH; ++x) {
-            d[y][x] = selector(x, y) ? bg_ : fg_;
-        }
-    }
-
-    for (int y = 0; y < MAPHEIGHT; ++y) {
-        for (int x = 0; x < MAPWIDTH; ++x) {
-            data_[y][x] = d[y][x];
+    for(int y=0; y<MAPHEIGHT; y++) {
+        for(int x=0; x<MAPWIDTH; x++) {
+            data_[y][x] = walls.get(x, y) ? bg_ : fg_;
         }
     }
 }
 
-
 void VoronoiTerrain::Generate(unsigned int seed) {
     Terrain::Generate(seed);
     uint8_t types[] = {
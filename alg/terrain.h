@@ -5,6 +5,8 @@
 #include <functional>
 #include <memory>
 #include <vector>
+
+#include "alg/perlin_batch.h"
 namespace z2util {
 
 // Terrain generators borrowed (with permission) from Quest Island
@@ -21,6 +23,8 @@ class Terrain {
     ~Terrain() {}
     virtual void Generate(unsigned int seed) { rand_.seed(seed); }
     virtual int GetTile(int x, int y) = 0;
+    // Fill out[w*h] with the tiles from (x0, y0) to (x0+w-1, y0+h-1).
+    virtual void GetTiles(int x0, int y0, int w, int h, uint8_t* out);
     void SetSize(int w, int h) { width_ = w; height_ = h; }
 
     // Zelda 2 Terrain types
@@ -55,8 +59,10 @@ class PerlinTerrain : public Terrain {
     PerlinTerrain() : Terrain(), noise_zoom_(0.03) {}
     void Generate(unsigned int seed) override;
     int GetTile(int x, int y) override;
+    void GetTiles(int x0, int y0, int w, int h, uint8_t* out) override;
     void set_noise_zoom(float nz) { noise_zoom_ = nz; }
   private:
+    int Classify(float e, float m) const;
     float Elevation(int x, int y) const;
     float Moisture(int x, int y) const;
     float Noise(int x, int y, int z) const;
@@ -64,23 +70,26 @@ class PerlinTerrain : public Terrain {
     float elevation_z_;
     float moisture_z_;
     float noise_zoom_;
+    std::unique_ptr<PerlinBatch> elevation_;
+    std::unique_ptr<PerlinBatch> moisture_;
 };
 
 class CellularTerrain: public Terrain {
   public:
     CellularTerrain()
       : Terrain(), 
-      fg_(Terrain::SAND), bg_(Terrain::MOUNTAINS), probability_(0.25) {}
+      fg_(Terrain::SAND), bg_(Terrain::MOUNTAINS), probability_(0.25),
+      iterations_(4) {}
     void Generate(unsigned int seed) override;
     int GetTile(int x, int y) override;
     void set_fg(int fg) { fg_ = fg; }
     void set_bg(int bg) { bg_ = bg; }
     void set_probability(float p) { probability_ = p; }
+    void set_iterations(int n) { iterations_ = n; }
   private:
-    int WallsWithin(int x, int y, int r);
-    void Iterate(std::function<bool(int, int)> selector);
     int fg_, bg_;
     float probability_;
+    int iterations_;
     uint8_t data_[MAPHEIGHT][MAPWIDTH];
 };
 
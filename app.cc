@@ -1,19 +1,30 @@
+#include <algorithm>
 #include <cstdio>
+#include <limits>
+#include <map>
+#include <set>
 
 #include <gflags/gflags.h>
 #include "app.h"
+#include "atlas.h"
 #include "imgui.h"
 #include "imwidget/error_dialog.h"
 #include "imwidget/map_connect.h"
 #include "nes/cpu6502.h"
+#include "nes/chr_analysis.h"
 #include "nes/chr_util.h"
+#include "nes/enemylist.h"
+#include "nes/music_rom.h"
+#include "nes/overworld_tiles.h"
 #include "nes/text_encoding.h"
 #include "proto/rominfo.pb.h"
 #include "util/browser.h"
 #include "util/config.h"
+#include "util/file.h"
 #include "util/os.h"
 #include "util/logging.h"
 #include "util/imgui_impl_sdl.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/match.h"
 
@@ -25,11 +36,15 @@
 
 DEFINE_string(emulator, "fceux", "Emulator to run for testing");
 DEFINE_string(romtmp, "zelda2-test.nes", "Temporary filename for running under test");
+DEFINE_bool(watch_config, true, "Reload the config when its files change");
 DECLARE_bool(move_from_keepout);
+DECLARE_int32(jobs);
 DECLARE_string(config);
 
 namespace z2util {
 
+const int kAudioRate = 44100;
+
 void Z2Edit::Init() {
     RegisterCommand("load", "Load a NES ROM or project file.", this, &Z2Edit::LoadFile);
     RegisterCommand("save", "Save a NES ROM or project file.", this, &Z2Edit::SaveFile);
@@ -54,6 +69,7 @@ void Z2Edit::Init() {
     RegisterCommand("wtp", "Write PRG text bytes.", this, &Z2Edit::WriteText);
     RegisterCommand("wtc", "Write CHR text bytes.", this, &Z2Edit::WriteText);
     RegisterCommand("elist", "Dump Enemy List.", this, &Z2Edit::EnemyList);
+    RegisterCommand("elistpack", "Report (or repack) enemy list space in every bank.", this, &Z2Edit::EnemyListPackAll);
     RegisterCommand("u", "Disassemble Code.", this, &Z2Edit::Unassemble);
     RegisterCommand("asm", "Assemble Code.", this, &Z2Edit::Assemble);
     RegisterCommand("insertprg", "Insert a PRG bank.", this, &Z2Edit::InsertPrg);
@@ -63,6 +79,7 @@ void Z2Edit::Init() {
     RegisterCommand("charclear", "Clear an individual char.", this, &Z2Edit::CharClear);
     RegisterCommand("charcopy", "Copy an individual char.", this, &Z2Edit::CharCopy);
     RegisterCommand("charswap", "Swap an individual char.", this, &Z2Edit::CharCopy);
+    RegisterCommand("charanalyze", "Report (or compact) free and duplicate chars in every CHR bank.", this, &Z2Edit::CharAnalyze);
     RegisterCommand("memmove", "Move memory within a PRG bank.", this, &Z2Edit::MemMove);
     RegisterCommand("swap", "Swap memory within a PRG bank.", this, &Z2Edit::Swap);
     RegisterCommand("bcopy", "Copy memory between PRG banks.", this, &Z2Edit::BCopy);
@@ -70,16 +87,25 @@ void Z2Edit::Init() {
     RegisterCommand("source", "Read and execute debugconsole commands from file.", this, &Z2Edit::Source);
     RegisterCommand("restore", "Read/restore a PRG bank from a NES file.", this, &Z2Edit::RestoreBank);
     RegisterCommand("conntable", "Show the connection table for a given overworld/subworld", this, &Z2Edit::ConnTable);
+    RegisterCommand("atlas", "Render every map to PNG atlases and an index.json.", this, &Z2Edit::Atlas);
     RegisterCommand("sendmessage", "Send a message to the editor refresh loop", this, &Z2Edit::SendMessage);
+    RegisterCommand("music", "Play the ROM's music.", this, &Z2Edit::Music);
 
     loaded_ = false;
+    prgsz_ = 0;
+    chrsz_ = 0;
     ibase_ = 0;
     bank_ = 0;
     text_encoding_ = 0;
+    project_.set_cartridge(&cartridge_);
+    if (headless())
+        return;
+
     hwpal_ = NesHardwarePalette::Get();
     chrview_.reset(new NesChrView);
     simplemap_.reset(new z2util::SimpleMap);
     misc_hacks_.reset(new z2util::MiscellaneousHacks);
+    music_editor_.reset(new z2util::MusicEditor);
     palace_gfx_.reset(new z2util::PalaceGraphics);
     palette_editor_.reset(new z2util::PaletteEditor);
     rom_memory_.reset(new z2util::RomMemory);
@@ -92,16 +118,178 @@ void Z2Edit::Init() {
     experience_table_.reset(new z2util::ExperienceTable);
     drops_.reset(new z2util::Drops);
     editor_.reset(z2util::Editor::New());
-    project_.set_cartridge(&cartridge_);
+
+    // In the order they're drawn.
+    AddDependent(start_values_.get());
+    AddDependent(text_table_.get());
+    AddDependent(tile_transform_.get());
+    AddDependent(item_effects_.get());
+    AddDependent(music_editor_.get());
+    AddDependent(palace_gfx_.get());
+    AddDependent(palette_editor_.get(), [this]() {
+        palette_editor_->Refresh();
+        palette_editor_->Init();
+    });
+    AddDependent(rom_memory_.get());
+    AddDependent(drops_.get());
+    AddDependent(simplemap_.get());
+    AddDependent(editor_.get());
+    AddDependent(object_table_.get(), [this]() {
+        object_table_->Refresh();
+        object_table_->Init();
+    });
+    AddDependent(enemy_editor_.get(), [this]() {
+        enemy_editor_->Refresh();
+        enemy_editor_->Init();
+    });
+    AddDependent(experience_table_.get());
+    watch_ = cartridge_.changes()->Subscribe(
+        {{ChangeBus::PRG, 0, std::numeric_limits<uint32_t>::max()},
+         {ChangeBus::CHR, 0, std::numeric_limits<uint32_t>::max()}},
+        [this](const std::vector<ChangeBus::Range>& changed) {
+            MarkChanged(changed);
+        });
     project_.set_visible(true);
+    SubscribeConfig();
+    WatchConfig();
+
+    synth_.reset(new z2music::Synth(kAudioRate));
+    music_editor_->set_synth(synth_.get());
+    InitAudio(kAudioRate, 1, 1024, AUDIO_S16SYS);
+}
+
+void Z2Edit::AudioCallback(void* stream, int len) {
+    if (synth_) {
+        synth_->render(static_cast<int16_t*>(stream), len / sizeof(int16_t));
+    } else {
+        ImApp::AudioCallback(stream, len);
+    }
+}
+
+void Z2Edit::SubscribeConfig() {
+    auto* config = ConfigLoader<RomInfo>::Get();
+    auto refresh = [this](ImWindowBase* w) {
+        return [this, w]() { if (loaded_) MarkStale(w); };
+    };
+
+    // Misc hacks first because it can modify config.  It is refreshed right
+    // away so that the windows refreshed after it see the config it sets.
+    config->Subscribe({"map", "misc", "palettes", "items", "dynamic_banks",
+                       "overworld_tiles", "objtable"},
+                      [this]() { if (loaded_) misc_hacks_->Refresh(); });
+    config->Subscribe({"map", "misc", "overworld_editor_keybind",
+                       "tile_transform_table"},
+                      refresh(editor_.get()));
+    config->Subscribe({"misc"}, refresh(palace_gfx_.get()));
+    config->Subscribe({"palettes"}, refresh(palette_editor_.get()));
+    config->Subscribe({"misc"}, refresh(rom_memory_.get()));
+    config->Subscribe({"misc"}, refresh(start_values_.get()));
+    config->Subscribe({"available", "decompress", "enemies", "item_effects",
+                       "items", "map", "text_table", "background", "misc"},
+                      refresh(simplemap_.get()));
+    config->Subscribe({"text_table"}, refresh(text_table_.get()));
+    config->Subscribe({"tile_transform_table"},
+                      refresh(tile_transform_.get()));
+    config->Subscribe({"item_effects"}, refresh(item_effects_.get()));
+    config->Subscribe({"drop_info", "enemies"}, refresh(drops_.get()));
+    config->Subscribe({"map", "objtable"}, refresh(object_table_.get()));
+    config->Subscribe({"enemies", "misc", "xptable"},
+                      refresh(enemy_editor_.get()));
+    config->Subscribe({"misc", "xptable"}, refresh(experience_table_.get()));
+}
+
+void Z2Edit::AddDependent(ImWindowBase* window,
+                          std::function<void()> refresh) {
+    if (!refresh) {
+        refresh = [window]() { window->Refresh(); };
+    }
+    dependents_.push_back({window, refresh, {}, {}});
+}
+
+void Z2Edit::MarkStale(ImWindowBase* window) {
+    for(auto& d : dependents_) {
+        if (d.window == window) {
+            d.window->set_stale(true);
+            return;
+        }
+    }
+    window->Refresh();
+}
+
+void Z2Edit::Refresh(Dependent* d) {
+    d->reads = Cartridge::ReadSet();
+    cartridge_.RecordReads(&d->reads);
+    d->refresh();
+    cartridge_.RecordReads(nullptr);
+    d->window->set_stale(false);
+}
+
+void Z2Edit::DrawDependents() {
+    for(auto& d : dependents_) {
+        if (d.window->stale() && d.window->visible()) {
+            Refresh(&d);
+        }
+        // Reads while drawing count too: some windows unpack as they draw.
+        cartridge_.RecordReads(&d.reads, &d.writes);
+        d.window->Draw();
+        cartridge_.RecordReads(nullptr);
+    }
+}
+
+void Z2Edit::MarkChanged(const std::vector<ChangeBus::Range>& changed) {
+    Cartridge::ReadSet banks;
+    for(const auto& r : changed) {
+        const int shift = r.space == ChangeBus::PRG ? 14 : 12;
+        auto& set = r.space == ChangeBus::PRG ? banks.prg : banks.chr;
+        uint32_t last = std::min((r.end - 1) >> shift,
+                                 uint32_t(set.size() - 1));
+        for(uint32_t b = r.begin >> shift; b <= last; b++) {
+            set[b] = true;
+        }
+    }
+    for(auto& d : dependents_) {
+        if ((d.reads.prg & banks.prg & ~d.writes.prg).any() ||
+            (d.reads.chr & banks.chr & ~d.writes.chr).any()) {
+            d.window->set_stale(true);
+        }
+        d.writes = Cartridge::ReadSet();
+    }
+}
+
+void Z2Edit::WatchConfig() {
+    if (FLAGS_config.empty() || !FLAGS_watch_config)
+        return;
+    // The set of files can change when a 'load' directive is edited.
+    config_watcher_.Clear();
+    for(const auto& f : ConfigLoader<RomInfo>::Get()->Files()) {
+        config_watcher_.Add(f);
+    }
+}
+
+void Z2Edit::ReloadConfig(const std::string& filename) {
+    auto* config = ConfigLoader<RomInfo>::Get();
+    auto changed = filename.empty() ? config->Reload()
+                                    : config->ReloadFile(filename);
+    LOG(INFO, "Reloaded config: ", absl::StrJoin(changed, ", "));
+    WatchConfig();
 }
 
 void Z2Edit::Load(const std::string& filename) {
     project_.Load(filename, false);
 }
 
-void Z2Edit::LoadPostProcess(int movekeepout) {
-    mapper_.reset(MapperRegistry::New(&cartridge_, cartridge_.mapper()));
+void Z2Edit::LoadPostProcess(int movekeepout, bool all) {
+    // Windows which aren't refreshed keep using the mapper, so it is only
+    // replaced if the new ROM needs a different one.
+    const bool remap = !mapper_ || mapper_number_ != cartridge_.mapper() ||
+                       prgsz_ != cartridge_.prgsz() ||
+                       chrsz_ != cartridge_.chrsz();
+    if (remap) {
+        mapper_.reset(MapperRegistry::New(&cartridge_, cartridge_.mapper()));
+        mapper_number_ = cartridge_.mapper();
+        prgsz_ = cartridge_.prgsz();
+        chrsz_ = cartridge_.chrsz();
+    }
     if (movekeepout == -1) {
         movekeepout = FLAGS_move_from_keepout;
     }
@@ -112,6 +300,12 @@ void Z2Edit::LoadPostProcess(int movekeepout) {
         memory_.CheckAllBanksForKeepout(true);
     }
     loaded_ = true;
+    // The overworld tile hack moves the overworld tables, and the config
+    // must point at them before anything, headless or not, reads them.
+    z2util::CheckOverworldTileHack(mapper_.get());
+    // Without a window, there are no widgets to refresh.
+    if (headless())
+        return;
 
     chrview_->set_mapper(mapper_.get());
     simplemap_->set_mapper(mapper_.get());
@@ -128,43 +322,39 @@ void Z2Edit::LoadPostProcess(int movekeepout) {
         n++;
     }
 
-    // Misc hacks first because it can modify config.
     misc_hacks_->set_mapper(mapper_.get());
-    misc_hacks_->Refresh();
 
     editor_->set_mapper(mapper_.get());
-    editor_->Refresh();
+    music_editor_->set_mapper(mapper_.get());
     palace_gfx_->set_mapper(mapper_.get());
-    palace_gfx_->Refresh();
     palette_editor_->set_mapper(mapper_.get());
-    palette_editor_->Refresh();
     rom_memory_->set_mapper(mapper_.get());
-    rom_memory_->Refresh();
     start_values_->set_mapper(mapper_.get());
-    start_values_->Refresh();
     simplemap_->set_mapper(mapper_.get());
-    simplemap_->Refresh();
     text_table_->set_mapper(mapper_.get());
-    text_table_->Refresh();
     tile_transform_->set_mapper(mapper_.get());
-    tile_transform_->Refresh();
     item_effects_->set_mapper(mapper_.get());
-    item_effects_->Refresh();
-
     drops_->set_mapper(mapper_.get());
-    drops_->Refresh();
-
     object_table_->set_mapper(mapper_.get());
-    object_table_->Refresh();
     enemy_editor_->set_mapper(mapper_.get());
-    enemy_editor_->Refresh();
     experience_table_->set_mapper(mapper_.get());
-    experience_table_->Refresh();
 
-    object_table_->Init();
-    palette_editor_->Init();
-    enemy_editor_->Init();
-    experience_table_->Init();
+    // Mark the windows which read what the load changed now, rather than
+    // at the next frame.
+    cartridge_.changes()->Dispatch();
+    for(auto& d : dependents_) {
+        // A window which read nothing through the cartridge may have read
+        // it some other way, so it is always refreshed.
+        if (all || d.reads.empty())
+            d.window->set_stale(true);
+    }
+    if (remap) {
+        // Windows may hold objects which use the old mapper: refresh them
+        // all now rather than when they are drawn.
+        for(auto& d : dependents_) {
+            Refresh(&d);
+        }
+    }
 
     for(auto it=draw_callback_.begin(); it != draw_callback_.end(); ++it) {
         (*it)->Refresh();
@@ -206,16 +396,20 @@ void Z2Edit::SaveFile(DebugConsole* console, int argc, char **argv) {
         console->AddLog("[error] Usage: %s [filename]", argv[0]);
         return;
     }
-    if (absl::EndsWith(argv[1], "nes") || absl::EndsWith(argv[1], "NES")) {
-        cartridge_.SaveFile(argv[1]);
-    } else if (absl::EndsWith(argv[1], "ips") || absl::EndsWith(argv[1], "IPS")) {
-        auto result = project_.ExportIps(argv[1]);
+    Save(argv[1], console);
+}
+
+void Z2Edit::Save(const std::string& filename, DebugConsole* console) {
+    if (absl::EndsWith(filename, "nes") || absl::EndsWith(filename, "NES")) {
+        cartridge_.SaveFile(filename);
+    } else if (absl::EndsWith(filename, "ips") || absl::EndsWith(filename, "IPS")) {
+        auto result = project_.ExportIps(filename);
         if (!result.ok()) {
             console->AddLog("[error] %s", result.ToString().c_str());
         }
     } else {
-        bool as_text = absl::EndsWith(argv[1], "textpb");
-        project_.Save(argv[1], as_text);
+        bool as_text = absl::EndsWith(filename, "textpb");
+        project_.Save(filename, as_text);
     }
 }
 
@@ -562,6 +756,42 @@ void Z2Edit::EnemyList(DebugConsole* console, int argc, char **argv) {
     }
 }
 
+void Z2Edit::EnemyListPackAll(DebugConsole* console, int argc, char **argv) {
+    bool write = (argc == 2 && !strcmp(argv[1], "write"));
+    if (argc > 2 || (argc == 2 && !write)) {
+        console->AddLog("[error] %s: Wrong number of arguments.", argv[0]);
+        console->AddLog("[error] %s [write]", argv[0]);
+        return;
+    }
+
+    // Every bank with sideview maps has its own enemy list buffer.
+    std::set<int> banks;
+    for(const auto& m : ConfigLoader<RomInfo>::GetConfig().map()) {
+        if (m.type() != z2util::MapType::OVERWORLD)
+            banks.insert(m.pointer().bank());
+    }
+    bool packed = false;
+    for(const auto& bank : banks) {
+        EnemyListPack ep(mapper_.get());
+        ep.Unpack(bank);
+        int unshared;
+        int length = ep.PackedLength(&unshared);
+        console->AddLog("%sbank %d: %4d / %4d bytes used, %4d free "
+                        "(%d without sharing)",
+                        length > ep.size() ? "[error] " : "",
+                        bank, length, ep.size(), ep.size() - length, unshared);
+        if (write && length <= ep.size()) {
+            packed |= ep.Pack();
+        }
+    }
+    if (packed) {
+        // Like any other edit: record it in the history and refresh the
+        // maps, which hold their own copies of the enemy lists.
+        ProcessMessage("commit", "Repack enemy lists");
+        ProcessMessage("repack", nullptr);
+    }
+}
+
 void Z2Edit::Unassemble(DebugConsole* console, int argc, char **argv) {
     int bank = bank_;
     static uint16_t addr;
@@ -769,6 +999,137 @@ void Z2Edit::CharCopy(DebugConsole* console, int argc, char **argv) {
     }
 }
 
+void Z2Edit::CharAnalyze(DebugConsole* console, int argc, char **argv) {
+    bool compact = false;
+    int detail = -1;
+    for(int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "compact")) {
+            compact = true;
+        } else if (!strncmp(argv[i], "b=", 2)) {
+            detail = strtoul(argv[i]+2, 0, ibase_);
+        } else {
+            console->AddLog("[error] Usage: %s [b=<chrbank>] [compact]", argv[0]);
+            return;
+        }
+    }
+
+    // Runs of chars, e.g. "40-4f 7a".
+    auto ranges = [](const std::vector<int>& chars) {
+        std::string result;
+        char buf[16];
+        for(size_t i=0; i<chars.size(); ) {
+            size_t j = i;
+            while(j+1 < chars.size() && chars[j+1] == chars[j]+1) j++;
+            if (i == j) {
+                snprintf(buf, sizeof(buf), " %02x", chars[i]);
+            } else {
+                snprintf(buf, sizeof(buf), " %02x-%02x", chars[i], chars[j]);
+            }
+            result += buf;
+            i = j+1;
+        }
+        return result;
+    };
+
+    ChrAnalysis analysis(mapper_.get());
+    analysis.Analyze();
+    if (compact) {
+        std::map<int, std::vector<int>> freed;
+        for(const auto& slot : analysis.Compact()) {
+            freed[slot.bank].push_back(slot.tile);
+        }
+        for(const auto& f : freed) {
+            console->AddLog("bank %02x: freed%s", f.first,
+                            ranges(f.second).c_str());
+        }
+        if (freed.empty()) {
+            console->AddLog("Nothing to compact.");
+        }
+        analysis.Analyze();
+    }
+
+    std::vector<int> unknown;
+    for(int bank=0; bank<analysis.banks(); bank++) {
+        if (!analysis.analyzed(bank)) {
+            unknown.push_back(bank);
+            continue;
+        }
+        auto free = analysis.Free(bank);
+        auto duplicates = analysis.Duplicates(bank);
+        int same = 0, flipped = 0;
+        for(const auto& group : duplicates) {
+            for(size_t i=1; i<group.size(); i++) {
+                if (analysis.Same({bank, group[0]}, {bank, group[i]})) {
+                    same++;
+                } else {
+                    flipped++;
+                }
+            }
+        }
+        console->AddLog("bank %02x: %3d free, %3d duplicate, %3d flipped%s",
+                        bank, int(free.size()), same, flipped,
+                        analysis.sprites(bank) ? " (sprites)" : "");
+        if (bank != detail)
+            continue;
+        console->AddLog("  free:%s", ranges(free).c_str());
+        for(const auto& group : duplicates) {
+            std::string line;
+            char buf[16];
+            for(size_t i=1; i<group.size(); i++) {
+                bool same = analysis.Same({bank, group[0]}, {bank, group[i]});
+                snprintf(buf, sizeof(buf), " %02x%s", group[i], same ? "" : "*");
+                line += buf;
+            }
+            std::set<std::string> names;
+            for(int t : group) {
+                for(const auto* ref : analysis.references({bank, t})) {
+                    names.insert(ref->name);
+                }
+            }
+            console->AddLog("  %02x =%s  %s", group[0], line.c_str(),
+                            absl::StrJoin(names, ", ").c_str());
+        }
+    }
+
+    int shared = 0;
+    for(const auto& group : analysis.Duplicates()) {
+        shared += group.size() - 1;
+    }
+    console->AddLog("%d chars duplicate another char in the CHR ROM.", shared);
+    if (!unknown.empty()) {
+        console->AddLog("Not analyzed, nothing known refers to them:%s",
+                        ranges(unknown).c_str());
+    }
+    if (detail >= 0) {
+        console->AddLog("* duplicate only when flipped.  Sprite banks also "
+                        "hold chars the engine draws without a table.");
+    }
+}
+
+void Z2Edit::Atlas(DebugConsole* console, int argc, char **argv) {
+    if (argc > 2) {
+        console->AddLog("[error] Usage: %s [dir]", argv[0]);
+        return;
+    }
+    std::string dir = argc == 2 ? argv[1] : ".";
+    // A script may have installed the overworld tile hack since the ROM
+    // was loaded.
+    if (z2util::CheckOverworldTileHack(mapper_.get()) < 0) {
+        console->AddLog("[error] %s: unknown overworld tile hack; the "
+                        "overworld tables in the config may be wrong.",
+                        argv[0]);
+    }
+    File::MakeDir(dir);
+    WorldAtlas atlas(mapper_.get(), FLAGS_jobs);
+    if (atlas.Export(dir)) {
+        console->AddLog("Wrote %d maps on %d pages to %s.",
+                        atlas.rooms(), atlas.pages(), dir.c_str());
+    } else {
+        console->AddLog("[error] %s: could not write the atlas to %s.",
+                        argv[0], dir.c_str());
+    }
+}
+
 void Z2Edit::SetVar(DebugConsole* console, int argc, char **argv) {
     if (argc < 3) {
         console->AddLog("[error] Usage: %s [var] [number]", argv[0]);
@@ -826,6 +1187,13 @@ void Z2Edit::Source(const std::string& filename, DebugConsole* console) {
     fclose(fp);
 }
 
+int Z2Edit::Finish(const std::string& output) {
+    if (!output.empty()) {
+        Save(output, &console_);
+    }
+    return console_.errors() + logging::ErrorCount();
+}
+
 void Z2Edit::RestoreBank(DebugConsole* console, int argc, char **argv) {
     bool move = FLAGS_move_from_keepout;
     if (argc < 4) {
@@ -861,7 +1229,7 @@ void Z2Edit::RestoreBank(DebugConsole* console, int argc, char **argv) {
         uint8_t data = kart.ReadPrg(from*16384 + i);
         mapper_->WritePrgBank(to, i, data);
     }
-    LoadPostProcess(move);
+    LoadPostProcess(move, false);
 }
 
 void Z2Edit::DumpTownText(DebugConsole* console, int argc, char **argv) {
@@ -934,6 +1302,78 @@ void Z2Edit::SendMessage(DebugConsole* console, int argc, char **argv) {
     ProcessMessage(message, reinterpret_cast<void*>(argument));
 }
 
+void Z2Edit::Music(DebugConsole* console, int argc, char **argv) {
+    using z2music::Rom;
+    const int nsongs = Rom::kSongCount;
+    if (argc < 2) {
+        console->AddLog("[error] Usage: %s list|space|stop|play <song> [pattern]|"
+                        "volume <0-100>|mute <channel> <0|1>", argv[0]);
+        return;
+    }
+    std::string cmd = argv[1];
+    if (!loaded_ && (cmd == "space" || cmd == "play")) {
+        console->AddLog("[error] No ROM loaded.");
+        return;
+    }
+    if (cmd == "list") {
+        for(int i=0; i<nsongs; i++) {
+            console->AddLog("%2d: %s", i,
+                            Rom::song_name(static_cast<Rom::SongTitle>(i)));
+        }
+    } else if (cmd == "space") {
+        std::unique_ptr<Rom> rom(new z2util::MusicRom(mapper_.get()));
+        for(const auto& t : rom->space()) {
+            console->AddLog("%s%06lx: %lu of %lu bytes, %ld free",
+                            t.fits ? "" : "[error] ", t.address, t.used,
+                            t.capacity, long(t.capacity) - long(t.used));
+        }
+    } else if (cmd == "stop") {
+        if (synth_) synth_->stop();
+    } else if (cmd == "play" && argc >= 3) {
+        char* end;
+        int song = strtol(argv[2], &end, 0);
+        if (end == argv[2] || *end != '\0')
+            song = -1;
+        for(int i=0; i<nsongs; i++) {
+            if (!strcasecmp(argv[2],
+                            Rom::song_name(static_cast<Rom::SongTitle>(i))))
+                song = i;
+        }
+        if (song < 0 || song >= nsongs) {
+            console->AddLog("[error] Unknown song %s", argv[2]);
+            return;
+        }
+        if (!synth_) {
+            console->AddLog("[error] No audio in this session.");
+            return;
+        }
+        std::unique_ptr<Rom> rom(new z2util::MusicRom(mapper_.get()));
+        const z2music::Song* s = rom->song(static_cast<Rom::SongTitle>(song));
+        if (argc >= 4) {
+            size_t pattern = strtoul(argv[3], 0, 0);
+            if (!s->at(pattern)) {
+                console->AddLog("[error] %s has %d patterns", Rom::song_name(
+                                    static_cast<Rom::SongTitle>(song)),
+                                int(s->sequence_length()));
+                return;
+            }
+            synth_->play(*s->at(pattern), true);
+        } else {
+            synth_->play(*s);
+        }
+    } else if (cmd == "volume" && argc == 3) {
+        if (synth_) synth_->set_volume(strtol(argv[2], 0, 0) / 100.0f);
+    } else if (cmd == "mute" && argc == 4) {
+        int ch = strtol(argv[2], 0, 0);
+        if (synth_ && ch >= 0 && ch < 4) {
+            synth_->mute(static_cast<z2music::Pattern::Channel>(ch),
+                         strtol(argv[3], 0, 0) != 0);
+        }
+    } else {
+        console->AddLog("[error] Unknown music command %s", argv[1]);
+    }
+}
+
 void Z2Edit::SpawnEmulator() {
     std::string romtmp = os::TempFilename(FLAGS_romtmp);
     cartridge_.SaveFile(romtmp);
@@ -1001,19 +1441,27 @@ void Z2Edit::ProcessEvent(SDL_Event* event) {
 }
 
 void Z2Edit::ProcessMessage(const std::string& msg, const void* extra) {
-    if (msg == "commit") {
+    if (headless() && msg != "commit" && msg != "loadpostprocess" &&
+        msg != "restorepostprocess") {
+        return;
+    } else if (msg == "commit") {
         project_.Commit(static_cast<const char*>(extra));
+        if (headless())
+            return;
         // Refresh this here for convenience: the table is very small, but
         // commites of the overworld can re-write it.
-        tile_transform_->Refresh();
+        MarkStale(tile_transform_.get());
     } else if (msg == "loadpostprocess") {
         LoadPostProcess(reinterpret_cast<intptr_t>(extra));
+    } else if (msg == "restorepostprocess") {
+        // A commit from the history: only what changed is refreshed.
+        LoadPostProcess(reinterpret_cast<intptr_t>(extra), false);
     } else if (msg == "overworld_tile_hack") {
         object_table_->Init();
         palette_editor_->Init();
     } else if (msg == "repack") {
-        simplemap_->Refresh();
-        editor_->Refresh();
+        MarkStale(simplemap_.get());
+        MarkStale(editor_.get());
     } else if (msg == "emulate_at") {
         const uint8_t* p = reinterpret_cast<const uint8_t*>(extra);
         SpawnEmulator(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8]);
@@ -1022,7 +1470,16 @@ void Z2Edit::ProcessMessage(const std::string& msg, const void* extra) {
     }
 }
 
+void Z2Edit::Idle() {
+    for(const auto& f : config_watcher_.Poll()) {
+        ReloadConfig(f);
+        Invalidate();
+    }
+}
+
 void Z2Edit::Draw() {
+    // Tell the caches which ROM bytes changed since the last frame.
+    cartridge_.changes()->Dispatch();
     SetTitle(project_.name());
     ImGui::SetNextWindowSize(ImVec2(500,300), ImGuiCond_FirstUseEver);
     if (ImGui::BeginMainMenuBar()) {
@@ -1121,8 +1578,7 @@ export_as:
             ImGui::Separator();
             if (!FLAGS_config.empty()) {
                 if (ImGui::MenuItem("Reload Config")) {
-                    auto* config = ConfigLoader<z2util::RomInfo>::Get();
-                    config->Reload();
+                    ReloadConfig("");
                 }
             }
             if (ImGui::MenuItem("Quit")) {
@@ -1147,6 +1603,8 @@ export_as:
                             &simplemap_->visible());
             ImGui::MenuItem("Miscellaneous Hacks", nullptr,
                             &misc_hacks_->visible());
+            ImGui::MenuItem("Music", nullptr,
+                            &music_editor_->visible());
             ImGui::MenuItem("Palace Graphics", nullptr,
                             &palace_gfx_->visible());
             ImGui::MenuItem("Palette Editor", nullptr,
@@ -1193,22 +1651,10 @@ export_as:
         ImGui::EndMainMenuBar();
     }
 
-    start_values_->Draw();
-    text_table_->Draw();
-    tile_transform_->Draw();
-    item_effects_->Draw();
     misc_hacks_->Draw();
-    palace_gfx_->Draw();
-    palette_editor_->Draw();
-    rom_memory_->Draw();
+    DrawDependents();
     hwpal_->Draw();
     chrview_->Draw();
-    drops_->Draw();
-    simplemap_->Draw();
-    editor_->Draw();
-    object_table_->Draw();
-    enemy_editor_->Draw();
-    experience_table_->Draw();
     project_.Draw();
 
     if (!loaded_) {
@@ -1,7 +1,9 @@
 #ifndef Z2UTIL_APP_H
 #define Z2UTIL_APP_H
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "imwidget/imapp.h"
 #include "imwidget/drops.h"
@@ -11,6 +13,7 @@
 #include "imwidget/imwidget.h"
 #include "imwidget/item_effects.h"
 #include "imwidget/misc_hacks.h"
+#include "imwidget/music_editor.h"
 #include "imwidget/neschrview.h"
 #include "imwidget/palace_gfx.h"
 #include "imwidget/palette.h"
@@ -22,30 +25,42 @@
 #include "imwidget/tile_transform.h"
 #include "imwidget/object_table.h"
 #include "imwidget/xptable.h"
+#include "music/synth.h"
 #include "nes/cartridge.h"
 #include "nes/mapper.h"
 #include "nes/memory.h"
+#include "util/file_watcher.h"
 
 namespace z2util {
 
 class Z2Edit: public ImApp {
   public:
-    Z2Edit(const std::string& name) : ImApp(name, 1280, 720) {}
-    ~Z2Edit() override {}
+    Z2Edit(const std::string& name, bool headless=false)
+      : ImApp(name, 1280, 720, headless) {}
+    // Stop the audio thread before the synth goes away.
+    ~Z2Edit() override { CloseAudio(); }
 
     void Init() override;
     void ProcessEvent(SDL_Event* event) override;
     void ProcessMessage(const std::string& msg, const void* extra) override;
     void Draw() override;
+    void Idle() override;
 
     void Load(const std::string& filename);
+    // Saves the ROM, an IPS patch or the project, by the file extension.
+    void Save(const std::string& filename, DebugConsole* console);
     void Source(const std::string& filename, DebugConsole* console=nullptr);
+    // Finish a headless run: save to |output| (if given) and return the
+    // number of console errors and logged errors.
+    int Finish(const std::string& output);
 
     // movekeepout is tri-state:
     // -1: default action based on FLAGS_move_from_keepout
     // 0: do not move from keepouts
     // 1: move from keepouts
-    void LoadPostProcess(int movekeepout);
+    // If all is false, only the windows which read banks that changed are
+    // refreshed, rather than every window.
+    void LoadPostProcess(int movekeepout, bool all=true);
     void Help(const std::string& topickey);
   private:
     void LoadFile(DebugConsole* console, int argc, char **argv);
@@ -59,12 +74,15 @@ class Z2Edit: public ImApp {
     void Unassemble(DebugConsole* console, int argc, char **argv);
     void Assemble(DebugConsole* console, int argc, char **argv);
     void EnemyList(DebugConsole* console, int argc, char **argv);
+    void EnemyListPackAll(DebugConsole* console, int argc, char **argv);
     void InsertPrg(DebugConsole* console, int argc, char **argv);
     void CopyPrg(DebugConsole* console, int argc, char **argv);
     void InsertChr(DebugConsole* console, int argc, char **argv);
     void CopyChr(DebugConsole* console, int argc, char **argv);
     void CharClear(DebugConsole* console, int argc, char **argv);
     void CharCopy(DebugConsole* console, int argc, char **argv);
+    void CharAnalyze(DebugConsole* console, int argc, char **argv);
+    void Atlas(DebugConsole* console, int argc, char **argv);
     void MemMove(DebugConsole* console, int argc, char **argv);
     void Swap(DebugConsole* console, int argc, char **argv);
     void BCopy(DebugConsole* console, int argc, char **argv);
@@ -74,12 +92,40 @@ class Z2Edit: public ImApp {
     void DumpTownText(DebugConsole* console, int argc, char **argv);
     void ConnTable(DebugConsole* console, int argc, char **argv);
     void SendMessage(DebugConsole* console, int argc, char **argv);
+    void Music(DebugConsole* console, int argc, char **argv);
+    void AudioCallback(void* stream, int len) override;
     void SpawnEmulator();
     void SpawnEmulator(uint8_t bank, uint8_t region, uint8_t world,
         uint8_t town_code, uint8_t palace_code, uint8_t connector,
         uint8_t room, uint8_t page, uint8_t prev_region);
     int EncodedText(int ch);
     bool ParseChr(const std::string& a, int* bank, uint8_t *addr);
+    // Refresh the widgets which depend on config sections changed by a
+    // config reload.
+    void SubscribeConfig();
+    void WatchConfig();
+    void ReloadConfig(const std::string& filename);
+
+    // Windows which unpack ROM data are refreshed lazily: when the change
+    // bus reports a write, only the windows which read a changed bank are
+    // marked stale, and a stale window is refreshed when it is next drawn
+    // while visible.
+    struct Dependent {
+        ImWindowBase* window;
+        std::function<void()> refresh;
+        // The banks read by the last refresh and the draws since.
+        Cartridge::ReadSet reads;
+        // The banks written by its draws since the last dispatch: a window
+        // isn't made stale by its own edits.
+        Cartridge::ReadSet writes;
+    };
+    void AddDependent(ImWindowBase* window,
+                      std::function<void()> refresh = nullptr);
+    void MarkStale(ImWindowBase* window);
+    void Refresh(Dependent* d);
+    void DrawDependents();
+    // Marks the dependents which read a bank in changed.
+    void MarkChanged(const std::vector<ChangeBus::Range>& changed);
 
     bool loaded_;
     int ibase_;
@@ -94,6 +140,7 @@ class Z2Edit: public ImApp {
     std::unique_ptr<z2util::Drops> drops_;
     std::unique_ptr<z2util::Editor> editor_;
     std::unique_ptr<z2util::MiscellaneousHacks> misc_hacks_;
+    std::unique_ptr<z2util::MusicEditor> music_editor_;
     std::unique_ptr<z2util::PalaceGraphics> palace_gfx_;
     std::unique_ptr<z2util::PaletteEditor> palette_editor_;
     std::unique_ptr<z2util::RomMemory> rom_memory_;
@@ -109,6 +156,14 @@ class Z2Edit: public ImApp {
     Project project_;
     z2util::Memory memory_;
     std::unique_ptr<Mapper> mapper_;
+    int mapper_number_;
+    std::vector<Dependent> dependents_;
+    ChangeBus::Subscription watch_;
+    // The bank counts the mapper was made for.
+    uint8_t prgsz_;
+    uint8_t chrsz_;
+    FileWatcher config_watcher_;
+    std::unique_ptr<z2music::Synth> synth_;
 };
 
 }  // namespace z2util
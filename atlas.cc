@@ -0,0 +1,258 @@
+#include "atlas.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include <gflags/gflags.h>
+#include "imwidget/glbitmap.h"
+#include "imwidget/hwpalette.h"
+#include "imwidget/map_command.h"
+#include "nes/chr_draw.h"
+#include "nes/mapper.h"
+#include "nes/z2decompress.h"
+#include "util/config.h"
+#include "util/file.h"
+#include "util/logging.h"
+#include "util/os.h"
+#include "absl/strings/str_cat.h"
+
+DECLARE_bool(render_items_in_known_banks);
+
+namespace z2util {
+namespace {
+
+// Copies the non-transparent pixels of a 16x16 object into a room.
+void Blit(std::vector<uint32_t>* room, int width, int x, int y,
+          const uint32_t* pixels) {
+    for(int yy=0; yy<16; yy++) {
+        for(int xx=0; xx<16; xx++) {
+            uint32_t val = pixels[yy * 16 + xx];
+            if (val >> 24)
+                (*room)[(y + yy) * width + x + xx] = val;
+        }
+    }
+}
+
+std::string Quote(const std::string& s) {
+    std::string result = "\"";
+    for(char c : s) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+            result.push_back(c);
+        } else if (uint8_t(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            result += buf;
+        } else {
+            result.push_back(c);
+        }
+    }
+    return result + "\"";
+}
+
+}  // namespace
+
+WorldAtlas::WorldAtlas(Mapper* m, int jobs)
+  : mapper_(m),
+  jobs_(jobs),
+  page_width_(0) {
+    if (jobs_ <= 0)
+        jobs_ = std::max(1u, std::thread::hardware_concurrency());
+}
+
+template<typename F>
+void WorldAtlas::Parallel(int n, F fn) const {
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for(int i = next++; i < n; i = next++) {
+            fn(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for(int i=0; i<std::min(jobs_, n); i++) {
+        threads.emplace_back(worker);
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+}
+
+void WorldAtlas::Render(Room* room) const {
+    const auto& ri = ConfigLoader<RomInfo>::GetConfig();
+    const Map& map = *room->map;
+    const bool overworld = map.type() == MapType::OVERWORLD;
+    Z2Decompress decomp;
+    decomp.set_mapper(mapper_);
+    decomp.Init();
+    decomp.Decompress(map);
+
+    // Sideview maps are decompressed four screens wide, whatever their
+    // real width.
+    int columns = overworld ? decomp.width() : decomp.mapwidth();
+    room->width = columns * 16;
+    room->height = decomp.height() * 16;
+    room->pixels.assign(room->width * room->height, 0);
+    ChrDraw canvas(mapper_, room->pixels.data(), room->width, room->height);
+
+    Address table[4];
+    for(int i=0; i<map.objtable_size() && i<4; i++) {
+        table[i] = overworld ? map.objtable(i)
+                             : mapper_->ReadAddr(map.objtable(i), 0);
+    }
+    // Each object is drawn once, then copied wherever it's used.
+    std::vector<uint32_t> objects[256];
+    for(int y=0; y<decomp.height(); y++) {
+        for(int x=0; x<columns; x++) {
+            uint8_t obj = decomp.map(x, y);
+            auto& pixels = objects[obj];
+            if (pixels.empty()) {
+                pixels.assign(16 * 16, 0);
+                ChrDraw draw(mapper_, pixels.data(), 16, 16);
+                draw.set_chr(map.chr());
+                draw.set_palette(overworld ? map.palette() : decomp.palette());
+                draw.Object(table[obj >> 6], obj, overworld, 0, 0);
+            }
+            Blit(&room->pixels, room->width, x*16, y*16, pixels.data());
+        }
+    }
+    if (overworld)
+        return;
+
+    canvas.set_palette(ChrDraw::ItemPalette(decomp.palette().bank()));
+    canvas.set_chr(ChrDraw::SpriteChr(map.chr()));
+    auto sprite = [&](const ItemInfo& info, int id, int x, int y) {
+        const auto& it = info.info().find(id);
+        if (it == info.info().end())
+            return;
+        canvas.Sprite(it->second, x, y, FLAGS_render_items_in_known_banks);
+    };
+    for(int y=0; y<decomp.height(); y++) {
+        for(int x=0; x<columns; x++) {
+            uint8_t item = decomp.item(x, y);
+            if (item != 0xFF)
+                sprite(ri.items(), item, x*16, y*16);
+        }
+    }
+    MapEnemyList enemies(mapper_);
+    enemies.Parse(map);
+    for(const auto& e : enemies.data()) {
+        sprite(decomp.EnemyInfo(), e.enemy, e.x*16, e.y*16);
+    }
+}
+
+void WorldAtlas::Layout() {
+    pages_.clear();
+    page_width_ = 0;
+    for(const auto& room : rooms_) {
+        page_width_ = std::max(page_width_, room.width);
+    }
+    int pages_in_world = 0;
+    int x = 0, y = 0, row = 0;
+    for(auto& room : rooms_) {
+        if (x + room.width > page_width_) {
+            x = 0;
+            y += row;
+            row = 0;
+        }
+        bool new_world = pages_.empty() ||
+                         pages_.back().world != room.map->world();
+        if (new_world || (y > 0 && y + room.height > kMaxPageHeight)) {
+            pages_in_world = new_world ? 0 : pages_in_world + 1;
+            pages_.push_back(Page{room.map->world(),
+                    absl::StrCat("world", room.map->world(), "_",
+                                 pages_in_world, ".png"), 0});
+            x = y = row = 0;
+        }
+        room.page = pages_.size() - 1;
+        room.x = x;
+        room.y = y;
+        x += room.width;
+        row = std::max(row, room.height);
+        pages_.back().height = std::max(pages_.back().height, y + room.height);
+    }
+}
+
+std::string WorldAtlas::Index() const {
+    std::string json = "{\n  \"pages\": [";
+    for(size_t i=0; i<pages_.size(); i++) {
+        const auto& page = pages_[i];
+        absl::StrAppend(&json, i ? "," : "", "\n    {\"file\": ",
+                        Quote(page.file), ", \"world\": ", page.world,
+                        ", \"width\": ", page_width_,
+                        ", \"height\": ", page.height, "}");
+    }
+    absl::StrAppend(&json, "\n  ],\n  \"rooms\": [");
+    for(size_t i=0; i<rooms_.size(); i++) {
+        const auto& room = rooms_[i];
+        const Map& map = *room.map;
+        absl::StrAppend(&json, i ? "," : "", "\n    {\"name\": ",
+                        Quote(map.name()),
+                        ", \"type\": ", Quote(MapType_Name(map.type())),
+                        ", \"world\": ", map.world(),
+                        ", \"overworld\": ", map.overworld(),
+                        ", \"subworld\": ", map.subworld(),
+                        ", \"area\": ", map.area(),
+                        ", \"file\": ", Quote(pages_[room.page].file),
+                        ", \"x\": ", room.x, ", \"y\": ", room.y,
+                        ", \"width\": ", room.width,
+                        ", \"height\": ", room.height, "}");
+    }
+    absl::StrAppend(&json, "\n  ]\n}\n");
+    return json;
+}
+
+bool WorldAtlas::Export(const std::string& dir) {
+    const auto& ri = ConfigLoader<RomInfo>::GetConfig();
+    int64_t start = os::utime_now();
+    // Create the shared palette before the workers use it.
+    NesHardwarePalette::Get();
+
+    // Background maps are only layers of other maps.
+    rooms_.clear();
+    for(const auto& m : ri.map()) {
+        if (m.world() >= 0)
+            rooms_.push_back(Room{&m, 0, 0, {}, 0, 0, 0});
+    }
+    std::stable_sort(rooms_.begin(), rooms_.end(),
+                     [](const Room& a, const Room& b) {
+                         return a.map->world() < b.map->world();
+                     });
+    Parallel(rooms_.size(), [this](int i) { Render(&rooms_[i]); });
+    Layout();
+
+    std::atomic<int> failed(0);
+    Parallel(pages_.size(), [&](int p) {
+        const Page& page = pages_[p];
+        std::vector<uint32_t> pixels(page_width_ * page.height, 0);
+        for(const auto& room : rooms_) {
+            if (room.page != p)
+                continue;
+            for(int y=0; y<room.height; y++) {
+                memcpy(&pixels[(room.y + y) * page_width_ + room.x],
+                       &room.pixels[y * room.width], room.width * 4);
+            }
+        }
+        std::string filename = os::path::Join({dir, page.file});
+        if (!GLBitmap::Save(filename, page_width_, page.height, pixels.data())) {
+            LOG(ERROR, "Could not write ", filename);
+            failed++;
+        }
+    });
+    std::string index = os::path::Join({dir, "index.json"});
+    if (!File::SetContents(index, Index())) {
+        LOG(ERROR, "Could not write ", index);
+        failed++;
+    }
+    // The pages have everything now.
+    for(auto& room : rooms_) {
+        std::vector<uint32_t>().swap(room.pixels);
+    }
+    LOG(INFO, "Atlas: ", rooms_.size(), " maps on ", pages_.size(),
+        " pages in ", (os::utime_now() - start) / 1000, "ms using ",
+        jobs_, " threads.");
+    return failed == 0;
+}
+
+}  // namespace z2util
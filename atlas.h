@@ -0,0 +1,66 @@
+#ifndef Z2UTIL_ATLAS_H
+#define Z2UTIL_ATLAS_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "proto/rominfo.pb.h"
+
+class Mapper;
+namespace z2util {
+
+// Renders every overworld and sideview map, with its items and enemies, at
+// full resolution into PNG atlases: one or more pages per world, plus an
+// index.json giving the rectangle of each map on its page.
+//
+// Rendering reads the ROM directly and needs no GL context, so it works in
+// headless runs.  Maps are rendered and pages are written on |jobs| threads
+// at once.
+class WorldAtlas {
+  public:
+    // Every page is as wide as the widest map.  Maps are packed in rows and
+    // a new page is started when a page would be taller than
+    // kMaxPageHeight.
+    static const int kMaxPageHeight = 8192;
+
+    explicit WorldAtlas(Mapper* m, int jobs=0);
+
+    // Writes <dir>/world<n>_<page>.png and <dir>/index.json.  Returns
+    // false if any of them couldn't be written.
+    bool Export(const std::string& dir);
+
+    inline int rooms() const { return rooms_.size(); }
+    inline int pages() const { return pages_.size(); }
+
+  private:
+    struct Room {
+        const Map* map;
+        int width;
+        int height;
+        std::vector<uint32_t> pixels;
+        int page;
+        int x;
+        int y;
+    };
+    struct Page {
+        int world;
+        std::string file;
+        int height;
+    };
+
+    void Render(Room* room) const;
+    void Layout();
+    std::string Index() const;
+    // Calls fn(0) ... fn(n-1) on up to jobs_ threads.
+    template<typename F>
+    void Parallel(int n, F fn) const;
+
+    Mapper* mapper_;
+    int jobs_;
+    int page_width_;
+    std::vector<Room> rooms_;
+    std::vector<Page> pages_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_ATLAS_H
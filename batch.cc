@@ -0,0 +1,151 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "absl/strings/str_cat.h"
+#include "util/logging.h"
+#include "util/os.h"
+
+namespace z2util {
+namespace {
+// Quotes an argument for the shell os::System runs.
+std::string Quote(const std::string& s) {
+#ifdef _WIN32
+    // Windows file names can't contain '"', and cmd.exe has no other quote.
+    return absl::StrCat("\"", s, "\"");
+#else
+    // Nothing is special inside single quotes except the quote itself.
+    std::string q = "'";
+    for(char ch : s) {
+        if (ch == '\'')
+            q += "'\\''";
+        else
+            q += ch;
+    }
+    return q + "'";
+#endif
+}
+
+std::string Basename(const std::string& path) {
+    return os::path::Split(path).back();
+}
+
+// Prefixes names which appear more than once with their position in the
+// list, so that each job gets its own output.
+void Disambiguate(std::vector<std::string>* names) {
+    std::map<std::string, int> count;
+    for(const auto& name : *names)
+        count[name]++;
+    for(size_t i=0; i<names->size(); ++i) {
+        std::string& name = (*names)[i];
+        if (count[name] > 1)
+            name = absl::StrCat(i, "-", name);
+    }
+}
+}  // namespace
+
+BatchDriver::BatchDriver(int jobs, const std::vector<std::string>& flags)
+  : jobs_(jobs),
+  worker_jobs_(1),
+  flags_(flags) {
+    if (jobs_ <= 0)
+        jobs_ = std::max(1u, std::thread::hardware_concurrency());
+}
+
+void BatchDriver::AddRoms(const std::string& script,
+                          const std::vector<std::string>& roms,
+                          const std::string& outdir) {
+    std::vector<std::string> names;
+    for(const auto& rom : roms)
+        names.push_back(Basename(rom));
+    Disambiguate(&names);
+    for(size_t i=0; i<roms.size(); ++i) {
+        job_.push_back(Job{roms[i], script,
+                           os::path::Join({outdir, names[i]})});
+    }
+}
+
+void BatchDriver::AddScripts(const std::string& rom,
+                             const std::vector<std::string>& scripts,
+                             const std::string& outdir) {
+    std::vector<std::string> names;
+    for(const auto& script : scripts) {
+        std::string name = Basename(script);
+        names.push_back(name.substr(0, name.rfind('.')) + ".nes");
+    }
+    Disambiguate(&names);
+    for(size_t i=0; i<scripts.size(); ++i) {
+        job_.push_back(Job{rom, scripts[i],
+                           os::path::Join({outdir, names[i]})});
+    }
+}
+
+std::string BatchDriver::Command(const Job& job) const {
+    std::string cmd = Quote(os::path::Executable());
+    for(const auto& f : flags_) {
+        absl::StrAppend(&cmd, " ", Quote(f));
+    }
+    // Share the cpus between the workers, rather than each worker's atlas
+    // starting a thread per cpu.
+    absl::StrAppend(&cmd, " --jobs=", worker_jobs_);
+    absl::StrAppend(&cmd, " --headless --output=", Quote(job.output), " ",
+                    Quote(job.rom), " ", Quote(job.script),
+                    " > ", Quote(job.output + ".log"), " 2>&1");
+#ifdef _WIN32
+    // cmd.exe strips the outer quotes of a command which starts with one.
+    cmd = Quote(cmd);
+#endif
+    return cmd;
+}
+
+int BatchDriver::Run() {
+    // Two jobs writing the same output would silently lose one result.
+    std::set<std::string> outputs;
+    for(const auto& job : job_) {
+        if (!outputs.insert(job.output).second) {
+            LOG(ERROR, "Batch: more than one job writes ", job.output);
+            return job_.size();
+        }
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    std::mutex mutex;
+    auto worker = [&]() {
+        for(size_t i = next++; i < job_.size(); i = next++) {
+            const Job& job = job_[i];
+            int status = os::System(Command(job));
+            std::lock_guard<std::mutex> lock(mutex);
+            if (status) {
+                failed++;
+                printf("FAIL %s + %s (see %s.log)\n", job.rom.c_str(),
+                       job.script.c_str(), job.output.c_str());
+            } else {
+                printf("ok   %s + %s -> %s\n", job.rom.c_str(),
+                       job.script.c_str(), job.output.c_str());
+            }
+        }
+    };
+
+    int n = std::min(jobs_, int(job_.size()));
+    worker_jobs_ = std::max(1, int(std::thread::hardware_concurrency()) /
+                               std::max(1, n));
+    LOG(INFO, "Batch: ", job_.size(), " jobs on ", n, " workers.");
+    std::vector<std::thread> threads;
+    for(int i=0; i<n; i++) {
+        threads.emplace_back(worker);
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    printf("%d of %zu jobs failed.\n", int(failed), job_.size());
+    return failed;
+}
+
+}  // namespace z2util
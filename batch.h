@@ -0,0 +1,49 @@
+#ifndef Z2UTIL_BATCH_H
+#define Z2UTIL_BATCH_H
+#include <string>
+#include <vector>
+
+namespace z2util {
+
+// Runs console scripts against ROMs without the GUI.  Each job is a
+// separate headless z2edit process, so jobs share no state; up to |jobs|
+// run at once.
+class BatchDriver {
+  public:
+    struct Job {
+        std::string rom;
+        std::string script;
+        std::string output;
+    };
+
+    // |flags| are passed on to every worker (eg: --config).
+    BatchDriver(int jobs, const std::vector<std::string>& flags);
+
+    // One script against many ROMs.  Each output is named after its ROM;
+    // ROMs with the same name get their position in |roms| as a prefix.
+    void AddRoms(const std::string& script,
+                 const std::vector<std::string>& roms,
+                 const std::string& outdir);
+    // Many scripts against one ROM.  Each output is named after its script,
+    // prefixed like AddRoms if names collide.
+    void AddScripts(const std::string& rom,
+                    const std::vector<std::string>& scripts,
+                    const std::string& outdir);
+
+    // Runs every job and returns the number which failed.  Each worker's
+    // console output goes to <output>.log.  If two jobs would write the
+    // same output, nothing is run and every job fails.
+    int Run();
+
+  private:
+    std::string Command(const Job& job) const;
+
+    int jobs_;
+    // The --jobs each worker gets.
+    int worker_jobs_;
+    std::vector<std::string> flags_;
+    std::vector<Job> job_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_BATCH_H
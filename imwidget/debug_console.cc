@@ -1,11 +1,41 @@
 #include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include "imwidget/debug_console.h"
 #include "util/logging.h"
 
+namespace {
+// The color of a log line, from its text.  Lines starting with "#{rgb}"
+// pick their own color; the prefix is skipped.
+ImU32 LineColor(char** text) {
+    char* item = *text;
+    if (strstr(item, "[error]"))
+        return ImColor(1.0f,0.4f,0.4f,1.0f);
+    if (strncmp(item, "# ", 2) == 0)
+        return ImColor(1.0f,0.78f,0.58f,1.0f);
+    if (strncmp(item, "#{", 2) == 0 && strlen(item) >= 6) {
+        unsigned cval = strtoul(item+2, 0, 16);
+        *text += 6;
+        return ImColor(float(cval & 0xF00) / float(0xF00),
+                       float(cval & 0x0F0) / float(0x0F0),
+                       float(cval & 0x00F) / float(0x00F),
+                       1.0f);
+    }
+    return ImColor(1.0f,1.0f,1.0f,1.0f);
+}
+}  // namespace
+
 DebugConsole::DebugConsole(const char* name)
   : ImWindowBase(false, false),
-    name_(name) {
+    name_(name),
+    echo_(false),
+    errors_(0),
+    text_(kTextSize),
+    line_(kMaxLines),
+    head_(0),
+    first_(0),
+    next_(0) {
     ClearLog();
     memset(inputbuf_, 0, sizeof(inputbuf_));
     history_pos_ = -1;
@@ -31,12 +61,63 @@ void DebugConsole::PopLineCallback() {
 }
 
 void  DebugConsole::ClearLog() {
-    for (int i = 0; i < items_.Size; i++)
-        free(items_[i]);
-    items_.clear();
+    head_ = 0;
+    first_ = next_;
+    match_.clear();
     scroll_to_bottom_ = true;
 }
 
+void DebugConsole::EvictOldest() {
+    first_++;
+    while(!match_.empty() && match_.front() < first_)
+        match_.pop_front();
+}
+
+void DebugConsole::AppendLine(const char* text, uint32_t length,
+                              ImU32 color) {
+    if (length > kTextSize - 1)
+        length = kTextSize - 1;
+    if (head_ + length + 1 > kTextSize) {
+        // Wrap around.  Whatever is still stored past the old head is
+        // older than everything at the start of the arena.
+        while(first_ < next_ && line(first_).offset >= head_)
+            EvictOldest();
+        head_ = 0;
+    }
+    // Make room for the text and for the line record.
+    uint32_t end = head_ + length + 1;
+    while(first_ < next_ && line(first_).offset >= head_ &&
+          line(first_).offset < end) {
+        EvictOldest();
+    }
+    if (next_ - first_ == kMaxLines)
+        EvictOldest();
+
+    memcpy(&text_[head_], text, length);
+    text_[head_ + length] = '\0';
+    Line& l = line_[next_ % kMaxLines];
+    l = Line{head_, length, color};
+    head_ = end;
+    if (filter_.IsActive() && PassFilter(l))
+        match_.push_back(next_);
+    next_++;
+}
+
+bool DebugConsole::PassFilter(const Line& l) const {
+    const char* text = LineText(l);
+    return filter_.PassFilter(text, text + l.length);
+}
+
+void DebugConsole::RebuildFilter() {
+    match_.clear();
+    if (!filter_.IsActive())
+        return;
+    for(uint64_t n = first_; n < next_; n++) {
+        if (PassFilter(line(n)))
+            match_.push_back(n);
+    }
+}
+
 void DebugConsole::RegisterCommand(const char* command, const char* shorthelp,
         std::function<void(DebugConsole*, int, char**)> fn) {
     shorthelp_.insert(std::make_pair(command, shorthelp));
@@ -50,18 +131,34 @@ void  DebugConsole::AddLog(const char* fmt, ...) {
     vsnprintf(buf, sizeof(buf), fmt, args);
     buf[sizeof(buf)-1] = 0;
     va_end(args);
-    items_.push_back(strdup(buf));
     scroll_to_bottom_ = true;
 
     char *log = buf;
-    if (log[0] == '#' && buf[1] == '{')
-        log += 6;
+    ImU32 color = LineColor(&log);
 
     char *end = log + strlen(log) - 1;
     while(end > log && (*end == '\r' || *end == '\n')) {
         *end-- = '\0';
     }
-    LOG(INFO, "$$ ", log);
+    // Store each line of the message separately, so every entry in the
+    // log is the same height.
+    for(const char* p = log;;) {
+        const char* eol = strchr(p, '\n');
+        uint32_t length = eol ? eol - p : strlen(p);
+        if (length && p[length-1] == '\r')
+            length--;
+        AppendLine(p, length, color);
+        if (!eol)
+            break;
+        p = eol + 1;
+    }
+    // The transcript is logged in full: a script can print far more than
+    // the rate limit allows from one call site.
+    logging::Log(logging::LogLevel::LL_INFO, "$$ ", log);
+    bool error = strstr(log, "[error]") != nullptr;
+    errors_ += error;
+    if (echo_)
+        fprintf(error ? stderr : stdout, "%s\n", log);
 }
 
 bool DebugConsole::Draw() {
@@ -85,8 +182,8 @@ bool DebugConsole::Draw() {
     ImGui::Separator();
 
     ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(0,0));
-    static ImGuiTextFilter filter;
-    filter.Draw("Filter (\"incl,-excl\") (\"error\")", 180);
+    if (filter_.Draw("Filter (\"incl,-excl\") (\"error\")", 180))
+        RebuildFilter();
     ImGui::PopStyleVar();
     ImGui::Separator();
 
@@ -98,38 +195,20 @@ bool DebugConsole::Draw() {
         ImGui::EndPopup();
     }
 
-    // Display every line as a separate entry so we can change their color or add custom widgets. If you only want raw text you can use ImGui::TextUnformatted(log.begin(), log.end());
-    // NB- if you have thousands of entries this approach may be too inefficient and may require user-side clipping to only process visible items.
-    // You can seek and display only the lines that are visible using the ImGuiListClipper helper, if your elements are evenly spaced and you have cheap random access to the elements.
-    // To use the clipper we could replace the 'for (int i = 0; i < items_.Size; i++)' loop with:
-    //     ImGuiListClipper clipper(items_.Size);
-    //     while (clipper.Step())
-    //         for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
-    // However take note that you can not use this code as is if a filter is active because it breaks the 'cheap random-access' property. We would need random-access on the post-filtered list.
-    // A typical application wanting coarse clipping and filtering may want to pre-compute an array of indices that passed the filtering test, recomputing this array when user changes the filter,
-    // and appending newly elements as they are inserted. This is left as a task to the user until we can manage to improve this example code!
-    // If your items are of variable size you may want to implement code similar to what ImGuiListClipper does. Or split your data into fixed height items to allow random-seeking into your list.
+    // Every entry is a single line, so only the visible ones need to be
+    // drawn.  With a filter active, match_ gives random access to the
+    // lines which pass it.
     ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(4,1)); // Tighten spacing
-    for (int i = 0; i < items_.Size; i++) {
-        const char* item = items_[i];
-        if (!filter.PassFilter(item))
-            continue;
-        ImVec4 col = ImVec4(1.0f,1.0f,1.0f,
-                            1.0f); // A better implementation may store a type per-item. For the sample let's just parse the text.
-        if (strstr(item, "[error]")) col = ImColor(1.0f,0.4f,0.4f,1.0f);
-        else if (strncmp(item, "# ", 2) == 0) col = ImColor(1.0f,0.78f,0.58f,1.0f);
-        else if (strncmp(item, "#{", 2) == 0) { // && item[5] == '}') {
-            unsigned cval = strtoul(item+2, 0, 16);
-            col = ImColor(float(cval & 0xF00) / float(0xF00),
-                          float(cval & 0x0F0) / float(0x0F0),
-                          float(cval & 0x00F) / float(0x00F),
-                          1.0f);
-            item += 6;
+    bool filtered = filter_.IsActive();
+    int count = int(filtered ? match_.size() : next_ - first_);
+    ImGuiListClipper clipper;
+    clipper.Begin(count);
+    while(clipper.Step()) {
+        for(int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+            DrawLine(filtered ? match_[i] : first_ + i);
         }
-        ImGui::PushStyleColor(ImGuiCol_Text, col);
-        ImGui::TextUnformatted(item);
-        ImGui::PopStyleColor();
     }
+    clipper.End();
     if (scroll_to_bottom_)
         ImGui::SetScrollHere();
     scroll_to_bottom_ = false;
@@ -158,6 +237,14 @@ bool DebugConsole::Draw() {
     return false;
 }
 
+void DebugConsole::DrawLine(uint64_t n) {
+    const Line& l = line(n);
+    const char* text = LineText(l);
+    ImGui::PushStyleColor(ImGuiCol_Text, l.color);
+    ImGui::TextUnformatted(text, text + l.length);
+    ImGui::PopStyleColor();
+}
+
 void  DebugConsole::ExecCommand(const char* command_line) {
     if (!line_cb_.empty()) {
         line_cb_.back()(this, command_line);
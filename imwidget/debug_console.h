@@ -1,5 +1,7 @@
 #ifndef SYNTHY_IMWIDGET_DEBUG_CONSOLE_H
 #define SYNTHY_IMWIDGET_DEBUG_CONSOLE_H
+#include <cstdint>
+#include <deque>
 #include <string>
 #include <map>
 #include <functional>
@@ -35,14 +37,50 @@ class DebugConsole: public ImWindowBase {
     void PushLineCallback(std::function<
             void(DebugConsole* console, const char* line)> line_cb);
     void PopLineCallback();
+
+    // Echo the log to stdout (and errors to stderr), for running without
+    // a window.
+    inline void set_echo(bool echo) { echo_ = echo; }
+    // The number of "[error]" lines logged.
+    inline int errors() const { return errors_; }
   private:
+    // The log is kept in a fixed size text arena, written circularly, with
+    // a ring of line records pointing into it.  Lines are identified by a
+    // sequence number that never repeats; line n lives in line_[n % size].
+    static const uint32_t kTextSize = 4 << 20;
+    static const uint32_t kMaxLines = 1 << 16;
+    struct Line {
+        uint32_t offset;
+        uint32_t length;
+        ImU32 color;
+    };
+    void AppendLine(const char* text, uint32_t length, ImU32 color);
+    void EvictOldest();
+    inline const Line& line(uint64_t n) const { return line_[n % kMaxLines]; }
+    inline const char* LineText(const Line& l) const {
+        return text_.data() + l.offset;
+    }
+    bool PassFilter(const Line& l) const;
+    void RebuildFilter();
+    void DrawLine(uint64_t n);
+
     int TextEditCallback(ImGuiTextEditCallbackData* data);
 
     static int TextEditCallbackStub(ImGuiTextEditCallbackData* data);
 
     const char* name_;
+    bool echo_;
+    int errors_;
     char inputbuf_[256];
-    ImVector<char*> items_;
+    std::vector<char> text_;
+    std::vector<Line> line_;
+    // Write position in text_.
+    uint32_t head_;
+    // Sequence numbers of the oldest line and of the next line written.
+    uint64_t first_, next_;
+    ImGuiTextFilter filter_;
+    // Sequence numbers of the lines which pass filter_, oldest first.
+    std::deque<uint64_t> match_;
     bool scroll_to_bottom_;
     ImVector<char*> history_;
     // -1: new line, 0..history_.Size-1 browsing history.
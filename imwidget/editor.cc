@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <string>
 #include <gflags/gflags.h>
 
+#include "absl/strings/str_cat.h"
 #include "alg/terrain.h"
 #include "imwidget/imapp.h"
 #include "imwidget/editor.h"
@@ -27,6 +29,9 @@ DECLARE_bool(hackjam2020);
 #define STBTE_DRAW_TILE(x, y, id, highlight, props) \
     z2util::Editor::Get()->DrawTile(x, y, id, highlight, props)
 
+#define STBTE_TILE_CHANGED(x, y) \
+    z2util::Editor::Get()->TileChanged(x, y)
+
 #define STBTE_PROP_TYPE(n, tiledata, params) \
     z2util::Editor::Get()->PropertyType(n, tiledata, params)
 
@@ -57,9 +62,11 @@ Editor::Editor()
     changed_(false),
     undo_len_(0),
     show_connections_(true),
+    show_row_length_(false),
     scale_(2.0),
     editor_(nullptr),
     map_(nullptr),
+    rle_(0, 0),
     mouse_origin_(0, 0),
     mouse_focus_(false),
     mapsel_(0)
@@ -99,6 +106,8 @@ void Editor::ConvertFromMap(Map* map) {
         encounters_.set_map(*map);
         encounters_.Unpack();
     }
+    suggestions_.clear();
+    row_length_.clear();
     editor_ = stbte_create_map(width, height, 1, 16, 16, 255);
     editor_->scroll_x = -80;
     editor_->scroll_y = -16;
@@ -120,22 +129,41 @@ void Editor::ConvertFromMap(Map* map) {
     undo_len_ = editor_->undo_len;
 }
 
+OverworldRle Editor::Encoder() {
+    OverworldRle rle(editor_->max_x, editor_->max_y);
+    rle.set_compress_boulders(FLAGS_compress_boulders);
+    rle.set_hackjam(FLAGS_hackjam2020);
+    for(int y=0; y<editor_->max_y; y++) {
+        for(int x=0; x<editor_->max_x; x++) {
+            rle.set_tile(x, y, editor_->data[y][x][0]);
+            // Don't compress magic connection spots.
+            rle.set_fixed(x, y, connections_.NoCompress(x, y) !=
+                                OverworldConnectorList::ST_NONE);
+        }
+    }
+    return rle;
+}
+
 std::vector<uint8_t> Editor::CompressMap() {
     const auto& misc = ConfigLoader<RomInfo>::GetConfig().misc();
-    std::vector<uint8_t> data;
+    std::vector<int> offset;
+    std::vector<uint8_t> data = Encoder().Encode(&offset);
     hidden_palace_tile_ = -1;
     hidden_town_tile_ = -1;
 
     for(int y=0; y<editor_->max_y; y++) {
         for(int x=0; x<editor_->max_x; x++) {
+            // Tiles in the middle of a run don't have their own address.
+            int ofs = offset[y * editor_->max_x + x];
+            if (ofs < 0)
+                continue;
             uint8_t tile = editor_->data[y][x][0];
-            uint8_t count = 0;
             // For palaces, write the ram address to the "turn to stone" offsets
             // in their respective rom banks.
             int conn = connections_.GetID(x, y);
             if (conn >= misc.palace_connection_id() &&
                 conn < misc.palace_connection_id() + 4) {
-                uint16_t addr = misc.overworld_ram() + data.size();
+                uint16_t addr = misc.overworld_ram() + ofs;
                 int n = conn - misc.palace_connection_id();
                 int w = map_->subworld() ? map_->subworld() : map_->overworld();
                 if (w != 1 || (w == 1 && n == 0)) {
@@ -153,63 +181,51 @@ std::vector<uint8_t> Editor::CompressMap() {
                         misc.palace_connection_id() + 3);
                 }
             }
-#if 0
-            // Don't compress expansion tiles
-            if (FLAGS_hackjam2020) {
-                if (tile >= 16) {
-                    // Special marker for expansion tile.
-                    data.push_back(0xFF);
-                    data.push_back(tile);
-                    continue;
-                }
-            }
-#endif
-            // Don't compress magic connection spots, boulders or the
-            // spider/river devil.
             auto st = connections_.NoCompress(x, y);
-            if (st != OverworldConnectorList::ST_NONE ||
-                (!FLAGS_compress_boulders && (tile == 0x0E || tile == 0x0F))) {
-                data.push_back(tile | count << 4);
-                if (st == OverworldConnectorList::ST_HIDDEN_PALACE) {
-                    hidden_palace_tile_ = tile;
-                } else if (st == OverworldConnectorList::ST_HIDDEN_TOWN) {
-                    hidden_town_tile_ = tile;
-                }
-                continue;
-            }
-            if (FLAGS_hackjam2020 && tile >=16) {
-                // Compress tiles using $1F to $FF as RLE escape bytes.
-                while(x+1 < editor_->max_x
-                      && tile == editor_->data[y][x+1][0]
-                      && !connections_.NoCompress(x+1, y)) {
-                    x++;
-                    count++;
-                    if (count == 14)
-                        break;
-                }
-                data.push_back(0xF | (count+1) << 4);
-                data.push_back(tile);
-            } else {
-                while(x+1 < editor_->max_x
-                      && tile == editor_->data[y][x+1][0]
-                      && !connections_.NoCompress(x+1, y)) {
-                    x++;
-                    count++;
-                    if (count == 15)
-                        break;
-                }
-                data.push_back(tile | count << 4);
+            if (st == OverworldConnectorList::ST_HIDDEN_PALACE) {
+                hidden_palace_tile_ = tile;
+            } else if (st == OverworldConnectorList::ST_HIDDEN_TOWN) {
+                hidden_town_tile_ = tile;
             }
         }
     }
     return data;
 }
 
+void Editor::TileChanged(int x, int y) {
+    if (size_t(y) < row_length_.size())
+        row_length_[y] = -1;
+    // Suggestions are only good for the map they were made for.
+    suggestions_.clear();
+}
+
+int Editor::UpdateRowLength() {
+    if (row_length_.size() != size_t(editor_->max_y)) {
+        rle_ = Encoder();
+        row_length_.assign(editor_->max_y, -1);
+    }
+    int total = 0;
+    for(int y=0; y<editor_->max_y; y++) {
+        if (row_length_[y] < 0) {
+            for(int x=0; x<editor_->max_x; x++) {
+                rle_.set_tile(x, y, editor_->data[y][x][0]);
+            }
+            row_length_[y] = rle_.RowLength(y);
+        }
+        total += row_length_[y];
+    }
+    return total;
+}
+
+int Editor::MaxLength() {
+    const auto& misc = ConfigLoader<RomInfo>::GetConfig().misc();
+    return FLAGS_max_map_length ? FLAGS_max_map_length
+                                : misc.overworld_length();
+}
+
 void Editor::SaveMap() {
     std::vector<uint8_t> data = CompressMap();
-    const auto& misc = ConfigLoader<RomInfo>::GetConfig().misc();
-    int max_length = misc.overworld_length();
-    if (FLAGS_max_map_length) max_length = FLAGS_max_map_length;
+    int max_length = MaxLength();
 
     if (!map_) {
         LOG(ERROR, "Can't save map: map_ == nullptr");
@@ -219,11 +235,32 @@ void Editor::SaveMap() {
     LOG(INFO, "Saving ", map_->name());
     LOG(INFO, "Map compresses to ", data.size(), " bytes.");
 
+    suggestions_.clear();
     if (data.size() > size_t(max_length)) {
+        std::string hint = "No small set of tile changes will make it fit.\n";
+        if (Encoder().Suggest(max_length, &suggestions_)) {
+            hint = absl::StrCat("Changing these ", suggestions_.size(),
+                                " tiles would make it fit (they are outlined "
+                                "in the editor):\n");
+            int n = 0;
+            for(const auto& c : suggestions_) {
+                LOGF(INFO, "Suggest (%d, %d): %02x -> %02x",
+                     c.x, c.y, c.from, c.to);
+                if (n++ < 16) {
+                    char buf[64];
+                    snprintf(buf, sizeof(buf), "    (%d, %d): %02x -> %02x\n",
+                             c.x, c.y, c.from, c.to);
+                    absl::StrAppend(&hint, buf);
+                }
+            }
+            if (n > 16)
+                absl::StrAppend(&hint, "    ...\n");
+        }
         ErrorDialog::Spawn("Overworld Save Error",
             "Can't save ", map_->name(), " because it is ", data.size(),
             " bytes\n\n"
-            "Overworld maps must be smaller than ", max_length, " bytes.\n");
+            "Overworld maps must be smaller than ", max_length, " bytes.\n\n",
+            hint);
         return;
     }
 
@@ -342,7 +379,10 @@ bool Editor::Draw() {
     if (ImGui::Button("Connections")) {
         ImGui::OpenPopup("Connections");
     }
-    changed_ |= connections_.Draw();
+    if (connections_.Draw()) {
+        changed_ = true;
+        row_length_.clear();
+    }
 
     ImGui::SameLine();
     if (ImGui::Button("Encounters")) {
@@ -354,7 +394,10 @@ bool Editor::Draw() {
     if (ImGui::Button("Randomize")) {
         ImGui::OpenPopup("Randomize");
     }
-    changed_ |= randomize_.Draw(editor_, &connections_);
+    if (randomize_.Draw(editor_, &connections_, MaxLength())) {
+        changed_ = true;
+        row_length_.clear();
+    }
 
     ImGui::SameLine();
     if (ImGui::Button("Commit to ROM")) {
@@ -363,6 +406,24 @@ bool Editor::Draw() {
                 "commit", absl::StrCat("Overworld edits to ", map_->name()).c_str());
     }
 
+    if (!suggestions_.empty()) {
+        ImGui::SameLine();
+        if (ImGui::Button("Apply Suggestions")) {
+            // Recording the undo marks each tile changed, which clears
+            // the suggestions, so work from a copy.
+            auto apply = std::move(suggestions_);
+            stbte__begin_undo(editor_);
+            for(const auto& c : apply) {
+                if (editor_->data[c.y][c.x][0] != c.from)
+                    continue;
+                stbte__undo_record(editor_, c.x, c.y, 0, c.from);
+                editor_->data[c.y][c.x][0] = c.to;
+            }
+            stbte__end_undo(editor_);
+            suggestions_.clear();
+        }
+    }
+
     ImGui::SameLine();
     ImGui::InputFloat("Zoom", &scale_, 0.25, 1.0);
     scale_ = Clamp(scale_, 0.25f, 8.0f);
@@ -376,6 +437,22 @@ bool Editor::Draw() {
                 map_->address().bank(), map_->address().address(),
                 compressed_length_);
 
+    // Live size of the map as edited.
+    int used = UpdateRowLength();
+    int max_length = MaxLength();
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "%d / %d bytes (%d free)",
+             used, max_length, max_length - used);
+    ImGui::SameLine();
+    ImGui::PushStyleColor(ImGuiCol_PlotHistogram,
+                          used > max_length ? ImVec4(0.8, 0.1, 0.1, 1.0)
+                                            : ImVec4(0.1, 0.6, 0.1, 1.0));
+    ImGui::ProgressBar(max_length ? float(used) / max_length : 1.0f,
+                       ImVec2(250, 0), overlay);
+    ImGui::PopStyleColor();
+    ImGui::SameLine();
+    ImGui::Checkbox("Row Sizes", &show_row_length_);
+
     ImGui::BeginChild("editarea", ImGui::GetContentRegionAvail());
     origin_ = ImGui::GetCursorPos();
     mouse_origin_ = ImGui::GetCursorScreenPos();
@@ -401,12 +478,47 @@ bool Editor::Draw() {
                 if (connections_.DrawInEditor((x + editor_->scroll_x)/16,
                                               (y + editor_->scroll_y)/16)) {
                     mouse_focus_ = false;
-                    changed_ |= connections_.changed();
+                    if (connections_.changed()) {
+                        changed_ = true;
+                        row_length_.clear();
+                    }
                 }
             }
         }
     }
 
+    auto* draw = ImGui::GetWindowDrawList();
+    if (show_row_length_) {
+        // Tint each row by its share of the most expensive row and label
+        // it with its size.
+        int most = *std::max_element(row_length_.begin(), row_length_.end());
+        for(int y=0; y<editor_->max_y; y++) {
+            float y0 = y * 16 - editor_->scroll_y;
+            float x0 = std::max(0, -editor_->scroll_x);
+            float x1 = std::min(editor_->max_x * 16 - editor_->scroll_x,
+                                int(size_.x));
+            if (y0 < 0 || y0 + 16 > size_.y || x0 >= x1)
+                continue;
+            uint32_t alpha = 0x80 * row_length_[y] / std::max(most, 1);
+            ImVec2 a = mouse_origin_ + ImVec2(x0, y0) * scale_;
+            ImVec2 b = mouse_origin_ + ImVec2(x1, y0 + 16) * scale_;
+            draw->AddRectFilled(a, b, (alpha << 24) | 0x0000FF);
+            char buf[8];
+            snprintf(buf, sizeof(buf), "%d", row_length_[y]);
+            draw->AddText(a + ImVec2(2, 1), 0xFFFFFFFF, buf);
+        }
+    }
+
+    // Outline the tiles suggested by the last failed save.
+    for(const auto& c : suggestions_) {
+        ImVec2 a(c.x * 16 - editor_->scroll_x, c.y * 16 - editor_->scroll_y);
+        ImVec2 b = a + ImVec2(16, 16);
+        if (a.x < 0 || a.y < 0 || b.x > size_.x || b.y > size_.y)
+            continue;
+        draw->AddRect(mouse_origin_ + a * scale_, mouse_origin_ + b * scale_,
+                      0xFF00FFFF, 0, ~0, 2.0f);
+    }
+
     for(auto& e : events_) {
         HandleEvent(&e);
     }
@@ -2,6 +2,7 @@
 #define Z2UTIL_IMWIDGET_EDITOR_H
 #include <memory>
 #include <vector>
+#include "alg/overworld_rle.h"
 #include "imwidget/error_dialog.h"
 #include "imwidget/glbitmap.h"
 #include "imwidget/imwidget.h"
@@ -28,8 +29,12 @@ class Editor: public ImWindowBase {
     Editor();
 
     void ConvertFromMap(Map* map);
+    // An encoder loaded with the map being edited.
+    OverworldRle Encoder();
     std::vector<uint8_t> CompressMap();
     void SaveMap();
+    // Called by the tilemap editor before a tile changes.
+    void TileChanged(int x, int y);
 
     void ProcessEvent(SDL_Event* e);
     bool Draw() override;
@@ -51,16 +56,26 @@ class Editor: public ImWindowBase {
     static PropertyInfo property_info_[];
   private:
     void HandleEvent(SDL_Event* e);
+    // Recompress the rows which changed since the last call and return
+    // the compressed length of the whole map.
+    int UpdateRowLength();
+    int MaxLength();
 
     bool changed_;
     int undo_len_;
     bool show_connections_;
+    bool show_row_length_;
     float scale_;
     stbte_tilemap* editor_;
     Map* map_;
     int compressed_length_;
     int hidden_palace_tile_;
     int hidden_town_tile_;
+    // Tile changes which would let the map fit, from the last failed save.
+    std::vector<OverworldRle::Change> suggestions_;
+    // The compressed length of each row; -1 if the row needs recompressing.
+    OverworldRle rle_;
+    std::vector<int> row_length_;
 
     Mapper* mapper_;
     NesHardwarePalette* hwpal_;
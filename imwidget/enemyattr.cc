@@ -3,6 +3,7 @@
 #include "imwidget/error_dialog.h"
 #include "imwidget/imapp.h"
 #include "imwidget/imutil.h"
+#include "nes/chr_draw.h"
 #include "nes/mapper.h"
 #include "proto/rominfo.pb.h"
 #include "util/config.h"
@@ -21,11 +22,7 @@ void PointsTable::Init() {
     cache_.set_mapper(mapper_);
     cache_.Init(none, chr, Z2ObjectCache::Schema::TILE8x16);
 
-    Address ipal;
-    // FIXME(cfrantz): hardcoded palette location
-    ipal.set_bank(1);
-    ipal.set_address(0x809e);
-    cache_.set_palette(ipal);
+    cache_.set_palette(ChrDraw::ItemPalette(1));
 
     cache_.Clear();
 }
@@ -1,6 +1,8 @@
 #include "imwidget/glbitmap.h"
 #include "imgui.h"
 #include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include "absl/strings/match.h"
 
 GLBitmap::GLBitmap()
   : width_(0),
@@ -59,6 +61,16 @@ void GLBitmap::Update() {
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void GLBitmap::Update(int x, int y, int w, int h) {
+    glBindTexture(GL_TEXTURE_2D, texture_id_);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, width_);
+    glTexSubImage2D(GL_TEXTURE_2D, 0,
+                    x, y, w, h,
+                    GL_RGBA, GL_UNSIGNED_BYTE, (void*)(data_ + y*width_ + x));
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 void GLBitmap::Draw(int w, int h) {
     if (w == 0) w = width_;
     if (h == 0) h = height_;
@@ -130,21 +142,32 @@ void GLBitmap::Blit(int x, int y, int w, int h, uint32_t* pixels) {
 }
 
 bool GLBitmap::Save(const std::string& filename) {
-    SDL_Surface *surface = SDL_CreateRGBSurface(0, width_, height_, 32,
+    return Save(filename, width_, height_, data_);
+}
+
+// Doesn't touch the GL, so that headless runs can save images.
+bool GLBitmap::Save(const std::string& filename, int w, int h,
+                    const uint32_t* pixels) {
+    SDL_Surface *surface = SDL_CreateRGBSurface(0, w, h, 32,
                                                 0x000000FF,
                                                 0x0000FF00,
                                                 0x00FF0000,
                                                 0xFF000000);
 
-    uint8_t *src = (uint8_t*)data_;
+    const uint8_t *src = (const uint8_t*)pixels;
     uint8_t *dst = (uint8_t*)surface->pixels;
-    for(int y=0; y<height_; y++) {
-        memcpy(dst, src, width_ * 4);
+    for(int y=0; y<h; y++) {
+        memcpy(dst, src, w * 4);
         dst += surface->pitch;
-        src += width_ * 4;
+        src += w * 4;
     }
 
-    bool retval = (SDL_SaveBMP(surface, filename.c_str()) == 0);
+    bool retval;
+    if (absl::EndsWithIgnoreCase(filename, ".png")) {
+        retval = (IMG_SavePNG(surface, filename.c_str()) == 0);
+    } else {
+        retval = (SDL_SaveBMP(surface, filename.c_str()) == 0);
+    }
     SDL_FreeSurface(surface);
     return retval;
 }
@@ -153,7 +176,8 @@ bool GLBitmap::Load(const std::string& filename) {
     bool retval = false;
     SDL_Surface *orig = nullptr, *surface = nullptr;
     uint8_t *dst = nullptr, *src = nullptr;
-    orig = SDL_LoadBMP(filename.c_str());
+    // SDL_image reads PNG as well as BMP.
+    orig = IMG_Load(filename.c_str());
     if (!orig) goto exitproc;
     surface = SDL_ConvertSurfaceFormat(orig, SDL_PIXELFORMAT_ABGR8888, 0);
     if (!surface) goto exitproc;
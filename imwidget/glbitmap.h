@@ -16,6 +16,8 @@ class GLBitmap {
 
     uint32_t* Allocate(uint32_t* data=nullptr, bool claim_ownership=true);
     void Update();
+    // Uploads only the given rectangle to the texture.
+    void Update(int x, int y, int w, int h);
     void Draw(int w=0, int h=0);
     void DrawAt(int x, int y, int w=0, int h=0);
     void DrawAt(int x, int y, float scale);
@@ -32,7 +34,11 @@ class GLBitmap {
     inline int width() const { return width_; }
     inline int height() const { return height_; }
 
+    // PNG if the filename ends in .png, else BMP.
     bool Save(const std::string& filename);
+    static bool Save(const std::string& filename, int w, int h,
+                     const uint32_t* pixels);
+    // Any format SDL_image reads, including PNG and BMP.
     bool Load(const std::string& filename);
 
   private:
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <gflags/gflags.h>
 #include "imapp.h"
 #include "imgui.h"
@@ -9,17 +10,36 @@
 
 DEFINE_double(hidpi, 1.0, "HiDPI scaling factor");
 DEFINE_string(controller_db, "", "Path to the SDL gamecontrollerdb.txt file");
+DEFINE_int32(fps, 60, "Frame rate cap (0 = no cap)");
+DEFINE_bool(lazy_redraw, true, "Only redraw on input or while animating");
+DEFINE_int32(idle_ms, 250, "Poll interval for background work while idle");
+
+// How often to redraw for the caret blink while a text field is active.
+const int kCaretBlinkMs = 100;
 
 
 ImApp* ImApp::singleton_;
 
-ImApp::ImApp(const std::string& name, int width, int height)
+ImApp::ImApp(const std::string& name, int width, int height, bool headless)
   : name_(name),
     width_(width),
     height_(height),
-    running_(true)
+    headless_(headless),
+    running_(true),
+    window_(nullptr),
+    glcontext_(nullptr),
+    audio_device_(0),
+    redraw_frames_(kSettleFrames),
+    frame_stats_{}
 {
     singleton_ = this;
+    RegisterCommand("quit", "Quit the application.", this, &ImApp::Quit);
+    RegisterCommand("framestats", "Show frame time statistics.",
+                    this, &ImApp::FrameStatsCommand);
+    if (headless_) {
+        console_.set_echo(true);
+        return;
+    }
     SDL_Init(SDL_INIT_VIDEO |
              SDL_INIT_AUDIO |
              SDL_INIT_TIMER |
@@ -45,12 +65,12 @@ ImApp::ImApp(const std::string& name, int width, int height)
     ImGui_ImplSdl_SetHiDPIScale(FLAGS_hidpi);
     ImGui_ImplSdlGL2_Init(window_);
     clear_color_ = ImColor(0, 16, 64);
-    //fpsmgr_.SetRate(60);
-
-    RegisterCommand("quit", "Quit the application.", this, &ImApp::Quit);
 }
 
 ImApp::~ImApp() {
+    if (headless_)
+        return;
+    CloseAudio();
     ImGui_ImplSdlGL2_Shutdown();
     ImGui::DestroyContext();
     SDL_GL_DeleteContext(glcontext_);
@@ -93,7 +113,28 @@ void ImApp::Quit(DebugConsole* console, int argc, char **argv) {
     running_ = false;
 }
 
+void ImApp::FrameStatsCommand(DebugConsole* console, int argc, char **argv) {
+    console->AddLog("frames: %lld  idle wakeups: %lld",
+                    (long long)frame_stats_.frames,
+                    (long long)frame_stats_.idle_wakeups);
+    console->AddLog("draw time: last %.2fms  average %.2fms  max %.2fms",
+                    frame_stats_.last_ms, frame_stats_.average_ms,
+                    frame_stats_.max_ms);
+    frame_stats_.max_ms = 0;
+}
+
+void ImApp::UpdateFrameStats(int64_t start_us) {
+    double ms = (os::utime_now() - start_us) / 1000.0;
+    auto& fs = frame_stats_;
+    fs.last_ms = ms;
+    fs.average_ms = fs.frames ? fs.average_ms * 0.95 + ms * 0.05 : ms;
+    fs.max_ms = std::max(fs.max_ms, ms);
+    fs.frames++;
+}
+
 void ImApp::SetTitle(const std::string& title, bool with_appname) {
+    if (headless_)
+        return;
     std::string val;
     if (with_appname) {
         val = title.empty() ? name_ : absl::StrCat(name_, ": ", title);
@@ -104,13 +145,33 @@ void ImApp::SetTitle(const std::string& title, bool with_appname) {
 }
 
 void ImApp::Run() {
+    if (headless_)
+        return;
+    if (FLAGS_fps > 0)
+        fpsmgr_.SetRate(std::min(FLAGS_fps, FPS_UPPER_LIMIT));
     while(running_) {
+        Idle();
+        if (FLAGS_lazy_redraw && redraw_frames_ == 0) {
+            // Nothing to draw: sleep until there is input.  An active text
+            // field still needs the occasional frame to blink its caret.
+            bool caret = ImGui::GetIO().WantTextInput;
+            int timeout = caret ? kCaretBlinkMs : FLAGS_idle_ms;
+            if (!SDL_WaitEventTimeout(nullptr, timeout) && !caret) {
+                frame_stats_.idle_wakeups++;
+                continue;
+            }
+        }
         if (!ProcessEvents()) {
             running_ = false;
             break;
         }
+        if (redraw_frames_ > 0)
+            redraw_frames_--;
+        int64_t start = os::utime_now();
         BaseDraw();
-        //fpsmgr_.Delay();
+        UpdateFrameStats(start);
+        if (FLAGS_fps > 0)
+            fpsmgr_.Delay();
     }
 }
 
@@ -122,6 +183,7 @@ bool ImApp::ProcessEvents() {
         if (event.type == SDL_QUIT)
             done = true;
         ProcessEvent(&event);
+        Invalidate();
     }
     return !done;
 }
@@ -160,7 +222,6 @@ void ImApp::BaseDraw() {
 
 void ImApp::InitAudio(int freq, int chan, int bufsz, SDL_AudioFormat fmt) {
     SDL_AudioSpec want, have;
-    SDL_AudioDeviceID dev;
 
     SDL_memset(&want, 0, sizeof(want));
     want.freq = freq;
@@ -170,9 +231,20 @@ void ImApp::InitAudio(int freq, int chan, int bufsz, SDL_AudioFormat fmt) {
     want.callback = ImApp::AudioCallback_;
     want.userdata = (void*)this;
 
-    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have,
-                              SDL_AUDIO_ALLOW_FORMAT_CHANGE);
-    SDL_PauseAudioDevice(dev, 0);
+    CloseAudio();
+    audio_device_ = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (audio_device_ == 0) {
+        LOG(ERROR, "Could not open audio device: ", SDL_GetError());
+        return;
+    }
+    SDL_PauseAudioDevice(audio_device_, 0);
+}
+
+void ImApp::CloseAudio() {
+    if (audio_device_) {
+        SDL_CloseAudioDevice(audio_device_);
+        audio_device_ = 0;
+    }
 }
 
 void ImApp::HelpButton(const std::string& topickey, bool right_justify) {
@@ -1,5 +1,6 @@
 #ifndef Z2UTIL_IMAPP_H
 #define Z2UTIL_IMAPP_H
+#include <cstdint>
 #include <memory>
 
 #include <string>
@@ -12,21 +13,50 @@
 
 class ImApp {
   public:
+    struct FrameStats {
+        int64_t frames;
+        // Times the loop woke up while idle without drawing a frame.
+        int64_t idle_wakeups;
+        // Time spent drawing, in milliseconds.
+        double last_ms;
+        double average_ms;
+        double max_ms;
+    };
+
     static ImApp* Get() { return singleton_; }
-    ImApp(const std::string& name, int width, int height);
+    // A headless app has no window, GL context or ImGui context: it only
+    // runs console commands.
+    ImApp(const std::string& name, int width, int height, bool headless=false);
     ImApp(const std::string& name) : ImApp(name, 1280, 720) {}
     virtual ~ImApp();
 
     void InitControllers();
+    // Opens the audio device with exactly the requested format; SDL
+    // converts if the hardware differs.  AudioCallback runs on SDL's audio
+    // thread until CloseAudio.
     void InitAudio(int freq, int chan, int bufsz, SDL_AudioFormat fmt);
+    void CloseAudio();
     virtual void Init() {}
     virtual bool PreDraw() { return false; }
     virtual void Draw() {}
     virtual void ProcessEvent(SDL_Event* event) {}
+    // Called on every pass through the main loop, including while idle.
+    // Use it to poll for background work; call Invalidate if it changed
+    // anything which needs to be drawn.
+    virtual void Idle() {}
     virtual void Help(const std::string& topickey) {}
 
     void SetTitle(const std::string& title, bool with_appname=true);
+    // Redraws only on input or after Invalidate, up to --fps frames a
+    // second.  Widgets which are animating should call Invalidate on
+    // every frame until they settle.
     void Run();
+    // Requests that the next frames be drawn.  Call from the main thread.
+    inline void Invalidate(int frames=kSettleFrames) {
+        if (redraw_frames_ < frames)
+            redraw_frames_ = frames;
+    }
+    inline const FrameStats& frame_stats() const { return frame_stats_; }
     void BaseDraw();
     virtual bool ProcessEvents();
 
@@ -52,6 +82,7 @@ class ImApp {
     void AddDrawCallback(ImWindowBase* window);
     void HelpButton(const std::string& topickey, bool right_justify=false);
 
+    inline bool headless() const { return headless_; }
     inline const ImVec4& clear_color() { return clear_color_; }
     inline void set_clear_color(const ImVec4& c) { clear_color_ = c; }
 
@@ -60,13 +91,19 @@ class ImApp {
     std::string name_;
     int width_;
     int height_;
+    bool headless_;
     bool running_;
     ImVec4 clear_color_;
     DebugConsole console_;
     std::vector<std::unique_ptr<ImWindowBase>> draw_callback_;
 
   private:
+    // ImGui needs a few frames after an input event for things like
+    // popups and auto-sized windows to settle.
+    static const int kSettleFrames = 3;
     void Quit(DebugConsole* console, int argc, char **argv);
+    void FrameStatsCommand(DebugConsole* console, int argc, char **argv);
+    void UpdateFrameStats(int64_t start_us);
     static void AudioCallback_(void* userdata, uint8_t* stream, int len);
 
     static ImApp* singleton_;
@@ -76,7 +113,10 @@ class ImApp {
     SDL_Texture *texture_;
     SDL_PixelFormat *format_;
     SDL_GLContext glcontext_;
+    SDL_AudioDeviceID audio_device_;
     FPSManager fpsmgr_;
+    int redraw_frames_;
+    FrameStats frame_stats_;
 
     std::vector<std::unique_ptr<ImWindowBase>> draw_added_;
 };
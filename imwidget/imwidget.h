@@ -1,9 +1,10 @@
 #ifndef Z2UTIL_IMWIDGET_IMWIDGET_H
 #define Z2UTIL_IMWIDGET_IMWIDGET_H
-
+#include <atomic>
 
 inline int UniqueID() {
-    static int id;
+    // Atomic because map commands are also built on palace search threads.
+    static std::atomic<int> id;
     return ++id;
 }
 
@@ -14,7 +15,8 @@ class ImWindowBase {
     explicit ImWindowBase(bool visible)
       : ImWindowBase(visible, true) {}
     explicit ImWindowBase(bool visible, bool want_dispose)
-      : id_(UniqueID()), visible_(visible), want_dispose_(want_dispose) {}
+      : id_(UniqueID()), visible_(visible), want_dispose_(want_dispose),
+        stale_(false) {}
     virtual ~ImWindowBase() {}
 
     virtual bool Draw() { return false; }
@@ -22,10 +24,15 @@ class ImWindowBase {
     inline bool& visible() { return visible_; }
     inline void set_visible(bool v) { visible_ = v; }
     inline bool want_dispose() { return want_dispose_; }
+    // A stale window's unpacked data no longer matches the ROM.  Its owner
+    // refreshes it before drawing it again.
+    inline bool stale() const { return stale_; }
+    inline void set_stale(bool s) { stale_ = s; }
   protected:
     int id_;
     bool visible_;
     bool want_dispose_;
+    bool stale_;
 };
 
 #endif // Z2UTIL_IMWIDGET_IMWIDGET_H
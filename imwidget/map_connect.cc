@@ -323,6 +323,12 @@ OverworldConnector* OverworldConnectorList::Swap(int a, int b) {
     return &list_[a];
 }
 
+void OverworldConnectorList::Move(int n, int x, int y) {
+    list_[n].x_ = x;
+    list_[n].y_ = y;
+    changed_ = true;
+}
+
 void OverworldConnectorList::Save() {
     for(auto& c : list_) {
         c.Write();
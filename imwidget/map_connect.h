@@ -98,10 +98,13 @@ class OverworldConnectorList {
         *x = item.xpos();
         *y = item.ypos();
     }
+    // Move connector |n| to x, y.
+    void Move(int n, int x, int y);
     SpecialType NoCompress(int x, int y);
     void Save();
     std::vector<std::string> Print() const;
 
+    inline int size() const { return int(list_.size()); }
     inline bool show() const { return show_; }
     inline bool changed() const { return changed_; }
     inline void set_scale(float s) { scale_ = s; }
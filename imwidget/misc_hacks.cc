@@ -3,6 +3,7 @@
 
 #include "imwidget/imapp.h"
 #include "nes/mapper.h"
+#include "nes/overworld_tiles.h"
 #include "proto/rominfo.pb.h"
 #include "util/config.h"
 #include "util/logging.h"
@@ -320,88 +321,7 @@ bool MiscellaneousHacks::DrawSwimEnables() {
 
 
 void MiscellaneousHacks::CheckOverworldTileHack() {
-    auto* ri = ConfigLoader<RomInfo>::MutableConfig();
-    int index = EnabledIndex([&]() { return ri->overworld_tiles(); });
-    LOGF(INFO, "Overworld tile hack: %d", index);
-    if (index == 1) {
-        auto *p = ri->mutable_palettes(0);
-        p->mutable_palette(0)->set_hidden(true);
-        p->mutable_palette(1)->set_hidden(true);
-        p->mutable_palette(2)->set_hidden(false);
-        p->mutable_palette(3)->set_hidden(false);
-        p->mutable_palette(4)->set_hidden(false);
-        p->mutable_palette(5)->set_hidden(false);
-        p->mutable_palette(6)->set_hidden(false);
-        p->mutable_palette(7)->set_hidden(false);
-        ri->mutable_map(0)->mutable_objtable(0)->set_address(0xbb80);
-        ri->mutable_map(1)->mutable_objtable(0)->set_address(0xbc00);
-        ri->mutable_map(2)->mutable_objtable(0)->set_address(0xbc80);
-        ri->mutable_map(3)->mutable_objtable(0)->set_address(0xbc00);
-        *ri->mutable_map(0)->mutable_palette() = p->palette(2).address();
-        *ri->mutable_map(1)->mutable_palette() = p->palette(4).address();
-        *ri->mutable_map(2)->mutable_palette() = p->palette(6).address();
-        *ri->mutable_map(3)->mutable_palette() = p->palette(4).address();
-        ri->mutable_misc()->mutable_overworld_tile_palettes()->set_address(0x87e3);
-
-        int size = 128*3;
-        int i;
-        for(i=0; i<size; i++) {
-            if (mapper_->ReadPrgBank(0, 0xbb80+i) != 0xff)
-                break;
-        }
-        if (i == size) {
-            for(i=0; i<0x50; i++) {
-                mapper_->WritePrgBank(0, 0xbb80+i, mapper_->ReadPrgBank(0, 0x87a3+i));
-                mapper_->WritePrgBank(0, 0xbc00+i, mapper_->ReadPrgBank(0, 0x87a3+i));
-                mapper_->WritePrgBank(0, 0xbc80+i, mapper_->ReadPrgBank(0, 0x87a3+i));
-            }
-            for(i=0; i<0x24; i++) {
-                mapper_->WritePrgBank(0, 0xbbd0+i, mapper_->ReadPrgBank(-1, 0xc458+i));
-                mapper_->WritePrgBank(0, 0xbc50+i, mapper_->ReadPrgBank(-1, 0xc458+i));
-                mapper_->WritePrgBank(0, 0xbcd0+i, mapper_->ReadPrgBank(-1, 0xc458+i));
-            }
-        }
-    } else if (index == 2) {
-        auto *p = ri->mutable_palettes(0);
-        p->mutable_palette(0)->set_hidden(false);
-        p->mutable_palette(1)->set_hidden(false);
-        p->mutable_palette(2)->set_hidden(true);
-        p->mutable_palette(3)->set_hidden(true);
-        p->mutable_palette(4)->set_hidden(true);
-        p->mutable_palette(5)->set_hidden(true);
-        p->mutable_palette(6)->set_hidden(true);
-        p->mutable_palette(7)->set_hidden(true);
-        ri->mutable_map(0)->mutable_objtable(0)->set_address(0xb000);
-        ri->mutable_map(1)->mutable_objtable(0)->set_address(0xb000);
-        ri->mutable_map(2)->mutable_objtable(0)->set_address(0xb000);
-        ri->mutable_map(3)->mutable_objtable(0)->set_address(0xb000);
-        *ri->mutable_map(0)->mutable_palette() = p->palette(0).address();
-        *ri->mutable_map(1)->mutable_palette() = p->palette(0).address();
-        *ri->mutable_map(2)->mutable_palette() = p->palette(0).address();
-        *ri->mutable_map(3)->mutable_palette() = p->palette(0).address();
-        ri->mutable_misc()->mutable_overworld_tile_palettes()->set_address(0xb100);
-
-    } else if (index == 0) {
-        auto *p = ri->mutable_palettes(0);
-        p->mutable_palette(0)->set_hidden(false);
-        p->mutable_palette(1)->set_hidden(false);
-        p->mutable_palette(2)->set_hidden(true);
-        p->mutable_palette(3)->set_hidden(true);
-        p->mutable_palette(4)->set_hidden(true);
-        p->mutable_palette(5)->set_hidden(true);
-        p->mutable_palette(6)->set_hidden(true);
-        p->mutable_palette(7)->set_hidden(true);
-        ri->mutable_map(0)->mutable_objtable(0)->set_address(0x87a3);
-        ri->mutable_map(1)->mutable_objtable(0)->set_address(0x87a3);
-        ri->mutable_map(2)->mutable_objtable(0)->set_address(0x87a3);
-        ri->mutable_map(3)->mutable_objtable(0)->set_address(0x87a3);
-        *ri->mutable_map(0)->mutable_palette() = p->palette(0).address();
-        *ri->mutable_map(1)->mutable_palette() = p->palette(0).address();
-        *ri->mutable_map(2)->mutable_palette() = p->palette(0).address();
-        *ri->mutable_map(3)->mutable_palette() = p->palette(0).address();
-        ri->mutable_misc()->mutable_overworld_tile_palettes()->set_address(0x87e3);
-    }
-
+    z2util::CheckOverworldTileHack(mapper_);
 }
 
 template<class GETALL>
@@ -8,6 +8,8 @@
 #include "util/macros.h"
 #include "absl/strings/str_cat.h"
 #include "alg/palace_gen.h"
+#include "alg/palace_search.h"
+#include "alg/palace_solver.h"
 
 #include <gflags/gflags.h>
 
@@ -87,6 +89,15 @@ void MultiMap::Init() {
     if (pgo_.num_rooms() == 0) pgo_.set_num_rooms(14);
     pgo_.set_start_room(start_);
     pgo_.set_world(world_);
+    if (pso_.seeds() == 0) {
+        pso_.set_seeds(1000);
+        pso_.set_top_k(10);
+        auto* w = pso_.mutable_weight();
+        w->set_path_length(1.0);
+        w->set_dead_ends(0.5);
+        w->set_elevators(0.25);
+        w->set_bytes(-0.01);
+    }
 }
 
 fdg::Node* MultiMap::AddRoom(int room, double x, double y) {
@@ -332,13 +343,119 @@ void MultiMap::DrawGen() {
         if (ImGui::Button("Generate")) {
             PalaceGenerator pgen(pgo_);
             pgen.set_mapper(mapper_);
-            pgen.Generate();
-            Init();
+            if (pgen.Generate()) {
+                Init();
+            } else {
+                reachability_ = absl::StrCat("No solvable palace for seed ",
+                                             pgo_.seed(), ".");
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Check Reachability")) {
+            CheckReachability();
         }
+        if (!reachability_.empty())
+            ImGui::TextWrapped("%s", reachability_.c_str());
+        DrawSearch();
         ImGui::EndPopup();
     }
 }
 
+void MultiMap::CheckReachability() {
+    PalaceSolver solver;
+    solver.Load(mapper_, maps_[start_]);
+    std::vector<bool> reached = solver.Solve(start_, PalaceSolver::Items{
+        pgo_.jump_required(), pgo_.glove_required(), pgo_.fairy_required()});
+
+    // Only report rooms which are part of this palace's map.
+    std::string missing;
+    for(const auto& dl : location_) {
+        int room = dl.first;
+        if (room < int(reached.size()) && !reached[room])
+            absl::StrAppend(&missing, missing.empty() ? "" : ", ", room);
+    }
+    reachability_ = missing.empty()
+        ? "Every room can be reached with the selected items."
+        : absl::StrCat("Rooms which can't be reached with the selected "
+                       "items: ", missing);
+}
+
+void MultiMap::DrawSearch() {
+    ImGui::Separator();
+    ImGui::Text("Seed Search");
+    int n = pso_.seeds();
+    if (ImGui::InputInt("Seeds", &n)) { pso_.set_seeds(std::max(n, 1)); }
+    ImGui::SameLine();
+    int k = pso_.top_k();
+    if (ImGui::InputInt("Keep", &k)) { pso_.set_top_k(std::max(k, 1)); }
+
+    auto* w = pso_.mutable_weight();
+    float weight[] = {
+        float(w->path_length()), float(w->dead_ends()),
+        float(w->elevators()), float(w->bytes()),
+    };
+    if (ImGui::InputFloat4("Weights", weight)) {
+        w->set_path_length(weight[0]);
+        w->set_dead_ends(weight[1]);
+        w->set_elevators(weight[2]);
+        w->set_bytes(weight[3]);
+    }
+    ImGui::Text("Score = weights . (path length, dead ends, elevators, bytes)");
+
+    if (search_ && search_->running()) {
+        ImApp::Get()->Invalidate();
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%d / %d",
+                 search_->done(), search_->total());
+        ImGui::ProgressBar(float(search_->done()) / search_->total(),
+                           ImVec2(300, 0), overlay);
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel")) {
+            search_->Cancel();
+        }
+        return;
+    }
+    if (ImGui::Button("Search")) {
+        if (!search_)
+            search_.reset(new PalaceSearch(mapper_));
+        search_->Start(pgo_, pso_);
+        return;
+    }
+    if (!search_)
+        return;
+
+    // Pick one of the best seeds to generate it into the ROM.
+    ImGui::Columns(6, "results");
+    for(const char* h : {"Seed", "Score", "Path", "Dead Ends",
+                         "Elevators", "Bytes"}) {
+        ImGui::Text("%s", h); ImGui::NextColumn();
+    }
+    ImGui::Separator();
+    for(const auto& f : search_->Results()) {
+        char seed[32];
+        snprintf(seed, sizeof(seed), "%lld", (long long)f.seed);
+        if (ImGui::Selectable(seed, f.seed == pgo_.seed(),
+                              ImGuiSelectableFlags_SpanAllColumns)) {
+            pgo_.set_seed(f.seed);
+            PalaceGenerator pgen(pgo_);
+            pgen.set_mapper(mapper_);
+            if (pgen.Generate()) {
+                Init();
+            } else {
+                reachability_ = absl::StrCat("No solvable palace for seed ",
+                                             pgo_.seed(), ".");
+            }
+        }
+        ImGui::NextColumn();
+        ImGui::Text("%.2f", f.score); ImGui::NextColumn();
+        ImGui::Text("%d", f.path_length); ImGui::NextColumn();
+        ImGui::Text("%d", f.dead_ends); ImGui::NextColumn();
+        ImGui::Text("%d", f.elevators); ImGui::NextColumn();
+        ImGui::Text("%d", f.bytes); ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
+
 bool MultiMap::Draw() {
     if (!visible_)
         return false;
@@ -424,8 +541,11 @@ bool MultiMap::Draw() {
     ImGui::EndChild();
     ImGui::End();
 
-    if (mcfg_->continuous_converge() && !(drag_ && mcfg_->pause_converge()))
-        graph_.Compute(1.0/60.0);
+    if (mcfg_->continuous_converge() && !(drag_ && mcfg_->pause_converge())) {
+        // Keep drawing until the layout settles.
+        if (graph_.Compute(1.0/60.0))
+            ImApp::Get()->Invalidate();
+    }
 
     return false;
 }
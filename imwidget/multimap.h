@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "alg/fdg.h"
+#include "alg/palace_search.h"
 #include "imwidget/glbitmap.h"
 #include "imwidget/imutil.h"
 #include "imwidget/imwidget.h"
@@ -59,6 +60,8 @@ class MultiMap: public ImWindowBase {
     void DrawConnections(const DrawLocation& dl);
     void DrawOne(const DrawLocation& dl);
     void DrawGen();
+    void DrawSearch();
+    void CheckReachability();
     void Traverse(int room, double x, double y, int from, double strength=1.0);
     void Sort();
     void DrawLegend();
@@ -80,6 +83,9 @@ class MultiMap: public ImWindowBase {
 
     MultiMapConfig* mcfg_;
     PalaceGeneratorOptions pgo_;
+    PalaceSearchOptions pso_;
+    std::unique_ptr<PalaceSearch> search_;
+    std::string reachability_;
 
     Vec2 origin_;
     Vec2 absolute_;
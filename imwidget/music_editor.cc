@@ -0,0 +1,265 @@
+#include "imwidget/music_editor.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "imwidget/error_dialog.h"
+#include "imwidget/imapp.h"
+#include "music/synth.h"
+#include "nes/mapper.h"
+#include "nes/music_rom.h"
+#include "imgui.h"
+
+namespace z2util {
+namespace {
+
+using z2music::Note;
+using z2music::Pattern;
+using z2music::Rom;
+
+const Pattern::Channel kChannels[4] = {
+    Pattern::Channel::Pulse1,
+    Pattern::Channel::Pulse2,
+    Pattern::Channel::Triangle,
+    Pattern::Channel::Noise,
+};
+const char* kChannelNames[4] = { "Pulse 1", "Pulse 2", "Triangle", "Noise" };
+
+// Parses whitespace separated numbers in the given base.  Returns false
+// if anything else is in the text.
+bool ParseNumbers(const char* text, int base, std::vector<unsigned long>* v) {
+    v->clear();
+    char* end;
+    for(;;) {
+        while (*text == ' ') text++;
+        if (*text == '\0') return true;
+        unsigned long n = strtoul(text, &end, base);
+        if (end == text) return false;
+        v->push_back(n);
+        text = end;
+    }
+}
+
+}  // namespace
+
+MusicEditor::MusicEditor()
+  : ImWindowBase(false),
+    mapper_(nullptr),
+    synth_(nullptr),
+    changed_(false),
+    song_(0),
+    phrase_(0),
+    mute_{},
+    sequence_{},
+    notes_{} {}
+
+MusicEditor::~MusicEditor() {}
+
+void MusicEditor::Refresh() {
+    rom_.reset(new MusicRom(mapper_));
+    space_.clear();
+    changed_ = false;
+    SelectSong(song_);
+}
+
+z2music::Song* MusicEditor::song() {
+    return rom_->song(static_cast<Rom::SongTitle>(song_));
+}
+
+void MusicEditor::SelectSong(int song) {
+    song_ = song;
+    phrase_ = 0;
+    int len = 0;
+    sequence_[0] = '\0';
+    for(size_t n : this->song()->sequence()) {
+        len += snprintf(sequence_ + len, sizeof(sequence_) - len, "%zu ", n);
+        if (len >= int(sizeof(sequence_))) break;
+    }
+}
+
+bool MusicEditor::Draw() {
+    if (!visible_)
+        return changed_;
+
+    ImGui::Begin("Music", &visible_);
+    if (!rom_) {
+        ImGui::Text("No ROM loaded.");
+        ImGui::End();
+        return changed_;
+    }
+
+    if (ImGui::Button("Commit to ROM")) {
+        Commit();
+    }
+    ImApp::Get()->HelpButton("music", true);
+
+    const char* names[Rom::kSongCount];
+    for(size_t i=0; i<Rom::kSongCount; i++) {
+        names[i] = Rom::song_name(static_cast<Rom::SongTitle>(i));
+    }
+    ImGui::PushItemWidth(200);
+    int title = song_;
+    if (ImGui::Combo("Song", &title, names, Rom::kSongCount)) {
+        SelectSong(title);
+    }
+    ImGui::PopItemWidth();
+
+    if (synth_) {
+        ImGui::SameLine();
+        if (ImGui::Button("Play")) {
+            synth_->play(*song(), true);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Stop")) {
+            synth_->stop();
+        }
+        for(int ch=0; ch<4; ch++) {
+            ImGui::SameLine();
+            if (ImGui::Checkbox(kChannelNames[ch], &mute_[ch])) {
+                synth_->mute(kChannels[ch], mute_[ch]);
+            }
+        }
+    }
+
+    DrawSpace();
+    ImGui::Separator();
+    bool edited = DrawSequence();
+    edited |= DrawPhrase();
+    if (edited) {
+        changed_ = true;
+        space_.clear();
+    }
+    ImGui::End();
+    return changed_;
+}
+
+void MusicEditor::DrawSpace() {
+    // Packing every table only takes a few KB of note data, but there's no
+    // need to do it every frame.
+    if (space_.empty())
+        space_ = rom_->space();
+    for(const auto& t : space_) {
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "%06zx: %zu / %zu bytes (%ld free)",
+                 t.address, t.used, t.capacity,
+                 long(t.capacity) - long(t.used));
+        ImGui::PushStyleColor(ImGuiCol_PlotHistogram,
+                              !t.fits ? ImVec4(0.8, 0.1, 0.1, 1.0)
+                                      : ImVec4(0.1, 0.6, 0.1, 1.0));
+        ImGui::ProgressBar(t.capacity ? float(t.used) / t.capacity : 1.0f,
+                           ImVec2(300, 0), overlay);
+        ImGui::PopStyleColor();
+    }
+}
+
+bool MusicEditor::DrawSequence() {
+    z2music::Song* s = song();
+    bool changed = false;
+
+    ImGui::Text("Sequence of patterns (0 - %d):", int(s->pattern_count()) - 1);
+    ImGui::PushItemWidth(400);
+    if (ImGui::InputText("Sequence", sequence_, sizeof(sequence_))) {
+        std::vector<unsigned long> seq;
+        bool ok = ParseNumbers(sequence_, 10, &seq) && !seq.empty();
+        for(unsigned long n : seq) {
+            ok = ok && n < s->pattern_count();
+        }
+        if (ok) {
+            s->set_sequence(std::vector<size_t>(seq.begin(), seq.end()));
+            phrase_ = std::min(phrase_, int(seq.size()) - 1);
+            changed = true;
+        }
+    }
+    ImGui::PopItemWidth();
+
+    ImGui::Text("Phrase:");
+    for(size_t i=0; i<s->sequence_length(); i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "%zu", s->sequence()[i]);
+        ImGui::PushID(i);
+        ImGui::SameLine();
+        if (ImGui::Selectable(label, int(i) == phrase_, 0, ImVec2(20, 0))) {
+            phrase_ = i;
+        }
+        ImGui::PopID();
+    }
+    return changed;
+}
+
+bool MusicEditor::DrawPhrase() {
+    Pattern* p = song()->at(phrase_);
+    if (p == nullptr)
+        return false;
+    bool changed = false;
+
+    if (synth_) {
+        if (ImGui::Button("Play Phrase")) {
+            synth_->play(*p, true);
+        }
+        ImGui::SameLine();
+    }
+    int tempo = p->tempo();
+    ImGui::PushItemWidth(100);
+    if (ImGui::InputInt("Tempo", &tempo, 1, 8,
+                        ImGuiInputTextFlags_CharsHexadecimal)) {
+        p->tempo(tempo);
+        changed = true;
+    }
+    ImGui::PopItemWidth();
+    ImGui::SameLine();
+    ImGui::Text("Length: %zu quarter notes", p->length() / 96);
+
+    // Each channel is edited as the note bytes the game stores; the
+    // pitches are shown under them.
+    ImGui::PushItemWidth(600);
+    for(int ch=0; ch<4; ch++) {
+        const std::vector<Note> notes = p->notes(kChannels[ch]);
+        // While the text is being edited, ImGui keeps its own copy.
+        int len = 0;
+        notes_[ch][0] = '\0';
+        for(Note n : notes) {
+            len += snprintf(notes_[ch] + len, sizeof(notes_[ch]) - len,
+                            "%02x ", uint8_t(n));
+            if (len >= int(sizeof(notes_[ch]))) break;
+        }
+        ImGui::PushID(ch);
+        if (ImGui::InputText(kChannelNames[ch], notes_[ch], sizeof(notes_[ch]),
+                             ImGuiInputTextFlags_EnterReturnsTrue)) {
+            std::vector<unsigned long> bytes;
+            bool ok = ParseNumbers(notes_[ch], 16, &bytes);
+            std::vector<Note> edited;
+            for(unsigned long b : bytes) {
+                // A zero byte would end the channel early.
+                ok = ok && b != 0 && b < 0x100;
+                edited.emplace_back(uint8_t(b));
+            }
+            if (ok) {
+                p->set_notes(kChannels[ch], edited);
+                changed = true;
+            }
+        }
+        std::string pitches;
+        for(Note n : notes) {
+            pitches += n.pitch_string();
+        }
+        ImGui::TextUnformatted(pitches.c_str());
+        ImGui::PopID();
+    }
+    ImGui::PopItemWidth();
+    return changed;
+}
+
+void MusicEditor::Commit() {
+    if (!rom_->commit()) {
+        ErrorDialog::Spawn("Music Commit Error",
+            "The songs don't fit in the space the ROM has for them.\n"
+            "See the space used by each song table above.");
+        return;
+    }
+    changed_ = false;
+    ImApp::Get()->ProcessMessage("commit", "Music");
+}
+
+}  // namespace z2util
@@ -0,0 +1,51 @@
+#ifndef Z2UTIL_IMWIDGET_MUSIC_EDITOR_H
+#define Z2UTIL_IMWIDGET_MUSIC_EDITOR_H
+#include <memory>
+#include <string>
+#include <vector>
+#include "imwidget/imwidget.h"
+#include "music/music.h"
+
+class Mapper;
+namespace z2music {
+class Synth;
+}
+
+namespace z2util {
+class MusicRom;
+
+class MusicEditor: public ImWindowBase {
+  public:
+    MusicEditor();
+    ~MusicEditor() override;
+
+    bool Draw() override;
+    void Refresh() override;
+
+    inline void set_mapper(Mapper* m) { mapper_ = m; }
+    inline void set_synth(z2music::Synth* s) { synth_ = s; }
+
+  private:
+    z2music::Song* song();
+    void SelectSong(int song);
+    bool DrawSequence();
+    bool DrawPhrase();
+    void DrawSpace();
+    void Commit();
+
+    Mapper* mapper_;
+    z2music::Synth* synth_;
+    std::unique_ptr<MusicRom> rom_;
+    bool changed_;
+    // The space each song table takes, repacked after each edit.
+    std::vector<z2music::Rom::TableSpace> space_;
+    int song_;
+    int phrase_;
+    bool mute_[4];
+    // Text being edited: the sequence and each channel of the phrase.
+    char sequence_[256];
+    char notes_[4][1024];
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_IMWIDGET_MUSIC_EDITOR_H
@@ -1,16 +1,31 @@
+#include <algorithm>
 #include <cstdio>
 #include "imwidget/error_dialog.h"
+#include "imwidget/hwpalette.h"
 #include "imwidget/imapp.h"
 #include "imwidget/neschrview.h"
+#include "proto/rominfo.pb.h"
+#include "util/config.h"
+#include "util/logging.h"
 #include "imgui.h"
+#include "absl/strings/str_cat.h"
 
 #ifdef HAVE_NFD
 #include "nfd.h"
 #endif
 
+namespace {
+const uint32_t kPalette[] = { 0xFF000000, 0xFF666666, 0xFFAAAAAA, 0xFFFFFFFF };
+// Banks per row in the all-banks overview.
+const int kBanksPerRow = 8;
+}  // namespace
+
 NesChrView::NesChrView(int bank)
   : ImWindowBase(false),
-  bank_(bank), mode_(true), grid_(true) {
+  bank_(bank), mode_(true), grid_(true), dirty_(true), palette_(0),
+  subpalette_(0), first_slot_(0), flips_(false), flips_bank_(-1),
+  all_banks_(false) {
+    std::copy(kPalette, kPalette + 4, colors_.begin());
     int sz = grid_ ? 160 : 128;
     bitmap_.reset(new GLBitmap(sz, sz));
 }
@@ -18,7 +33,6 @@ NesChrView::NesChrView(int bank)
 NesChrView::NesChrView() : NesChrView(0) {}
 
 void NesChrView::RenderChr() {
-    uint32_t pal[] = { 0xFF000000, 0xFF666666, 0xFFAAAAAA, 0xFFFFFFFF };
     uint32_t *image = bitmap_->data();
     int tile = 0;
     int inc = mode_ + 1;
@@ -36,18 +50,23 @@ void NesChrView::RenderChr() {
         for(int x=0; x<16; x++, tile+=inc) {
             // Each tile is 8x8 or 8x16
             for(int row=0; row<8*inc; row++) {
-                uint8_t a = mapper_->ReadChrBank(
-                        bank_, 16*(tile + !!(row&8)) + (row & 7));
-                uint8_t b = mapper_->ReadChrBank(
-                        bank_, 16*(tile + !!(row&8)) + (row & 7) + 8);
-                for(int col=0; col<8; col++, a<<=1, b<<=1) {
-                    int color = ((a & 0x80) >> 7) | ((b & 0x80) >> 6);
-                    image[width*(sz*inc*y + row) + sz*x + col] = pal[color];
+                const uint8_t* pixels =
+                    chr_.Tile(bank_, tile + !!(row&8)) + 8*(row & 7);
+                uint32_t* dest = image + width*(sz*inc*y + row) + sz*x;
+                for(int col=0; col<8; col++) {
+                    dest[col] = colors_[pixels[col]];
                 }
             }
         }
     }
     bitmap_->Update();
+
+    dirty_ = false;
+    watch_ = mapper_->changes()->Subscribe(
+        {mapper_->ChrRange(bank_, 0, 0x1000)},
+        [this](const std::vector<ChangeBus::Range>& changed) {
+            dirty_ = true;
+        });
 }
 
 void NesChrView::Export(const std::string& filename) {
@@ -57,43 +76,171 @@ void NesChrView::Export(const std::string& filename) {
     }
 }
 
+std::vector<z2util::ChrImport::SubPalette> NesChrView::SubPalettes() {
+    std::vector<z2util::ChrImport::SubPalette> result;
+    const auto& ri = ConfigLoader<z2util::RomInfo>::GetConfig();
+    int n = 0;
+    for(const auto& group : ri.palettes()) {
+        for(const auto& p : group.palette()) {
+            if (++n != palette_)
+                continue;
+            int length = p.length() ? p.length() : 16;
+            for(int i=0; i+4<=length; i+=4) {
+                z2util::ChrImport::SubPalette sp;
+                for(int c=0; c<4; c++) {
+                    sp[c] = NesHardwarePalette::Get()->palette(
+                            mapper_->Read(p.address(), i + c) & 0x3F);
+                }
+                result.push_back(sp);
+            }
+        }
+    }
+    if (result.empty()) {
+        z2util::ChrImport::SubPalette gray;
+        std::copy(kPalette, kPalette + 4, gray.begin());
+        result.push_back(gray);
+    }
+    return result;
+}
+
 void NesChrView::Import(const std::string& filename) {
-    if (!bitmap_->Load(filename)) {
+    GLBitmap image;
+    if (!image.Load(filename)) {
         ErrorDialog::Spawn("Error Loading File",
                 "There was an error loading ", filename);
         return;
     }
 
-    uint32_t *image = bitmap_->data();
     int tile = 0;
     int inc = mode_ + 1;
     int width = grid_ ? 160 : 128;
     int sz = grid_ ? 10 : 8;
+    if (image.width() != width || image.height() != width) {
+        ErrorDialog::Spawn("Error Loading File",
+                filename, " is ", image.width(), "x", image.height(),
+                ", but this view is ", width, "x", width, ".\n\n"
+                "Use \"Import Tiles\" for tilesets of other sizes.");
+        return;
+    }
 
+    const uint32_t *origin = image.data();
     if (grid_) {
-        image += width*inc + 1;
+        origin += width*inc + 1;
     }
+    // Each tile is quantized to the subpalette closest to its colors.
+    z2util::ChrImport importer(SubPalettes());
+    uint8_t planes[16];
     for(int y=0; y<16/inc; y++) {
         for(int x=0; x<16; x++, tile+=inc) {
             // Each tile is 8x8 or 8x16
-            for(int row=0; row<8*inc; row++) {
-                uint8_t a=0, b=0, bit=0x80;
-                for(int col=0; col<8; col++, bit>>=1) {
-                    uint32_t pixel = image[width*(sz*inc*y + row) + sz*x + col];
-                    uint8_t blue = pixel >> 16, green = pixel >> 8, red = pixel;
-                    int val = (red + green + blue) / (3 * 0x40);
-                    a |= (val & 1) ? bit : 0;
-                    b |= (val & 2) ? bit : 0;
+            for(int half=0; half<inc; half++) {
+                auto t = importer.Quantize(
+                        origin + width*(sz*inc*y + 8*half) + sz*x, width);
+                z2util::ChrImport::Encode(t.pixels, planes);
+                for(int i=0; i<16; i++) {
+                    mapper_->WriteChrBank(bank_, 16*(tile + half) + i,
+                                          planes[i]);
                 }
-                mapper_->WriteChrBank(
-                        bank_, 16*(tile + !!(row&8)) + (row & 7), a);
-                mapper_->WriteChrBank(
-                        bank_, 16*(tile + !!(row&8)) + (row & 7) + 8, b);
             }
         }
     }
 }
 
+bool NesChrView::SpriteBank(int bank) {
+    const auto& ri = ConfigLoader<z2util::RomInfo>::GetConfig();
+    auto uses = [bank](const z2util::ItemInfo& info) {
+        for(const auto& it : info.info()) {
+            int chr = it.second.has_chr() ? it.second.chr().bank()
+                                          : info.chr().bank();
+            // 8x16 sprites take their odd tiles from the next bank.
+            if (bank == chr || bank == chr + 1)
+                return true;
+        }
+        return false;
+    };
+    if (uses(ri.items()))
+        return true;
+    for(const auto& e : ri.enemies()) {
+        if (uses(e))
+            return true;
+    }
+    return false;
+}
+
+void NesChrView::ImportTiles(const std::string& filename) {
+    GLBitmap image;
+    if (!image.Load(filename)) {
+        ErrorDialog::Spawn("Error Loading File",
+                "There was an error loading ", filename);
+        return;
+    }
+
+    z2util::ChrImport importer(SubPalettes());
+    auto tiles = importer.Quantize(image.data(), image.width(),
+                                   image.height());
+    std::vector<z2util::ChrImport::Placement> placements;
+    if (!z2util::ChrImport::Place(mapper_, bank_, first_slot_, tiles, flips_,
+                                  &placements)) {
+        ErrorDialog::Spawn("Import Error",
+                "The tiles in ", filename, " don't fit in slots ",
+                absl::Hex(first_slot_, absl::kZeroPad2), "-ff.");
+        return;
+    }
+
+    // Where each tile went, for updating whatever refers to them.
+    int written = 0;
+    std::string where;
+    int columns = image.width() / 8;
+    for(size_t i=0; i<placements.size(); i++) {
+        const auto& p = placements[i];
+        written += p.written;
+        absl::StrAppend(&where, i / columns, ",", i % columns, ": ",
+                        absl::Hex(p.slot, absl::kZeroPad2),
+                        p.hflip ? " hflip" : "", p.vflip ? " vflip" : "",
+                        " subpalette ", tiles[i].subpalette, "\n");
+    }
+    LOG(INFO, "Imported ", filename, " to bank ", bank_, ":\n", where);
+    ImGui::SetClipboardText(where.c_str());
+    ErrorDialog::Spawn("Import Tiles",
+            ErrorDialog::OK,
+            "Imported ", placements.size(), " tiles into ", written,
+            " new slots.\n\n"
+            "Where each tile went (row,column: slot) was copied to the "
+            "clipboard.");
+}
+
+void NesChrView::MakePalettes() {
+    const auto& ri = ConfigLoader<z2util::RomInfo>::GetConfig();
+    std::vector<std::string> names = {"Grayscale"};
+    for(const auto& group : ri.palettes()) {
+        for(const auto& p : group.palette()) {
+            names.push_back(absl::StrCat(group.name(), ": ", p.name()));
+        }
+    }
+    std::vector<const char*> lptrs;
+    for(const auto& n : names) {
+        lptrs.push_back(n.c_str());
+    }
+    ImGui::PushItemWidth(300);
+    ImGui::Combo("Palette", &palette_, lptrs.data(), lptrs.size());
+    ImGui::PopItemWidth();
+    ImGui::SameLine();
+    ImGui::PushItemWidth(100);
+    ImGui::InputInt("Subpalette", &subpalette_);
+    ImGui::PopItemWidth();
+
+    // The palette is read every frame, so edits to it show right away.
+    auto subpalettes = SubPalettes();
+    subpalette_ = std::max(0, std::min(subpalette_,
+                                       int(subpalettes.size()) - 1));
+    if (colors_ != subpalettes[subpalette_]) {
+        colors_ = subpalettes[subpalette_];
+        dirty_ = true;
+        // The overview is drawn again from scratch.
+        uploaded_.assign(uploaded_.size(), 0);
+    }
+}
+
 void NesChrView::MakeLabels() {
     const char *lptrs[256];
     int i;
@@ -105,10 +252,77 @@ void NesChrView::MakeLabels() {
     }
     nr_labels_ = i;
     ImGui::PushItemWidth(200);
-    ImGui::Combo("Bank", &bank_, lptrs, nr_labels_);
+    dirty_ |= ImGui::Combo("Bank", &bank_, lptrs, nr_labels_);
     ImGui::PopItemWidth();
 }
 
+void NesChrView::DrawAllBanks() {
+    const int tiles = chr_.tiles();
+    const int banks = tiles / 256;
+    const int width = kBanksPerRow * 128;
+    const int height = (banks + kBanksPerRow - 1) / kBanksPerRow * 128;
+    if (height == 0)
+        return;
+    if (!overview_ || overview_->height() != height) {
+        overview_.reset(new GLBitmap(width, height));
+        uploaded_.assign(tiles, 0);
+    }
+
+    std::vector<int> dirty;
+    for(int i=0; i<tiles; i++) {
+        if (uploaded_[i] != chr_.generation(i))
+            dirty.push_back(i);
+    }
+    auto position = [](int i, int* x, int* y) {
+        int bank = i / 256, tile = i % 256;
+        *x = (bank % kBanksPerRow) * 128 + (tile % 16) * 8;
+        *y = (bank / kBanksPerRow) * 128 + (tile / 16) * 8;
+    };
+    for(int i : dirty) {
+        int x, y;
+        position(i, &x, &y);
+        const uint8_t* pixels = chr_.Tile(i);
+        for(int row=0; row<8; row++) {
+            uint32_t* dest = overview_->data() + (y + row) * width + x;
+            for(int col=0; col<8; col++) {
+                dest[col] = colors_[pixels[row*8 + col]];
+            }
+        }
+        uploaded_[i] = chr_.generation(i);
+    }
+    // Past a point, one upload is cheaper than many small ones.
+    if (dirty.size() > size_t(tiles / 16)) {
+        overview_->Update();
+    } else {
+        for(int i : dirty) {
+            int x, y;
+            position(i, &x, &y);
+            overview_->Update(x, y, 8, 8);
+        }
+    }
+
+    ImGui::BeginChild("banks", ImVec2(0, 0), false,
+                      ImGuiWindowFlags_HorizontalScrollbar);
+    overview_->Draw();
+    if (ImGui::IsItemHovered()) {
+        ImVec2 pos = ImGui::GetMousePos();
+        ImVec2 min = ImGui::GetItemRectMin();
+        int x = int(pos.x - min.x), y = int(pos.y - min.y);
+        int bank = (y / 128) * kBanksPerRow + x / 128;
+        int tile = (y % 128) / 8 * 16 + (x % 128) / 8;
+        if (bank < banks) {
+            ImGui::SetTooltip("Bank %02x tile %02x", bank, tile);
+            if (ImGui::IsMouseClicked(0)) {
+                // Show the bank by itself.
+                bank_ = bank;
+                all_banks_ = false;
+                dirty_ = true;
+            }
+        }
+    }
+    ImGui::EndChild();
+}
+
 bool NesChrView::Draw() {
     if (!visible_)
         return false;
@@ -116,24 +330,35 @@ bool NesChrView::Draw() {
 
     int sz = grid_ ? 10 : 8;
     ImGui::Begin("CHR Viewer", &visible_);
+    ImGui::Checkbox("All Banks", &all_banks_);
+    ImGui::SameLine();
+    MakePalettes();
+    if (all_banks_) {
+        ImApp::Get()->HelpButton("chr-viewer", true);
+        DrawAllBanks();
+        ImGui::End();
+        return false;
+    }
+    ImGui::SameLine();
     MakeLabels();
 
     ImGui::SameLine();
     ImGui::PushItemWidth(100);
-    ImGui::Combo("Mode", &mode_, "8x8\0008x16\000\0");
+    dirty_ |= ImGui::Combo("Mode", &mode_, "8x8\0008x16\000\0");
     ImGui::PopItemWidth();
 
     ImGui::SameLine();
     if (ImGui::Checkbox("Grid", &grid_)) {
         sz = grid_ ? 10 : 8;
         bitmap_.reset(new GLBitmap(16*sz, 16*sz));
+        dirty_ = true;
     }
 
 #ifdef HAVE_NFD
     ImGui::SameLine();
     if (ImGui::Button("Export")) {
         char *filename = nullptr;
-        auto result = NFD_SaveDialog("bmp", nullptr, &filename);
+        auto result = NFD_SaveDialog("png;bmp", nullptr, &filename);
         if (result == NFD_OKAY) {
             Export(filename);
         }
@@ -142,12 +367,34 @@ bool NesChrView::Draw() {
     ImGui::SameLine();
     if (ImGui::Button("Import")) {
         char *filename = nullptr;
-        auto result = NFD_OpenDialog("bmp", nullptr, &filename);
+        auto result = NFD_OpenDialog("png;bmp", nullptr, &filename);
         if (result == NFD_OKAY) {
             Import(filename);
         }
         free(filename);
     }
+    ImGui::SameLine();
+    if (ImGui::Button("Import Tiles")) {
+        char *filename = nullptr;
+        auto result = NFD_OpenDialog("png;bmp", nullptr, &filename);
+        if (result == NFD_OKAY) {
+            ImportTiles(filename);
+        }
+        free(filename);
+    }
+    ImGui::SameLine();
+    ImGui::PushItemWidth(100);
+    if (ImGui::InputInt("First Slot", &first_slot_, 1, 16,
+                        ImGuiInputTextFlags_CharsHexadecimal)) {
+        first_slot_ = std::max(0, std::min(first_slot_, 0xFF));
+    }
+    ImGui::PopItemWidth();
+    if (flips_bank_ != bank_) {
+        flips_ = SpriteBank(bank_);
+        flips_bank_ = bank_;
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox("Reuse Flipped", &flips_);
 #endif
 
     ImApp::Get()->HelpButton("chr-viewer", true);
@@ -174,7 +421,7 @@ bool NesChrView::Draw() {
     }
 
     // Render the CHR image
-    RenderChr();
+    if (dirty_) RenderChr();
     ImGui::SetCursorPosY(y);
     bitmap_->Draw(sz*4*16, sz*4*16);
     ImGui::EndGroup();
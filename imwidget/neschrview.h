@@ -3,6 +3,8 @@
 #include <memory>
 #include <vector>
 
+#include "nes/chr_cache.h"
+#include "nes/chr_import.h"
 #include "nes/mapper.h"
 #include "imwidget/glbitmap.h"
 #include "imwidget/imwidget.h"
@@ -16,11 +18,25 @@ class NesChrView: public ImWindowBase {
     void RenderChr8x8();
     void RenderChr8x16();
     void MakeLabels();
+    void MakePalettes();
+    void DrawAllBanks();
     bool Draw();
-    inline void set_mapper(Mapper* mapper) { mapper_ = mapper; }
+    inline void set_mapper(Mapper* mapper) {
+        mapper_ = mapper;
+        chr_.set_mapper(mapper);
+        dirty_ = true;
+    }
     void Export(const std::string& filename);
     void Import(const std::string& filename);
+    // Imports a tileset of any size, writing only the tiles which aren't
+    // already in the bank, starting at first_slot_.
+    void ImportTiles(const std::string& filename);
   private:
+    // The subpalettes of the selected palette, as RGBA colors.
+    std::vector<z2util::ChrImport::SubPalette> SubPalettes();
+    // Whether the config draws items or enemies from the bank.
+    static bool SpriteBank(int bank);
+
     Mapper* mapper_;
     int bank_;
     std::unique_ptr<GLBitmap> bitmap_;
@@ -28,6 +44,25 @@ class NesChrView: public ImWindowBase {
     int nr_labels_;
     int mode_;
     bool grid_;
+    // The bitmap is only re-rendered when the view or its CHR changes.
+    bool dirty_;
+    ChangeBus::Subscription watch_;
+    z2util::ChrCache chr_;
+    // 0 for grayscale, else the palettes in the config, in order, from 1.
+    int palette_;
+    int subpalette_;
+    z2util::ChrImport::SubPalette colors_;
+    int first_slot_;
+    // Whether Import Tiles may reuse flipped tiles.  It defaults to on
+    // only for sprite banks, and is reset when flips_bank_ isn't bank_.
+    bool flips_;
+    int flips_bank_;
+
+    // Every bank at once.  Only the tiles whose CHR changed since they
+    // were last uploaded are uploaded again.
+    bool all_banks_;
+    std::unique_ptr<GLBitmap> overview_;
+    std::vector<uint32_t> uploaded_;
 };
 
 #endif // Z2UTIL_IMWIDGET_NESCHRVIEW_H
@@ -52,7 +52,7 @@ bool Project::Draw() {
         auto rom = ZLib::Uncompress(project_.history(selection_).rom());
         if (rom.ok()) {
             cartridge_->LoadRom(rom.ValueOrDie());
-            ImApp::Get()->ProcessMessage("loadpostprocess",
+            ImApp::Get()->ProcessMessage("restorepostprocess",
                     reinterpret_cast<void*>(0));
         }
     }
@@ -1,17 +1,33 @@
 #include "imwidget/randomize.h"
 
+#include <algorithm>
+#include <map>
+#include <vector>
+
 #include "imgui.h"
 #include "alg/terrain.h"
+#include "gflags/gflags.h"
+#include "imwidget/imapp.h"
 #include "imwidget/map_connect.h"
 #include "proto/rominfo.pb.h"
 #include "util/config.h"
 #include "util/stb_tilemap_editor.h"
 
+DECLARE_bool(hackjam2020);
+DECLARE_bool(compress_boulders);
+
 namespace z2util {
 
 RandomizeOverworld::RandomizeOverworld()
-  : random_params_{0, true, 0.03f, Terrain::MOUNTAINS, Terrain::SAND}
-{}
+  : random_params_{0, false, true, 0.03f, Terrain::MOUNTAINS, Terrain::SAND, 4},
+  world_preview_(false)
+{
+    ogo_.set_seeds(200);
+    ogo_.set_noise_zoom(0.1);
+    ogo_.set_min_spacing(4);
+    ogo_.set_carve_cost(8);
+    ogo_.set_top_k(10);
+}
 
 void RandomizeOverworld::InitParams(stbte_tilemap* editor) {
     if (random_params_.initialized)
@@ -27,7 +43,9 @@ void RandomizeOverworld::InitParams(stbte_tilemap* editor) {
         random_params_.y1 = height - 1;
     }
     random_params_.initialized = true;
+    random_params_.generated = false;
     random_params_.keep = false;
+    world_preview_ = false;
     SaveMap(editor);
 }
 
@@ -51,7 +69,109 @@ void RandomizeOverworld::RestoreMap(stbte_tilemap* editor) {
     }
 }
 
-bool RandomizeOverworld::Draw(stbte_tilemap* editor, OverworldConnectorList* connections) {
+void RandomizeOverworld::DrawWorld(stbte_tilemap* editor,
+                                   OverworldConnectorList* connections,
+                                   int max_length) {
+    int n = ogo_.seeds();
+    ImGui::PushItemWidth(100);
+    if (ImGui::InputInt("Seeds", &n)) { ogo_.set_seeds(std::max(n, 1)); }
+    ImGui::SameLine();
+    n = ogo_.min_spacing();
+    if (ImGui::InputInt("Spacing", &n)) { ogo_.set_min_spacing(std::max(n, 1)); }
+    ImGui::SameLine();
+    n = ogo_.carve_cost();
+    if (ImGui::InputInt("Carve Cost", &n)) { ogo_.set_carve_cost(std::max(n, 1)); }
+    ImGui::PopItemWidth();
+    float zoom = ogo_.noise_zoom();
+    if (ImGui::SliderFloat("World NoiseZoom", &zoom, 0.0f, 1.0f)) {
+        ogo_.set_noise_zoom(zoom);
+    }
+
+    if (search_ && search_->running()) {
+        ImApp::Get()->Invalidate();
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%d / %d",
+                 search_->done(), search_->total());
+        ImGui::ProgressBar(float(search_->done()) / search_->total(),
+                           ImVec2(300, 0), overlay);
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel Search")) {
+            search_->Cancel();
+        }
+        return;
+    }
+    if (ImGui::Button("Search")) {
+        const auto& misc = ConfigLoader<RomInfo>::GetConfig().misc();
+        ogo_.set_seed(random_params_.seed);
+        ogo_.set_width(misc.overworld_width());
+        ogo_.set_height(misc.overworld_height());
+        ogo_.set_max_length(max_length);
+        ogo_.set_hackjam(FLAGS_hackjam2020);
+        ogo_.set_compress_boulders(FLAGS_compress_boulders);
+        // Connectors sharing a spot move together.  The sites are in
+        // connector order, so the first site (the start) holds connector 0.
+        ogo_.clear_site();
+        std::map<std::pair<int, int>, OverworldSite*> spot;
+        for(int i=0; i<connections->size(); i++) {
+            int x, y;
+            connections->GetXY(i, &x, &y);
+            if (x < 0 || y < 0 || x >= ogo_.width() || y >= ogo_.height())
+                continue;
+            auto*& site = spot[std::make_pair(x, y)];
+            if (!site) {
+                site = ogo_.add_site();
+                site->set_tile(random_params_.backup[y][x]);
+                site->set_fixed(connections->NoCompress(x, y) !=
+                                OverworldConnectorList::ST_NONE);
+            }
+            site->add_connector(i);
+        }
+        if (!search_)
+            search_.reset(new OverworldSearch);
+        search_->Start(ogo_);
+        return;
+    }
+    if (!search_)
+        return;
+
+    ImGui::Columns(4, "world");
+    for(const char* h : {"Seed", "Fits", "Bytes", "Carved"}) {
+        ImGui::Text("%s", h); ImGui::NextColumn();
+    }
+    ImGui::Separator();
+    for(const auto& r : search_->Results()) {
+        char seed[32];
+        snprintf(seed, sizeof(seed), "%lld", (long long)r.seed);
+        if (ImGui::Selectable(seed, world_preview_ && r.seed == world_.seed,
+                              ImGuiSelectableFlags_SpanAllColumns)) {
+            world_ = r;
+            world_preview_ = true;
+            for(int y=0; y<r.height; y++) {
+                for(int x=0; x<r.width; x++) {
+                    stbte_set_tile(editor, x, y, 0, r.tile[y * r.width + x]);
+                }
+            }
+        }
+        ImGui::NextColumn();
+        ImGui::Text("%s", !r.placed ? "no room" : r.fits ? "yes" : "no");
+        ImGui::NextColumn();
+        ImGui::Text("%d", r.bytes); ImGui::NextColumn();
+        ImGui::Text("%d", r.carved); ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
+
+void RandomizeOverworld::ApplyWorld(OverworldConnectorList* connections) {
+    for(int s=0; s<int(world_.site.size()); s++) {
+        for(int c : ogo_.site(s).connector()) {
+            connections->Move(c, world_.site[s].first, world_.site[s].second);
+        }
+    }
+}
+
+bool RandomizeOverworld::Draw(stbte_tilemap* editor,
+                              OverworldConnectorList* connections,
+                              int max_length) {
     bool changed = false;
     const char * algorithms = "Perlin\0Cellular\0Voronoi\0Manhattan\0\0";
     const char * terrains = "Town\0Cave\0Palace\0Bridge\0Sand\0Grass\0Forest\0Swamp\0Graveyard\0Road\0Lava\0Mountain\0Water\0Walk-Water\0Boulder\0Spider\0\0";
@@ -60,22 +180,25 @@ bool RandomizeOverworld::Draw(stbte_tilemap* editor, OverworldConnectorList* con
         InitParams(editor);
         ImGui::Text("Randomize Overworld Map");
 
+        // Only regenerate when a parameter changes, so dragging a slider
+        // redraws just once per step.
+        bool dirty = !random_params_.generated;
         ImGui::PushItemWidth(100);
-        ImGui::InputInt("x0", &random_params_.x0);
+        dirty |= ImGui::InputInt("x0", &random_params_.x0);
         ImGui::SameLine();
-        ImGui::InputInt("x1", &random_params_.x1);
+        dirty |= ImGui::InputInt("x1", &random_params_.x1);
 
-        ImGui::InputInt("y0", &random_params_.y0);
+        dirty |= ImGui::InputInt("y0", &random_params_.y0);
         ImGui::SameLine();
-        ImGui::InputInt("y1", &random_params_.y1);
+        dirty |= ImGui::InputInt("y1", &random_params_.y1);
 
-        ImGui::InputInt("cx", &random_params_.centerx);
+        dirty |= ImGui::InputInt("cx", &random_params_.centerx);
         ImGui::SameLine();
-        ImGui::InputInt("cy", &random_params_.centery);
+        dirty |= ImGui::InputInt("cy", &random_params_.centery);
         ImGui::PopItemWidth();
 
-        ImGui::Combo("Algorithm", &random_params_.algorithm, algorithms);
-        ImGui::InputInt("Seed", &random_params_.seed);
+        dirty |= ImGui::Combo("Algorithm", &random_params_.algorithm, algorithms);
+        dirty |= ImGui::InputInt("Seed", &random_params_.seed);
 
         int x0 = random_params_.x0;
         int y0 = random_params_.y0;
@@ -88,37 +211,54 @@ bool RandomizeOverworld::Draw(stbte_tilemap* editor, OverworldConnectorList* con
         auto terrain = Terrain::New(alg);
         terrain->SetSize(x1-x0+1, y1-y0+1);
         if (alg == Terrain::PERLIN) {
-            ImGui::SliderFloat("NoiseZoom", &random_params_.p, 0.0f, 1.0f);
+            dirty |= ImGui::SliderFloat("NoiseZoom", &random_params_.p, 0.0f, 1.0f);
             static_cast<PerlinTerrain*>(terrain.get())->set_noise_zoom(random_params_.p);
             cx += x0 + (x1-x0) / 2;
             cy += y0 + (y1-y0) / 2;
         } else if (alg == Terrain::CELLULAR) {
-            ImGui::SliderFloat("Probability", &random_params_.p, 0.0f, 1.0f);
+            dirty |= ImGui::SliderFloat("Probability", &random_params_.p, 0.0f, 1.0f);
             ImGui::PushItemWidth(100);
-            ImGui::Combo("BG", &random_params_.bg, terrains);
+            dirty |= ImGui::Combo("BG", &random_params_.bg, terrains);
             ImGui::SameLine();
-            ImGui::Combo("FG", &random_params_.fg, terrains);
+            dirty |= ImGui::Combo("FG", &random_params_.fg, terrains);
+            dirty |= ImGui::InputInt("Iterations", &random_params_.iterations);
             ImGui::PopItemWidth();
             static_cast<CellularTerrain*>(terrain.get())->set_probability(random_params_.p);
+            static_cast<CellularTerrain*>(terrain.get())->set_iterations(random_params_.iterations);
             static_cast<CellularTerrain*>(terrain.get())->set_bg(random_params_.bg);
             static_cast<CellularTerrain*>(terrain.get())->set_fg(random_params_.fg);
         } else if (alg == Terrain::VORONOI || alg == Terrain::MANHATTAN) {
-            ImGui::SliderFloat("NumPoints", &random_params_.p, 0.0f, 200.0f);
+            dirty |= ImGui::SliderFloat("NumPoints", &random_params_.p, 0.0f, 200.0f);
             static_cast<VoronoiTerrain*>(terrain.get())->set_num(int(random_params_.p));
         }
 
-        ImGui::Checkbox("Keep Transfer Tiles", &random_params_.keep_transfer_tiles);
-        terrain->Generate(unsigned(random_params_.seed));
-        for(int y=y0; y<=y1; y++) {
-            for(int x=x0; x<=x1; x++) {
-                stbte_set_tile(editor, x, y, 0, terrain->GetTile(x-x0-cx, y-y0-cy));
-                if (random_params_.keep_transfer_tiles
-                    && connections->GetAtXY(x, y)) {
-                    stbte_set_tile(editor, x, y, 0, random_params_.backup[y][x]);
+        dirty |= ImGui::Checkbox("Keep Transfer Tiles", &random_params_.keep_transfer_tiles);
+        // Changing the region parameters replaces a whole overworld preview.
+        if (dirty)
+            world_preview_ = false;
+        if (dirty && x1 >= x0 && y1 >= y0) {
+            int w = x1 - x0 + 1;
+            std::vector<uint8_t> tiles(w * (y1 - y0 + 1));
+            terrain->Generate(unsigned(random_params_.seed));
+            terrain->GetTiles(-cx, -cy, w, y1 - y0 + 1, tiles.data());
+            for(int y=y0; y<=y1; y++) {
+                for(int x=x0; x<=x1; x++) {
+                    int tile = tiles[(y - y0) * w + x - x0];
+                    if (random_params_.keep_transfer_tiles
+                        && connections->GetAtXY(x, y)) {
+                        tile = random_params_.backup[y][x];
+                    }
+                    stbte_set_tile(editor, x, y, 0, tile);
                 }
             }
+            random_params_.generated = true;
+        }
+        if (ImGui::CollapsingHeader("Whole Overworld")) {
+            DrawWorld(editor, connections, max_length);
         }
         if (ImGui::Button("Apply")) {
+            if (world_preview_)
+                ApplyWorld(connections);
             ImGui::CloseCurrentPopup();
             random_params_.keep = true;
             changed = true;
@@ -1,6 +1,10 @@
 #ifndef Z2UTIL_IMWIDGET_RANDOMIZE_H
 #define Z2UTIL_IMWIDGET_RANDOMIZE_H
 #include <cstdint>
+#include <memory>
+
+#include "alg/overworld_gen.h"
+#include "proto/generator.pb.h"
 
 typedef struct stbte_tilemap stbte_tilemap;
 namespace z2util {
@@ -9,17 +13,25 @@ class OverworldConnectorList;
 class RandomizeOverworld {
   public:
     RandomizeOverworld();
-    bool Draw(stbte_tilemap* editor, OverworldConnectorList* connections);
+    bool Draw(stbte_tilemap* editor, OverworldConnectorList* connections,
+              int max_length);
   private:
+    // Generate whole overworlds, connectors included, and preview the
+    // chosen one.
+    void DrawWorld(stbte_tilemap* editor, OverworldConnectorList* connections,
+                   int max_length);
+    void ApplyWorld(OverworldConnectorList* connections);
     void InitParams(stbte_tilemap* editor);
     void SaveMap(stbte_tilemap* editor);
     void RestoreMap(stbte_tilemap* editor);
     struct RandomParams {
         bool initialized;
+        bool generated;
         bool keep_transfer_tiles;
         float p;
         int bg;
         int fg;
+        int iterations;
         int algorithm;
         int seed;
         int x0;
@@ -32,6 +44,12 @@ class RandomizeOverworld {
         uint8_t backup[100][64];
     };
     RandomParams random_params_;
+
+    OverworldGeneratorOptions ogo_;
+    std::unique_ptr<OverworldSearch> search_;
+    // The whole overworld being previewed, if any.
+    bool world_preview_;
+    OverworldGenerator::Result world_;
 };
 }  // namespace z2util
 #endif // Z2UTIL_IMWIDGET_RANDOMIZE_H
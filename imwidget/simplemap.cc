@@ -4,6 +4,7 @@
 #include "imwidget/imapp.h"
 #include "imwidget/imutil.h"
 #include "imwidget/error_dialog.h"
+#include "nes/chr_draw.h"
 #include "util/config.h"
 #include "absl/strings/str_cat.h"
 
@@ -16,6 +17,7 @@ namespace z2util {
 SimpleMap::SimpleMap()
   : ImWindowBase(false),
     changed_(false),
+    reload_(false),
     object_box_(true),
     enemy_box_(true),
     avail_box_(true),
@@ -158,6 +160,12 @@ bool SimpleMap::Draw() {
     if (!visible_)
         return changed_;
 
+    if (reload_) {
+        reload_ = false;
+        // Don't throw away edits which haven't been committed.
+        if (!changed_) SetMap(map_);
+    }
+
     ImGui::SetNextWindowSize(ImVec2(1024, 700), ImGuiCond_FirstUseEver);
     ImGui::Begin(window_title_.c_str(), &visible_);
     const auto& ri = ConfigLoader<RomInfo>::GetConfig();
@@ -319,10 +327,7 @@ void SimpleMap::SetMap(const z2util::Map& map, int mapsel) {
     cache_.Init(map);
 
     items_.set_mapper(mapper_);
-    Address ipal;
-    // FIXME(cfrantz): hardcoded palette location
-    ipal.set_bank(decomp_.palette().bank());
-    ipal.set_address(0x809e);
+    Address ipal = ChrDraw::ItemPalette(decomp_.palette().bank());
     items_.Init(ri.items());
     items_.set_palette(ipal);
 
@@ -336,8 +341,7 @@ void SimpleMap::SetMap(const z2util::Map& map, int mapsel) {
         enemy_.set_use_iteminfo_chr(true);
     } else {
         // Use the CHR banks associated with this map.
-        Address chr;
-        chr.set_bank(cache_.chr().bank() & ~1);
+        Address chr = ChrDraw::SpriteChr(cache_.chr());
         items_.set_chr(chr);
         enemy_.set_chr(chr);
     }
@@ -359,6 +363,19 @@ void SimpleMap::SetMap(const z2util::Map& map, int mapsel) {
         swapper_.set_map(map);
     }
     changed_ = false;
+    Watch();
+}
+
+void SimpleMap::Watch() {
+    std::vector<ChangeBus::Range> ranges;
+    if (map_.pointer().address()) {
+        ranges.push_back(mapper_->PrgRange(map_.pointer(), 2));
+    }
+    ranges.push_back(mapper_->PrgRange(decomp_.address(), decomp_.length()));
+    watch_ = mapper_->changes()->Subscribe(ranges,
+        [this](const std::vector<ChangeBus::Range>& changed) {
+            reload_ = true;
+        });
 }
 
 }  // namespace z2util
@@ -28,7 +28,11 @@ class SimpleMap: public ImWindowBase {
     void RenderToBuffer(GLBitmap *buffer);
     std::unique_ptr<GLBitmap> RenderToNewBuffer();
   private:
+    // Re-decompresses the map when its data in the ROM changes.
+    void Watch();
+
     bool changed_;
+    bool reload_;
     bool object_box_;
     bool enemy_box_;
     bool avail_box_;
@@ -55,6 +59,7 @@ class SimpleMap: public ImWindowBase {
     Z2ObjectCache cache_;
     Z2ObjectCache items_;
     Z2ObjectCache enemy_;
+    ChangeBus::Subscription watch_;
     static const uint32_t RED    = 0xFF0000FF;
     static const uint8_t ELEVATOR = 0xEE;
 };
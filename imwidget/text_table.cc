@@ -19,19 +19,13 @@ void TextTableEditor::Init() {
     Load();
 }
 
-int TextTableEditor::TotalLength() {
-    int other = 1 - world_;
-    int i;
-    int total = 0;
-    // Count up size of strings in the other world.
-    for(i=0; i<pack_.Length(other); ++i) {
-        total += pack_.Get(other, i).size() + 1;
-    }
-    // Count up size of strings actively under edit.
-    for(i=0; i<pack_.Length(world_); ++i) {
-        total += strlen(data_[i]) + 1;
+int TextTableEditor::TotalLength(int* saved) {
+    // Update the pack with the strings actively under edit and ask it how
+    // much space they'd need once duplicates and common suffixes are shared.
+    for(int i=0; i<pack_.Length(world_); ++i) {
+        pack_.Set(world_, i, data_[i]);
     }
-    return total;
+    return pack_.PackedLength(saved);
 }
 
 bool TextTableEditor::Draw() {
@@ -62,6 +56,15 @@ bool TextTableEditor::Draw() {
     }
     ImGui::PopItemWidth();
 
+    if (tt.has_compression()) {
+        ImGui::SameLine();
+        bool compress = pack_.compress();
+        if (ImGui::Checkbox("Compress", &compress)) {
+            pack_.set_compress(compress);
+            changed_ = dirty_ = true;
+        }
+    }
+
     ImGui::SameLine();
     if (ImGui::Button("Commit to ROM")) {
         Save();
@@ -69,9 +72,14 @@ bool TextTableEditor::Draw() {
     }
     ImApp::Get()->HelpButton("texttable", true);
 
-    ImGui::Text("Space available: %d bytes (%d / %d used)",
-            tt.text_data().length() - TotalLength(),
-            TotalLength(), tt.text_data().length());
+    // Packing (and compressing) the text is too slow to do every frame.
+    if (dirty_) {
+        total_ = TotalLength(&saved_);
+        dirty_ = false;
+    }
+    ImGui::Text("Space available: %d bytes (%d / %d used, %d shared)",
+            pack_.Capacity() - total_,
+            total_, pack_.Capacity(), saved_);
 
     ImGui::BeginChild("texttable", ImVec2(0, 0), true);
     int len = pack_.Length(world_);
@@ -79,7 +87,9 @@ bool TextTableEditor::Draw() {
         ImGui::PushID(i);
         ImGui::Text("%3d: ", i);
         ImGui::SameLine();
-        changed_ |= ImGui::InputText("##text", data_[i], sizeof(data_[0]));
+        if (ImGui::InputText("##text", data_[i], sizeof(data_[0]))) {
+            changed_ = dirty_ = true;
+        }
         ImGui::PopID();
     }
     ImGui::EndChild();
@@ -100,10 +110,10 @@ void TextTableEditor::Load() {
         memcpy(data_[i], s.data(), s.size());
     }
     changed_ = false;
+    dirty_ = true;
 }
 
 void TextTableEditor::Save() {
-    const auto& tt = ConfigLoader<RomInfo>::GetConfig().text_table();
     int len = pack_.Length(world_);
     for(int i=0; i<len; i++) {
         pack_.Set(world_, i, data_[i]);
@@ -112,7 +122,7 @@ void TextTableEditor::Save() {
         ErrorDialog::Spawn("Error Saving Text Table",
                 "Failed to save the text table.  You probably\n"
                 "have too much text.  Adjust your text to have\n"
-                "fewer than ", tt.text_data().length(), " bytes.");
+                "fewer than ", pack_.Capacity(), " bytes.");
                 
         return;
     }
@@ -10,11 +10,12 @@ namespace z2util {
 class TextTableEditor: public ImWindowBase {
   public:
     TextTableEditor()
-        : ImWindowBase(false), mapper_(nullptr), changed_(false), world_(0) {}
+        : ImWindowBase(false), mapper_(nullptr), changed_(false),
+          dirty_(true), world_(0), total_(0), saved_(0) {}
     void Init();
     void Refresh() override { Init(); }
     bool Draw() override;
-    int TotalLength();
+    int TotalLength(int* saved=nullptr);
 
     inline void set_mapper(Mapper* m) { mapper_ = m; }
   private:
@@ -24,7 +25,10 @@ class TextTableEditor: public ImWindowBase {
 
     Mapper* mapper_;
     bool changed_;
+    bool dirty_;
     int world_;
+    int total_;
+    int saved_;
     TextListPack pack_;
     const static int MAX_STRINGS = 128;
     char data_[MAX_STRINGS][128];
@@ -1,9 +1,12 @@
 #include <cstdio>
+#include <set>
 #include <string>
+#include <vector>
 #include <gflags/gflags.h>
 #include <SDL2/SDL.h>
 
 #include "app.h"
+#include "batch.h"
 #include "util/config.h"
 #include "zelda2_config.h"
 
@@ -14,6 +17,12 @@ DEFINE_bool(move_from_keepout, true, "Move maps out of known keepout areas");
 DEFINE_bool(reminder_dialogs, true, "Pop up dialogs for discarding changes");
 DECLARE_int32(bank5_enemy_list_size);
 DEFINE_bool(hackjam2020, false, "Turn on features for hackjam2020");
+DEFINE_bool(headless, false, "Run the scripts without a window, then exit");
+DEFINE_string(output, "", "With --headless, save the result to this file");
+DEFINE_string(batch_script, "", "Run this script against every ROM given");
+DEFINE_string(batch_rom, "", "Run every script given against this ROM");
+DEFINE_string(outdir, ".", "Output directory for batch runs");
+DEFINE_int32(jobs, 0, "Number of batch or atlas workers (0 = one per cpu)");
 
 ConfigLoader<z2util::OverworldEditorKeybinds>* keybinds;
 
@@ -131,8 +140,37 @@ Flags:
   --hidpi <n>                Set the scaling factor on hidpi displays (try 2.0)
   --emulator <prog>          Emulator to run for File | Emulate.
   --romtmp <filename>        Temporary filename for File | Emulate.
+
+Batch mode:
+  --headless [--output <file>] <rom> [script ...]
+      Run the scripts without a window, optionally save the result and
+      exit.  The exit status is non-zero if any command logged an error.
+  --batch_script <script> [--outdir <dir>] [--jobs <n>] <rom ...>
+      Run one script against many ROMs, in parallel.
+  --batch_rom <rom> [--outdir <dir>] [--jobs <n>] <script ...>
+      Run many scripts against one ROM, in parallel.
+
+  A script containing 'atlas <dir>' renders every map of the ROM to PNG
+  atlases with an index.json, using --jobs threads.  In a batch run, each
+  worker's atlas gets an equal share of the cpus.
 )ZZZ";
 
+// The flags given on the command line which batch workers should inherit.
+std::vector<std::string> WorkerFlags() {
+    const std::set<std::string> batch = {
+        "headless", "output", "batch_script", "batch_rom", "outdir", "jobs",
+        "flagfile", "fromenv", "tryfromenv", "undefok",
+    };
+    std::vector<std::string> result;
+    std::vector<gflags::CommandLineFlagInfo> flags;
+    gflags::GetAllFlags(&flags);
+    for(const auto& f : flags) {
+        if (!f.is_default && batch.find(f.name) == batch.end())
+            result.push_back("--" + f.name + "=" + f.current_value);
+    }
+    return result;
+}
+
 int main(int argc, char *argv[]) {
     gflags::SetUsageMessage(kUsage);
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -154,7 +192,18 @@ int main(int argc, char *argv[]) {
         exit(0);
     }
 
-    z2util::Z2Edit app("Zelda 2 ROM Editor");
+    if (!FLAGS_batch_script.empty() || !FLAGS_batch_rom.empty()) {
+        z2util::BatchDriver batch(FLAGS_jobs, WorkerFlags());
+        std::vector<std::string> args(argv + 1, argv + argc);
+        if (!FLAGS_batch_script.empty()) {
+            batch.AddRoms(FLAGS_batch_script, args, FLAGS_outdir);
+        } else {
+            batch.AddScripts(FLAGS_batch_rom, args, FLAGS_outdir);
+        }
+        return batch.Run() ? 1 : 0;
+    }
+
+    z2util::Z2Edit app("Zelda 2 ROM Editor", FLAGS_headless);
     app.Init();
 
     if (argc > 1) {
@@ -163,6 +212,9 @@ int main(int argc, char *argv[]) {
             app.Source(argv[i]);
         }
     }
+    if (FLAGS_headless) {
+        return app.Finish(FLAGS_output) ? 1 : 0;
+    }
     app.Run();
     return 0;
 }
@@ -1,10 +1,14 @@
 #include "music.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstring>
 #include <fstream>
 #include <map>
 
+#include "util/logging.h"
+
 namespace z2music {
 
 template <typename E>
@@ -134,6 +138,10 @@ void Pattern::add_notes(Pattern::Channel ch, std::initializer_list<Note> notes)
   }
 }
 
+void Pattern::set_notes(Pattern::Channel ch, const std::vector<Note>& notes) {
+  notes_[ch] = notes;
+}
+
 void Pattern::clear() {
   notes_[Channel::Pulse1].clear();
   notes_[Channel::Pulse2].clear();
@@ -236,22 +244,18 @@ void Pattern::read_notes(Pattern::Channel ch, const Rom& rom, size_t address) {
   const size_t max_length = ch == Channel::Pulse1 ? 64 * 96 : length();
   size_t length = 0;
 
-  fprintf(stderr, "Reading note data at %06lx\n", address);
-
   while (length < max_length) {
     Note n = Note(rom.getc(address++));
     // Note data can terminate early on 00 byte
-    if (n == 0x00) {
-      fprintf(stderr, "Terminating early on 00 note\n");
-      break;
-    }
+    if (n == 0x00) break;
 
     length += n.length();
     add_notes(ch, {n});
 
     // The QuarterTriplet duration has special meaning when preceeded by
     // two EighthTriplets, which differs based on a tempo flag.
-    if (n.duration() == Note::Duration::QuarterTriplet) {
+    if (n.duration() == Note::Duration::QuarterTriplet &&
+        notes_[ch].size() >= 3) {
       const size_t i = notes_[ch].size() - 3;
       if (notes_[ch][i + 0].duration() == Note::Duration::EighthTriplet &&
           notes_[ch][i + 1].duration() == Note::Duration::EighthTriplet) {
@@ -335,10 +339,14 @@ void Song::clear() {
   sequence_.clear();
 }
 
-std::vector<Pattern> Song::patterns() {
+std::vector<Pattern> Song::patterns() const {
   return patterns_;
 }
 
+const std::vector<size_t>& Song::sequence() const {
+  return sequence_;
+}
+
 Pattern* Song::at(size_t i) {
   if (i < 0 || i >= sequence_.size()) return nullptr;
   return &(patterns_.at(sequence_.at(i)));
@@ -395,8 +403,6 @@ std::string parse_string_(const Rom& rom, size_t address) {
     s.append(1, z2_decode_(rom.getc(address + i + 3)));
   }
 
-  fprintf(stderr, "Found string at %06lx - [%s]\n", address, s.c_str());
-
   return s;
 }
 
@@ -415,8 +421,6 @@ Credits::Credits(const Rom& rom) {
   for (size_t i = 0; i < kCreditsPages; ++i) {
     const size_t addr = kCreditsTableAddress + 4 * i;
 
-    fprintf(stderr, "Reading credits entries from table at %06lx\n", addr);
-
     const size_t title = rom.getw(addr) + kCreditsBankOffset;
     const size_t names = rom.getw(addr + 2) + kCreditsBankOffset;
 
@@ -470,42 +474,116 @@ void Credits::commit(Rom& rom) const {
   }
 }
 
-Rom::Rom(const std::string& filename) {
+Rom::Rom(const std::string& filename) :
+  header_{}, image_(kRomSize, 0xff), data_(image_.data()), size_(kRomSize),
+  loaded_(false) {
   std::ifstream file(filename, std::ios::binary);
   if (file.is_open()) {
     file.read(reinterpret_cast<char *>(&header_[0]), kHeaderSize);
-    file.read(reinterpret_cast<char *>(&data_[0]), kRomSize);
-
-    songs_[SongTitle::OverworldIntro] = Song(*this, kOverworldSongTable, 0);
-    songs_[SongTitle::OverworldTheme] = Song(*this, kOverworldSongTable, 1);
-    songs_[SongTitle::BattleTheme] = Song(*this, kOverworldSongTable, 2);
-    songs_[SongTitle::CaveItemFanfare] = Song(*this, kOverworldSongTable, 4);
-
-    songs_[SongTitle::TownIntro] = Song(*this, kTownSongTable, 0);
-    songs_[SongTitle::TownTheme] = Song(*this, kTownSongTable, 1);
-    songs_[SongTitle::HouseTheme] = Song(*this, kTownSongTable, 2);
-    songs_[SongTitle::TownItemFanfare] = Song(*this, kTownSongTable, 4);
-
-    songs_[SongTitle::PalaceIntro] = Song(*this, kPalaceSongTable, 0);
-    songs_[SongTitle::PalaceTheme] = Song(*this, kPalaceSongTable, 1);
-    songs_[SongTitle::BossTheme] = Song(*this, kPalaceSongTable, 3);
-    songs_[SongTitle::PalaceItemFanfare] = Song(*this, kPalaceSongTable, 4);
-    songs_[SongTitle::CrystalFanfare] = Song(*this, kPalaceSongTable, 6);
+    file.read(reinterpret_cast<char *>(data_), kRomSize);
+    loaded_ = static_cast<bool>(file);
+  }
+  // A truncated image is padded with 0xff, which has no song terminators.
+  if (loaded_) load();
+}
+
+Rom::Rom(const uint8_t* image, size_t size) :
+  header_{}, image_(kRomSize, 0xff), data_(image_.data()), size_(kRomSize),
+  loaded_(false) {
+  if (size < kHeaderSize) return;
+  std::memcpy(header_, image, kHeaderSize);
+  const size_t length = size - kHeaderSize;
+  std::memcpy(data_, image + kHeaderSize,
+              length < kRomSize ? length : kRomSize);
+  loaded_ = length >= kRomSize;
+  if (loaded_) load();
+}
+
+Rom::Rom(const Rom::Prg& prg) :
+  header_{}, data_(prg.data), size_(prg.size), loaded_(true),
+  read_(prg.read), write_(prg.write) {
+  load();
+}
+
+const std::array<Rom::SongTable, Rom::kSongTableCount>& Rom::song_tables() {
+  static const std::array<SongTable, kSongTableCount> tables = {{
+    { kOverworldSongTable,
+      { SongTitle::OverworldIntro, SongTitle::OverworldTheme,
+        SongTitle::BattleTheme, SongTitle::CaveItemFanfare },
+      { 0, 1, 2, 2, 3, 4, 4, 4 } },
+    { kTownSongTable,
+      { SongTitle::TownIntro, SongTitle::TownTheme,
+        SongTitle::HouseTheme, SongTitle::TownItemFanfare },
+      { 0, 1, 2, 2, 3, 4, 4, 4 } },
+    { kPalaceSongTable,
+      { SongTitle::PalaceIntro, SongTitle::PalaceTheme,
+        SongTitle::BossTheme, SongTitle::PalaceItemFanfare,
+        SongTitle::CrystalFanfare },
+      { 0, 1, 1, 2, 3, 5, 4, 5 } },
+    { kGreatPalaceSongTable,
+      { SongTitle::GreatPalaceIntro, SongTitle::GreatPalaceTheme,
+        SongTitle::ZeldaTheme, SongTitle::CreditsTheme,
+        SongTitle::GreatPalaceItemFanfare, SongTitle::TriforceFanfare,
+        SongTitle::FinalBossTheme },
+      { 0, 1, 2, 3, 4, 5, 6, 7 } },
+  }};
+  return tables;
+}
+
+void Rom::load() {
+  const auto& tables = song_tables();
+  for (size_t t = 0; t < tables.size(); ++t) {
+    const SongTable& table = tables[t];
+    for (size_t i = 0; i < table.songs.size(); ++i) {
+      // Read each song from the first table entry which plays it.
+      const auto entry =
+        std::find(table.entries.begin(), table.entries.end(), i);
+      songs_[table.songs[i]] =
+        Song(*this, table.address, entry - table.entries.begin());
+    }
 
-    songs_[SongTitle::GreatPalaceIntro] = Song(*this, kGreatPalaceSongTable, 0);
-    songs_[SongTitle::GreatPalaceTheme] = Song(*this, kGreatPalaceSongTable, 1);
-    songs_[SongTitle::ZeldaTheme] = Song(*this, kGreatPalaceSongTable, 2);
-    songs_[SongTitle::CreditsTheme] = Song(*this, kGreatPalaceSongTable, 3);
-    songs_[SongTitle::GreatPalaceItemFanfare] = Song(*this, kGreatPalaceSongTable, 4);
-    songs_[SongTitle::TriforceFanfare] = Song(*this, kGreatPalaceSongTable, 5);
-    songs_[SongTitle::FinalBossTheme] = Song(*this, kGreatPalaceSongTable, 6);
+    table_end_[t] = t + 1 < tables.size() ? tables[t + 1].address
+                                          : extent(table);
+  }
 
-    credits_ = Credits(*this);
+  credits_ = Credits(*this);
+}
+
+size_t Rom::extent(const Rom::SongTable& table) const {
+  size_t end = table.address + table.entries.size();
+  // A table can't run past the end of its 16KB bank, so a sequence with
+  // no terminator there is garbage.
+  const size_t limit = std::min(size_, (table.address | 0x3fff) + 1);
+
+  for (size_t entry = 0; entry < table.entries.size(); ++entry) {
+    size_t seq = table.address + getc(table.address + entry);
+    for (; seq < limit && getc(seq) != 0; ++seq) {
+      const size_t header = table.address + getc(seq);
+      end = std::max(end, header + 6);
+
+      const size_t notes = getw(header + 1) + 0x10000;
+      const Pattern p(*this, header);
+      end = std::max(end, notes + p.note_data(Pattern::Channel::Pulse1).size());
+
+      const std::array<std::pair<Pattern::Channel, size_t>, 3> channels = {{
+        { Pattern::Channel::Triangle, getc(header + 3) },
+        { Pattern::Channel::Pulse2, getc(header + 4) },
+        { Pattern::Channel::Noise, getc(header + 5) },
+      }};
+      for (const auto& c : channels) {
+        if (c.second == 0) continue;
+        end = std::max(end, notes + c.second + p.note_data(c.first).size());
+      }
+    }
+    end = std::max(end, seq + 1);
   }
+
+  return end;
 }
 
 uint8_t Rom::getc(size_t address) const {
-  if (address > kRomSize) return 0xff;
+  if (address >= size_) return 0xff;
+  if (read_) return read_(address);
   return data_[address];
 }
 
@@ -514,7 +592,6 @@ uint16_t Rom::getw(size_t address) const {
 }
 
 void Rom::read(uint8_t* buffer, size_t address, size_t length) const {
-  fprintf(stderr, "Reading %02lx bytes at %06lx\n", length, address);
   // Could use std::copy or std::memcpy but this handles out of range addresses
   for (size_t i = 0; i < length; ++i) {
     buffer[i] = getc(address + i);
@@ -522,7 +599,11 @@ void Rom::read(uint8_t* buffer, size_t address, size_t length) const {
 }
 
 void Rom::putc(size_t address, uint8_t data) {
-  if (address > kRomSize) return;
+  if (address >= size_) return;
+  if (write_) {
+    write_(address, data);
+    return;
+  }
   data_[address] = data;
 }
 
@@ -538,36 +619,42 @@ void Rom::write(size_t address, std::vector<uint8_t> data) {
   }
 }
 
+std::vector<Rom::TableSpace> Rom::space() const {
+  std::vector<TableSpace> space;
+  const auto& tables = song_tables();
+  for (size_t t = 0; t < tables.size(); ++t) {
+    std::vector<uint8_t> image;
+    const bool encodable = pack(tables[t], &image);
+    const size_t capacity = table_end_[t] - tables[t].address;
+    space.push_back({ tables[t].address, image.size(), capacity,
+                      encodable && image.size() <= capacity });
+  }
+  return space;
+}
+
 bool Rom::commit() {
-  // TODO check if committing worked
-
-  commit(kOverworldSongTable, {
-      SongTitle::OverworldIntro,
-      SongTitle::OverworldTheme,
-      SongTitle::BattleTheme,
-      SongTitle::CaveItemFanfare});
-
-  commit(kTownSongTable, {
-      SongTitle::TownIntro,
-      SongTitle::TownTheme,
-      SongTitle::HouseTheme,
-      SongTitle::TownItemFanfare});
-
-  commit(kPalaceSongTable, {
-      SongTitle::PalaceIntro,
-      SongTitle::PalaceTheme,
-      SongTitle::BossTheme,
-      SongTitle::PalaceItemFanfare,
-      SongTitle::CrystalFanfare});
-
-  commit(kGreatPalaceSongTable, {
-      SongTitle::GreatPalaceIntro,
-      SongTitle::GreatPalaceTheme,
-      SongTitle::ZeldaTheme,
-      SongTitle::CreditsTheme,
-      SongTitle::GreatPalaceItemFanfare,
-      SongTitle::TriforceFanfare,
-      SongTitle::FinalBossTheme});
+  const auto& tables = song_tables();
+  std::array<std::vector<uint8_t>, kSongTableCount> images;
+
+  // Pack every table before writing any, so that a song which doesn't
+  // fit leaves the ROM as it was.
+  bool ok = true;
+  for (size_t t = 0; t < tables.size(); ++t) {
+    const size_t capacity = table_end_[t] - tables[t].address;
+    if (!pack(tables[t], &images[t])) {
+      LOGF(ERROR, "Song table at %06lx can't be encoded", tables[t].address);
+      ok = false;
+    } else if (images[t].size() > capacity) {
+      LOGF(ERROR, "Song table at %06lx needs %lu bytes, has %lu",
+           tables[t].address, images[t].size(), capacity);
+      ok = false;
+    }
+  }
+  if (!ok) return false;
+
+  for (size_t t = 0; t < tables.size(); ++t) {
+    write(tables[t].address, images[t]);
+  }
 
   credits_.commit(*this);
 
@@ -579,117 +666,245 @@ void Rom::save(const std::string& filename) {
     std::ofstream file(filename, std::ios::binary);
     if (file.is_open()) {
       file.write(reinterpret_cast<char *>(&header_[0]), kHeaderSize);
-      file.write(reinterpret_cast<char *>(&data_[0]), kRomSize);
+      file.write(reinterpret_cast<char *>(data_), size_);
     }
   }
 }
 
+const char* Rom::song_name(Rom::SongTitle title) {
+  static const char* const names[kSongCount] = {
+    "OverworldIntro", "OverworldTheme", "BattleTheme", "CaveItemFanfare",
+    "TownIntro", "TownTheme", "HouseTheme", "TownItemFanfare",
+    "PalaceIntro", "PalaceTheme", "BossTheme", "PalaceItemFanfare",
+    "CrystalFanfare", "GreatPalaceIntro", "GreatPalaceTheme", "ZeldaTheme",
+    "CreditsTheme", "GreatPalaceItemFanfare", "TriforceFanfare",
+    "FinalBossTheme",
+  };
+  const size_t i = static_cast<size_t>(title);
+  return i < kSongCount ? names[i] : "Unknown";
+}
+
 Song* Rom::song(Rom::SongTitle title) {
   return &songs_[title];
 }
 
+const Song* Rom::song(Rom::SongTitle title) const {
+  const auto it = songs_.find(title);
+  return it == songs_.end() ? nullptr : &it->second;
+}
+
 Credits* Rom::credits() {
   return &credits_;
 }
 
-void Rom::commit(size_t address, std::initializer_list<Rom::SongTitle> songs) {
-  // TODO commit song data to PRG ROM
-  std::array<uint8_t, 8> table;
-
-  // TODO make these changeable.
-  // This will require rearchitecting things so that there is a Score object
-  // which is a list of 8 (possibly duplicate) songs.  For now, it's just 
-  // hardcode which songs are where in each table.
-  switch (address) {
-    case kOverworldSongTable:
-    case kTownSongTable:
-      table = {0, 1, 2, 2, 3, 4, 4, 4 };
-      break;
-
-    case kPalaceSongTable:
-      table = { 0, 1, 1, 2, 3, 5, 4, 5 };
-      break;
+namespace {
 
-    case kGreatPalaceSongTable:
-      table = { 0, 1, 2, 3, 4, 5, 6, 7 };
-      break;
+// The bytes of a pattern which make it a pattern: its tempo and the note
+// data of each channel.
+std::vector<uint8_t> pattern_key(const Pattern& p) {
+  std::vector<uint8_t> key = { p.tempo() };
+  for (auto ch : { Pattern::Channel::Pulse1, Pattern::Channel::Pulse2,
+                   Pattern::Channel::Triangle, Pattern::Channel::Noise }) {
+    const std::vector<uint8_t> data = p.note_data(ch);
+    key.push_back(data.size() & 0xff);
+    key.push_back(data.size() >> 8);
+    key.insert(key.end(), data.begin(), data.end());
+  }
+  return key;
+}
+
+// Finds needle in haystack starting within [first, last], or returns
+// haystack.size().
+template <typename T>
+size_t find_in(const std::vector<T>& haystack, const std::vector<T>& needle,
+               size_t first, size_t last) {
+  if (needle.size() > haystack.size()) return haystack.size();
+  last = std::min(last, haystack.size() - needle.size());
+  for (size_t i = first; i <= last && i < haystack.size(); ++i) {
+    if (std::equal(needle.begin(), needle.end(), haystack.begin() + i)) {
+      return i;
+    }
+  }
+  return haystack.size();
+}
 
-    default:
-      // Other values are nonsense
-      return;
+// Where needle would start if appended to data, overlapping as much of the
+// end of data as it can without starting before first.
+size_t append_at(const std::vector<uint8_t>& data,
+                 const std::vector<uint8_t>& needle, size_t first) {
+  const size_t room = data.size() > first ? data.size() - first : 0;
+  for (size_t k = std::min(room, needle.size()); k > 0; --k) {
+    if (std::equal(needle.begin(), needle.begin() + k, data.end() - k)) {
+      return data.size() - k;
+    }
   }
+  return data.size();
+}
 
-  /**************
-   * SONG TABLE *
-   **************/
+void append(std::vector<uint8_t>* data, const std::vector<uint8_t>& needle,
+            size_t at) {
+  data->insert(data->end(), needle.begin() + (data->size() - at),
+               needle.end());
+}
 
-  uint8_t offset = 8;
-  std::vector<uint8_t> offsets;
-  offsets.reserve(8);
+} // namespace
 
-  // Calculate song offset table
-  for (auto s : songs) {
-    offsets.push_back(offset);
-    fprintf(stderr, "Offset for next song: %02x\n", offset);
-    offset += songs_.at(s).sequence_length() + 1;
-  }
+bool Rom::pack(const Rom::SongTable& table,
+               std::vector<uint8_t>* image) const {
+  /*******************
+   * UNIQUE PATTERNS *
+   *******************/
 
-  // One extra offset for the "empty" song at the end
-  // We could save a whole byte by pointing this at the end of some other
-  // sequence but it's kind of nice to see the double 00 to mean the end of the
-  // sequence data.
-  offsets.push_back(offset);
+  // Identical patterns in any of the table's songs share one header.
+  std::map<std::vector<uint8_t>, size_t> index;
+  std::vector<const Pattern*> patterns;
+  std::vector<std::vector<size_t>> sequences;
 
-  // Write song table to ROM
-  for (size_t i = 0; i < 8; ++i) {
-    putc(address + i, offsets[table[i]]);
+  for (auto title : table.songs) {
+    const Song& song = songs_.at(title);
+    std::vector<size_t> seq;
+    for (size_t i = 0; i < song.sequence_length(); ++i) {
+      const Pattern* p = song.at(i);
+      const auto it = index.emplace(pattern_key(*p), patterns.size());
+      if (it.second) patterns.push_back(p);
+      seq.push_back(it.first->second);
+    }
+    sequences.push_back(seq);
   }
+  // The empty song.
+  sequences.push_back({});
 
   /******************
    * SEQUENCE TABLE *
    ******************/
 
-  const uint8_t first_pattern = offset + 1;
-  uint8_t seq_offset = 8;
-  uint8_t pat_offset = first_pattern;
-
-  for (auto s : songs) {
-    fprintf(stderr, "Writing seq at %02x with pat at %02x: ", seq_offset, pat_offset);
-    const std::vector<uint8_t> seq = songs_.at(s).sequence_data(pat_offset);
-    write(address + seq_offset, seq);
+  // Sequences are lists of pattern numbers ending with a 0.  A sequence
+  // which ends another one (like the empty one) is stored only once.
+  // Pattern numbers are turned into header offsets once the length of
+  // the sequences is known.
+  const size_t kEnd = patterns.size();
+  std::vector<size_t> order(sequences.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return sequences[a].size() > sequences[b].size();
+  });
+
+  std::vector<size_t> seq_data;
+  std::vector<size_t> seq_start(sequences.size());
+  for (size_t i : order) {
+    std::vector<size_t> seq = sequences[i];
+    seq.push_back(kEnd);
+    size_t at = find_in(seq_data, seq, 0, seq_data.size());
+    if (at == seq_data.size()) seq_data.insert(seq_data.end(), seq.begin(), seq.end());
+    seq_start[i] = at;
+  }
 
-    for (auto b : seq) fprintf(stderr, "%02x ", b);
-    fprintf(stderr, "\n");
+  const size_t seq_offset = table.entries.size();
+  const size_t pat_offset = seq_offset + seq_data.size();
+  const size_t note_offset = pat_offset + 6 * patterns.size();
 
-    pat_offset += 6 * songs_.at(s).pattern_count();
-    seq_offset += seq.size();
+  // Every header must be reachable with a one byte offset.
+  if (!patterns.empty() && pat_offset + 6 * (patterns.size() - 1) > 0xff) {
+    return false;
   }
 
-  // Write an empty sequence for the empty song
-  putc(address + seq_offset, 0);
+  image->assign(note_offset, 0);
+
+  for (size_t i = 0; i < table.entries.size(); ++i) {
+    (*image)[i] = seq_offset + seq_start[table.entries[i]];
+  }
+  for (size_t i = 0; i < seq_data.size(); ++i) {
+    (*image)[seq_offset + i] =
+      seq_data[i] == kEnd ? 0 : pat_offset + 6 * seq_data[i];
+  }
 
   /*******************************
    * PATTERN TABLE AND NOTE DATA *
    *******************************/
 
-  size_t note_address = pat_offset + address;
-  pat_offset = first_pattern;
-
-  fprintf(stderr, "Note data to start at %06lx\n", note_address);
+  // Each channel's notes are found from the pulse 1 notes by a one byte
+  // offset (0 meaning the channel is silent), so every channel's data
+  // must be in the 255 bytes after them.  Note data which is already in
+  // the table is reused rather than written again: a channel can point
+  // into any earlier data with the same bytes.  Data which has to be
+  // written overlaps whatever it can of the end of the table.
+  const std::array<Pattern::Channel, 3> others = {
+    Pattern::Channel::Triangle,
+    Pattern::Channel::Pulse2,
+    Pattern::Channel::Noise,
+  };
 
-  for (auto s : songs) {
-    for (auto p : songs_.at(s).patterns()) {
-      const std::vector<uint8_t> note_data = p.note_data();
+  // Larger patterns go first, so that smaller ones can share their data.
+  std::vector<size_t> by_size(patterns.size());
+  for (size_t i = 0; i < by_size.size(); ++i) by_size[i] = i;
+  std::stable_sort(by_size.begin(), by_size.end(), [&](size_t a, size_t b) {
+    return patterns[a]->note_data().size() > patterns[b]->note_data().size();
+  });
+
+  for (size_t i : by_size) {
+    const Pattern& p = *patterns[i];
+    const std::vector<uint8_t> pw1 = p.note_data(Pattern::Channel::Pulse1);
+
+    // Try the pulse 1 notes everywhere they already are and at the end,
+    // and keep whichever adds the fewest bytes.
+    std::vector<size_t> bases;
+    for (size_t at = find_in(*image, pw1, note_offset, image->size());
+         at < image->size();
+         at = find_in(*image, pw1, at + 1, image->size())) {
+      bases.push_back(at);
+    }
+    bases.push_back(image->size());
+
+    std::vector<uint8_t> best;
+    size_t best_base = 0;
+    std::array<uint8_t, 3> best_offsets = {};
+    bool found = false;
+
+    for (size_t base : bases) {
+      std::vector<uint8_t> data = *image;
+      if (base == image->size()) {
+        base = append_at(data, pw1, note_offset);
+        append(&data, pw1, base);
+      }
 
-      fprintf(stderr, "Pattern at %06lx, notes at %06lx\n", address + pat_offset, note_address);
+      std::array<uint8_t, 3> offsets = {};
+      bool ok = true;
+      for (size_t c = 0; c < others.size() && ok; ++c) {
+        const std::vector<uint8_t> notes = p.note_data(others[c]);
+        if (notes.empty()) continue;
 
-      write(address + pat_offset, p.meta_data(note_address));
-      write(note_address, note_data);
+        size_t at = find_in(data, notes, base + 1, base + 0xff);
+        if (at == data.size()) {
+          at = append_at(data, notes, base + 1);
+          append(&data, notes, at);
+        }
+        ok = at - base <= 0xff;
+        offsets[c] = at - base;
+      }
 
-      pat_offset += 6;
-      note_address += note_data.size();
+      if (ok && (!found || data.size() < best.size())) {
+        best.swap(data);
+        best_base = base;
+        best_offsets = offsets;
+        found = true;
+      }
     }
+
+    // Even written out in full, the channels are too long to reach.
+    if (!found) return false;
+    image->swap(best);
+
+    const size_t notes = table.address + best_base - 0x10000;
+    const size_t header = pat_offset + 6 * i;
+    (*image)[header + 0] = p.tempo();
+    (*image)[header + 1] = notes & 0xff;
+    (*image)[header + 2] = notes >> 8;
+    (*image)[header + 3] = best_offsets[0];
+    (*image)[header + 4] = best_offsets[1];
+    (*image)[header + 5] = best_offsets[2];
   }
+
+  return true;
 }
 
 } // namespace z2music
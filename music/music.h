@@ -3,6 +3,7 @@
 
 #include <array>
 #include <fstream>
+#include <functional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -77,6 +78,7 @@ class Pattern {
     size_t length() const;
 
     void add_notes(Channel ch, std::initializer_list<Note> notes);
+    void set_notes(Channel ch, const std::vector<Note>& notes);
     void clear();
     std::vector<Note> notes(Channel ch) const;
 
@@ -87,6 +89,7 @@ class Pattern {
     bool validate() const;
 
     std::vector<uint8_t> note_data() const;
+    std::vector<uint8_t> note_data(Channel ch) const;
     std::vector<uint8_t> meta_data(size_t pw1_address) const;
 
   private:
@@ -95,7 +98,6 @@ class Pattern {
 
     size_t length(Channel ch) const;
     bool pad_note_data(Channel ch) const;
-    std::vector<uint8_t> note_data(Channel ch) const;
     size_t note_data_length(Channel ch) const;
 
     void read_notes(Channel ch, const Rom& rom, size_t address);
@@ -118,7 +120,9 @@ class Song {
 
     void clear();
 
-    std::vector<Pattern> patterns();
+    std::vector<Pattern> patterns() const;
+    // The pattern numbers in the order the song plays them.
+    const std::vector<size_t>& sequence() const;
 
     Pattern* at(size_t i);
     const Pattern* at(size_t i) const;
@@ -174,8 +178,37 @@ class Rom {
       TriforceFanfare,
       FinalBossTheme,
     };
+    static constexpr size_t kSongCount = 20;
+
+    // The name of a song, as spelled in SongTitle.
+    static const char* song_name(SongTitle title);
+
+  protected:
+    // PRG ROM which belongs to someone else, such as an editor's cartridge.
+    // If set, read and write are called for every byte instead of
+    // accessing data directly, so the owner can see what the Rom touches.
+    struct Prg {
+      uint8_t* data;
+      size_t size;
+      std::function<uint8_t(size_t address)> read;
+      std::function<void(size_t address, uint8_t data)> write;
+    };
+    // Nothing is copied: songs are read from and committed straight to the
+    // PRG ROM, which must outlive the Rom.
+    explicit Rom(const Prg& prg);
+
+  public:
 
     Rom(const std::string& filename);
+    // Reads an iNES image already in memory.
+    Rom(const uint8_t* image, size_t size);
+    virtual ~Rom() = default;
+
+    Rom(const Rom&) = delete;
+    Rom& operator=(const Rom&) = delete;
+
+    // False if the file couldn't be read, or was too short to be a ROM.
+    bool loaded() const { return loaded_; }
 
     uint8_t getc(size_t address) const;
     uint16_t getw(size_t address) const;
@@ -186,10 +219,27 @@ class Rom {
     void read(uint8_t* buffer, size_t address, size_t length) const;
     void write(size_t address, std::vector<uint8_t> data);
 
+    // The space a song table takes when packed, and the space it has
+    // before it runs into the next one.
+    struct TableSpace {
+      size_t address;
+      size_t used;
+      size_t capacity;
+      // False if the table doesn't fit, or if its patterns or their notes
+      // are too far apart for the one byte offsets the table uses.
+      bool fits;
+    };
+
+    // Packs every song table, without writing them.
+    std::vector<TableSpace> space() const;
+
+    // Writes the songs back to the ROM.  Fails, writing nothing, if any
+    // song table doesn't fit.
     bool commit();
     void save(const std::string& filename);
 
     Song* song(SongTitle title);
+    const Song* song(SongTitle title) const;
     Credits* credits();
 
   private:
@@ -202,14 +252,35 @@ class Rom {
     static constexpr size_t kPalaceSongTable      = 0x01a62f;
     static constexpr size_t kGreatPalaceSongTable = 0x01a936;
 
+    static constexpr size_t kSongTableCount = 4;
+
+    struct SongTable {
+      size_t address;
+      std::vector<SongTitle> songs;
+      // The song each of the 8 table entries plays, as an index into
+      // songs.  songs.size() is an empty song.
+      std::array<uint8_t, 8> entries;
+    };
+    static const std::array<SongTable, kSongTableCount>& song_tables();
+
     uint8_t header_[kHeaderSize];
-    uint8_t data_[kRomSize];
+    // The PRG ROM: image_, or memory which the Rom doesn't own.
+    std::vector<uint8_t> image_;
+    uint8_t* data_;
+    size_t size_;
+    bool loaded_;
+    std::function<uint8_t(size_t)> read_;
+    std::function<void(size_t, uint8_t)> write_;
 
     std::unordered_map<SongTitle, Song> songs_;
     Credits credits_;
+    // Where each song table's space ends: at the next table, or for the
+    // last one, where its data ended when the ROM was loaded.
+    std::array<size_t, kSongTableCount> table_end_;
 
-    void commit(size_t address, std::initializer_list<SongTitle> songs);
-    size_t metadata_length(std::vector<SongTitle> songs);
+    void load();
+    size_t extent(const SongTable& table) const;
+    bool pack(const SongTable& table, std::vector<uint8_t>* image) const;
 };
 
 // Convenience method for writing notes
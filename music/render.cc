@@ -0,0 +1,209 @@
+#include "music.h"
+#include "synth.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Renders every song in a ROM through the synth, faster than real time,
+// and prints a hash of each song's samples so that a CI job can tell
+// when a ROM edit changed the music.
+
+namespace {
+
+// Samples are rendered in blocks of this size, so a song's length (and
+// hash) includes the tail of its last block.
+constexpr size_t kBlockSize = 1024;
+
+struct Options {
+  int jobs = 0;
+  int rate = 44100;
+  int max_seconds = 600;
+  bool raw = false;
+  std::string outdir;
+  std::string rom;
+};
+
+struct Result {
+  const z2music::Song* song;
+  std::vector<int16_t> samples;
+  uint64_t hash;
+};
+
+void usage(const char* prog) {
+  std::cerr << "Usage: " << prog
+            << " [-j jobs] [-r rate] [-t max_seconds] [-o outdir] [--raw] z2_rom" << std::endl
+            << std::endl
+            << "Renders every song to <outdir>/<NN>_<name>.wav (or .raw, "
+            << "16-bit mono PCM)" << std::endl
+            << "and prints a hash of the samples of each.  Without -o, "
+            << "only the hashes" << std::endl
+            << "are printed.  Songs are cut off after max_seconds." << std::endl;
+}
+
+bool parse(int argc, char** argv, Options* opt) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "-j" && has_value) {
+      opt->jobs = std::atoi(argv[++i]);
+    } else if (arg == "-r" && has_value) {
+      opt->rate = std::atoi(argv[++i]);
+    } else if (arg == "-t" && has_value) {
+      opt->max_seconds = std::atoi(argv[++i]);
+    } else if (arg == "-o" && has_value) {
+      opt->outdir = argv[++i];
+    } else if (arg == "--raw") {
+      opt->raw = true;
+    } else if (opt->rom.empty() && arg[0] != '-') {
+      opt->rom = arg;
+    } else {
+      return false;
+    }
+  }
+  return !opt->rom.empty() && opt->rate > 0 && opt->max_seconds > 0;
+}
+
+// 64-bit FNV-1a over the little-endian bytes of the samples.
+uint64_t hash(const std::vector<int16_t>& samples) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (int16_t s : samples) {
+    const uint16_t u = static_cast<uint16_t>(s);
+    h = (h ^ (u & 0xff)) * 0x100000001b3ULL;
+    h = (h ^ (u >> 8)) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+void render(const z2music::Song& song, int rate, size_t max_samples,
+            Result* result) {
+  z2music::Synth synth(rate);
+  synth.play(song, false);
+
+  // The first render picks up the play command, so the song is playing
+  // after it unless it is empty.
+  result->samples.reserve(std::min<size_t>(max_samples, 60 * rate));
+  do {
+    const size_t n = result->samples.size();
+    result->samples.resize(n + kBlockSize);
+    synth.render(&result->samples[n], kBlockSize);
+  } while (synth.playing() && result->samples.size() < max_samples);
+
+  result->hash = hash(result->samples);
+}
+
+void put16(std::ostream& out, uint16_t v) {
+  const char b[2] = { static_cast<char>(v), static_cast<char>(v >> 8) };
+  out.write(b, 2);
+}
+
+void put32(std::ostream& out, uint32_t v) {
+  put16(out, v & 0xffff);
+  put16(out, v >> 16);
+}
+
+bool write(const std::string& filename, const Result& result, int rate,
+           bool raw) {
+  std::ofstream out(filename, std::ios::binary);
+  if (!out) return false;
+
+  const uint32_t bytes = result.samples.size() * sizeof(int16_t);
+  if (!raw) {
+    out.write("RIFF", 4);
+    put32(out, 36 + bytes);
+    out.write("WAVEfmt ", 8);
+    put32(out, 16);
+    put16(out, 1);         // PCM
+    put16(out, 1);         // mono
+    put32(out, rate);
+    put32(out, rate * 2);  // byte rate
+    put16(out, 2);         // block align
+    put16(out, 16);        // bits per sample
+    out.write("data", 4);
+    put32(out, bytes);
+  }
+  for (int16_t s : result.samples) put16(out, static_cast<uint16_t>(s));
+  return static_cast<bool>(out);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parse(argc, argv, &opt)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (opt.jobs <= 0) opt.jobs = std::max(1u, std::thread::hardware_concurrency());
+
+  z2music::Rom rom(opt.rom);
+  if (!rom.loaded()) {
+    std::cerr << "Could not read a ROM from " << opt.rom << std::endl;
+    return 1;
+  }
+
+  // Look every song up before starting the workers, which then only
+  // read them.
+  std::vector<Result> results(z2music::Rom::kSongCount);
+  for (size_t i = 0; i < results.size(); ++i) {
+    results[i].song = rom.song(static_cast<z2music::Rom::SongTitle>(i));
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (int j = 0; j < opt.jobs && j < static_cast<int>(results.size()); ++j) {
+    workers.emplace_back([&]() {
+      for (size_t i = next++; i < results.size(); i = next++) {
+        render(*results[i].song, opt.rate,
+               static_cast<size_t>(opt.max_seconds) * opt.rate, &results[i]);
+      }
+    });
+  }
+  for (std::thread& t : workers) t.join();
+  const double elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  int status = 0;
+  double audio = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    const char* name =
+        z2music::Rom::song_name(static_cast<z2music::Rom::SongTitle>(i));
+    const double seconds = static_cast<double>(r.samples.size()) / opt.rate;
+    audio += seconds;
+
+    char line[128];
+    snprintf(line, sizeof(line), "%2zu %-24s %8.2fs %016llx", i, name,
+             seconds, static_cast<unsigned long long>(r.hash));
+    std::cout << line;
+
+    if (!opt.outdir.empty()) {
+      char filename[64];
+      snprintf(filename, sizeof(filename), "/%02zu_%s.%s", i, name,
+               opt.raw ? "raw" : "wav");
+      const std::string path = opt.outdir + filename;
+      if (write(path, r, opt.rate, opt.raw)) {
+        std::cout << "  " << path;
+      } else {
+        std::cerr << "Could not write " << path << std::endl;
+        status = 1;
+      }
+    }
+    std::cout << std::endl;
+  }
+
+  std::cerr << "Rendered " << audio << "s of audio in " << elapsed
+            << "s on " << workers.size() << " threads ("
+            << (elapsed > 0 ? audio / elapsed : 0) << "x real time)"
+            << std::endl;
+  return status;
+}
@@ -0,0 +1,377 @@
+#include "synth.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace z2music {
+
+namespace {
+
+constexpr float kCpuClock = 1789773.0f;
+
+constexpr uint8_t kDuty[4][8] = {
+  {0, 1, 0, 0, 0, 0, 0, 0},
+  {0, 1, 1, 0, 0, 0, 0, 0},
+  {0, 1, 1, 1, 1, 0, 0, 0},
+  {1, 0, 0, 1, 1, 1, 1, 1},
+};
+
+// Noise timer periods, in CPU cycles.
+constexpr int kNoisePeriod[16] = {
+  4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+// Duty cycle and envelope of each pulse channel.  Zelda II restarts the
+// envelope on every note and lets it decay to a level it holds until the
+// note ends, with the harmony on a wider duty than the melody.
+constexpr int kPulseDuty[2] = {2, 1};
+constexpr int kPulseDecay[2] = {3, 3};
+constexpr int kPulseSustain[2] = {6, 9};
+constexpr int kNoiseDecay = 1;
+
+constexpr uint8_t kRest = static_cast<uint8_t>(Note::Pitch::Rest);
+
+// The MIDI note number of a pitch value, or -1 for a rest.  From C4
+// upward every step of 2 is a semitone; the values below that are the
+// few low notes the game has.
+int midi_note(uint8_t pitch) {
+  switch (pitch) {
+    case 0x02: return -1;
+    case 0x3e: return 49;
+    case 0x04: return 52;
+    case 0x06: return 55;
+    case 0x08: return 56;
+    case 0x0a: return 57;
+    case 0x0c: return 58;
+    case 0x0e: return 59;
+  }
+  return 60 + (pitch - 0x10) / 2;
+}
+
+// The APU timer period which plays a pitch on a pulse channel.  The
+// triangle uses the same period and so sounds an octave lower.
+int timer_period(uint8_t pitch) {
+  const int note = midi_note(pitch & 0x3e);
+  if (note < 0) return 0;
+  const float freq = 440.0f * std::pow(2.0f, (note - 69) / 12.0f);
+  return static_cast<int>(std::lround(kCpuClock / (16.0f * freq))) - 1;
+}
+
+} // namespace
+
+Synth::Synth(int sample_rate) :
+  sample_rate_(sample_rate),
+  cycles_per_sample_(kCpuClock / sample_rate),
+  playing_(false),
+  score_(nullptr),
+  unretired_(nullptr),
+  next_event_{},
+  frame_(0),
+  frame_clock_(0),
+  envelope_clock_(0),
+  volume_(1.0f),
+  muted_{},
+  pulse_{},
+  triangle_{},
+  noise_{},
+  highpass_in_(0),
+  highpass_out_(0) {
+  for (int i = 0; i < 2; ++i) {
+    pulse_[i].duty = kPulseDuty[i];
+    pulse_[i].decay = kPulseDecay[i];
+    pulse_[i].sustain = kPulseSustain[i];
+  }
+  noise_.lfsr = 1;
+  noise_.period = kNoisePeriod[0];
+}
+
+Synth::~Synth() {
+  collect();
+  Command cmd;
+  while (commands_.pop(&cmd)) delete cmd.score;
+  while (unretired_) {
+    Score* next = unretired_->next;
+    delete unretired_;
+    unretired_ = next;
+  }
+  delete score_;
+}
+
+int Synth::sample_rate() const {
+  return sample_rate_;
+}
+
+bool Synth::playing() const {
+  return playing_;
+}
+
+int Synth::quarter_frames(uint8_t tempo) {
+  // The game keeps a table of note lengths for each tempo; the tempo
+  // value is the offset of that table and grows in steps of 0x08, which
+  // also flags how triplets are read.  The default tempo, 0x18, plays a
+  // quarter note in 24 frames (150 bpm); other tables are approximated
+  // from the table offset.
+  return (tempo & 0x70) + 8;
+}
+
+void Synth::append(const Pattern& pattern, Synth::Score* score) const {
+  const uint32_t base = score->frames;
+  const size_t length = pattern.length();
+  const size_t qf = quarter_frames(pattern.tempo());
+
+  const std::array<Pattern::Channel, 4> channels = {
+    Pattern::Channel::Pulse1,
+    Pattern::Channel::Pulse2,
+    Pattern::Channel::Triangle,
+    Pattern::Channel::Noise,
+  };
+
+  for (size_t ch = 0; ch < channels.size(); ++ch) {
+    const std::vector<Note> notes = pattern.notes(channels[ch]);
+    std::vector<Event>& events = score->events[ch];
+
+    // Silence whatever the last pattern left playing on this channel.
+    events.push_back({base, kRest});
+    if (notes.empty()) continue;
+
+    // Channels shorter than Pulse1 start over until the pattern ends.
+    size_t pos = 0;
+    while (pos < length) {
+      for (Note n : notes) {
+        if (pos >= length) break;
+        events.push_back({static_cast<uint32_t>(base + pos * qf / 96), n});
+        pos += n.length();
+      }
+    }
+  }
+
+  score->frames = base + length * qf / 96;
+}
+
+void Synth::play(const Pattern& pattern, bool loop) {
+  Score* score = new Score();
+  score->frames = 0;
+  score->loop = loop;
+  append(pattern, score);
+  send({Command::Type::Play, score, 0, 0});
+}
+
+void Synth::play(const Song& song, bool loop) {
+  Score* score = new Score();
+  score->frames = 0;
+  score->loop = loop;
+  for (size_t i = 0; i < song.sequence_length(); ++i) {
+    append(*song.at(i), score);
+  }
+  send({Command::Type::Play, score, 0, 0});
+}
+
+void Synth::stop() {
+  send({Command::Type::Stop, nullptr, 0, 0});
+}
+
+void Synth::set_volume(float volume) {
+  send({Command::Type::Volume, nullptr, volume, 0});
+}
+
+void Synth::mute(Pattern::Channel ch, bool mute) {
+  send({Command::Type::Mute, nullptr, mute ? 1.0f : 0.0f,
+        static_cast<int>(ch)});
+}
+
+void Synth::send(const Synth::Command& cmd) {
+  collect();
+  if (!commands_.push(cmd)) delete cmd.score;
+}
+
+void Synth::collect() {
+  Score* score;
+  while (retired_.pop(&score)) delete score;
+}
+
+void Synth::retire(Synth::Score* score) {
+  // The queue is full if the UI thread hasn't collected in a while: hold
+  // on to the score, without allocating, until there is room.
+  score->next = unretired_;
+  unretired_ = score;
+  while (unretired_) {
+    // Once pushed, the UI thread may free it.
+    Score* next = unretired_->next;
+    if (!retired_.push(unretired_)) break;
+    unretired_ = next;
+  }
+}
+
+void Synth::run_command(const Synth::Command& cmd) {
+  switch (cmd.type) {
+    case Command::Type::Play:
+    case Command::Type::Stop:
+      if (score_) retire(score_);
+      score_ = cmd.score;
+      if (score_ && score_->frames == 0) {
+        retire(score_);
+        score_ = nullptr;
+      }
+      next_event_.fill(0);
+      frame_ = 0;
+      frame_clock_ = 0;
+      for (int ch = 0; ch < 4; ++ch) start_note(ch, kRest);
+      playing_ = score_ != nullptr;
+      if (score_) start_frame();
+      break;
+
+    case Command::Type::Volume:
+      volume_ = cmd.value;
+      break;
+
+    case Command::Type::Mute:
+      if (cmd.channel >= 0 && cmd.channel < 4) {
+        muted_[cmd.channel] = cmd.value != 0;
+      }
+      break;
+  }
+}
+
+void Synth::start_frame() {
+  if (!score_) return;
+
+  for (int ch = 0; ch < 4; ++ch) {
+    const std::vector<Event>& events = score_->events[ch];
+    while (next_event_[ch] < events.size() &&
+           events[next_event_[ch]].frame <= frame_) {
+      start_note(ch, events[next_event_[ch]++].note);
+    }
+  }
+
+  if (++frame_ < score_->frames) return;
+
+  if (score_->loop) {
+    frame_ = 0;
+    next_event_.fill(0);
+  } else {
+    retire(score_);
+    score_ = nullptr;
+    for (int ch = 0; ch < 4; ++ch) start_note(ch, kRest);
+    playing_ = false;
+  }
+}
+
+void Synth::start_note(int ch, uint8_t note) {
+  const uint8_t pitch = note & 0x3e;
+  const bool rest = pitch == kRest;
+
+  switch (ch) {
+    case 0:
+    case 1: {
+      Pulse& p = pulse_[ch];
+      p.period = rest ? 0 : timer_period(pitch);
+      p.volume = rest ? 0 : 15;
+      p.divider = p.decay;
+      break;
+    }
+
+    case 2:
+      triangle_.on = !rest;
+      if (!rest) triangle_.period = timer_period(pitch);
+      break;
+
+    case 3:
+      // Noise notes are drum hits: the pitch picks the noise period.
+      noise_.volume = rest ? 0 : 15;
+      noise_.divider = kNoiseDecay;
+      noise_.period = kNoisePeriod[(pitch >> 1) & 0x0f];
+      break;
+  }
+}
+
+void Synth::clock_envelopes() {
+  for (Pulse& p : pulse_) {
+    if (p.divider > 0) {
+      --p.divider;
+    } else {
+      p.divider = p.decay;
+      if (p.volume > p.sustain) --p.volume;
+    }
+  }
+
+  if (noise_.divider > 0) {
+    --noise_.divider;
+  } else {
+    noise_.divider = kNoiseDecay;
+    if (noise_.volume > 0) --noise_.volume;
+  }
+}
+
+float Synth::mix() {
+  float pulse_sum = 0;
+  for (int i = 0; i < 2; ++i) {
+    Pulse& p = pulse_[i];
+    // Periods under 8 are silenced by the sweep unit on the real thing.
+    if (p.period < 8 || p.volume == 0) continue;
+    p.phase = std::fmod(p.phase + cycles_per_sample_ / (2 * (p.period + 1)),
+                        8.0f);
+    if (!muted_[i] && kDuty[p.duty][static_cast<int>(p.phase)]) {
+      pulse_sum += p.volume;
+    }
+  }
+
+  // The triangle holds its last output level when it stops, so that
+  // notes don't click.
+  if (triangle_.on && triangle_.period >= 2) {
+    triangle_.phase = std::fmod(
+        triangle_.phase + cycles_per_sample_ / (triangle_.period + 1), 32.0f);
+  }
+  const int step = static_cast<int>(triangle_.phase);
+  const float tri = muted_[2] ? 0 : (step < 16 ? 15 - step : step - 16);
+
+  float noise = 0;
+  if (noise_.volume > 0) {
+    noise_.phase += cycles_per_sample_ / noise_.period;
+    while (noise_.phase >= 1) {
+      noise_.phase -= 1;
+      const uint16_t bit = (noise_.lfsr ^ (noise_.lfsr >> 1)) & 1;
+      noise_.lfsr = (noise_.lfsr >> 1) | (bit << 14);
+    }
+    if (!muted_[3] && !(noise_.lfsr & 1)) noise = noise_.volume;
+  }
+
+  // The NES's non-linear mixer.
+  const float pulse_out =
+      pulse_sum > 0 ? 95.88f / (8128.0f / pulse_sum + 100.0f) : 0;
+  const float tnd = tri / 8227.0f + noise / 12241.0f;
+  const float tnd_out = tnd > 0 ? 159.79f / (1.0f / tnd + 100.0f) : 0;
+  return pulse_out + tnd_out;
+}
+
+void Synth::render(int16_t* out, size_t samples) {
+  Command cmd;
+  while (commands_.pop(&cmd)) run_command(cmd);
+
+  // The console's output stage: a high-pass filter at about 90Hz, which
+  // also takes out the mixer's DC offset.
+  const float rc = 1.0f / (2.0f * 3.14159265f * 90.0f);
+  const float dt = 1.0f / sample_rate_;
+  const float alpha = rc / (rc + dt);
+
+  for (size_t i = 0; i < samples; ++i) {
+    frame_clock_ += 60.0f / sample_rate_;
+    if (frame_clock_ >= 1.0f) {
+      frame_clock_ -= 1.0f;
+      start_frame();
+    }
+    envelope_clock_ += 240.0f / sample_rate_;
+    if (envelope_clock_ >= 1.0f) {
+      envelope_clock_ -= 1.0f;
+      clock_envelopes();
+    }
+
+    const float in = mix();
+    highpass_out_ = alpha * (highpass_out_ + in - highpass_in_);
+    highpass_in_ = in;
+
+    const float v = highpass_out_ * volume_ * 32767.0f;
+    out[i] = static_cast<int16_t>(std::max(-32768.0f, std::min(32767.0f, v)));
+  }
+}
+
+} // namespace z2music
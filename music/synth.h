@@ -0,0 +1,152 @@
+#ifndef Z2UTIL_MUSIC_SYNTH
+#define Z2UTIL_MUSIC_SYNTH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "music.h"
+
+namespace z2music {
+
+// A single-producer, single-consumer queue which never blocks or
+// allocates, for talking to the audio thread.
+template <typename T, size_t N>
+class SpscQueue {
+  public:
+    SpscQueue() : head_(0), tail_(0) {}
+
+    bool push(const T& item) {
+      const size_t head = head_.load(std::memory_order_relaxed);
+      const size_t next = (head + 1) % N;
+      if (next == tail_.load(std::memory_order_acquire)) return false;
+      items_[head] = item;
+      head_.store(next, std::memory_order_release);
+      return true;
+    }
+
+    bool pop(T* item) {
+      const size_t tail = tail_.load(std::memory_order_relaxed);
+      if (tail == head_.load(std::memory_order_acquire)) return false;
+      *item = items_[tail];
+      tail_.store((tail + 1) % N, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    std::array<T, N> items_;
+    std::atomic<size_t> head_;
+    std::atomic<size_t> tail_;
+};
+
+// Plays patterns and songs through a model of the NES APU: two pulse
+// channels, a triangle and a noise channel, mixed the way the NES mixes
+// them.
+//
+// The play/stop/volume/mute methods are called from the UI thread and
+// only queue a command; render() runs on the audio thread, picks the
+// commands up and never allocates or frees.  Scores which the audio
+// thread is done with are passed back and freed on the next UI call.
+class Synth {
+  public:
+    explicit Synth(int sample_rate);
+    ~Synth();
+
+    void play(const Pattern& pattern, bool loop = false);
+    void play(const Song& song, bool loop = true);
+    void stop();
+    void set_volume(float volume);
+    void mute(Pattern::Channel ch, bool mute);
+
+    // True while a score is playing, as of the last render().
+    bool playing() const;
+
+    // Fills the buffer with signed 16-bit mono samples.
+    void render(int16_t* out, size_t samples);
+
+    int sample_rate() const;
+
+    // The number of 60Hz frames a quarter note lasts at the given tempo.
+    static int quarter_frames(uint8_t tempo);
+
+  private:
+    // The notes of every channel, flattened into one timeline of frames.
+    struct Event {
+      uint32_t frame;
+      uint8_t note;
+    };
+    struct Score {
+      std::array<std::vector<Event>, 4> events;
+      uint32_t frames;
+      bool loop;
+      // Links the scores waiting for room in retired_.
+      Score* next;
+    };
+
+    struct Command {
+      enum class Type { Play, Stop, Volume, Mute };
+      Type type;
+      Score* score;
+      float value;
+      int channel;
+    };
+
+    struct Pulse {
+      int duty;
+      float phase;
+      int period;
+      int volume;
+      int decay;
+      int sustain;
+      int divider;
+    };
+    struct Triangle {
+      float phase;
+      int period;
+      bool on;
+    };
+    struct Noise {
+      float phase;
+      int period;
+      uint16_t lfsr;
+      int volume;
+      int divider;
+    };
+
+    void send(const Command& cmd);
+    void collect();
+    void retire(Score* score);
+    void append(const Pattern& pattern, Score* score) const;
+    void run_command(const Command& cmd);
+    void start_frame();
+    void start_note(int ch, uint8_t note);
+    void clock_envelopes();
+    float mix();
+
+    const int sample_rate_;
+    const float cycles_per_sample_;
+
+    SpscQueue<Command, 64> commands_;
+    SpscQueue<Score*, 64> retired_;
+    std::atomic<bool> playing_;
+
+    // Audio thread state.
+    Score* score_;
+    Score* unretired_;
+    std::array<size_t, 4> next_event_;
+    uint32_t frame_;
+    float frame_clock_;
+    float envelope_clock_;
+    float volume_;
+    std::array<bool, 4> muted_;
+    std::array<Pulse, 2> pulse_;
+    Triangle triangle_;
+    Noise noise_;
+    float highpass_in_;
+    float highpass_out_;
+};
+
+} // namespace z2music
+
+#endif // define Z2UTIL_MUSIC_SYNTH
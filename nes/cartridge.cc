@@ -1,10 +1,29 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 
 #include "nes/cartridge.h"
 #include "util/file.h"
 
+thread_local Cartridge::ReadSet* Cartridge::reads_;
+thread_local Cartridge::ReadSet* Cartridge::writes_;
+
+namespace {
+// Reports the blocks which differ between two images of the same size.
+void ReportChanges(ChangeBus* bus, ChangeBus::Space space,
+                   const uint8_t* before, const uint8_t* after,
+                   uint32_t length) {
+    const uint32_t kBlock = 256;
+    for(uint32_t a=0; a<length; a+=kBlock) {
+        uint32_t n = std::min(kBlock, length - a);
+        if (memcmp(before + a, after + a, n))
+            bus->Changed(space, a, a + n);
+    }
+}
+}  // namespace
+
 Cartridge::Cartridge()
     : prg_(nullptr), prglen_(0),
     chr_(nullptr), chrlen_(0),
@@ -48,6 +67,12 @@ void Cartridge::LoadRom(const std::string& rom) {
     memcpy(&header_, data, sizeof(header_));
     offset += sizeof(header_);
 
+    // Keep the old image to tell the change bus what differs.
+    std::unique_ptr<uint8_t[]> oldprg(std::move(prg_));
+    std::unique_ptr<uint8_t[]> oldchr(std::move(chr_));
+    const uint32_t oldprglen = prglen_;
+    const uint32_t oldchrlen = chrlen_;
+
     mirror_ = MirrorMode(header_.mirror0 | (header_.mirror1 << 1));
     prglen_ = 16384 * header_.prgsz;
     prg_.reset(new uint8_t[prglen_]);
@@ -79,6 +104,14 @@ void Cartridge::LoadRom(const std::string& rom) {
     }
     memcpy(chr_.get(), data + offset, 8192 * header_.chrsz);
     offset += 8192 * header_.chrsz;
+    if (oldprg && oldchr && oldprglen == prglen_ && oldchrlen == chrlen_) {
+        ReportChanges(&changes_, ChangeBus::PRG, oldprg.get(), prg_.get(),
+                      prglen_);
+        ReportChanges(&changes_, ChangeBus::CHR, oldchr.get(), chr_.get(),
+                      chrlen_);
+    } else {
+        changes_.ChangedAll();
+    }
 }
 
 std::string Cartridge::SaveRom() {
@@ -153,6 +186,7 @@ void Cartridge::InsertPrg(int bank, uint8_t *data) {
     prglen_ += 16384;
     header_.prgsz++;
     prg_.reset(newprg);
+    changes_.ChangedAll();
 }
 
 void Cartridge::InsertChr(int bank, uint8_t *data) {
@@ -171,4 +205,5 @@ void Cartridge::InsertChr(int bank, uint8_t *data) {
     chrlen_ += 8192;
     header_.chrsz++;
     chr_.reset(newchr);
+    changes_.ChangedAll();
 }
@@ -1,10 +1,12 @@
 #ifndef Z2UTIL_NES_CARTRIDGE_H
 #define Z2UTIL_NES_CARTRIDGE_H
+#include <bitset>
 #include <string>
 #include <memory>
 #include <cstdint>
 
 #include "imwidget/debug_console.h"
+#include "nes/change_bus.h"
 
 class Cartridge {
   public:
@@ -63,10 +65,42 @@ class Cartridge {
     inline uint8_t* prg() const { return prg_.get(); }
     inline uint8_t* chr() const { return chr_.get(); }
 
-    inline uint8_t ReadPrg(uint32_t addr) { return prg_[addr]; }
-    inline uint8_t ReadChr(uint32_t addr) { return chr_[addr]; }
-    inline void WritePrg(uint32_t addr, uint8_t val) { prg_[addr] = val; }
-    inline void WriteChr(uint32_t addr, uint8_t val) { chr_[addr] = val; }
+    inline uint8_t ReadPrg(uint32_t addr) {
+        if (reads_) reads_->prg[(addr >> 14) & 0xFF] = true;
+        return prg_[addr];
+    }
+    inline uint8_t ReadChr(uint32_t addr) {
+        if (reads_) reads_->chr[(addr >> 12) & 0xFF] = true;
+        return chr_[addr];
+    }
+
+    // The 16KB PRG banks and 4KB CHR banks read or written while recording.
+    struct ReadSet {
+        std::bitset<256> prg;
+        std::bitset<256> chr;
+        bool empty() const { return prg.none() && chr.none(); }
+    };
+    // Records the banks read through ReadPrg and ReadChr into reads, and
+    // those written through WritePrg and WriteChr into writes, or stops
+    // recording if they are null.  Recording is per thread, so reads made
+    // by worker threads are never charged to the UI.
+    static inline void RecordReads(ReadSet* reads, ReadSet* writes=nullptr) {
+        reads_ = reads;
+        writes_ = writes;
+    }
+    inline void WritePrg(uint32_t addr, uint8_t val) {
+        prg_[addr] = val;
+        if (writes_) writes_->prg[(addr >> 14) & 0xFF] = true;
+        changes_.Changed(ChangeBus::PRG, addr);
+    }
+    inline void WriteChr(uint32_t addr, uint8_t val) {
+        chr_[addr] = val;
+        if (writes_) writes_->chr[(addr >> 12) & 0xFF] = true;
+        changes_.Changed(ChangeBus::CHR, addr);
+    }
+    // Writes through WritePrg and WriteChr are reported to the bus.  Code
+    // which writes through prg() or chr() must report its own changes.
+    inline ChangeBus* changes() { return &changes_; }
 
     void PrintHeader(DebugConsole* console, int argc, char **argv);
     void LoadFile(DebugConsole* console, int argc, char **argv);
@@ -82,6 +116,10 @@ class Cartridge {
     uint32_t chrlen_;
     std::unique_ptr<uint8_t[]> trainer_;
     MirrorMode mirror_;
+    static thread_local ReadSet* reads_;
+    static thread_local ReadSet* writes_;
+    // Not copied: subscribers watch the cartridge they subscribed to.
+    ChangeBus changes_;
 };
 
 #endif // Z2UTIL_NES_CARTRIDGE_H
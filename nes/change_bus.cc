@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <limits>
+
+#include "nes/change_bus.h"
+
+struct ChangeBus::Subscription::State {
+    struct Subscriber {
+        std::vector<Range> ranges;
+        // False if ranges were added since they were last sorted.
+        bool sorted;
+        Callback callback;
+    };
+    int next_id = 1;
+    std::map<int, Subscriber> subscribers;
+};
+
+namespace {
+
+// Sorts and merges overlapping or adjacent ranges.
+void Coalesce(std::vector<ChangeBus::Range>* ranges) {
+    std::sort(ranges->begin(), ranges->end(),
+              [](const ChangeBus::Range& a, const ChangeBus::Range& b) {
+                  return a.begin < b.begin;
+              });
+    size_t n = 0;
+    for(const auto& r : *ranges) {
+        if (n && r.begin <= (*ranges)[n-1].end) {
+            (*ranges)[n-1].end = std::max((*ranges)[n-1].end, r.end);
+        } else {
+            (*ranges)[n++] = r;
+        }
+    }
+    ranges->resize(n);
+}
+
+// Drops empty ranges, then sorts and merges the PRG ranges followed by the
+// CHR ranges.
+void Normalize(std::vector<ChangeBus::Range>* ranges) {
+    std::vector<ChangeBus::Range> result;
+    for(int space : {ChangeBus::PRG, ChangeBus::CHR}) {
+        std::vector<ChangeBus::Range> r;
+        for(const auto& range : *ranges) {
+            if (range.space == space && range.begin < range.end)
+                r.push_back(range);
+        }
+        Coalesce(&r);
+        result.insert(result.end(), r.begin(), r.end());
+    }
+    ranges->swap(result);
+}
+
+}  // namespace
+
+ChangeBus::Subscription::Subscription(Subscription&& other)
+  : state_(std::move(other.state_)), id_(other.id_) {
+    other.id_ = 0;
+}
+
+ChangeBus::Subscription& ChangeBus::Subscription::operator=(
+        Subscription&& other) {
+    if (this != &other) {
+        Reset();
+        state_ = std::move(other.state_);
+        id_ = other.id_;
+        other.id_ = 0;
+    }
+    return *this;
+}
+
+void ChangeBus::Subscription::Reset() {
+    if (auto state = state_.lock()) {
+        state->subscribers.erase(id_);
+    }
+    state_.reset();
+    id_ = 0;
+}
+
+void ChangeBus::Subscription::Add(const Range& range) {
+    auto state = state_.lock();
+    if (!state)
+        return;
+    auto it = state->subscribers.find(id_);
+    if (it != state->subscribers.end()) {
+        it->second.ranges.push_back(range);
+        it->second.sorted = false;
+    }
+}
+
+ChangeBus::ChangeBus()
+  : state_(std::make_shared<Subscription::State>()) {}
+
+ChangeBus::Subscription ChangeBus::Subscribe(std::vector<Range> ranges,
+                                             Callback callback) {
+    Subscription::State::Subscriber s;
+    s.ranges = std::move(ranges);
+    Normalize(&s.ranges);
+    s.sorted = true;
+    s.callback = callback;
+
+    int id = state_->next_id++;
+    state_->subscribers[id] = std::move(s);
+    return Subscription(state_, id);
+}
+
+void ChangeBus::Changed(Space space, uint32_t begin, uint32_t end) {
+    if (begin < end)
+        pending_[space].push_back({space, begin, end});
+}
+
+void ChangeBus::Compact(Space space) {
+    auto& p = pending_[space];
+    Coalesce(&p);
+    if (p.size() > kMaxPending / 2) {
+        // Still too scattered: report everything between them as changed.
+        p.front().end = p.back().end;
+        p.resize(1);
+    }
+}
+
+void ChangeBus::ChangedAll() {
+    for(int space : {PRG, CHR}) {
+        pending_[space].clear();
+        pending_[space].push_back({Space(space), 0,
+                                   std::numeric_limits<uint32_t>::max()});
+    }
+}
+
+void ChangeBus::Dispatch() {
+    if (pending_[PRG].empty() && pending_[CHR].empty())
+        return;
+
+    // Writes made by the subscribers are dispatched on the next call.
+    std::vector<Range> changed[2];
+    for(int space : {PRG, CHR}) {
+        changed[space].swap(pending_[space]);
+        Coalesce(&changed[space]);
+    }
+
+    // Subscribers may subscribe or unsubscribe while being called: only
+    // the ones which were subscribed before the dispatch and still are
+    // get called.
+    std::vector<int> ids;
+    for(const auto& s : state_->subscribers) {
+        ids.push_back(s.first);
+    }
+    for(int id : ids) {
+        auto it = state_->subscribers.find(id);
+        if (it == state_->subscribers.end())
+            continue;
+        if (!it->second.sorted) {
+            Normalize(&it->second.ranges);
+            it->second.sorted = true;
+        }
+
+        std::vector<Range> hits;
+        for(const auto& r : it->second.ranges) {
+            const auto& c = changed[r.space];
+            auto first = std::lower_bound(c.begin(), c.end(), r.begin,
+                    [](const Range& a, uint32_t addr) {
+                        return a.end <= addr;
+                    });
+            for(; first != c.end() && first->begin < r.end; ++first) {
+                hits.push_back({r.space, std::max(r.begin, first->begin),
+                                std::min(r.end, first->end)});
+            }
+        }
+        if (!hits.empty()) {
+            // The callback may unsubscribe, destroying itself.
+            Callback callback = it->second.callback;
+            callback(hits);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef Z2UTIL_NES_CHANGE_BUS_H
+#define Z2UTIL_NES_CHANGE_BUS_H
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Tells interested parties which bytes of the PRG and CHR ROM changed.
+//
+// Writes are recorded as they happen, but subscribers are only called from
+// Dispatch(), once per frame, with the changed ranges coalesced and clipped
+// to the ranges they subscribed to.  Each subscriber is called at most once
+// per Dispatch().
+class ChangeBus {
+  public:
+    enum Space {
+        PRG,
+        CHR,
+    };
+    // A range of offsets into the whole PRG or CHR ROM: [begin, end).
+    struct Range {
+        Space space;
+        uint32_t begin;
+        uint32_t end;
+    };
+    typedef std::function<void(const std::vector<Range>& changed)> Callback;
+
+    // Unsubscribes when destroyed.  It may outlive the bus.
+    class Subscription {
+      public:
+        Subscription() : id_(0) {}
+        Subscription(Subscription&& other);
+        Subscription& operator=(Subscription&& other);
+        ~Subscription() { Reset(); }
+
+        void Reset();
+        inline bool active() const { return id_ != 0; }
+        // Watches another range as well.  Ranges added between dispatches
+        // are merged with the others once, at the next Dispatch().
+        void Add(const Range& range);
+      private:
+        friend class ChangeBus;
+        struct State;
+        Subscription(std::weak_ptr<State> state, int id)
+          : state_(state), id_(id) {}
+
+        std::weak_ptr<State> state_;
+        int id_;
+    };
+
+    ChangeBus();
+    ChangeBus(const ChangeBus&) = delete;
+    ChangeBus& operator=(const ChangeBus&) = delete;
+
+    // The callback is called from Dispatch() when any of the ranges change.
+    Subscription Subscribe(std::vector<Range> ranges, Callback callback);
+
+    inline void Changed(Space space, uint32_t addr) {
+        // Most edits write consecutive bytes, which extend the last range.
+        auto& p = pending_[space];
+        if (!p.empty() && p.back().end == addr) {
+            p.back().end++;
+        } else if (p.empty() || addr < p.back().begin || addr >= p.back().end) {
+            p.push_back({space, addr, addr + 1});
+            if (p.size() >= kMaxPending) Compact(space);
+        }
+    }
+    void Changed(Space space, uint32_t begin, uint32_t end);
+    // Everything changed: a new image was loaded.
+    void ChangedAll();
+
+    // Calls the subscribers whose ranges changed since the last call.
+    void Dispatch();
+
+  private:
+    // Nothing dispatches in headless mode, so scattered writes are merged
+    // now and then to bound the pending list.
+    static const size_t kMaxPending = 4096;
+    void Compact(Space space);
+
+    std::vector<Range> pending_[2];
+    std::shared_ptr<Subscription::State> state_;
+};
+
+#endif // Z2UTIL_NES_CHANGE_BUS_H
@@ -0,0 +1,299 @@
+#include "nes/chr_analysis.h"
+
+#include <algorithm>
+
+#include <gflags/gflags.h>
+#include "nes/chr_util.h"
+#include "nes/mapper.h"
+#include "nes/text_encoding.h"
+#include "util/config.h"
+
+DECLARE_bool(hackjam2020);
+
+namespace z2util {
+
+std::string ChrAnalysis::Hash(const Planes& p) {
+    std::string best;
+    for(int f=0; f<4; f++) {
+        Planes flipped;
+        ChrUtil::Flip(p.data(), f & 1, f & 2, flipped.data());
+        std::string key(reinterpret_cast<const char*>(flipped.data()),
+                        flipped.size());
+        if (f == 0 || key < best)
+            best = key;
+    }
+    return best;
+}
+
+void ChrAnalysis::Analyze() {
+    const auto& ri = ConfigLoader<RomInfo>::GetConfig();
+    int n = mapper_->cartridge()->chrlen() / 16;
+    tiles_.resize(n);
+    hash_.resize(n);
+    for(int i=0; i<n; i++) {
+        for(int j=0; j<16; j++) {
+            tiles_[i][j] = mapper_->ReadChrBank(i / 256, (i % 256)*16 + j);
+        }
+        hash_[i] = Hash(tiles_[i]);
+    }
+
+    analyzed_.clear();
+    sprites_.clear();
+    references_.clear();
+    bytes_.clear();
+    for(const auto& m : ri.map()) {
+        AddMap(m);
+    }
+    for(const auto& m : ri.objtable()) {
+        AddMap(m);
+    }
+    std::set<int> sprites;
+    for(const auto& e : ri.enemies()) {
+        AddSprites(e, {});
+        for(const auto& it : e.info()) {
+            sprites.insert(it.second.chr().bank());
+        }
+    }
+    // Items show up in every area, so their tiles are in every sprite bank.
+    AddSprites(ri.items(), sprites);
+    Index();
+}
+
+void ChrAnalysis::AddMap(const Map& map) {
+    const auto& ri = ConfigLoader<RomInfo>::GetConfig();
+    int bank = map.chr().bank();
+    if (bank < 0 || bank >= banks() || !map.objtable_size())
+        return;
+    if (analyzed_.insert(bank).second) {
+        for(int t=0; t<256; t++) {
+            if (TextEncoding::FromZelda2(t))
+                Add(TEXT, {bank, t}, nullptr, false, "font");
+        }
+    }
+
+    if (map.type() == MapType::OVERWORLD) {
+        int size = FLAGS_hackjam2020 ? 64 : 16;
+        for(int i=0; i<size*4; i++) {
+            Address addr = map.objtable(0);
+            addr.set_address(addr.address() + i);
+            Add(OBJECT, {bank, mapper_->Read(addr, 0)}, &addr, true,
+                map.name());
+        }
+        return;
+    }
+
+    // Only the objects the decompressor draws are known to be in the
+    // tables.  The rest of each set may be other data, so their bytes keep
+    // their tiles in use but are never rewritten.
+    std::set<int> drawn;
+    for(const auto& d : ri.decompress()) {
+        if (d.area() == map.type())
+            drawn.insert(d.objid().begin(), d.objid().end());
+    }
+    for(int set=0; set<map.objtable_size() && set<4; set++) {
+        Address table = mapper_->ReadAddr(map.objtable(set), 0);
+        for(int i=0; i<64*4; i++) {
+            Address addr = table;
+            addr.set_address(table.address() + i);
+            Add(OBJECT, {bank, mapper_->Read(addr, 0)}, &addr,
+                drawn.count(set << 6 | i / 4) != 0, map.name());
+        }
+    }
+}
+
+void ChrAnalysis::AddSprites(const ItemInfo& info,
+                             const std::set<int>& extra) {
+    for(const auto& it : info.info()) {
+        const auto& sprite = it.second;
+        std::set<int> chr = extra;
+        chr.insert(sprite.has_chr() ? sprite.chr().bank() : info.chr().bank());
+        int width = sprite.width() ? sprite.width() : 16;
+        int height = sprite.height() ? sprite.height() : 16;
+        int n = sprite.id_size();
+        if (!n && sprite.has_table())
+            n = (width / 8) * (height / 16);
+
+        for(int i=0; i<n; i++) {
+            Address addr = sprite.table();
+            int id;
+            if (sprite.id_size()) {
+                id = sprite.id(i);
+                if (id == -1)
+                    continue;
+                id &= 0xff;
+            } else {
+                addr.set_address(addr.address() + i);
+                id = mapper_->Read(addr, 0);
+            }
+            // Sprites are 8x16: the low bit of the id picks the bank.
+            for(int bank : chr) {
+                for(int half=0; half<2; half++) {
+                    Slot slot{bank + (id & 1), (id & ~1) + half};
+                    if (slot.bank >= banks())
+                        continue;
+                    sprites_.insert(slot.bank);
+                    analyzed_.insert(slot.bank);
+                    Add(SPRITE, slot, sprite.id_size() ? nullptr : &addr,
+                        false, sprite.name());
+                }
+            }
+        }
+    }
+}
+
+void ChrAnalysis::Add(Source source, const Slot& slot, const Address* addr,
+                      bool rewritable, const std::string& name) {
+    Reference ref{source, slot, addr != nullptr, Address(), rewritable, name};
+    if (addr) {
+        ref.addr = *addr;
+        // Several maps share the same tables: count each byte once per bank.
+        auto& refs = bytes_[mapper_->PrgRange(*addr, 1).begin];
+        for(int r : refs) {
+            auto& other = references_[r];
+            if (other.source == source && other.slot.bank == slot.bank) {
+                other.rewritable |= rewritable;
+                return;
+            }
+        }
+        refs.push_back(references_.size());
+    }
+    references_.push_back(ref);
+}
+
+void ChrAnalysis::Index() {
+    used_.assign(tiles_.size(), {});
+    for(size_t i=0; i<references_.size(); i++) {
+        used_[index(references_[i].slot)].push_back(i);
+    }
+}
+
+std::vector<const ChrAnalysis::Reference*> ChrAnalysis::references(
+        const Slot& slot) const {
+    std::vector<const Reference*> refs;
+    for(int r : used_.at(index(slot))) {
+        refs.push_back(&references_[r]);
+    }
+    return refs;
+}
+
+std::vector<int> ChrAnalysis::Free(int bank) const {
+    std::vector<int> free;
+    if (!analyzed(bank))
+        return free;
+    for(int t=0; t<256; t++) {
+        if (used_[index({bank, t})].empty())
+            free.push_back(t);
+    }
+    return free;
+}
+
+std::vector<std::vector<int>> ChrAnalysis::Duplicates(int bank) const {
+    std::map<std::string, std::vector<int>> groups;
+    for(int t=0; t<256; t++) {
+        groups[hash_[index({bank, t})]].push_back(t);
+    }
+    std::vector<std::vector<int>> result;
+    for(auto& g : groups) {
+        if (g.second.size() > 1)
+            result.push_back(std::move(g.second));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<std::vector<ChrAnalysis::Slot>> ChrAnalysis::Duplicates() const {
+    std::map<std::string, std::vector<Slot>> groups;
+    for(size_t i=0; i<tiles_.size(); i++) {
+        groups[hash_[i]].push_back({int(i / 256), int(i % 256)});
+    }
+    std::vector<std::vector<Slot>> result;
+    for(auto& g : groups) {
+        if (g.second.size() > 1)
+            result.push_back(std::move(g.second));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool ChrAnalysis::Same(const Slot& a, const Slot& b) const {
+    return tiles_[index(a)] == tiles_[index(b)];
+}
+
+std::vector<ChrAnalysis::Slot> ChrAnalysis::Compact() {
+    std::vector<bool> before(used_.size());
+    for(size_t i=0; i<used_.size(); i++) {
+        before[i] = !used_[i].empty();
+    }
+
+    auto pinned = [this](const Slot& tile) {
+        for(int r : used_[index(tile)]) {
+            if (!references_[r].in_rom || !references_[r].rewritable)
+                return true;
+        }
+        return false;
+    };
+    // Whether every reference to the tile can be pointed at target.
+    auto movable = [this](const Slot& tile, int target) {
+        for(int r : used_[index(tile)]) {
+            const auto& ref = references_[r];
+            if (!ref.in_rom || !ref.rewritable)
+                return false;
+            // The byte also names the tile in the other banks it's used with.
+            for(int b : bytes_[mapper_->PrgRange(ref.addr, 1).begin]) {
+                int bank = references_[b].slot.bank;
+                if (!references_[b].rewritable ||
+                    !Same({bank, tile.tile}, {bank, target}))
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    for(int bank : analyzed_) {
+        std::map<Planes, std::vector<int>> same;
+        for(int t=0; t<256; t++) {
+            same[tiles_[index({bank, t})]].push_back(t);
+        }
+        for(const auto& group : same) {
+            const auto& slots = group.second;
+            if (slots.size() < 2)
+                continue;
+            // Keep a tile something can't move away from, if there is one,
+            // else the first one in use.
+            int target = -1;
+            for(int t : slots) {
+                if (target == -1 && !used_[index({bank, t})].empty())
+                    target = t;
+                if (pinned({bank, t})) {
+                    target = t;
+                    break;
+                }
+            }
+            if (target == -1)
+                continue;
+            for(int t : slots) {
+                Slot tile{bank, t};
+                if (t == target || used_[index(tile)].empty() ||
+                    !movable(tile, target))
+                    continue;
+                for(int r : std::vector<int>(used_[index(tile)])) {
+                    const Address addr = references_[r].addr;
+                    mapper_->Write(addr, 0, target);
+                    for(int b : bytes_[mapper_->PrgRange(addr, 1).begin]) {
+                        references_[b].slot.tile = target;
+                    }
+                }
+                Index();
+            }
+        }
+    }
+
+    std::vector<Slot> freed;
+    for(size_t i=0; i<used_.size(); i++) {
+        if (before[i] && used_[i].empty())
+            freed.push_back({int(i / 256), int(i % 256)});
+    }
+    return freed;
+}
+
+}  // namespace z2util
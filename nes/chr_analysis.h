@@ -0,0 +1,110 @@
+#ifndef Z2UTIL_NES_CHR_ANALYSIS_H
+#define Z2UTIL_NES_CHR_ANALYSIS_H
+#include <array>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "proto/rominfo.pb.h"
+
+class Mapper;
+namespace z2util {
+
+// Finds the duplicate and unused tiles in the CHR ROM.
+//
+// Every tile of every 4KB CHR bank is hashed so that a tile and its flipped
+// versions hash the same.  References to tiles come from the object tables
+// of the maps, the item and enemy sprites in the config and the font.
+// Banks nothing refers to aren't analyzed: the game loads some tiles (e.g.
+// Link's sprites) without any table we know about, so in them no tile can
+// be called free.
+class ChrAnalysis {
+  public:
+    enum Source {
+        // A tile byte of an object table.
+        OBJECT,
+        // One half of an 8x16 item or enemy sprite.
+        SPRITE,
+        // A letter of the font.
+        TEXT,
+    };
+    struct Slot {
+        int bank;
+        int tile;
+        bool operator<(const Slot& b) const {
+            return bank < b.bank || (bank == b.bank && tile < b.tile);
+        }
+    };
+    struct Reference {
+        Source source;
+        Slot slot;
+        // The PRG byte holding the tile id, if it is in the ROM at all.
+        bool in_rom;
+        Address addr;
+        // The byte is known to be used, so it may be pointed at an
+        // identical tile.  Sprite ids name a pair of tiles and can't be.
+        bool rewritable;
+        std::string name;
+    };
+
+    ChrAnalysis() : ChrAnalysis(nullptr) {}
+    explicit ChrAnalysis(Mapper* m) : mapper_(m) {}
+    inline void set_mapper(Mapper* m) { mapper_ = m; }
+
+    // Hashes the tiles and collects the references to them.
+    void Analyze();
+
+    int banks() const { return tiles_.size() / 256; }
+    inline bool analyzed(int bank) const { return analyzed_.count(bank) != 0; }
+    // Sprite banks also hold tiles the engine draws without any table, so
+    // their free slots may not really be free.
+    inline bool sprites(int bank) const { return sprites_.count(bank) != 0; }
+    inline const std::vector<Reference>& references() const {
+        return references_;
+    }
+    std::vector<const Reference*> references(const Slot& slot) const;
+
+    // The slots of an analyzed bank which nothing refers to.
+    std::vector<int> Free(int bank) const;
+    // Groups of identical tiles in one bank, possibly only when flipped.
+    // The first slot of each group is the one the others duplicate.
+    std::vector<std::vector<int>> Duplicates(int bank) const;
+    // Groups of identical tiles, possibly flipped, in every bank.
+    std::vector<std::vector<Slot>> Duplicates() const;
+    // True if the tiles are the same without flipping.
+    bool Same(const Slot& a, const Slot& b) const;
+
+    // Points the rewritable references to each tile at the first identical
+    // tile in the same bank.  A tile is only given up if all of its
+    // references can be moved, and a byte is only rewritten if the two
+    // tiles are identical in every bank the byte is used with.  Returns
+    // the slots which were freed.
+    std::vector<Slot> Compact();
+
+  private:
+    typedef std::array<uint8_t, 16> Planes;
+    inline int index(const Slot& s) const { return s.bank * 256 + s.tile; }
+    // The same string for a tile and its flipped versions.
+    static std::string Hash(const Planes& p);
+    void AddMap(const Map& map);
+    void AddSprites(const ItemInfo& info, const std::set<int>& extra);
+    void Add(Source source, const Slot& slot, const Address* addr,
+             bool rewritable, const std::string& name);
+    void Index();
+
+    Mapper* mapper_;
+    std::vector<Planes> tiles_;
+    std::vector<std::string> hash_;
+    std::set<int> analyzed_;
+    std::set<int> sprites_;
+    std::vector<Reference> references_;
+    // The references to each tile, by index.
+    std::vector<std::vector<int>> used_;
+    // The references through each PRG byte, by PRG offset.
+    std::map<uint32_t, std::vector<int>> bytes_;
+};
+
+}  // namespace
+#endif // Z2UTIL_NES_CHR_ANALYSIS_H
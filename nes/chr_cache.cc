@@ -0,0 +1,137 @@
+#include "nes/chr_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "nes/mapper.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHR_CACHE_SSE2
+#endif
+
+namespace z2util {
+namespace {
+
+#ifndef CHR_CACHE_SSE2
+// The eight pixels of one bitplane row, one byte each, leftmost first.
+struct Spread {
+    uint8_t bits[256][8];
+    Spread() {
+        for(int v=0; v<256; v++) {
+            for(int col=0; col<8; col++) {
+                bits[v][col] = (v >> (7 - col)) & 1;
+            }
+        }
+    }
+};
+#endif
+
+}  // namespace
+
+ChrCache::ChrCache(Mapper* m)
+  : mapper_(nullptr) {
+    set_mapper(m);
+}
+
+void ChrCache::set_mapper(Mapper* m) {
+    mapper_ = m;
+    watch_.Reset();
+    Resize();
+    if (mapper_) {
+        watch_ = mapper_->changes()->Subscribe(
+            {{ChangeBus::CHR, 0, std::numeric_limits<uint32_t>::max()}},
+            [this](const std::vector<ChangeBus::Range>& changed) {
+                Invalidate(changed);
+            });
+    }
+}
+
+int ChrCache::tiles() const {
+    return mapper_ ? mapper_->cartridge()->chrlen() / 16 : 0;
+}
+
+int ChrCache::index(int bank, int tile) const {
+    return mapper_->ChrRange(bank, tile * 16, 16).begin / 16;
+}
+
+uint32_t ChrCache::generation(int index) const {
+    return index >= 0 && index < int(generation_.size())
+        ? generation_[index] : 0;
+}
+
+void ChrCache::Resize() {
+    int n = tiles();
+    pixels_.assign(n * kTileSize, 0);
+    valid_.assign(n, false);
+    generation_.resize(n);
+    for(auto& g : generation_) {
+        g++;
+    }
+}
+
+void ChrCache::Invalidate(const std::vector<ChangeBus::Range>& changed) {
+    if (int(valid_.size()) != tiles()) {
+        // A new image was loaded or a bank was inserted.
+        Resize();
+        return;
+    }
+    for(const auto& r : changed) {
+        size_t last = std::min<size_t>(valid_.size(), (size_t(r.end) + 15) / 16);
+        for(size_t i = r.begin / 16; i < last; i++) {
+            valid_[i] = false;
+            generation_[i]++;
+        }
+    }
+}
+
+const uint8_t* ChrCache::Tile(int index) {
+    static const uint8_t blank[kTileSize] = {0};
+    if (int(valid_.size()) != tiles()) {
+        Resize();
+    }
+    if (index < 0 || index >= int(valid_.size())) {
+        return blank;
+    }
+    uint8_t* pixels = &pixels_[index * kTileSize];
+    if (!valid_[index]) {
+        Decode(mapper_->cartridge()->chr() + index * 16, pixels);
+        valid_[index] = true;
+    }
+    return pixels;
+}
+
+void ChrCache::Decode(const uint8_t* planes, uint8_t* pixels) {
+#ifdef CHR_CACHE_SSE2
+    // Two rows at a time: broadcast each row's bitplane byte to eight
+    // lanes, then pick one bit per lane.
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, char(0x80),
+                                      1, 2, 4, 8, 16, 32, 64, char(0x80));
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    for(int row=0; row<8; row+=2) {
+        __m128i lo = _mm_unpacklo_epi64(_mm_set1_epi8(char(planes[row])),
+                                        _mm_set1_epi8(char(planes[row+1])));
+        __m128i hi = _mm_unpacklo_epi64(_mm_set1_epi8(char(planes[row+8])),
+                                        _mm_set1_epi8(char(planes[row+9])));
+        lo = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), one);
+        hi = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), two);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + row*8),
+                         _mm_or_si128(lo, hi));
+    }
+#else
+    // A row at a time, eight pixels in a 64 bit word.
+    static const Spread spread;
+    for(int row=0; row<8; row++) {
+        uint64_t lo, hi;
+        memcpy(&lo, spread.bits[planes[row]], 8);
+        memcpy(&hi, spread.bits[planes[row+8]], 8);
+        lo |= hi << 1;
+        memcpy(pixels + row*8, &lo, 8);
+    }
+#endif
+}
+
+}  // namespace z2util
@@ -0,0 +1,57 @@
+#ifndef Z2UTIL_NES_CHR_CACHE_H
+#define Z2UTIL_NES_CHR_CACHE_H
+#include <cstdint>
+#include <vector>
+
+#include "nes/change_bus.h"
+
+class Mapper;
+namespace z2util {
+
+// Decoded CHR tiles: each 8x8 tile as 64 bytes of color indices (0-3), one
+// byte per pixel, in rows.
+//
+// Tiles are decoded the first time they're asked for and again after a
+// write to their CHR bytes, which the cache learns about from the
+// cartridge's change bus.
+class ChrCache {
+  public:
+    static const int kTileSize = 64;
+
+    ChrCache() : ChrCache(nullptr) {}
+    explicit ChrCache(Mapper* m);
+    ChrCache(const ChrCache&) = delete;
+    ChrCache& operator=(const ChrCache&) = delete;
+
+    void set_mapper(Mapper* m);
+
+    // The tiles in the CHR ROM.  A tile's index is its CHR offset / 16.
+    int tiles() const;
+    // The index of a tile in a 4KB CHR bank, as ReadChrBank sees it.
+    int index(int bank, int tile) const;
+    // The pixels of the tile with the given index.
+    const uint8_t* Tile(int index);
+    inline const uint8_t* Tile(int bank, int tile) {
+        return Tile(index(bank, tile));
+    }
+    // Changes whenever the tile's CHR bytes are written, so that viewers
+    // can tell which tiles they need to draw again.
+    uint32_t generation(int index) const;
+
+    // Expands the two bitplanes of a tile (16 bytes, as stored in the CHR
+    // ROM) to 64 color indices.
+    static void Decode(const uint8_t* planes, uint8_t* pixels);
+
+  private:
+    void Resize();
+    void Invalidate(const std::vector<ChangeBus::Range>& changed);
+
+    Mapper* mapper_;
+    std::vector<uint8_t> pixels_;
+    std::vector<bool> valid_;
+    std::vector<uint32_t> generation_;
+    ChangeBus::Subscription watch_;
+};
+
+}  // namespace
+#endif // Z2UTIL_NES_CHR_CACHE_H
@@ -0,0 +1,112 @@
+#include "nes/chr_draw.h"
+
+#include <algorithm>
+
+#include "imwidget/hwpalette.h"
+#include "nes/mapper.h"
+#include "util/config.h"
+
+namespace z2util {
+
+void ChrDraw::Tile(int tile, int pal, int x, int y, bool tall, bool flip) {
+    int bank = chr_.bank();
+    int height = 8;
+    if (tall) {
+        bank += tile & 1;
+        tile &= ~1;
+        height = 16;
+    }
+    Read(mapper_->ChrRange(bank, chr_.address() + 16*tile, 16*(height / 8)));
+    Read(mapper_->PrgRange(palette_.bank(), palette_.address() + pal * 4, 4));
+
+    const auto* hw = NesHardwarePalette::Get();
+    for(int row=0; row<height; row++) {
+        int dy = y + row;
+        if (dy < 0 || dy >= height_)
+            continue;
+        int addr = chr_.address() + 16*(tile + row / 8) + (row & 7);
+        uint8_t a = mapper_->ReadChrBank(bank, addr);
+        uint8_t b = mapper_->ReadChrBank(bank, addr + 8);
+        for(int col=0; col<8; col++, a<<=1, b<<=1) {
+            int dx = x + (flip ? 7 - col : col);
+            uint8_t color = (a & 0x80) >> 7 | (b & 0x80) >> 6;
+            color = mapper_->Read(palette_, pal * 4 + color);
+            if (color != 0xFF && dx >= 0 && dx < width_)
+                pixels_[dy * width_ + dx] = hw->palette(color);
+        }
+    }
+}
+
+void ChrDraw::Object(const Address& table, uint8_t obj, bool overworld,
+                     int x, int y) {
+    int pal = obj >> 6;
+    if (overworld) {
+        const auto& misc = ConfigLoader<RomInfo>::GetConfig().misc();
+        Read(mapper_->PrgRange(misc.overworld_tile_palettes().bank(),
+                misc.overworld_tile_palettes().address() + obj, 1));
+        pal = mapper_->Read(misc.overworld_tile_palettes(), obj);
+    }
+    int offset = (obj & 0x3f) * 4;
+    Read(mapper_->PrgRange(table.bank(), table.address() + offset, 4));
+    for(int i=0; i<4; i++) {
+        Tile(mapper_->Read(table, offset + i), pal,
+             x + (i / 2) * 8, y + (i % 2) * 8);
+    }
+
+    // Hack to make walkable water tiles visible
+    if (overworld && obj == 13) {
+        for(int dy=std::max(y, 0); dy<y+16 && dy<height_; dy++) {
+            for(int dx=std::max(x, 0); dx<x+16 && dx<width_; dx++) {
+                uint32_t& p = pixels_[dy * width_ + dx];
+                p = ((p >> 1) & 0x7f7f7f7f) | 0xFF000000;
+            }
+        }
+    }
+}
+
+void ChrDraw::Sprite(const SpriteInfo& item, int x, int y, bool known_bank) {
+    Address chr = chr_;
+    if (known_bank)
+        chr_ = item.chr();
+    int width = item.width() ? item.width() : 16;
+    int height = item.height() ? item.height() : 16;
+    if (!item.id_size())
+        Read(mapper_->PrgRange(item.table(), (width / 8) * (height / 16)));
+    int n = 0;
+    for(int sy=0; sy<height; sy+=16) {
+        int lasttile = -1;
+        for(int sx=0; sx<width; sx+=8, n++) {
+            if (item.id_size() && n >= item.id_size())
+                break;
+            int tile = item.id_size() ? item.id(n) :
+                mapper_->Read(item.table(), n);
+            if (tile == -1)
+                continue;
+            // Magic bits from tile IDs in the config control non-grid
+            // offset placements and mirroring.
+            bool mirror = tile==lasttile || tile & 0x1000000;
+            int xofs = (tile >> 16) & 0xff;
+            int yofs = (tile >> 8) & 0xff;
+            tile &= 0xff;
+            Tile(tile, item.palette(), x+sx+xofs, y+sy+yofs, true, mirror);
+            lasttile = tile;
+        }
+    }
+    chr_ = chr;
+}
+
+Address ChrDraw::ItemPalette(int bank) {
+    Address ipal;
+    // FIXME(cfrantz): hardcoded palette location
+    ipal.set_bank(bank);
+    ipal.set_address(0x809e);
+    return ipal;
+}
+
+Address ChrDraw::SpriteChr(const Address& map_chr) {
+    Address chr;
+    chr.set_bank(map_chr.bank() & ~1);
+    return chr;
+}
+
+}  // namespace z2util
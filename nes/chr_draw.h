@@ -0,0 +1,60 @@
+#ifndef Z2UTIL_NES_CHR_DRAW_H
+#define Z2UTIL_NES_CHR_DRAW_H
+#include <cstdint>
+#include <functional>
+
+#include "nes/change_bus.h"
+#include "proto/rominfo.pb.h"
+
+class Mapper;
+namespace z2util {
+
+// Draws CHR tiles from the ROM into RGBA pixels.  Z2ObjectCache draws its
+// bitmaps with it and WorldAtlas draws whole maps with it, without GL.
+// Transparent pixels are left alone and nothing is drawn outside of the
+// pixels.
+class ChrDraw {
+  public:
+    // Called with every range of the ROM a drawing reads.
+    typedef std::function<void(const ChangeBus::Range&)> Reads;
+
+    ChrDraw(Mapper* m, uint32_t* pixels, int width, int height)
+      : mapper_(m), pixels_(pixels), width_(width), height_(height) {}
+
+    inline void set_chr(const Address& chr) { chr_ = chr; }
+    inline void set_palette(const Address& p) { palette_ = p; }
+    inline void set_reads(Reads reads) { reads_ = reads; }
+
+    // Draws an 8x8 tile or, if tall, the 8x16 sprite with the given id.
+    void Tile(int tile, int pal, int x, int y, bool tall=false,
+              bool flip=false);
+    // Draws the 16x16 object obj from an object table.  Overworld objects
+    // take their subpalette from the config, sideview objects from their
+    // set.
+    void Object(const Address& table, uint8_t obj, bool overworld,
+                int x, int y);
+    // Draws an item or enemy, from its own CHR bank if known_bank.
+    void Sprite(const SpriteInfo& item, int x, int y, bool known_bank=false);
+
+    // Where items and enemies get their palette in a sideview area.
+    static Address ItemPalette(int bank);
+    // Items and enemies are drawn from the even CHR bank of their area.
+    static Address SpriteChr(const Address& map_chr);
+
+  private:
+    void Read(const ChangeBus::Range& range) {
+        if (reads_)
+            reads_(range);
+    }
+
+    Mapper* mapper_;
+    uint32_t* pixels_;
+    int width_;
+    int height_;
+    Address chr_;
+    Address palette_;
+    Reads reads_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_NES_CHR_DRAW_H
@@ -0,0 +1,185 @@
+#include "nes/chr_import.h"
+
+#include <cmath>
+#include <string>
+
+#include "nes/chr_util.h"
+#include "nes/mapper.h"
+
+namespace z2util {
+namespace {
+
+typedef std::array<uint8_t, 16> Planes;
+
+Planes Flip(const Planes& p, bool hflip, bool vflip) {
+    Planes f;
+    ChrUtil::Flip(p.data(), hflip, vflip, f.data());
+    return f;
+}
+
+std::string Key(const Planes& p) {
+    return std::string(reinterpret_cast<const char*>(p.data()), p.size());
+}
+
+float Linear(uint8_t c) {
+    float v = c / 255.0f;
+    return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+}  // namespace
+
+ChrImport::ChrImport(const std::vector<SubPalette>& subpalettes) {
+    for(const auto& sp : subpalettes) {
+        std::array<Lab, 4> lab;
+        for(int i=0; i<4; i++) {
+            lab[i] = ToLab(sp[i]);
+        }
+        subpalettes_.push_back(lab);
+    }
+}
+
+ChrImport::Lab ChrImport::ToLab(uint32_t rgba) {
+    // sRGB to OKLab.
+    float r = Linear(rgba), g = Linear(rgba >> 8), b = Linear(rgba >> 16);
+    float l = std::cbrt(0.4122214708f*r + 0.5363325363f*g + 0.0514459929f*b);
+    float m = std::cbrt(0.2119034982f*r + 0.6806995451f*g + 0.1073969566f*b);
+    float s = std::cbrt(0.0883024619f*r + 0.2817188376f*g + 0.6299787005f*b);
+    return {
+        0.2104542553f*l + 0.7936177850f*m - 0.0040720468f*s,
+        1.9779984951f*l - 2.4285922050f*m + 0.4505937099f*s,
+        0.0259040371f*l + 0.7827717662f*m - 0.8086757660f*s,
+    };
+}
+
+const ChrImport::Match& ChrImport::Nearest(uint32_t rgba) {
+    // Images have few colors: each is matched against the subpalettes once.
+    auto it = matches_.find(rgba);
+    if (it != matches_.end())
+        return it->second;
+
+    Match& m = matches_[rgba];
+    const bool transparent = (rgba >> 24) == 0;
+    const Lab c = ToLab(rgba);
+    for(const auto& sp : subpalettes_) {
+        int best = 0;
+        float distance = 0;
+        if (!transparent) {
+            distance = INFINITY;
+            for(int i=0; i<4; i++) {
+                float dl = c.l - sp[i].l, da = c.a - sp[i].a, db = c.b - sp[i].b;
+                float d = dl*dl + da*da + db*db;
+                if (d < distance) {
+                    distance = d;
+                    best = i;
+                }
+            }
+        }
+        m.index.push_back(best);
+        m.distance.push_back(distance);
+    }
+    return m;
+}
+
+ChrImport::Tile ChrImport::Quantize(const uint32_t* pixels, int stride) {
+    const Match* match[64];
+    for(int y=0; y<8; y++) {
+        for(int x=0; x<8; x++) {
+            match[y*8 + x] = &Nearest(pixels[y*stride + x]);
+        }
+    }
+
+    Tile tile;
+    tile.subpalette = 0;
+    float best = INFINITY;
+    for(size_t sp=0; sp<subpalettes_.size(); sp++) {
+        float error = 0;
+        for(int i=0; i<64; i++) {
+            error += match[i]->distance[sp];
+        }
+        if (error < best) {
+            best = error;
+            tile.subpalette = sp;
+        }
+    }
+    for(int i=0; i<64; i++) {
+        tile.pixels[i] = subpalettes_.empty()
+            ? 0 : match[i]->index[tile.subpalette];
+    }
+    return tile;
+}
+
+std::vector<ChrImport::Tile> ChrImport::Quantize(const uint32_t* image,
+                                                 int width, int height) {
+    std::vector<Tile> tiles;
+    for(int y=0; y+8<=height; y+=8) {
+        for(int x=0; x+8<=width; x+=8) {
+            tiles.push_back(Quantize(image + y*width + x, width));
+        }
+    }
+    return tiles;
+}
+
+void ChrImport::Encode(const uint8_t* pixels, uint8_t* planes) {
+    for(int row=0; row<8; row++) {
+        uint8_t a = 0, b = 0;
+        for(int col=0; col<8; col++) {
+            a = a << 1 | (pixels[row*8 + col] & 1);
+            b = b << 1 | (pixels[row*8 + col] >> 1 & 1);
+        }
+        planes[row] = a;
+        planes[row+8] = b;
+    }
+}
+
+bool ChrImport::Place(Mapper* mapper, int bank, int first,
+                      const std::vector<Tile>& tiles, bool flips,
+                      std::vector<Placement>* placements) {
+    // Every orientation of every tile which can be reused.  Unflipped
+    // tiles go in first so that they're preferred.
+    std::unordered_map<std::string, Placement> known;
+    auto add = [&known, flips](const Planes& p, int slot) {
+        for(int f=0; f < (flips ? 4 : 1); f++) {
+            known.emplace(Key(Flip(p, f & 1, f & 2)),
+                          Placement{slot, bool(f & 1), bool(f & 2), false});
+        }
+    };
+    std::vector<Planes> existing(first);
+    for(int slot=0; slot<first; slot++) {
+        for(int i=0; i<16; i++) {
+            existing[slot][i] = mapper->ReadChrBank(bank, slot*16 + i);
+        }
+        known.emplace(Key(existing[slot]), Placement{slot, false, false, false});
+    }
+    for(int slot=0; slot<first; slot++) {
+        add(existing[slot], slot);
+    }
+
+    // Plan everything before writing anything.
+    std::vector<Placement> result;
+    std::vector<Planes> writes;
+    for(const auto& tile : tiles) {
+        Planes p;
+        Encode(tile.pixels, p.data());
+        auto it = known.find(Key(p));
+        if (it != known.end()) {
+            result.push_back(it->second);
+            continue;
+        }
+        int slot = first + writes.size();
+        if (slot >= 256)
+            return false;
+        writes.push_back(p);
+        add(p, slot);
+        result.push_back({slot, false, false, true});
+    }
+
+    for(size_t n=0; n<writes.size(); n++) {
+        for(int i=0; i<16; i++) {
+            mapper->WriteChrBank(bank, (first + n)*16 + i, writes[n][i]);
+        }
+    }
+    placements->swap(result);
+    return true;
+}
+
+}  // namespace z2util
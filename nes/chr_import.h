@@ -0,0 +1,72 @@
+#ifndef Z2UTIL_NES_CHR_IMPORT_H
+#define Z2UTIL_NES_CHR_IMPORT_H
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class Mapper;
+namespace z2util {
+
+// Converts images to CHR tiles.
+//
+// Each 8x8 tile of an image is quantized to whichever of the subpalettes
+// matches it best, comparing colors in the OKLab perceptual color space.
+// Colors are RGBA words as GLBitmap stores them (0xAABBGGRR); transparent
+// pixels become color 0.
+class ChrImport {
+  public:
+    typedef std::array<uint32_t, 4> SubPalette;
+    struct Tile {
+        uint8_t pixels[64];
+        int subpalette;
+    };
+    // Where an imported tile ended up in the bank, and how the tile in
+    // that slot must be flipped to show it.
+    struct Placement {
+        int slot;
+        bool hflip;
+        bool vflip;
+        // False if an existing tile was reused.
+        bool written;
+    };
+
+    explicit ChrImport(const std::vector<SubPalette>& subpalettes);
+
+    // Quantizes the 8x8 tile at pixels, whose rows are stride pixels apart.
+    Tile Quantize(const uint32_t* pixels, int stride);
+    // Quantizes every whole 8x8 tile of the image, in rows.
+    std::vector<Tile> Quantize(const uint32_t* image, int width, int height);
+
+    // Writes tiles to the CHR bank using as few slots as possible.  A tile
+    // which is already in one of the slots before first, or which was
+    // already written, is not written again.  Flipped matches are only
+    // reused if flips is set: the PPU can flip sprites but not background
+    // tiles.  The others are written to consecutive slots starting at
+    // first.  Returns false, writing nothing, if they don't fit.
+    static bool Place(Mapper* mapper, int bank, int first,
+                      const std::vector<Tile>& tiles, bool flips,
+                      std::vector<Placement>* placements);
+
+    // Converts between 64 color indices and the two bitplanes (16 bytes)
+    // a tile is stored as.
+    static void Encode(const uint8_t* pixels, uint8_t* planes);
+
+  private:
+    struct Lab {
+        float l, a, b;
+    };
+    // The closest color of each subpalette to one image color.
+    struct Match {
+        std::vector<uint8_t> index;
+        std::vector<float> distance;
+    };
+    static Lab ToLab(uint32_t rgba);
+    const Match& Nearest(uint32_t rgba);
+
+    std::vector<std::array<Lab, 4>> subpalettes_;
+    std::unordered_map<uint32_t, Match> matches_;
+};
+
+}  // namespace
+#endif // Z2UTIL_NES_CHR_IMPORT_H
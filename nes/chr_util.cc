@@ -4,6 +4,17 @@
 #include "nes/mapper.h"
 
 namespace z2util {
+namespace {
+
+uint8_t Reverse(uint8_t v) {
+    v = (v & 0xF0) >> 4 | (v & 0x0F) << 4;
+    v = (v & 0xCC) >> 2 | (v & 0x33) << 2;
+    v = (v & 0xAA) >> 1 | (v & 0x55) << 1;
+    return v;
+}
+
+}  // namespace
+
 const uint8_t chrxdigits[16][8] = {
     { 2, 5, 5, 5, 5, 5, 2, 0 },    // 0
     { 2, 6, 2, 2, 2, 2, 7, 0 },    // 1
@@ -55,5 +66,13 @@ void ChrUtil::Swap(int dbank, uint8_t dst, int sbank, uint8_t src) {
     }
 }
 
+void ChrUtil::Flip(const uint8_t* planes, bool hflip, bool vflip,
+                   uint8_t* out) {
+    for(int row=0; row<8; row++) {
+        int src = vflip ? 7 - row : row;
+        out[row] = hflip ? Reverse(planes[src]) : planes[src];
+        out[row+8] = hflip ? Reverse(planes[src+8]) : planes[src+8];
+    }
+}
 
 }  // namespace
@@ -13,6 +13,10 @@ class ChrUtil {
     void Clear(int bank, uint8_t ch, bool with_id=false);
     void Copy(int dbank, uint8_t dst, int sbank, uint8_t src);
     void Swap(int dbank, uint8_t dst, int sbank, uint8_t src);
+    // Flips the two bitplanes (16 bytes) of a tile horizontally and/or
+    // vertically.  planes and out must not overlap.
+    static void Flip(const uint8_t* planes, bool hflip, bool vflip,
+                     uint8_t* out);
     inline void set_mapper(Mapper* m) { mapper_ = m; }
 
   private:
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <set>
 
 #include "nes/enemylist.h"
@@ -5,6 +6,7 @@
 #include "nes/mapper.h"
 #include "proto/rominfo.pb.h"
 #include "util/config.h"
+#include "util/logging.h"
 #include <gflags/gflags.h>
 
 
@@ -111,49 +113,251 @@ void EnemyListPack::Add(int area, const std::vector<uint8_t>& data) {
 }
 
 
-bool EnemyListPack::Pack() {
+namespace {
+typedef std::vector<uint8_t> EnemyList;
+
+// Split an area's data into its enemy lists.  Each list starts with its
+// own length (including the length byte).
+std::vector<EnemyList> SplitLists(const std::vector<uint8_t>& data) {
+    std::vector<EnemyList> lists;
+    for(size_t i=0; i<data.size(); ) {
+        size_t len = data[i];
+        if (len == 0 || i + len > data.size())
+            len = data.size() - i;
+        lists.emplace_back(data.begin() + i, data.begin() + i + len);
+        i += len;
+    }
+    return lists;
+}
+}  // namespace
+
+// Lists are packed as indivisible units.  An area needs either a single
+// list (anywhere in the buffer) or, for overworld encounter areas, a pair
+// of lists which must be adjacent.  Identical lists are stored once, and
+// each required pair is an edge in a graph of lists.  The buffer is a set
+// of trails through that graph; covering every edge exactly once with the
+// fewest (and cheapest) trail starts gives the smallest buffer.
+int EnemyListPack::Layout(std::vector<uint8_t>* packed, int* unshared) {
     const auto& misc = ConfigLoader<RomInfo>::GetConfig().misc();
-    std::vector<uint8_t> packed;
-    
-    // Insert an empty list to consolidate all empty rooms to the same
-    // zero length list.
-    packed.push_back(1);
-    // Insert a second empty list: if Link dies to a large encounter, the
-    // game will spawn enemies from the second encounter list in area 0
-    // (north palace).  Since North Palace is usually empty, it will pick
-    // the enemy list from the next area.
-    packed.push_back(1);
+    std::map<EnemyList, int> ids;
+    std::vector<EnemyList> lists;
+    auto id = [&ids, &lists](const EnemyList& list) {
+        auto r = ids.emplace(list, lists.size());
+        if (r.second)
+            lists.push_back(list);
+        return r.first->second;
+    };
 
-    // Pack all of the enemy lists into the buffer
+    // The empty-list sentinels are always first: all empty rooms share the
+    // first one, and if Link dies to a large encounter, the game will spawn
+    // enemies from the second encounter list in area 0 (north palace).
+    // Since North Palace is usually empty, it will pick the enemy list from
+    // the next area.
+    const int kEmpty = id(EnemyList{1});
+
+    // What each referenced entry needs.
+    std::map<uint16_t, std::vector<int>> need;
+    std::set<uint16_t> seen;
+    *unshared = 2;
     for(int i=0; i<126; i++) {
-        char side = 'A' + i/63;
-        int room = i%63;
         int addr = area_[i];
-        if (addr == 0)
+        if (addr == 0 || !seen.insert(addr).second)
+            continue;
+        const List& entry = entry_[addr];
+        std::vector<int> tokens;
+        for(const auto& list : SplitLists(entry.data)) {
+            tokens.push_back(id(list));
+        }
+        if (tokens.size() > 2)
+            tokens.resize(2);
+        if (!(entry.data.size() == 1 && !IsEncounter(i % 63)))
+            *unshared += entry.data.size();
+        need[addr] = tokens;
+    }
+
+    // Build the graph of required adjacent pairs.  The sentinels already
+    // provide (empty, empty).
+    int n = lists.size();
+    std::set<std::pair<int, int>> edge_set;
+    std::set<int> single;
+    for(const auto& nd : need) {
+        if (nd.second.size() == 2) {
+            if (!(nd.second[0] == kEmpty && nd.second[1] == kEmpty))
+                edge_set.insert(std::make_pair(nd.second[0], nd.second[1]));
+        } else if (nd.second.size() == 1) {
+            single.insert(nd.second[0]);
+        }
+    }
+    std::vector<std::vector<int>> adj(n + 1);
+    std::vector<int> balance(n, 0);
+    std::vector<std::pair<int, int>> edges(edge_set.begin(), edge_set.end());
+    for(size_t e=0; e<edges.size(); ++e) {
+        adj[edges[e].first].push_back(e);
+        balance[edges[e].first]++;
+        balance[edges[e].second]--;
+    }
+
+    // Find the weakly connected components of the lists with edges.
+    std::vector<std::vector<int>> neighbor(n);
+    for(const auto& e : edges) {
+        neighbor[e.first].push_back(e.second);
+        neighbor[e.second].push_back(e.first);
+    }
+    std::vector<int> comp(n, -1);
+    int ncomp = 0;
+    for(int v=0; v<n; ++v) {
+        if (comp[v] != -1 || neighbor[v].empty())
             continue;
+        std::vector<int> stack = {v};
+        comp[v] = ncomp;
+        while(!stack.empty()) {
+            int u = stack.back();
+            stack.pop_back();
+            for(const auto& w : neighbor[u]) {
+                if (comp[w] == -1) {
+                    comp[w] = ncomp;
+                    stack.push_back(w);
+                }
+            }
+        }
+        ncomp++;
+    }
 
-        List& entry = entry_[addr];
-        if (entry.newaddr == 0) {
-            if (entry.data.size() == 1 && !IsEncounter(room)) {
-                // All empty lists (lists of length 1) point to the
-                // empty-list sentinel at the beginning of the packed array.
-                entry.newaddr = 0 + misc.enemy_data_ram();
-                LOGF(INFO, "Packed room %c%d at %04x (%d bytes)",
-                        side, room, entry.newaddr, entry.data.size());
-            } else if (packed.size() + entry.data.size() > size_) {
-                LOGF(ERROR, "Out of space for enemy list at %c%d (want %d+%d / %d)",
-                        side, room, packed.size(), entry.data.size(), size_);
-                return false;
-            } else {
-                entry.newaddr = packed.size() + misc.enemy_data_ram();
-                packed.insert(packed.end(), entry.data.begin(), entry.data.end());
-                LOGF(INFO, "Packed room %c%d at %04x (%d bytes)",
-                        side, room, entry.newaddr, entry.data.size());
+    // Trails must start at nodes with more outgoing than incoming edges.
+    // A balanced component is a circuit; start it at its cheapest node,
+    // preferring the empty list so it can follow the sentinels.  A virtual
+    // node (n) joins the ends of the trails so that one Euler circuit per
+    // component visits every edge.
+    const int kVirtual = n;
+    std::vector<std::pair<int, int>> all = edges;
+    for(int c=0; c<ncomp; ++c) {
+        int best = -1;
+        bool balanced = true;
+        for(int v=0; v<n; ++v) {
+            if (comp[v] != c) continue;
+            if (balance[v] != 0) balanced = false;
+            if (best == -1 || v == kEmpty ||
+                (best != kEmpty && lists[v].size() < lists[best].size()))
+                best = v;
+        }
+        for(int v=0; v<n; ++v) {
+            if (comp[v] != c) continue;
+            int d = balanced ? (v == best) : balance[v];
+            for(; d > 0; --d) {
+                adj[kVirtual].push_back(all.size());
+                all.emplace_back(kVirtual, v);
+            }
+            d = balanced ? (v == best) : -balance[v];
+            for(; d > 0; --d) {
+                adj[v].push_back(all.size());
+                all.emplace_back(v, kVirtual);
             }
+        }
+    }
+
+    // Hierholzer's algorithm from the virtual node, then split the circuit
+    // into trails wherever it passes through the virtual node.
+    std::vector<size_t> next(n + 1, 0);
+    std::vector<int> circuit;
+    std::vector<int> stack = {kVirtual};
+    while(!stack.empty()) {
+        int u = stack.back();
+        if (next[u] < adj[u].size()) {
+            stack.push_back(all[adj[u][next[u]++]].second);
         } else {
-            LOGF(INFO, "Refer room  %c%d to %04x", side, room, entry.newaddr);
+            circuit.push_back(u);
+            stack.pop_back();
         }
     }
+    std::reverse(circuit.begin(), circuit.end());
+    std::vector<std::vector<int>> trails;
+    for(const auto& v : circuit) {
+        if (v == kVirtual) {
+            trails.emplace_back();
+        } else {
+            trails.back().push_back(v);
+        }
+    }
+
+    // Sentinels, then any trail which starts with the empty list (sharing
+    // the second sentinel), then the other trails, then the single lists
+    // which didn't appear in any trail.
+    std::vector<int> order = {kEmpty, kEmpty};
+    std::set<int> placed = {kEmpty};
+    std::stable_sort(trails.begin(), trails.end(),
+              [kEmpty](const std::vector<int>& a, const std::vector<int>& b) {
+        bool ae = !a.empty() && a[0] == kEmpty;
+        bool be = !b.empty() && b[0] == kEmpty;
+        return ae > be;
+    });
+    for(size_t t=0; t<trails.size(); ++t) {
+        if (trails[t].empty()) continue;
+        bool share = (t == 0 && trails[t][0] == kEmpty);
+        order.insert(order.end(), trails[t].begin() + share, trails[t].end());
+        placed.insert(trails[t].begin(), trails[t].end());
+    }
+    for(const auto& s : single) {
+        if (placed.insert(s).second)
+            order.push_back(s);
+    }
+
+    // Assign addresses.
+    std::map<int, int> single_at;
+    std::map<std::pair<int, int>, int> pair_at;
+    for(size_t i=0; i<order.size(); ++i) {
+        int offset = packed->size();
+        single_at.emplace(order[i], offset);
+        if (i+1 < order.size())
+            pair_at.emplace(std::make_pair(order[i], order[i+1]), offset);
+        packed->insert(packed->end(), lists[order[i]].begin(),
+                       lists[order[i]].end());
+    }
+    for(auto& entry : entry_) {
+        const auto& nd = need.find(entry.first);
+        if (nd == need.end())
+            continue;
+        int offset = 0;
+        if (nd->second.size() == 2) {
+            offset = pair_at.at(std::make_pair(nd->second[0], nd->second[1]));
+        } else if (nd->second.size() == 1) {
+            offset = single_at.at(nd->second[0]);
+        }
+        entry.second.newaddr = offset + misc.enemy_data_ram();
+    }
+    return packed->size();
+}
+
+int EnemyListPack::PackedLength(int* unshared) {
+    std::vector<uint8_t> packed;
+    int dummy;
+    int length = Layout(&packed, unshared ? unshared : &dummy);
+    for(auto& entry : entry_) {
+        entry.second.newaddr = 0;
+    }
+    return length;
+}
+
+bool EnemyListPack::Pack() {
+    const auto& misc = ConfigLoader<RomInfo>::GetConfig().misc();
+    std::vector<uint8_t> packed;
+    int unshared;
+
+    // Pack all of the enemy lists into the buffer
+    int length = Layout(&packed, &unshared);
+    if (length > int(size_)) {
+        LOGF(ERROR, "Out of space for enemy lists in bank %d (want %d / %d)",
+             bank_, length, size_);
+        return false;
+    }
+    for(int i=0; i<126; i++) {
+        int addr = area_[i];
+        if (addr == 0)
+            continue;
+        LOGF(INFO, "Packed room %c%d at %04x (%d bytes)", 'A' + i/63, i%63,
+             entry_[addr].newaddr, entry_[addr].data.size());
+    }
+    LOGF(INFO, "Packed bank %d enemy lists into %d bytes (%d saved by sharing)",
+         bank_, length, unshared - length);
 
     // If everything fit, rewrite the map pointers
     int i = 0;
@@ -16,11 +16,18 @@ class EnemyListPack {
     void Unpack(int bank);
     void Add(int area, const std::vector<uint8_t>& data);
     bool Pack();
+    // Returns the number of bytes Pack would use, without writing anything.
+    // If |unshared| is not null, it receives the number of bytes needed if
+    // no lists were shared.
+    int PackedLength(int* unshared=nullptr);
+    // The number of bytes available for enemy lists in this bank.
+    inline int size() const { return size_; }
     inline void set_mapper(Mapper* m) { mapper_ = m; }
   private:
     void LoadEncounters();
     bool IsEncounter(int area);
     void ReadOne(int area, Address addr);
+    int Layout(std::vector<uint8_t>* packed, int* unshared);
 
     Mapper* mapper_;
     int newareas_;
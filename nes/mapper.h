@@ -1,5 +1,6 @@
 #ifndef Z2UTIL_NES_MAPPER_H
 #define Z2UTIL_NES_MAPPER_H
+#include <algorithm>
 #include <functional>
 #include <map>
 #include <cstdint>
@@ -82,6 +83,26 @@ class Mapper {
     uint16_t IsAlloc(z2util::Address start);
     void Free(z2util::Address start);
 
+    // Ranges to subscribe to on the cartridge's change bus, for the bytes
+    // ReadPrgBank and ReadChrBank would read.  A range doesn't extend past
+    // the end of its bank.
+    ChangeBus::Range PrgRange(int bank, uint32_t addr, uint32_t length) {
+        if (bank < 0) bank += cartridge_->prgsz();
+        addr &= 0x3FFF;
+        return {ChangeBus::PRG, bank * 0x4000 + addr,
+                bank * 0x4000 + std::min(addr + length, 0x4000u)};
+    }
+    ChangeBus::Range PrgRange(const z2util::Address& addr, uint32_t length) {
+        return PrgRange(addr.bank(), addr.address(), length);
+    }
+    ChangeBus::Range ChrRange(int bank, uint32_t addr, uint32_t length) {
+        if (bank < 0) bank += cartridge_->chrsz();
+        addr &= 0x0FFF;
+        return {ChangeBus::CHR, bank * 0x1000 + addr,
+                bank * 0x1000 + std::min(addr + length, 0x1000u)};
+    }
+    ChangeBus* changes() { return cartridge_->changes(); }
+
     Cartridge* cartridge() { return cartridge_; }
   protected:
     Cartridge* cartridge_;
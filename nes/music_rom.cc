@@ -0,0 +1,18 @@
+#include "nes/music_rom.h"
+#include "nes/cartridge.h"
+#include "nes/mapper.h"
+
+namespace z2util {
+
+MusicRom::MusicRom(Mapper* mapper)
+  : z2music::Rom(Prg{
+        mapper->cartridge()->prg(),
+        mapper->cartridge()->prglen(),
+        [cart = mapper->cartridge()](size_t addr) {
+            return cart->ReadPrg(addr);
+        },
+        [cart = mapper->cartridge()](size_t addr, uint8_t val) {
+            cart->WritePrg(addr, val);
+        }}) {}
+
+}  // namespace z2util
@@ -0,0 +1,18 @@
+#ifndef Z2UTIL_NES_MUSIC_ROM_H
+#define Z2UTIL_NES_MUSIC_ROM_H
+#include "music/music.h"
+
+class Mapper;
+namespace z2util {
+
+// The songs in the mapper's cartridge.  Reads and writes go through the
+// cartridge's ReadPrg and WritePrg, so the banks the songs come from are
+// recorded like any other read, and commit() reports every byte it writes,
+// credits included, to the change bus.
+class MusicRom : public z2music::Rom {
+  public:
+    explicit MusicRom(Mapper* mapper);
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_NES_MUSIC_ROM_H
@@ -0,0 +1,16 @@
+#ifndef Z2UTIL_NES_OVERWORLD_TILES_H
+#define Z2UTIL_NES_OVERWORLD_TILES_H
+
+class Mapper;
+namespace z2util {
+
+// Finds which of the overworld_tiles hacks in the config the ROM has and
+// points the config's overworld object tables, palettes and tile palettes
+// at that hack's tables, creating them if the ROM doesn't have them yet.
+// Everything which reads overworld tiles through the config depends on
+// this, with or without a window.  Returns the index of the hack, or -1 if
+// none of them matches.
+int CheckOverworldTileHack(Mapper* mapper);
+
+}  // namespace z2util
+#endif // Z2UTIL_NES_OVERWORLD_TILES_H
@@ -0,0 +1,559 @@
+#include "nes/text_compress.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <map>
+
+#include "nes/cpu6502.h"
+#include "nes/mapper.h"
+#include "nes/text_encoding.h"
+#include "proto/rominfo.pb.h"
+#include "util/config.h"
+#include "util/logging.h"
+#include "absl/strings/str_cat.h"
+
+namespace z2util {
+namespace {
+
+// Tokens above 0xFF are dictionary pairs (0x100 + index).
+const int kPairToken = 0x100;
+
+// A mapper which gives the emulated CPU RAM below $8000 and records writes
+// to ROM instead of modifying the cartridge.  Reads of unwritten ROM fall
+// through to the real mapper.
+class SandboxMapper: public Mapper {
+  public:
+    SandboxMapper(Mapper* rom)
+      : Mapper(rom->cartridge()), rom_(rom), ram_(0x8000, 0) {}
+
+    using Mapper::Read;
+    using Mapper::Write;
+    uint8_t Read(uint16_t addr) override { return ReadPrgBank(-1, addr); }
+    void Write(uint16_t addr, uint8_t val) override {
+        WritePrgBank(-1, addr, val);
+    }
+    uint8_t ReadPrgBank(int bank, uint32_t addr) override {
+        addr &= 0xFFFF;
+        if (addr < 0x8000)
+            return ram_[addr];
+        const auto& it = rom_overlay_.find(Key(bank, addr));
+        if (it != rom_overlay_.end())
+            return it->second;
+        return rom_->ReadPrgBank(bank, addr);
+    }
+    void WritePrgBank(int bank, uint32_t addr, uint8_t val) override {
+        addr &= 0xFFFF;
+        if (addr < 0x8000) {
+            ram_[addr] = val;
+        } else {
+            rom_overlay_[Key(bank, addr)] = val;
+        }
+    }
+
+    void Apply(const GameHack& hack) {
+        for(const auto& h : hack.hack()) {
+            for(int i=0; i<h.data_size(); ++i) {
+                Mapper::Write(h.address(), i, h.data(i));
+            }
+        }
+    }
+
+    // Convert the ROM writes into runs of PokeData.
+    void ToGameHack(GameHack* hack) {
+        PokeData* poke = nullptr;
+        std::pair<int, uint32_t> next(-1, 0);
+        for(const auto& w : rom_overlay_) {
+            if (!poke || w.first != next) {
+                poke = hack->add_hack();
+                poke->mutable_address()->set_bank(w.first.first);
+                poke->mutable_address()->set_address(w.first.second);
+            }
+            poke->add_data(w.second);
+            next = std::make_pair(w.first.first, w.first.second + 1);
+        }
+    }
+
+  private:
+    std::pair<int, uint32_t> Key(int bank, uint32_t addr) {
+        if (bank < 0 || addr >= 0xC000)
+            bank = cartridge_->prgsz() - 1;
+        return std::make_pair(bank, addr);
+    }
+
+    Mapper* rom_;
+    std::vector<uint8_t> ram_;
+    std::map<std::pair<int, uint32_t>, uint8_t> rom_overlay_;
+};
+
+// Format one line of assembly.
+std::string Asm(const char* fmt, ...) {
+    char buf[80];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    return std::string(buf);
+}
+
+// Assemble |code|.  |end| receives the address following the last byte.
+bool AssembleAll(Cpu* cpu, const std::vector<std::string>& code,
+                 uint16_t* end=nullptr) {
+    uint16_t pc = 0;
+    for(const auto& line : code) {
+        auto err = cpu->Assemble(line, &pc);
+        if (err != Cpu::AsmError::None && err != Cpu::AsmError::Meta) {
+            LOG(ERROR, "Text decoder: could not assemble '", line,
+                "': error ", int(err));
+            return false;
+        }
+    }
+    for(const auto& e : cpu->ApplyFixups()) {
+        LOG(ERROR, "Text decoder: ", e);
+        return false;
+    }
+    if (end)
+        *end = pc;
+    return true;
+}
+
+std::string DataBytes(const std::vector<uint8_t>& data) {
+    std::string result = ".db ";
+    for(size_t i=0; i<data.size(); ++i) {
+        absl::StrAppend(&result, Asm(i ? ",$%02x" : "$%02x", data[i]));
+    }
+    return result;
+}
+
+}  // namespace
+
+void TextDictionary::Build(const std::vector<std::string>& corpus,
+                           int first_code, int max_pairs) {
+    first_code_ = first_code;
+    pairs_.clear();
+
+    std::vector<std::vector<int>> text;
+    for(const auto& s : corpus) {
+        text.emplace_back(s.begin(), s.end());
+        for(auto& t : text.back()) t &= 0xFF;
+    }
+
+    while(size() < max_pairs) {
+        // Count non-overlapping occurrences of each pair of ordinary codes.
+        std::map<std::pair<int, int>, int> count;
+        for(const auto& t : text) {
+            std::pair<int, int> prev(-1, -1);
+            for(size_t i=1; i<t.size(); ++i) {
+                // The decoder keeps a pair's second byte pending and uses
+                // zero for "nothing pending", so zero can't be a second.
+                if (t[i-1] >= kPairToken || t[i] >= kPairToken || t[i] == 0)
+                    continue;
+                std::pair<int, int> p(t[i-1], t[i]);
+                // For runs like "aaa", only count "aa" once.
+                if (p == prev && p.first == p.second) {
+                    prev = std::make_pair(-1, -1);
+                    continue;
+                }
+                count[p]++;
+                prev = p;
+            }
+        }
+
+        // Each replacement saves a byte, but the pair costs two bytes of
+        // dictionary.
+        auto best = count.end();
+        for(auto it = count.begin(); it != count.end(); ++it) {
+            if (best == count.end() || it->second > best->second)
+                best = it;
+        }
+        if (best == count.end() || best->second <= 2)
+            break;
+
+        int token = kPairToken + size();
+        pairs_.emplace_back(best->first.first, best->first.second);
+        for(auto& t : text) {
+            std::vector<int> out;
+            for(size_t i=0; i<t.size(); ++i) {
+                if (i+1 < t.size() && t[i] == best->first.first &&
+                    t[i+1] == best->first.second) {
+                    out.push_back(token);
+                    ++i;
+                } else {
+                    out.push_back(t[i]);
+                }
+            }
+            t.swap(out);
+        }
+    }
+}
+
+std::string TextDictionary::Compress(const std::string& text) const {
+    std::vector<int> t(text.begin(), text.end());
+    for(auto& ch : t) ch &= 0xFF;
+
+    for(int n=0; n<size(); ++n) {
+        std::vector<int> out;
+        for(size_t i=0; i<t.size(); ++i) {
+            if (i+1 < t.size() && t[i] == pairs_[n].first &&
+                t[i+1] == pairs_[n].second) {
+                out.push_back(kPairToken + n);
+                ++i;
+            } else {
+                out.push_back(t[i]);
+            }
+        }
+        t.swap(out);
+    }
+
+    std::string result;
+    for(const auto& ch : t) {
+        result.push_back(ch >= kPairToken ? first_code_ + ch - kPairToken : ch);
+    }
+    return result;
+}
+
+std::string TextDictionary::Expand(const std::string& text) const {
+    std::string result;
+    for(const auto& ch : text) {
+        int code = uint8_t(ch);
+        if (Contains(code)) {
+            const auto& p = pairs_[code - first_code_];
+            result.push_back(p.first);
+            result.push_back(p.second);
+        } else {
+            result.push_back(ch);
+        }
+    }
+    return result;
+}
+
+int TextDecoder::MaxPairs() {
+    const auto& tc = ConfigLoader<RomInfo>::GetConfig().text_table().compression();
+    // Dictionary codes must be a contiguous run of codes which ordinary text
+    // never uses.
+    int n = 0;
+    int limit = tc.max_pairs() ? tc.max_pairs() : 0xFF;
+    for(int code = tc.first_code(); code < 0xFF && n < limit; ++code) {
+        if (TextEncoding::FromZelda2(code) != 0)
+            break;
+        ++n;
+    }
+    return n;
+}
+
+bool TextDecoder::FindHook(Address* hook) {
+    const auto& tc = ConfigLoader<RomInfo>::GetConfig().text_table().compression();
+    int found = 0;
+    for(int i=0; i <= tc.hook_search(); ++i) {
+        uint8_t opcode = mapper_->Read(tc.hook(), i);
+        // Either the original load or the JSR which replaced it.
+        int target = mapper_->ReadWord(tc.hook(), i + 1);
+        if (opcode == 0xB1 ||
+            (opcode == 0x20 && target >= tc.decoder().address() &&
+             target < tc.decoder().address() + tc.decoder().length())) {
+            *hook = tc.hook();
+            hook->set_address(tc.hook().address() + i);
+            ++found;
+        }
+    }
+    if (found != 1) {
+        LOGF(ERROR, "Text decoder: found %d candidate hooks at %d:%04x+%d",
+             found, tc.hook().bank(), tc.hook().address(), tc.hook_search());
+        return false;
+    }
+    return true;
+}
+
+bool TextDecoder::HookBytes(const Address& hook, std::vector<uint8_t>* orig) {
+    Cpu cpu(mapper_);
+    cpu.set_bank(hook.bank());
+
+    uint16_t pc = hook.address();
+    if (mapper_->Read(hook, 0) != 0xB1) {
+        LOGF(ERROR, "Text decoder: hook at %d:%04x is not 'LDA (ptr),Y'",
+             hook.bank(), hook.address());
+        return false;
+    }
+    // Displace whole instructions until there is room for a JSR.
+    while(pc - hook.address() < 3) {
+        uint8_t opcode = mapper_->Read(hook, pc - hook.address());
+        if ((opcode & 0x1F) == 0x10 || opcode == 0x00 || opcode == 0x20 ||
+            opcode == 0x40 || opcode == 0x4C || opcode == 0x60 ||
+            opcode == 0x6C) {
+            LOGF(ERROR, "Text decoder: can't relocate control flow "
+                 "instruction %02x at %04x", opcode, pc);
+            return false;
+        }
+        cpu.Disassemble(&pc);
+    }
+    orig->clear();
+    for(int i=0; i < pc - hook.address(); ++i) {
+        orig->push_back(mapper_->Read(hook, i));
+    }
+    return true;
+}
+
+bool TextDecoder::Installed(TextDictionary* dict) {
+    const auto& tc = ConfigLoader<RomInfo>::GetConfig().text_table().compression();
+    Address hook;
+    if (tc.decoder().length() == 0 || !FindHook(&hook))
+        return false;
+    if (mapper_->Read(hook, 0) != 0x20)
+        return false;
+
+    int count = mapper_->Read(tc.decoder(), 0);
+    int hooklen = mapper_->Read(tc.decoder(), 1);
+    int first = 2 + hooklen;
+    int entry = tc.decoder().address() + first + 2*count;
+    if (mapper_->ReadWord(hook, 1) != entry)
+        return false;
+
+    dict->Clear();
+    dict->set_first_code(tc.first_code());
+    for(int i=0; i<count; ++i) {
+        dict->Add(mapper_->Read(tc.decoder(), first + i),
+                  mapper_->Read(tc.decoder(), first + count + i));
+    }
+    return true;
+}
+
+bool TextDecoder::Uninstall(GameHack* hack) {
+    const auto& tc = ConfigLoader<RomInfo>::GetConfig().text_table().compression();
+    TextDictionary dict;
+    Address hook;
+    if (!Installed(&dict) || !FindHook(&hook))
+        return false;
+
+    PokeData* poke = hack->add_hack();
+    *poke->mutable_address() = hook;
+    int hooklen = mapper_->Read(tc.decoder(), 1);
+    for(int i=0; i<hooklen; ++i) {
+        poke->add_data(mapper_->Read(tc.decoder(), 2 + i));
+    }
+    return true;
+}
+
+bool TextDecoder::Generate(const TextDictionary& dict, GameHack* hack) {
+    const auto& tc = ConfigLoader<RomInfo>::GetConfig().text_table().compression();
+    std::vector<uint8_t> orig;
+    Address hook;
+
+    hack->Clear();
+    hack->set_name("Text dictionary decoder");
+    if (!FindHook(&hook))
+        return false;
+    TextDictionary current;
+    if (Installed(&current)) {
+        // The hook was already replaced: recover the original instructions
+        // from the existing decoder.
+        int hooklen = mapper_->Read(tc.decoder(), 1);
+        for(int i=0; i<hooklen; ++i) {
+            orig.push_back(mapper_->Read(tc.decoder(), 2 + i));
+        }
+    } else if (!HookBytes(hook, &orig)) {
+        return false;
+    }
+
+    std::vector<uint8_t> first, second;
+    for(int i=0; i<dict.size(); ++i) {
+        first.push_back(dict.pair(i).first);
+        second.push_back(dict.pair(i).second);
+    }
+    int ptr = orig[1];
+    int pend = tc.scratch();
+    int save = tc.scratch() + 1;
+    int pos = tc.scratch() + 2;
+    int where = tc.scratch() + 3;
+    int fc = dict.first_code();
+    int lc = dict.first_code() + dict.size();
+
+    std::vector<std::string> code = {
+        Asm(".org $%04x", tc.decoder().address()),
+        DataBytes({uint8_t(dict.size()), uint8_t(orig.size())}),
+        DataBytes(orig),
+    };
+    if (dict.size()) {
+        code.push_back("first:");
+        code.push_back(DataBytes(first));
+        code.push_back("second:");
+        code.push_back(DataBytes(second));
+    } else {
+        code.push_back("first:");
+        code.push_back("second:");
+    }
+    // Returns the next text byte in A with the flags set as 'LDA (ptr),Y'
+    // would.  For a dictionary code, return the first byte of the pair,
+    // remember the second and where the code was, and back Y up so the
+    // caller's INY returns to the same position.  A pending byte from
+    // anywhere else was left by a string which was closed halfway through
+    // a pair, and is dropped.
+    std::vector<std::string> decoder = {
+        "entry:",
+        "php",
+        Asm("lda $%04x", pend),
+        "beq fetch",
+        Asm("cpy $%04x", pos),
+        "bne stale",
+        Asm("lda $%02x", ptr),
+        Asm("cmp $%04x", where),
+        "beq second_half",
+        "stale:",
+        "lda #$00",
+        Asm("sta $%04x", pend),
+        "fetch:",
+        Asm("lda ($%02x),y", ptr),
+        Asm("cmp #$%02x", fc),
+        "bcc done",
+        Asm("cmp #$%02x", lc),
+        "bcs done",
+        Asm("stx $%04x", save),
+        "sec",
+        Asm("sbc #$%02x", fc),
+        "tax",
+        Asm("sty $%04x", pos),
+        Asm("lda $%02x", ptr),
+        Asm("sta $%04x", where),
+        "lda second,x",
+        Asm("sta $%04x", pend),
+        "lda first,x",
+        Asm("ldx $%04x", save),
+        "dey",
+        "jmp done",
+        "second_half:",
+        Asm("lda $%04x", pend),
+        Asm("stx $%04x", save),
+        "ldx #$00",
+        Asm("stx $%04x", pend),
+        Asm("ldx $%04x", save),
+        "done:",
+        "plp",
+        "ora #$00",
+    };
+    code.insert(code.end(), decoder.begin(), decoder.end());
+    if (orig.size() > 2) {
+        // Execute the instructions displaced by the JSR.
+        code.push_back(DataBytes(std::vector<uint8_t>(orig.begin() + 2,
+                                                      orig.end())));
+    }
+    code.push_back("rts");
+
+    SandboxMapper sandbox(mapper_);
+    Cpu cpu(&sandbox);
+    cpu.set_bank(tc.decoder().bank());
+    uint16_t end;
+    if (!AssembleAll(&cpu, code, &end))
+        return false;
+
+    uint16_t entry = tc.decoder().address() + 2 + orig.size() + 2*dict.size();
+    int length = end - tc.decoder().address();
+    if (length > tc.decoder().length()) {
+        LOGF(ERROR, "Text decoder needs %d bytes, but only %d available.",
+             length, tc.decoder().length());
+        return false;
+    }
+
+    // Replace the hook with a call to the decoder.
+    std::vector<std::string> call = {
+        Asm(".org $%04x", hook.address()),
+        Asm("jsr $%04x", entry),
+    };
+    for(size_t i=3; i<orig.size(); ++i) {
+        call.push_back("nop");
+    }
+    Cpu hcpu(&sandbox);
+    hcpu.set_bank(hook.bank());
+    if (!AssembleAll(&hcpu, call))
+        return false;
+
+    sandbox.ToGameHack(hack);
+    return true;
+}
+
+bool TextDecoder::Verify(
+        const GameHack& hack, const std::vector<uint8_t>& packed,
+        const std::vector<std::pair<uint16_t, std::string>>& strings) {
+    const auto& tt = ConfigLoader<RomInfo>::GetConfig().text_table();
+    const auto& tc = tt.compression();
+    const int kOutput = 0x0600;
+    const int kCount = 0x0700;
+    const int kHarness = 0x0300;
+
+    SandboxMapper sandbox(mapper_);
+    sandbox.Apply(hack);
+    for(size_t i=0; i<packed.size(); ++i) {
+        sandbox.Write(tt.text_data(), i, packed[i]);
+    }
+
+    Address hook;
+    if (!TextDecoder(&sandbox).FindHook(&hook))
+        return false;
+    uint16_t entry = sandbox.ReadWord(hook, 1);
+    // If the displaced instructions don't advance Y, the caller must.
+    int hooklen = sandbox.Read(tc.decoder(), 1);
+    bool iny = true;
+    for(int i=2; i<hooklen; ++i) {
+        if (sandbox.Read(tc.decoder(), 2 + i) == 0xC8)
+            iny = false;
+    }
+
+    // Read through the same zero page pointer as the hooked renderer.
+    int ptr = sandbox.Read(tc.decoder(), 3);
+    for(const auto& s : strings) {
+        Cpu cpu(&sandbox);
+        cpu.set_bank(hook.bank());
+        // Leave a pending byte from some other string, as if a dialog was
+        // closed halfway through a pair: the decoder must drop it.
+        sandbox.Write(tc.scratch(), 0xFF);
+        sandbox.Write(tc.scratch() + 2, 0);
+        sandbox.Write(tc.scratch() + 3, (s.first & 0xFF) ^ 0x80);
+        std::vector<std::string> harness = {
+            Asm(".org $%04x", kHarness),
+            Asm("lda #$%02x", s.first & 0xFF),
+            Asm("sta $%02x", ptr),
+            Asm("lda #$%02x", s.first >> 8),
+            Asm("sta $%02x", ptr + 1),
+            "lda #$00",
+            Asm("sta $%04x", kCount),
+            "ldy #$00",
+            "loop:",
+            Asm("jsr $%04x", entry),
+            Asm("ldx $%04x", kCount),
+            Asm("sta $%04x,x", kOutput),
+            Asm("inc $%04x", kCount),
+            "cmp #$ff",
+            "beq finished",
+            iny ? "iny" : "",
+            "jmp loop",
+            "finished:",
+        };
+        uint16_t finished;
+        if (!AssembleAll(&cpu, harness, &finished))
+            return false;
+
+        cpu.Reset();
+        cpu.set_pc(kHarness);
+        for(int steps = 0; cpu.pc() != finished; ++steps) {
+            if (steps > 100000) {
+                LOGF(ERROR, "Text decoder: string at %04x did not terminate",
+                     s.first);
+                return false;
+            }
+            cpu.Emulate();
+        }
+
+        std::string result;
+        int count = sandbox.ReadPrgBank(0, kCount);
+        for(int i=0; i<count; ++i) {
+            result.push_back(sandbox.ReadPrgBank(0, kOutput + i));
+        }
+        std::string expected = s.second;
+        expected.push_back(0xFF);
+        if (result != expected) {
+            LOGF(ERROR, "Text decoder: string at %04x did not round-trip",
+                 s.first);
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace z2util
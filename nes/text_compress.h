@@ -0,0 +1,85 @@
+#ifndef Z2UTIL_NES_TEXT_COMPRESS_H
+#define Z2UTIL_NES_TEXT_COMPRESS_H
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "proto/rominfo.pb.h"
+
+class Mapper;
+namespace z2util {
+
+// A dual tile encoding dictionary.  Each dictionary code stands for a pair
+// of ordinary text codes.  Pairs never contain other dictionary codes, so
+// the decoder only has to expand a code once.
+class TextDictionary {
+  public:
+    TextDictionary() : first_code_(0) {}
+
+    // Choose up to |max_pairs| pairs for |corpus| (zelda2-encoded strings
+    // without terminators).  Pairs are chosen greedily: the pair which
+    // saves the most bytes is replaced everywhere, then the pairs are
+    // recounted.  Dictionary codes start at |first_code|.
+    void Build(const std::vector<std::string>& corpus, int first_code,
+               int max_pairs);
+    // Replace pairs in |text| with dictionary codes.  The pairs are applied
+    // in the order they were chosen so that compression matches Build.
+    std::string Compress(const std::string& text) const;
+    // Expand the dictionary codes in |text|.
+    std::string Expand(const std::string& text) const;
+
+    void Clear() { pairs_.clear(); }
+    void Add(uint8_t a, uint8_t b) { pairs_.emplace_back(a, b); }
+    inline bool Contains(int code) const {
+        return code >= first_code_ && code < first_code_ + size();
+    }
+    inline int size() const { return int(pairs_.size()); }
+    inline int first_code() const { return first_code_; }
+    inline void set_first_code(int c) { first_code_ = c; }
+    inline const std::pair<uint8_t, uint8_t>& pair(int i) const {
+        return pairs_.at(i);
+    }
+  private:
+    int first_code_;
+    std::vector<std::pair<uint8_t, uint8_t>> pairs_;
+};
+
+// Generates, detects and verifies the 6502 routine which expands dictionary
+// codes as the game reads text.  The routine lives in the region described
+// by text_table.compression.decoder:
+//
+//     .db count, hooklen, <original hook bytes>
+//     first:  .db <first code of each pair>
+//     second: .db <second code of each pair>
+//     entry:  <decoder>
+//
+// and the hook is replaced with 'JSR entry' (padded with NOPs).
+class TextDecoder {
+  public:
+    TextDecoder(Mapper* m) : mapper_(m) {}
+
+    // Returns true if the decoder hook is installed in the ROM and loads
+    // the ROM's dictionary into |dict|.
+    bool Installed(TextDictionary* dict);
+    // Assemble the decoder and hook for |dict|.
+    bool Generate(const TextDictionary& dict, GameHack* hack);
+    // Returns the hack which restores the original hook.
+    bool Uninstall(GameHack* hack);
+    // Run the decoder in the emulated CPU over each of the |strings|
+    // (address, expected decoded text without terminator) within |packed|,
+    // which is the text_data region with |hack| applied.
+    bool Verify(const GameHack& hack, const std::vector<uint8_t>& packed,
+                const std::vector<std::pair<uint16_t, std::string>>& strings);
+
+    // The number of dictionary codes available starting at first_code.
+    static int MaxPairs();
+  private:
+    // Finds the hook within hook_search bytes of the configured hook.
+    bool FindHook(Address* hook);
+    bool HookBytes(const Address& hook, std::vector<uint8_t>* orig);
+
+    Mapper* mapper_;
+};
+
+}  // namespace z2util
+#endif // Z2UTIL_NES_TEXT_COMPRESS_H
@@ -1,22 +1,48 @@
 #include "nes/text_list.h"
 
+#include <algorithm>
+#include <numeric>
+#include <set>
+
 #include "nes/mapper.h"
+#include "nes/text_compress.h"
 #include "nes/text_encoding.h"
 #include "proto/rominfo.pb.h"
 #include "util/config.h"
 #include "util/logging.h"
+#include "absl/strings/match.h"
 
 namespace z2util {
 
+namespace {
+// Convert to the zelda2 encoding.
+std::string Encode(const std::string& text) {
+    std::string enc;
+    for(const auto& ch : text) {
+        char zch = TextEncoding::ToZelda2(ch);
+        if (zch == 0) {
+            // Transform any unknown character to a question mark.
+            zch = TextEncoding::ToZelda2('?');
+        }
+        enc.push_back(zch);
+    }
+    return enc;
+}
+}  // namespace
+
 std::string TextListPack::ReadNesString(const Address& addr) {
     int ch;
-    std::string result;
+    std::string raw;
     for(int i=0; ;i++) {
         ch = mapper_->Read(addr, i);
         if (ch == 0xFF)
             break;
-        result.push_back(TextEncoding::FromZelda2(ch));
+        raw.push_back(ch);
+    }
 
+    std::string result;
+    for(const auto& ch : dict_.Expand(raw)) {
+        result.push_back(TextEncoding::FromZelda2(uint8_t(ch)));
     }
     return result;
 }
@@ -42,6 +68,10 @@ void TextListPack::Unpack(int bank) {
     const auto& tt = ConfigLoader<RomInfo>::GetConfig().text_table();
     bank_ = bank;
 
+    // If the ROM's text is compressed, the dictionary is needed to read it.
+    compress_ = TextDecoder(mapper_).Installed(&dict_);
+    if (!compress_)
+        dict_.Clear();
     index_.clear();
     entry_.clear();
 
@@ -93,48 +123,178 @@ void TextListPack::ResetAddrs() {
     }
 }
 
-bool TextListPack::Pack() {
+// Lay out the text so that identical strings share storage and any string
+// which is a suffix of another points into the longer string's bytes (both
+// end at the same 0xFF terminator).  If |dict| is not null, a dictionary is
+// built for the text and the strings are compressed with it before layout.
+// Sets newaddr on every referenced entry and returns the packed length.
+// |unshared| receives the length the text would occupy if every entry were
+// written separately.
+int TextListPack::Layout(std::vector<uint8_t>* packed, int* unshared,
+                         TextDictionary* dict) {
     const auto& tt = ConfigLoader<RomInfo>::GetConfig().text_table();
-    std::vector<uint8_t> packed;
-    
-    // Pack all of the text into the buffer
+
+    // Referenced entries, in the order they're first used.
+    std::vector<uint16_t> order;
+    std::set<uint16_t> seen;
     int world = 0;
     for(const auto len : tt.length()) {
         for(int i=0; i<len; ++i) {
             int addr = index_[world][i];
-            if (addr == 0)
-                continue;
-
-            List& entry = entry_[addr];
-            int na = packed.size() + tt.text_data().address();
-            LOGF(INFO, "Text w=%d i=%d addr=%04x->%04x '%s'", world, i, addr, na, entry.data.c_str());
-            if (entry.newaddr == 0) {
-                int newsize = packed.size() + entry.data.size() + 1;
-                if (newsize > tt.text_data().length()) {
-                    LOGF(ERROR, "Out of space for text list at world=%d index=%d", world, i);
-                    LOGF(ERROR, "Want %d bytes, but only %d available.",
-                         newsize, tt.text_data().length());
-                    ResetAddrs();
-                    return false;
-                }
-                entry.newaddr = packed.size() + tt.text_data().address();
-                for(const auto& ch : entry.data) {
-                    char zch = TextEncoding::ToZelda2(ch);
-                    if (zch == 0) {
-                        // Transform any unknown character to a question mark.
-                        zch = TextEncoding::ToZelda2('?');
-                    }
-                    packed.push_back(zch);
-                }
-                // Terminate the string.
-                packed.push_back(0xff);
-            }
+            if (addr != 0 && seen.insert(addr).second)
+                order.push_back(addr);
         }
         ++world;
     }
 
+    // Encode all of the strings and merge exact duplicates.
+    std::vector<std::string> unique;
+    std::map<std::string, int> ids;
+    std::vector<int> id(order.size());
+    *unshared = 0;
+    for(size_t n=0; n<order.size(); ++n) {
+        std::string enc = Encode(entry_[order[n]].data);
+        *unshared += enc.size() + 1;
+        auto r = ids.emplace(enc, unique.size());
+        if (r.second)
+            unique.push_back(enc);
+        id[n] = r.first->second;
+    }
+
+    if (dict) {
+        const auto& tc = tt.compression();
+        dict->Build(unique, tc.first_code(), TextDecoder::MaxPairs());
+        for(auto& u : unique) {
+            u = dict->Compress(u);
+        }
+    }
+
+    // Sort by the reversed strings.  In that order, a string which is a
+    // suffix of any other string is a suffix of its immediate successor,
+    // so walking backwards finds the longest string containing each one.
+    std::vector<int> sorted(unique.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [&unique](int a, int b) {
+        return std::lexicographical_compare(
+            unique[a].rbegin(), unique[a].rend(),
+            unique[b].rbegin(), unique[b].rend());
+    });
+    std::vector<int> owner(unique.size());
+    for(int k=int(sorted.size())-1; k>=0; --k) {
+        int u = sorted[k];
+        owner[u] = u;
+        if (k+1 < int(sorted.size())) {
+            int v = sorted[k+1];
+            if (absl::EndsWith(unique[v], unique[u]))
+                owner[u] = owner[v];
+        }
+    }
+
+    // Write out the strings which aren't contained in another string, then
+    // point the rest into them.
+    std::vector<int> offset(unique.size());
+    for(size_t u=0; u<unique.size(); ++u) {
+        if (owner[u] != int(u))
+            continue;
+        offset[u] = packed->size();
+        packed->insert(packed->end(), unique[u].begin(), unique[u].end());
+        // Terminate the string.
+        packed->push_back(0xff);
+    }
+    for(size_t u=0; u<unique.size(); ++u) {
+        int o = owner[u];
+        offset[u] = offset[o] + unique[o].size() - unique[u].size();
+    }
+    for(size_t n=0; n<order.size(); ++n) {
+        List& entry = entry_[order[n]];
+        entry.newaddr = tt.text_data().address() + offset[id[n]];
+        LOGF(VERBOSE, "Text addr=%04x->%04x '%s'", order[n], entry.newaddr,
+             entry.data.c_str());
+    }
+    return packed->size();
+}
+
+int TextListPack::PackedLength(int* saved) {
+    std::vector<uint8_t> packed;
+    int unshared;
+    TextDictionary dict;
+    int length = Layout(&packed, &unshared, compress_ ? &dict : nullptr);
+    ResetAddrs();
+    if (saved)
+        *saved = unshared - length;
+    return length;
+}
+
+int TextListPack::Capacity() const {
+    const auto& tt = ConfigLoader<RomInfo>::GetConfig().text_table();
+    const auto& text = tt.text_data();
+    const auto& decoder = tt.compression().decoder();
+    int length = text.length();
+    if (compress_ && decoder.bank() == text.bank() &&
+        decoder.address() >= text.address() &&
+        decoder.address() < text.address() + length) {
+        length = decoder.address() - text.address();
+    }
+    return length;
+}
+
+bool TextListPack::Pack() {
+    const auto& tt = ConfigLoader<RomInfo>::GetConfig().text_table();
+    std::vector<uint8_t> packed;
+    int unshared;
+    TextDictionary dict;
+    TextDecoder decoder(mapper_);
+    GameHack hack;
+
+    if (compress_ && (tt.compression().decoder().length() == 0 ||
+                      tt.compression().hook().bank() != tt.text_data().bank())) {
+        LOGF(ERROR, "Text compression is not configured for this ROM");
+        return false;
+    }
+    // The hook calls the decoder with a plain JSR, so the decoder must be
+    // mapped whenever the hook's bank is.
+    const int dbank = tt.compression().decoder().bank();
+    if (compress_ && dbank != tt.compression().hook().bank() && dbank != -1 &&
+        dbank != mapper_->cartridge()->prgsz() - 1) {
+        LOGF(ERROR, "Text decoder in bank %d can't be called from bank %d",
+             dbank, tt.compression().hook().bank());
+        return false;
+    }
+
+    // Pack all of the text into the buffer
+    int length = Layout(&packed, &unshared, compress_ ? &dict : nullptr);
+    if (length > Capacity()) {
+        LOGF(ERROR, "Out of space for text list");
+        LOGF(ERROR, "Want %d bytes, but only %d available.",
+             length, Capacity());
+        ResetAddrs();
+        return false;
+    }
+    LOGF(INFO, "Packed text into %d bytes (%d bytes saved by sharing%s).",
+         length, unshared - length, compress_ ? " and compression" : "");
+
+    if (compress_) {
+        // Build the decoder and check that it reproduces every string
+        // before touching the ROM.
+        std::vector<std::pair<uint16_t, std::string>> strings;
+        for(const auto& entry : entry_) {
+            if (entry.second.newaddr)
+                strings.emplace_back(entry.second.newaddr,
+                                     Encode(entry.second.data));
+        }
+        if (!decoder.Generate(dict, &hack) ||
+            !decoder.Verify(hack, packed, strings)) {
+            LOGF(ERROR, "Could not build a text decoder");
+            ResetAddrs();
+            return false;
+        }
+    } else {
+        // Put back the original text renderer if it had been hooked.
+        decoder.Uninstall(&hack);
+    }
+
     // Copy text pointers to ROM.
-    world = 0;
+    int world = 0;
     for(const auto len : tt.length()) {
         Address table = mapper_->ReadAddr(tt.pointer(), world*2);
         for(int i=0; i<len; ++i) {
@@ -149,10 +309,18 @@ bool TextListPack::Pack() {
     }
 
     // And copy the text to the ROM.
-    packed.resize(tt.text_data().length(), 0);
+    packed.resize(Capacity(), 0);
     for(size_t i=0; i<packed.size(); i++) {
         mapper_->Write(tt.text_data(), i, packed[i]);
     }
+
+    // Finally, install or remove the decoder.
+    for(const auto& h : hack.hack()) {
+        for(int i=0; i<h.data_size(); ++i) {
+            mapper_->Write(h.address(), i, h.data(i));
+        }
+    }
+    dict_ = dict;
     return true;
 }
 
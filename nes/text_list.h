@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <map>
 #include <vector>
+#include "nes/text_compress.h"
 #include "proto/rominfo.pb.h"
 
 class Mapper;
@@ -10,7 +11,8 @@ namespace z2util {
 
 class TextListPack {
   public:
-    TextListPack(Mapper* m) : mapper_(m), newtext_(0), bank_(0) {}
+    TextListPack(Mapper* m)
+      : mapper_(m), newtext_(0), bank_(0), compress_(false) {}
     TextListPack() : TextListPack(nullptr) {}
 
     void Unpack(int bank);
@@ -20,17 +22,34 @@ class TextListPack {
     bool Get(int world, int index, std::string* val);
     bool Set(int world, int index, const std::string& val);
     int Length(int world);
+    // Returns the number of bytes Pack would write.  If |saved| is not
+    // null, it receives the number of bytes saved by sharing duplicate
+    // strings and common suffixes.
+    int PackedLength(int* saved=nullptr);
+    // Returns the number of bytes of text_data Pack may use.  When
+    // compressing, a decoder at the end of text_data takes its space.
+    int Capacity() const;
     //void Add(int index, const std::vector<uint8_t>& data);
     inline void set_mapper(Mapper* m) { mapper_ = m; }
+    // Whether Pack should compress the text with a dictionary and install
+    // the decoder described by text_table.compression.  Unpack sets this
+    // according to whether the ROM's text is already compressed.
+    inline bool compress() const { return compress_; }
+    inline void set_compress(bool c) { compress_ = c; }
   private:
     void ReadOne(int world, int index, Address addr);
     std::string ReadNesString(const Address& addr);
     void WriteNesString(const Address& addr, const std::string& val);
     void ResetAddrs();
+    int Layout(std::vector<uint8_t>* packed, int* unshared,
+               TextDictionary* dict);
 
     Mapper* mapper_;
     int newtext_;
     int bank_;
+    bool compress_;
+    // The dictionary of the text currently in the ROM.
+    TextDictionary dict_;
 
     struct List {
         uint16_t newaddr;
@@ -370,7 +370,10 @@ void Z2Decompress::DecompressSideView(const uint8_t* data, bool collapse) {
             }
 
             // Look up the put funtion and call it
-            PutFn put = put_[fn];
+            // Use find rather than operator[]: the map must not be modified
+            // since palace searches decompress rooms on several threads.
+            const auto& pf = put_.find(fn);
+            PutFn put = (pf == put_.end()) ? nullptr : pf->second;
             if (!put) {
                 LOG(ERROR, "Couldn't find PutFn for '", fn, "': ",
                         info->DebugString());
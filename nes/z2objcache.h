@@ -2,11 +2,12 @@
 #define Z2UTIL_NES_Z2OBJCACHE_H
 #include <cstdint>
 #include <map>
+#include <vector>
 #include "proto/rominfo.pb.h"
 #include "imwidget/glbitmap.h"
+#include "nes/change_bus.h"
 
 class Mapper;
-class NesHardwarePalette;
 
 namespace z2util {
 
@@ -23,6 +24,8 @@ class Z2ObjectCache {
     Z2ObjectCache();
     explicit Z2ObjectCache(Mapper* mapper)
         : mapper_(mapper) {}
+    Z2ObjectCache(const Z2ObjectCache&) = delete;
+    Z2ObjectCache& operator=(const Z2ObjectCache&) = delete;
 
     void Init(const Map& map);
     void Init(const ItemInfo& info);
@@ -34,11 +37,16 @@ class Z2ObjectCache {
     inline void set_chr(const Address& chr) { chr_ = chr; }
     inline void set_use_iteminfo_chr(bool v) { use_iteminfo_chr_ = v; }
     inline const Address& chr() { return chr_; }
-    inline void Clear() { cache_.clear(); }
+    inline void Clear() {
+        cache_.clear();
+        reads_.clear();
+        watch_.Reset();
+    }
   private:
     void CreateObject(uint8_t obj);
-    void BlitTile(uint32_t* dest, int x, int y, int tile, int pal,
-                  int width, bool flip=false);
+    // Records that the object being created reads the given bytes.
+    void Watch(uint8_t obj, const ChangeBus::Range& range);
+    void Invalidate(const std::vector<ChangeBus::Range>& changed);
 
     Mapper* mapper_;
 
@@ -50,6 +58,10 @@ class Z2ObjectCache {
     ItemInfo info_;
 
     std::map<uint8_t, GLBitmap> cache_;
+    // The ROM bytes each cached object was drawn from.  An object is
+    // dropped from the cache when any of them change.
+    std::map<uint8_t, std::vector<ChangeBus::Range>> reads_;
+    ChangeBus::Subscription watch_;
 };
 
 }  // namespace
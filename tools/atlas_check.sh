@@ -0,0 +1,30 @@
+#!/bin/sh
+# Renders the atlas of a ROM headless, with and without the per-overworld
+# tile hack (hacked-roms/overworld_tiles.z2edit), and checks that the hacked
+# run pointed the config at the hack's overworld tables before rendering.
+#
+# Usage: tools/atlas_check.sh <zelda2.nes>
+
+ROM="$1"
+OUT="/tmp/atlas_check"
+
+bazel build :z2edit || exit
+Z2EDIT=./bazel-bin/z2edit
+
+rm -rf "$OUT"
+mkdir -p "$OUT"
+echo "atlas $OUT/vanilla" > "$OUT/vanilla.z2edit"
+echo "atlas $OUT/hacked" > "$OUT/hacked.z2edit"
+
+$Z2EDIT --headless "$ROM" "$OUT/vanilla.z2edit" > "$OUT/vanilla.log" 2>&1 \
+    || { echo "FAIL: vanilla atlas (see $OUT/vanilla.log)"; exit 1; }
+$Z2EDIT --headless "$ROM" hacked-roms/overworld_tiles.z2edit \
+    "$OUT/hacked.z2edit" > "$OUT/hacked.log" 2>&1 \
+    || { echo "FAIL: hacked atlas (see $OUT/hacked.log)"; exit 1; }
+
+grep -q "Overworld tile hack: 1" "$OUT/hacked.log" \
+    || { echo "FAIL: tile hack not seen before the atlas"; exit 1; }
+# The hack draws Death Mountain from new tables with new tiles.
+cmp -s "$OUT/vanilla/world0_0.png" "$OUT/hacked/world0_0.png" \
+    && { echo "FAIL: hacked overworld drawn from the vanilla tables"; exit 1; }
+echo "Atlas check passed."
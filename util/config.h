@@ -2,12 +2,52 @@
 #define UTIL_CONFIG_H
 #include <string>
 #include <functional>
+#include <map>
+#include <set>
+#include <vector>
 
 #include "google/protobuf/text_format.h"
+#include "google/protobuf/util/message_differencer.h"
 #include "util/file.h"
 #include "util/logging.h"
 #include "util/os.h"
 
+namespace config_internal {
+
+// Collects the top-level fields which differ between two messages.
+class FieldCollector:
+    public google::protobuf::util::MessageDifferencer::Reporter {
+  public:
+    typedef google::protobuf::util::MessageDifferencer::SpecificField
+        SpecificField;
+    void ReportAdded(const google::protobuf::Message& m1,
+                     const google::protobuf::Message& m2,
+                     const std::vector<SpecificField>& path) override {
+        Add(path);
+    }
+    void ReportDeleted(const google::protobuf::Message& m1,
+                       const google::protobuf::Message& m2,
+                       const std::vector<SpecificField>& path) override {
+        Add(path);
+    }
+    void ReportModified(const google::protobuf::Message& m1,
+                        const google::protobuf::Message& m2,
+                        const std::vector<SpecificField>& path) override {
+        Add(path);
+    }
+    const std::set<const google::protobuf::FieldDescriptor*>& fields() {
+        return fields_;
+    }
+  private:
+    void Add(const std::vector<SpecificField>& path) {
+        if (!path.empty() && path[0].field)
+            fields_.insert(path[0].field);
+    }
+    std::set<const google::protobuf::FieldDescriptor*> fields_;
+};
+
+}  // namespace config_internal
+
 template<typename T>
 class ConfigLoader {
   public:
@@ -22,52 +62,196 @@ class ConfigLoader {
               std::function<void(T*)> postprocess=nullptr) {
         filename_ = filename;
         postprocess_ = postprocess;
+        files_.clear();
         Load(filename_, &config_);
         if (postprocess_)
             postprocess_(&config_);
+        assembled_ = config_;
     }
     void Parse(const std::string& data,
               std::function<void(T*)> postprocess=nullptr) {
         postprocess_ = postprocess;
+        files_.clear();
         Load("", &config_, &data);
         if (postprocess_)
             postprocess_(&config_);
+        assembled_ = config_;
     }
-    void Reload() {
-        config_.Clear();
-        Load(filename_, &config_);
-        if (postprocess_)
-            postprocess_(&config_);
+
+    // Re-read every file in the config.  Only the top-level fields which
+    // changed are replaced; their names are returned and their subscribers
+    // are notified.
+    std::vector<std::string> Reload() {
+        auto saved = files_;
+        files_.clear();
+        T fresh;
+        if (!ParseFile(filename_, nullptr, false) ||
+            !Assemble(filename_, &fresh, false)) {
+            files_ = saved;
+            return {};
+        }
+        return Update(&fresh);
+    }
+
+    // Re-read a single file which is part of the config (either the
+    // top-level config or one of the files it loads), then rebuild the
+    // config from the cached contents of the other files.
+    std::vector<std::string> ReloadFile(const std::string& filename) {
+        const auto& it = files_.find(filename);
+        if (it == files_.end()) {
+            LOG(ERROR, "Not part of the config: '", filename, "'.");
+            return {};
+        }
+        T saved = it->second;
+        T fresh;
+        if (!ParseFile(filename, nullptr, false) ||
+            !Assemble(filename_, &fresh, false)) {
+            files_[filename] = saved;
+            return {};
+        }
+        Prune();
+        return Update(&fresh);
+    }
+
+    // Call |fn| after a reload changes any of the named top-level fields.
+    // Subscribers are called in the order they were registered.
+    void Subscribe(const std::vector<std::string>& fields,
+                   std::function<void()> fn) {
+        subscriber_.push_back(std::make_pair(
+            std::set<std::string>(fields.begin(), fields.end()), fn));
+    }
+
+    // The names of all of the files which make up the config.
+    std::vector<std::string> Files() const {
+        std::vector<std::string> files;
+        for(const auto& f : files_) {
+            if (!f.first.empty())
+                files.push_back(f.first);
+        }
+        return files;
     }
+
     inline const T& config() const { return config_; }
 
   protected:
     void Load(const std::string& filename, T* config,
               const std::string* data = nullptr) {
+        ParseFile(filename, data, true);
+        Assemble(filename, config, true);
+    }
+
+    // Parse one file into the file cache without following its 'load'
+    // directives.
+    bool ParseFile(const std::string& filename, const std::string* data,
+                   bool fatal) {
         std::string pb;
-        std::string path = File::Dirname(filename);
         T local_config;
 
         if (data) {
             pb = *data;
         } else if (!File::GetContents(filename, &pb)) {
-            LOG(FATAL, "Could not read '", filename, "'.");
+            if (fatal)
+                LOG(FATAL, "Could not read '", filename, "'.");
+            LOG(ERROR, "Could not read '", filename, "'.");
+            return false;
         }
         if (!google::protobuf::TextFormat::ParseFromString(pb, &local_config)) {
-            LOG(FATAL, "Could not parse '", filename, "'.");
+            if (fatal)
+                LOG(FATAL, "Could not parse '", filename, "'.");
+            LOG(ERROR, "Could not parse '", filename, "'.");
+            return false;
         }
+        files_[filename] = std::move(local_config);
+        return true;
+    }
+
+    // Merge a cached file and everything it loads into |config|.  Files
+    // named by 'load' which are not yet cached are read now.
+    bool Assemble(const std::string& filename, T* config, bool fatal) {
+        std::string path = File::Dirname(filename);
+        T local_config = files_[filename];
 
-        for(const auto& file : local_config.load()) {
-            Load(os::path::Join({path, file}), &local_config);
+        for(const auto& file : files_[filename].load()) {
+            std::string child = os::path::Join({path, file});
+            if (files_.find(child) == files_.end() &&
+                !ParseFile(child, nullptr, fatal)) {
+                return false;
+            }
+            if (!Assemble(child, &local_config, fatal))
+                return false;
         }
 
         config->MergeFrom(local_config);
+        return true;
+    }
+
+    // Drop cached files which are no longer loaded by any file in the
+    // config, so that removing a 'load' removes the file from Files().
+    void Prune() {
+        std::set<std::string> keep;
+        std::vector<std::string> todo = {filename_};
+        while(!todo.empty()) {
+            std::string filename = todo.back();
+            todo.pop_back();
+            if (!keep.insert(filename).second)
+                continue;
+            std::string path = File::Dirname(filename);
+            for(const auto& file : files_[filename].load()) {
+                todo.push_back(os::path::Join({path, file}));
+            }
+        }
+        for(auto it = files_.begin(); it != files_.end(); ) {
+            if (keep.find(it->first) == keep.end())
+                it = files_.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    // Swap the fields which differ between the previously assembled config
+    // and |fresh| into config_.  Fields which did not change keep their
+    // storage, so pointers held into them remain valid.
+    std::vector<std::string> Update(T* fresh) {
+        if (postprocess_)
+            postprocess_(fresh);
+
+        config_internal::FieldCollector collector;
+        google::protobuf::util::MessageDifferencer differencer;
+        differencer.ReportDifferencesTo(&collector);
+        differencer.Compare(assembled_, *fresh);
+
+        std::vector<const google::protobuf::FieldDescriptor*> fields(
+            collector.fields().begin(), collector.fields().end());
+        std::set<std::string> names;
+        for(const auto* f : fields) {
+            names.insert(f->name());
+        }
+
+        assembled_ = *fresh;
+        config_.GetReflection()->SwapFields(&config_, fresh, fields);
+        LOG(INFO, "Config reload changed ", names.size(), " sections.");
+
+        for(const auto& s : subscriber_) {
+            for(const auto& n : names) {
+                if (s.first.find(n) != s.first.end()) {
+                    s.second();
+                    break;
+                }
+            }
+        }
+        return std::vector<std::string>(names.begin(), names.end());
     }
 
     ConfigLoader() {};
     T config_;
+    // The config as assembled from the files, before any edits made via
+    // MutableConfig.  Reloads are diffed against this.
+    T assembled_;
     std::string filename_;
     std::function<void(T*)> postprocess_;
+    std::map<std::string, T> files_;
+    std::vector<std::pair<std::set<std::string>,
+                          std::function<void()>>> subscriber_;
 };
 
 #endif // UTIL_CONFIG_H
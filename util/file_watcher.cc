@@ -0,0 +1,86 @@
+#include "util/file_watcher.h"
+
+#include <set>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "util/file.h"
+#include "util/logging.h"
+#include "util/os.h"
+
+#ifdef __linux__
+FileWatcher::FileWatcher()
+  : fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+    if (fd_ < 0)
+        LOG(ERROR, "inotify_init1 failed: errno=", errno);
+}
+
+FileWatcher::~FileWatcher() {
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+void FileWatcher::Add(const std::string& filename) {
+    if (fd_ < 0)
+        return;
+    std::string dir = File::Dirname(filename);
+    std::string key = os::path::Join({dir, File::Basename(filename)});
+    for(const auto& d : dirs_) {
+        if (d.second == dir) {
+            files_[key] = filename;
+            return;
+        }
+    }
+    int wd = inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+        LOG(ERROR, "Could not watch '", dir, "': errno=", errno);
+        return;
+    }
+    dirs_[wd] = dir;
+    files_[key] = filename;
+}
+
+void FileWatcher::Clear() {
+    for(const auto& d : dirs_) {
+        inotify_rm_watch(fd_, d.first);
+    }
+    dirs_.clear();
+    files_.clear();
+}
+
+std::vector<std::string> FileWatcher::Poll() {
+    std::set<std::string> changed;
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    if (fd_ < 0)
+        return {};
+    for(;;) {
+        ssize_t len = read(fd_, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+        for(char* p = buf; p < buf + len; ) {
+            const auto* ev = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+            const auto& d = dirs_.find(ev->wd);
+            if (d == dirs_.end() || ev->len == 0)
+                continue;
+            const auto& f = files_.find(
+                os::path::Join({d->second, ev->name}));
+            if (f != files_.end())
+                changed.insert(f->second);
+        }
+    }
+    return std::vector<std::string>(changed.begin(), changed.end());
+}
+#else
+FileWatcher::FileWatcher() : fd_(-1) {}
+FileWatcher::~FileWatcher() {}
+void FileWatcher::Add(const std::string& filename) {}
+void FileWatcher::Clear() {}
+std::vector<std::string> FileWatcher::Poll() { return {}; }
+#endif
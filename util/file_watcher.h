@@ -0,0 +1,34 @@
+#ifndef Z2HD_UTIL_FILE_WATCHER_H
+#define Z2HD_UTIL_FILE_WATCHER_H
+#include <map>
+#include <string>
+#include <vector>
+
+// Watches a set of files for changes.  Directories are watched rather than
+// the files themselves so that editors which save by writing a new file and
+// renaming it over the old one are still noticed.
+//
+// Only implemented on Linux (inotify); elsewhere Poll never reports changes.
+class FileWatcher {
+  public:
+    FileWatcher();
+    ~FileWatcher();
+
+    // Start watching |filename|.
+    void Add(const std::string& filename);
+    // Stop watching everything.
+    void Clear();
+    // Return the watched files which changed since the last call.  Never
+    // blocks.  Each file appears at most once no matter how many events
+    // were received for it.
+    std::vector<std::string> Poll();
+
+  private:
+    int fd_;
+    // Watch descriptor -> directory name.
+    std::map<int, std::string> dirs_;
+    // Directory-qualified name -> name as given to Add.
+    std::map<std::string, std::string> files_;
+};
+
+#endif // Z2HD_UTIL_FILE_WATCHER_H
@@ -1,4 +1,8 @@
 #include <stdarg.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "util/logging.h"
 #ifdef _WIN32
 #include <windows.h>
@@ -8,6 +12,9 @@
 
 DEFINE_int32(loglevel, 4, "Logging level");
 DEFINE_string(logfile, "", "Log to file");
+DEFINE_bool(log_async, true, "Write log messages on a background thread");
+DEFINE_int32(log_rate_limit, 100,
+             "Maximum messages per second from one call site (0 = no limit)");
 
 namespace logging {
 
@@ -33,7 +40,7 @@ const char _MAGENTA[] = "\033[35m";
 const char _CYAN[]    = "\033[36m";
 const char _WHITE[]   = "\033[37m";
 
-int logging_init_done;
+std::atomic<int> logging_init_done;
 LogLevel loglevel;
 FILE* logfp;
 int logfp_isatty;
@@ -41,28 +48,247 @@ int logfp_isatty;
 HANDLE hStdErr;
 #endif
 
-void logging_init() {
-    if (logging_init_done)
-        return;
+namespace {
+// A message waiting for the writer thread.
+struct Message {
+    LogLevel level;
+    std::string text;
+    std::atomic<Message*> next;
+};
+
+// A lock-free multi-producer, single-consumer queue (after Dmitry
+// Vyukov's intrusive MPSC queue).  Producers only do one atomic
+// exchange; the writer thread is the only consumer.
+class MessageQueue {
+  public:
+    MessageQueue() : head_(&stub_), tail_(&stub_) { stub_.next = nullptr; }
+
+    void Push(Message* m) {
+        m->next.store(nullptr, std::memory_order_relaxed);
+        Message* prev = head_.exchange(m, std::memory_order_acq_rel);
+        prev->next.store(m, std::memory_order_release);
+    }
+
+    // Returns nullptr if the queue is empty, or if a producer is part way
+    // through a push.
+    Message* Pop() {
+        Message* tail = tail_;
+        Message* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (next == nullptr)
+                return nullptr;
+            tail_ = tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        if (tail != head_.load(std::memory_order_acquire))
+            return nullptr;
+        Push(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+  private:
+    std::atomic<Message*> head_;
+    Message* tail_;
+    Message stub_;
+};
+
+MessageQueue queue;
+std::atomic<bool> async_running;
+std::atomic<bool> writer_stop;
+std::atomic<bool> writer_waiting;
+std::atomic<uint64_t> submitted;
+std::atomic<uint64_t> written;
+std::mutex writer_mutex;
+std::condition_variable writer_cv;
+// Serializes writes to logfp.
+std::mutex write_mutex;
+std::thread* writer;
+int rate_limit;
+std::atomic<int> errors;
+
+void Write(LogLevel level, const std::string& text) {
+    int color = WHITE;
+    const char* prefix = "[?] ";
+    switch(level) {
+        case LL_FATAL:
+            prefix = "[F] ";
+            color = RED;
+            break;
+        case LL_ERROR:
+            prefix = "[E] ";
+            color = RED;
+            break;
+        case LL_WARN:
+            prefix = "[W] ";
+            color = YELLOW;
+            break;
+        case LL_INFO:
+            prefix = "[I] ";
+            color = BLUE;
+            break;
+        case LL_VERBOSE:
+            prefix = "[V] ";
+            color = GREEN;
+            break;
+        default:
+            ; // Do nothing
+    }
 
-    bool initerror = false;
-    loglevel = LogLevel(FLAGS_loglevel);
-    if (FLAGS_logfile.empty()) {
-        logfp = stderr;
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (logfp_isatty) {
+        SetLogColor(color);
+        fputs(prefix, logfp);
+        fputs(text.c_str(), logfp);
+        SetLogColor(RESET);
+        fputs("\n", logfp);
+    } else {
+        fputs(prefix, logfp);
+        fputs(text.c_str(), logfp);
+        fputs("\n", logfp);
+    }
+}
+
+void WriterThread() {
+    for(;;) {
+        Message* m = queue.Pop();
+        if (m) {
+            Write(m->level, m->text);
+            delete m;
+            written++;
+            continue;
+        }
+        if (written != submitted) {
+            // A producer is part way through a push.
+            std::this_thread::yield();
+            continue;
+        }
+        fflush(logfp);
+        if (writer_stop)
+            break;
+        std::unique_lock<std::mutex> lock(writer_mutex);
+        writer_waiting = true;
+        // Producers count a message before looking at writer_waiting, so
+        // either we see the message here or they see us waiting.
+        writer_cv.wait(lock, []() {
+            return writer_stop || written != submitted;
+        });
+        writer_waiting = false;
+    }
+}
+
+void Wake() {
+    if (writer_waiting) {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        writer_cv.notify_one();
+    }
+}
+
+void StopWriter() {
+    async_running = false;
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        writer_stop = true;
+        writer_cv.notify_one();
+    }
+    writer->join();
+}
+}  // namespace
+
+void logging_init() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+        bool initerror = false;
+        loglevel = LogLevel(FLAGS_loglevel);
+        if (FLAGS_logfile.empty()) {
+            logfp = stderr;
 #ifdef _WIN32
-        hStdErr = GetStdHandle(STD_ERROR_HANDLE);
+            hStdErr = GetStdHandle(STD_ERROR_HANDLE);
 #endif
+        } else {
+            logfp = fopen(FLAGS_logfile.c_str(), "w");
+            if (logfp == nullptr) {
+                initerror = true;
+                logfp = stderr;
+            }
+        }
+        logfp_isatty = isatty(fileno(logfp));
+        rate_limit = FLAGS_log_rate_limit;
+        if (initerror) {
+            Submit(LL_FATAL, absl::StrCat("Could not open ", FLAGS_logfile,
+                                          " for writing."));
+        }
+        if (FLAGS_log_async) {
+            writer = new std::thread(WriterThread);
+            async_running = true;
+            atexit(StopWriter);
+        }
+        logging_init_done = 1;
+    });
+}
+
+void Submit(LogLevel level, std::string text) {
+    if (level == LL_ERROR)
+        errors++;
+    if (async_running) {
+        // The writer is only woken if it has run out of messages.
+        queue.Push(new Message{level, std::move(text), {nullptr}});
+        submitted++;
+        Wake();
     } else {
-        logfp = fopen(FLAGS_logfile.c_str(), "w");
-        if (logfp == nullptr) {
-            initerror = true;
-            logfp = stderr;
+        Write(level, text);
+    }
+    if (level == LL_FATAL) {
+        Flush();
+        abort();
+    }
+}
+
+void Flush() {
+    if (async_running) {
+        uint64_t target = submitted;
+        while(written < target) {
+            Wake();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
     }
-    logfp_isatty = isatty(fileno(logfp));
-    if (initerror) {
-        LOG(FATAL, "Could not open ", FLAGS_logfile, " for writing.");
+    std::lock_guard<std::mutex> lock(write_mutex);
+    fflush(logfp);
+}
+
+bool RateLimiter::Allow(LogLevel level, int* suppressed) {
+    *suppressed = 0;
+    if (level <= LL_ERROR || rate_limit <= 0)
+        return true;
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t window = window_.load(std::memory_order_relaxed);
+    if (window != now &&
+        window_.compare_exchange_strong(window, now)) {
+        count_ = 0;
+        *suppressed = suppressed_.exchange(0);
     }
+    if (count_++ < rate_limit)
+        return true;
+    suppressed_++;
+    return false;
+}
+
+int ErrorCount() {
+    return errors;
+}
+
+void Suppressed(LogLevel level, const char* file, int line, int count) {
+    Submit(level, absl::StrCat("(", count, " messages from ", file, ":",
+                               line, " suppressed)"));
 }
 
 void SetLogColor(int color) {
@@ -152,55 +378,8 @@ std::string Hex(uint64_t x, bool lz, bool zx) {
     return std::move(std::string(buf));
 }
 
-#if 0
-template<typename ...Args>
-void Log(LogLevel level, Args ...args) {
-    if (!logging_init_done)
-        logging_init();
-
-    if (level > loglevel)
-        return;
-
-    const char* color = "";
-    const char* prefix = "[?]";
-    switch(level) {
-        case LL_FATAL:
-            prefix = "[F]";
-            color = RED;
-            break;
-        case LL_ERROR:
-            prefix = "[E]";
-            color = RED;
-            break;
-        case LL_WARN:
-            prefix = "[W]";
-            color = YELLOW;
-            break;
-        case LL_INFO:
-            prefix = "[I]";
-            color = CYAN;
-            break;
-        case LL_VERBOSE:
-            prefix = "[V]";
-            color = GREEN;
-            break;
-        default:
-            ; // Do nothing
-    }
-
-    if (logfp_isatty) {
-        Print(logfp, BOLD, color, prefix, args..., RESET, "\n");
-    } else {
-        Println(logfp, prefix, args...);
-    }
-    if (level == LL_FATAL) {
-        abort();
-    }
-}
-#endif
-
 void LogF(LogLevel level, const char *fmt, ...) {
-    if (level > loglevel)
+    if (!Enabled(level))
         return;
 
     char buf[1024];
@@ -208,7 +387,7 @@ void LogF(LogLevel level, const char *fmt, ...) {
     va_start(ap, fmt);
     vsnprintf(buf, sizeof(buf)-1, fmt, ap);
     va_end(ap);
-    Log(level, buf);
+    Submit(level, buf);
 }
 
 }  // namespace
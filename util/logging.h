@@ -1,15 +1,43 @@
 #ifndef Z2HD_UTIL_LOGGING_H
 #define Z2HD_UTIL_LOGGING_H
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
 #include <string>
 #include <unistd.h>
 #include "absl/strings/str_cat.h"
 
 
+// Messages above this level are compiled out entirely: build with
+// -DLOGGING_MAX_LEVEL=2 to drop INFO and VERBOSE logging from the binary.
+#ifndef LOGGING_MAX_LEVEL
+#define LOGGING_MAX_LEVEL 4
+#endif
+
+// Each call site gets its own rate limiter.  The arguments are only
+// evaluated when the message will actually be logged.
+#define LOG_AT_SITE_(LEVEL, CALL) \
+    do { \
+        if (int(logging::LogLevel::LL_##LEVEL) <= LOGGING_MAX_LEVEL && \
+            logging::Enabled(logging::LogLevel::LL_##LEVEL)) { \
+            static logging::RateLimiter log_site_; \
+            int log_suppressed_; \
+            if (log_site_.Allow(logging::LogLevel::LL_##LEVEL, \
+                                &log_suppressed_)) { \
+                if (log_suppressed_) \
+                    logging::Suppressed(logging::LogLevel::LL_##LEVEL, \
+                                        __FILE__, __LINE__, log_suppressed_); \
+                CALL; \
+            } \
+        } \
+    } while(0)
+
 #define LOG(LEVEL, ...) \
-    logging::Log(logging::LogLevel::LL_##LEVEL, __VA_ARGS__)
+    LOG_AT_SITE_(LEVEL, \
+                 logging::Log(logging::LogLevel::LL_##LEVEL, __VA_ARGS__))
 #define LOGF(LEVEL, ...) \
-    logging::LogF(logging::LogLevel::LL_##LEVEL, __VA_ARGS__)
+    LOG_AT_SITE_(LEVEL, \
+                 logging::LogF(logging::LogLevel::LL_##LEVEL, __VA_ARGS__))
 #define HEX(...) logging::Hex(__VA_ARGS__)
 
 namespace logging {
@@ -35,7 +63,7 @@ enum LogLevel {
 };
 
 extern void logging_init();
-extern int logging_init_done;
+extern std::atomic<int> logging_init_done;
 extern LogLevel loglevel;
 extern FILE* logfp;
 extern int logfp_isatty;
@@ -62,55 +90,40 @@ inline std::string Hex(void* x, bool lz=true, bool zx=true) {
     return Hex(intptr_t(x), lz, zx);
 }
 
-template<typename ...Args>
-void Log(LogLevel level, Args ...args) {
+inline bool Enabled(LogLevel level) {
     if (!logging_init_done)
         logging_init();
+    return level <= loglevel;
+}
 
-    if (level > loglevel)
-        return;
+// Limits a call site to --log_rate_limit messages per second.  FATAL and
+// ERROR messages are never dropped.
+class RateLimiter {
+  public:
+    // Returns whether a message may be logged now.  Sets suppressed to the
+    // number of messages dropped since the last one which was allowed.
+    bool Allow(LogLevel level, int* suppressed);
+  private:
+    std::atomic<int64_t> window_{0};
+    std::atomic<int> count_{0};
+    std::atomic<int> suppressed_{0};
+};
+
+// Hands a formatted message to the writer.  With --log_async, messages
+// are queued for a background thread; FATAL messages are flushed before
+// aborting.
+void Submit(LogLevel level, std::string text);
+// Waits until every message submitted so far has been written.
+void Flush();
+void Suppressed(LogLevel level, const char* file, int line, int count);
+// The number of ERROR messages logged so far.
+int ErrorCount();
 
-    int color = WHITE;
-    const char* prefix = "[?] ";
-    switch(level) {
-        case LL_FATAL:
-            prefix = "[F] ";
-            color = RED;
-            break;
-        case LL_ERROR:
-            prefix = "[E] ";
-            color = RED;
-            break;
-        case LL_WARN:
-            prefix = "[W] ";
-            color = YELLOW;
-            break;
-        case LL_INFO:
-            prefix = "[I] ";
-            color = BLUE;
-            break;
-        case LL_VERBOSE:
-            prefix = "[V] ";
-            color = GREEN;
-            break;
-        default:
-            ; // Do nothing
-    }
-
-    if (logfp_isatty) {
-        SetLogColor(color);
-        fputs(prefix, logfp);
-        fputs(absl::StrCat(args...).c_str(), logfp);
-        SetLogColor(RESET);
-        fputs("\n", logfp);
-    } else {
-        fputs(prefix, logfp);
-        fputs(absl::StrCat(args...).c_str(), logfp);
-        fputs("\n", logfp);
-    }
-    if (level == LL_FATAL) {
-        abort();
-    }
+template<typename ...Args>
+void Log(LogLevel level, const Args& ...args) {
+    if (!Enabled(level))
+        return;
+    Submit(level, absl::StrCat(args...));
 }
 
 void LogF(LogLevel level, const char *fmt, ...);
@@ -79,11 +79,13 @@ std::string TempFilename(const std::string& filename) {
 
 int System(const std::string& cmd, bool background) {
     std::string header, trailer;
+    if (background) {
 #ifdef _WIN32
-    header = "cmd.exe /c start ";
+        header = "cmd.exe /c start ";
 #else
-    trailer = " &";
+        trailer = " &";
 #endif
+    }
     return system(absl::StrCat(header, cmd, trailer).c_str());
 }
 
@@ -238,6 +238,11 @@
 //      // be used.
 //
 //
+//      #define STBTE_TILE_CHANGED(x,y)   ...your code here...
+//      // called just before the tile at x,y is changed by an edit, undo
+//      // or redo (or by stbte_set_tile). Use it to keep data derived from
+//      // the map up to date without rescanning the whole map.
+//
 //      [[ support for those below is not implemented yet ]]
 //
 //      #define STBTE_HITTEST_TILE(x0,y0,id,mx,my)   ...your code here...
@@ -552,6 +557,10 @@ extern int stbte_get_selection(stbte_tilemap *tm,
 #define STBTE_MAX_PROPERTIES           10
 #endif
 
+#ifndef STBTE_TILE_CHANGED
+#define STBTE_TILE_CHANGED(x,y)
+#endif
+
 #ifndef STBTE_PROP_MIN
 #define STBTE_PROP_MIN(n,td,tp)  0
 #endif
@@ -1240,6 +1249,7 @@ void stbte_set_tile(stbte_tilemap *tm, int x, int y, int layer, signed short til
       return;
    if (layer < 0 || layer >= tm->num_layers || tile < -1)
       return;
+   STBTE_TILE_CHANGED(x, y);
    tm->data[y][x][layer] = tile;
 }
 
@@ -1398,6 +1408,7 @@ static void stbte__end_undo(stbte_tilemap *tm)
 static void stbte__undo_record(stbte_tilemap *tm, int x, int y, int i, int v)
 {
    STBTE_ASSERT(stbte__ui.undoing);
+   STBTE_TILE_CHANGED(x, y);
    if (stbte__ui.undoing) {
       stbte__write_undo(tm, v);
       stbte__write_undo(tm, x);
@@ -1520,6 +1531,7 @@ static void stbte__undo(stbte_tilemap *tm)
          // write the redo entry
          stbte__redo_record(tm, x, y, n, tm->data[y][x][n]);
          // apply the undo entry
+         STBTE_TILE_CHANGED(x, y);
          tm->data[y][x][n] = (short) v;
       }
    }
@@ -1594,6 +1606,7 @@ static void stbte__redo(stbte_tilemap *tm)
          stbte__write_undo(tm, x);
          stbte__write_undo(tm, y);
          stbte__write_undo(tm, n);
+         STBTE_TILE_CHANGED(x, y);
          tm->data[y][x][n] = (short) v;
       }
    }